@@ -220,6 +220,27 @@ struct sg_simple_inquiry_resp {
 int sg_simple_inquiry(int sg_fd, struct sg_simple_inquiry_resp * inq_data,
                       bool noisy, int verbose);
 
+struct sg_simple_block_limits_resp {   /* fields in logical blocks */
+    bool wsnz;                  /* WRITE SAME with NUMBER OF BLOCKS 0 */
+    uint8_t max_cmp_write_len;  /* MAXIMUM COMPARE AND WRITE LENGTH */
+    uint16_t opt_xfer_gran;     /* OPTIMAL TRANSFER LENGTH GRANULARITY */
+    uint32_t max_xfer_len;      /* 0 -> not reported */
+    uint32_t opt_xfer_len;
+    uint32_t max_prefetch_len;
+    uint32_t max_unmap_lba_count;
+    uint32_t max_unmap_desc_count;
+    uint32_t opt_unmap_gran;
+    uint64_t max_ws_len;        /* MAXIMUM WRITE SAME LENGTH */
+};
+
+/* Yields the commonly used fields of the Block Limits VPD page [0xb0]
+ * (SBC). Fields beyond the end of a short (e.g. SBC-2) page are 0.
+ * Returns 0 when successful, SG_LIB_CAT_MALFORMED if the response is not
+ * that page, otherwise as for sg_ll_inquiry(). */
+int sg_simple_block_limits(int sg_fd,
+                           struct sg_simple_block_limits_resp * blp,
+                           bool noisy, int verbose);
+
 /* MODE SENSE commands yield a response that has header then zero or more
  * block descriptors followed by mode pages. In most cases users are
  * interested in the first mode page. This function returns the (byte)
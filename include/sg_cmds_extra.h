@@ -267,7 +267,9 @@ int sg_ll_verify10(int sg_fd, int vrprotect, bool dpo, int bytechk,
  * SG_LIB_CAT_MEDIUM_HARD -> medium or hardware error, no valid info,
  * SG_LIB_CAT_MEDIUM_HARD_WITH_INFO -> as previous, with valid info,
  * SG_LIB_CAT_NOT_READY -> device not ready, SG_LIB_CAT_ABORTED_COMMAND,
- * SG_LIB_CAT_MISCOMPARE, -1 -> other failure */
+ * SG_LIB_CAT_MISCOMPARE -> if info field valid then it is written to
+ * *infop (with BYTCHK=1 that is the byte offset of the first miscompare
+ * within data_out), -1 -> other failure */
 int sg_ll_verify16(int sg_fd, int vrprotect, bool dpo, int bytechk,
                    uint64_t llba, int veri_len, int group_num,
                    void * data_out, int data_out_len, uint64_t * infop,
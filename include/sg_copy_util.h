@@ -0,0 +1,127 @@
+#ifndef SG_COPY_UTIL_H
+#define SG_COPY_UTIL_H
+
+/*
+ * Copyright (c) 2026 Douglas Gilbert.
+ * All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the BSD_LICENSE file.
+ */
+
+/*
+ * Version 1.00 [20261018]
+ */
+
+/*
+ * This header file contains helpers shared by the dd-like copy utilities
+ * (sg_dd and sgp_dd). They are Linux specific.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "sg_lib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SG_RATE_BURST_MS 100    /* token buckets hold at most this much */
+
+/* State of the rate=, iops= and rate_file= limiter. Zero it, set the
+ * fields marked 'caller', then call sg_rate_start() before the copy. */
+struct sg_rate {
+    bool on;                /* caller: a cap or rate_file given */
+    const char * fn;        /* caller: rate_file=RF, NULL if not given */
+    int mbps;               /* caller: cap in MB/s, 0 -> none */
+    int iops;               /* caller: cap in transfers per second */
+    volatile sig_atomic_t reread; /* caller (e.g. SIGHUP): re-read fn */
+    double byte_tok;        /* token buckets, negative when in debt */
+    double op_tok;
+    double slept;           /* seconds spent waiting for tokens */
+    struct timeval last;    /* when buckets last refilled */
+    time_t fn_mtime;        /* of rate_file when last read */
+    time_t fn_checked;      /* when rate_file last stat()-ed */
+};
+
+/* Fills the token buckets' reference time; call as the copy starts. */
+void sg_rate_start(struct sg_rate * rp);
+
+/* Re-reads rp->fn when it has changed (looked at no more than once a
+ * second) or rp->reread is set. It holds "rate=MBPS" and/or "iops=IOPS"
+ * separated by whitespace or commas; 0 removes that cap, '#' starts a
+ * comment. A missing file or bad value leaves the caps as they were. */
+void sg_rate_check_file(struct sg_rate * rp);
+
+/* Takes 'bytes' and one transfer from token buckets that refill at
+ * rp->mbps MB/s and rp->iops per second and hold at most SG_RATE_BURST_MS
+ * worth (or one transfer). Returns the seconds the caller should sleep
+ * while either bucket is in debt (0.0 if none) and adds them to
+ * rp->slept. Re-reads rate_file first. Not thread safe: callers sharing
+ * 'rp' between threads hold their own lock around this call. */
+double sg_rate_take(struct sg_rate * rp, int bytes);
+
+/* Sleeps for 'secs' seconds, resuming after signal interruptions. */
+void sg_rate_sleep(double secs);
+
+/* sg_rate_take() then sg_rate_sleep(), for single threaded callers. */
+void sg_rate_wait(struct sg_rate * rp, int bytes);
+
+/* State of the progress= and progress_file= JSON lines. Zero it, set the
+ * fields marked 'caller', then call sg_prog_open() as the copy starts. */
+struct sg_prog {
+    int secs;               /* caller: between lines, 0 -> off */
+    const char * fn;        /* caller: progress_file=PF, NULL -> stderr */
+    const char * name;      /* caller: tool name, the "prog" member */
+    int bs;                 /* caller: block size in bytes */
+    int64_t base;           /* caller: blocks done by earlier runs */
+    int64_t total;          /* caller: blocks in the whole copy */
+    /* caller: appends tool specific members (each preceded by a comma)
+     * to 'b' and returns the number of characters added; NULL -> none.
+     * Called with the progress lock held, so it must not block. */
+    int (*extra)(void * arg, char * b, int blen);
+    void * extra_arg;       /* caller: passed to extra() */
+    int fd;
+    bool is_sock;           /* PF is a Unix domain socket */
+    bool failed;            /* a line could not be written, stop trying */
+    bool stop;              /* heartbeat thread should exit */
+    bool thr_started;
+    int64_t done;           /* blocks copied, from start of the copy */
+    int64_t xfers;          /* transfers (a read then a write) done */
+    int64_t last_done;      /* as at the previous line */
+    int64_t last_xfers;
+    struct timeval start;
+    struct timeval last;    /* when the previous line was written */
+    struct sg_lat_hist lat; /* transfer latencies since previous line */
+    pthread_mutex_t mutex;  /* guards the counters, latencies and 'last' */
+    pthread_cond_t cv;      /* wakes the heartbeat thread to stop */
+    pthread_t thr;
+};
+
+/* Opens where progress lines go: stderr unless pp->fn is given. If that
+ * is a Unix domain socket it is connected to (stream, else datagram) so a
+ * monitor can collect lines from many copies; otherwise it is appended
+ * to, being created if need be. Then starts a thread that writes a
+ * "running" line every pp->secs seconds, whether or not transfers are
+ * completing. Returns 0 on success, else SG_LIB_FILE_ERROR or
+ * SG_LIB_OS_BASE_ERR + errno. */
+int sg_prog_open(struct sg_prog * pp);
+
+/* Records a transfer that took 'usecs' microseconds, after which 'done'
+ * blocks (from the start of the copy) have been copied. Thread safe. */
+void sg_prog_xfer(struct sg_prog * pp, int64_t usecs, int64_t done);
+
+/* Stops the heartbeat thread, writes the last line with 'state' (e.g.
+ * "done", "error" or "interrupted") and 'done' blocks, then closes
+ * pp->fn if it was opened. */
+void sg_prog_close(struct sg_prog * pp, int64_t done, const char * state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
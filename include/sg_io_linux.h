@@ -173,6 +173,19 @@ int sg_err_category_new(int scsi_status, int host_status, int driver_status,
 /* The following function declaration is for the sg version 3 driver. */
 int sg_err_category3(struct sg_io_hdr * hp);
 
+/* Device names starting with SG_LOOP_DEV_PREFIX select the user space
+   loopback (see sg_pt_linux_loop.c). They are opened with
+   scsi_pt_open_flags() and closed with scsi_pt_close_device().
+   sg_loop_fd() returns true if fd refers to such a device.
+   sg_loop_sg_io() issues the sg version 3 request in hp to it as
+   ioctl(fd, SG_IO, hp) does to a sg device, for any other fd it is that
+   ioctl. Returns 0, or -1 with errno set. */
+#ifndef SG_LOOP_DEV_PREFIX
+#define SG_LOOP_DEV_PREFIX "loop:"
+#endif
+bool sg_loop_fd(int fd);
+int sg_loop_sg_io(int fd, struct sg_io_hdr * hp);
+
 
 /* Note about SCSI status codes found in older versions of Linux.
    Linux has traditionally used a 1 bit right shifted and masked
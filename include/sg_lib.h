@@ -539,6 +539,82 @@ bool sg_is_big_endian();
 bool sg_all_zeros(const uint8_t * bp, int b_len);
 bool sg_all_ffs(const uint8_t * bp, int b_len);
 
+/* Computes the CRC-32C (Castagnoli polynomial, as used by iSCSI) of the
+ * b_len bytes starting at bp. To calculate over a stream in pieces, pass
+ * the previous return value as crc (use 0 for the first piece). Uses the
+ * SSE4.2 crc32 instruction when the library is built for it. */
+uint32_t sg_crc32c(uint32_t crc, const uint8_t * bp, int b_len);
+
+/* A copy manifest is a text file with the CRC-32C of each chunk of
+ * 'chunk_blks' blocks copied, one line per chunk, then the CRC-32C of the
+ * whole copy. The copy utilities write it for manifest=MF and read it back
+ * for delta=DMF. */
+struct sg_manifest {
+    FILE * fp;
+    int bs;                 /* logical block size in bytes */
+    int chunk_blks;         /* blocks per chunk (mchunk=) */
+    int fill_blks;          /* blocks in current chunk so far */
+    int64_t chunk_start;    /* block offset, from start of copy, of chunk */
+    uint32_t chunk_crc;
+    uint32_t total_crc;
+};
+
+/* Creates manifest file 'fn' and writes its header, naming 'origin' (e.g.
+ * the utility and its version) as the writer. Returns 0 on success, else
+ * SG_LIB_FILE_ERROR with errno set by fopen(). */
+int sg_manifest_open(struct sg_manifest * mfp, const char * fn,
+                     const char * origin, int bs, int chunk_blks,
+                     int64_t skip, int64_t seek);
+
+/* Adds the next 'blocks' blocks of the copy, held at 'bp', to the running
+ * digests; writes a line each time a chunk fills. Must be called in copy
+ * order; the caller serializes calls from several threads. */
+void sg_manifest_add(struct sg_manifest * mfp, const uint8_t * bp,
+                     int blocks);
+
+/* Writes any partial last chunk and the digest of the whole copy then
+ * closes the manifest. Afterwards mfp->chunk_start is the number of blocks
+ * covered and mfp->total_crc their digest. Returns 0 on success, else
+ * SG_LIB_FILE_ERROR . */
+int sg_manifest_close(struct sg_manifest * mfp);
+
+/* Log-linear latency histogram, in microseconds. Values below 32 have their
+ * own bucket, above that each power of 2 is split into SG_LAT_SUB_BKTS
+ * buckets so the error in a reported percentile is less than
+ * 1/SG_LAT_SUB_BKTS (6.25%). Zero a struct sg_lat_hist before use. */
+#define SG_LAT_SUB_SHIFT 4
+#define SG_LAT_SUB_BKTS (1 << SG_LAT_SUB_SHIFT)
+#define SG_LAT_MAX_EXP 40       /* 2**41 microseconds is about 25 days */
+#define SG_LAT_BKTS ((SG_LAT_MAX_EXP - SG_LAT_SUB_SHIFT + 2) * SG_LAT_SUB_BKTS)
+
+struct sg_lat_hist {
+    int64_t num;
+    int64_t min;
+    int64_t max;
+    int64_t sum;
+    int64_t bkt[SG_LAT_BKTS];
+};
+
+/* Returns the bucket index for 'usecs'; beyond range goes in the last. */
+int sg_lat_bkt(int64_t usecs);
+
+/* Returns the largest latency (in microseconds) held by bucket 'b'. */
+int64_t sg_lat_bkt_top(int b);
+
+/* Adds one latency of 'usecs' (negative taken as 0) to the histogram. */
+void sg_lat_add(struct sg_lat_hist * hp, int64_t usecs);
+
+/* Adds the counts in histogram 'from' to histogram 'to'. */
+void sg_lat_merge(struct sg_lat_hist * to, const struct sg_lat_hist * from);
+
+/* Returns the latency (in microseconds) at or below which 'pc' percent of
+ * the entries fall, clamped to [min, max]. Returns 0 when empty. */
+int64_t sg_lat_pc(const struct sg_lat_hist * hp, double pc);
+
+/* xorshift64* pseudo random number generator. Advances the state at 'sp',
+ * which must not be 0, and returns the next 64 bit value. */
+uint64_t sg_xorshift64s(uint64_t * sp);
+
 /* Extract character sequence from ATA words as in the model string
  * in a IDENTIFY DEVICE response. Returns number of characters
  * written to 'ochars' before 0 character is found or 'num' words
@@ -2,7 +2,7 @@
 #define SG_PT_LINUX_H
 
 /*
- * Copyright (c) 2017-2018 Douglas Gilbert.
+ * Copyright (c) 2017-2026 Douglas Gilbert.
  * All rights reserved.
  * Use of this source code is governed by a BSD-style
  * license that can be found in the BSD_LICENSE file.
@@ -100,6 +100,7 @@ struct sg_pt_linux_scsi {
     bool nvme_direct;   /* false: our SNTL; true: received NVMe command */
     bool mdxfer_out;    /* direction of metadata xfer, true->data-out */
     bool scsi_dsense;   /* SCSI descriptor sense active when true */
+    bool is_loop;       /* user space loopback, see sg_pt_linux_loop.c */
     int dev_fd;                 /* -1 if not given (yet) */
     int in_err;
     int os_err;
@@ -164,6 +165,19 @@ int sg_do_nvme_pt(struct sg_pt_base * vp, int fd, int time_secs, int vb);
 bool sg_get_nvme_char_devname(const char * nvme_block_devname, uint32_t b_len,
                               char * b);
 
+/* Device names starting with this prefix select the user space loopback
+ * (emulated SCSI target held in RAM) in sg_pt_linux_loop.c . What follows
+ * the prefix is a comma separated list of options, possibly empty. */
+#ifndef SG_LOOP_DEV_PREFIX
+#define SG_LOOP_DEV_PREFIX "loop:"
+#endif
+
+int sg_loop_open(const char * opts, int flags, int vb);
+/* Returns true if fd was returned by sg_loop_open() and is still open */
+bool sg_loop_fd(int fd);
+int sg_loop_close(int fd);
+int sg_do_loop_pt(struct sg_pt_base * vp, int fd, int time_secs, int vb);
+
 
 #ifdef __cplusplus
 }
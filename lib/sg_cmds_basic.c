@@ -56,6 +56,8 @@ static const char * const version_str = "1.85 20180302";
 #define TUR_CMDLEN  6
 
 #define SAFE_STD_INQ_RESP_LEN 36 /* other lengths lock up some devices */
+#define BLOCK_LIMITS_VPD 0xb0
+#define BLOCK_LIMITS_VPD_LEN 64
 
 
 const char *
@@ -460,6 +462,41 @@ sg_simple_inquiry(int sg_fd, struct sg_simple_inquiry_resp * inq_data,
     return ret;
 }
 
+int
+sg_simple_block_limits(int sg_fd, struct sg_simple_block_limits_resp * blp,
+                       bool noisy, int verbose)
+{
+    int ret, len;
+    uint8_t b[BLOCK_LIMITS_VPD_LEN];
+
+    memset(blp, 0, sizeof(* blp));
+    memset(b, 0, sizeof(b));
+    ret = sg_ll_inquiry_com(sg_fd, false, true, BLOCK_LIMITS_VPD, b,
+                            sizeof(b), 0, NULL, noisy, verbose);
+    if (ret)
+        return ret;
+    if (BLOCK_LIMITS_VPD != b[1]) {
+        if (verbose)
+            pr2ws("%s: response is not the Block Limits VPD page\n",
+                  __func__);
+        return SG_LIB_CAT_MALFORMED;
+    }
+    len = sg_get_unaligned_be16(b + 2) + 4;
+    if (len < (int)sizeof(b))       /* ignore what follows a short page */
+        memset(b + len, 0, sizeof(b) - len);
+    blp->wsnz = !! (0x1 & b[4]);
+    blp->max_cmp_write_len = b[5];
+    blp->opt_xfer_gran = sg_get_unaligned_be16(b + 6);
+    blp->max_xfer_len = sg_get_unaligned_be32(b + 8);
+    blp->opt_xfer_len = sg_get_unaligned_be32(b + 12);
+    blp->max_prefetch_len = sg_get_unaligned_be32(b + 16);
+    blp->max_unmap_lba_count = sg_get_unaligned_be32(b + 20);
+    blp->max_unmap_desc_count = sg_get_unaligned_be32(b + 24);
+    blp->opt_unmap_gran = sg_get_unaligned_be32(b + 28);
+    blp->max_ws_len = sg_get_unaligned_be64(b + 36);
+    return 0;
+}
+
 /* Invokes a SCSI INQUIRY command and yields the response. Returns 0 when
  * successful, various SG_LIB_CAT_* positive values or -1 -> other errors.
  * The CMDDT field is obsolete in the INQUIRY cdb (since spc3r16 in 2003) so
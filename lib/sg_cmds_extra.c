@@ -1630,6 +1630,16 @@ sg_ll_verify16(int sg_fd, int vrprotect, bool dpo, int bytchk, uint64_t llba,
                     ret = SG_LIB_CAT_MEDIUM_HARD;
             }
             break;
+        case SG_LIB_CAT_MISCOMPARE:
+            {   /* info field holds offset (bytes) of first miscompare */
+                uint64_t ull = 0;
+
+                slen = get_scsi_pt_sense_len(ptvp);
+                if (sg_get_sense_info_fld(sense_b, slen, &ull) && infop)
+                    *infop = ull;
+                ret = sense_cat;
+            }
+            break;
         default:
             ret = sense_cat;
             break;
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2026 Douglas Gilbert.
+ * All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the BSD_LICENSE file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef SG_LIB_LINUX
+
+#include "sg_lib.h"
+#include "sg_copy_util.h"
+
+
+/* Version 1.00 20261018 */
+
+#if defined(__GNUC__) || defined(__clang__)
+static int pr2ws(const char * fmt, ...)
+        __attribute__ ((format (printf, 1, 2)));
+#else
+static int pr2ws(const char * fmt, ...);
+#endif
+
+
+static int
+pr2ws(const char * fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vfprintf(sg_warnings_strm ? sg_warnings_strm : stderr, fmt, args);
+    va_end(args);
+    return n;
+}
+
+void
+sg_rate_start(struct sg_rate * rp)
+{
+    gettimeofday(&rp->last, NULL);
+}
+
+void
+sg_rate_check_file(struct sg_rate * rp)
+{
+    int mbps = rp->mbps;
+    int iops = rp->iops;
+    struct stat st;
+    struct timeval now;
+    FILE * fp;
+    char * cp;
+    char * savep;
+    char line[128];
+
+    gettimeofday(&now, NULL);
+    if ((! rp->reread) && (now.tv_sec == rp->fn_checked))
+        return;
+    rp->fn_checked = now.tv_sec;
+    if (stat(rp->fn, &st) < 0)
+        return;
+    if ((! rp->reread) && (st.st_mtime == rp->fn_mtime))
+        return;
+    rp->reread = 0;
+    rp->fn_mtime = st.st_mtime;
+    if (NULL == (fp = fopen(rp->fn, "r")))
+        return;
+    while (fgets(line, sizeof(line), fp)) {
+        if ((cp = strchr(line, '#')))
+            *cp = '\0';
+        for (cp = strtok_r(line, " \t,\n", &savep); cp;
+             cp = strtok_r(NULL, " \t,\n", &savep)) {
+            if (0 == strncmp(cp, "rate=", 5))
+                mbps = sg_get_num(cp + 5);
+            else if (0 == strncmp(cp, "iops=", 5))
+                iops = sg_get_num(cp + 5);
+            else
+                mbps = -1;
+        }
+    }
+    fclose(fp);
+    if ((mbps < 0) || (iops < 0)) {
+        pr2ws("rate_file %s: bad contents, ignored\n", rp->fn);
+        return;
+    }
+    if ((mbps != rp->mbps) || (iops != rp->iops)) {
+        rp->mbps = mbps;
+        rp->iops = iops;
+        pr2ws("rate: now %d MB/s, %d transfers/s (0: no cap)\n", mbps,
+              iops);
+    }
+}
+
+double
+sg_rate_take(struct sg_rate * rp, int bytes)
+{
+    double dt, rate, cap;
+    double wait = 0.0;
+    struct timeval now;
+
+    if (rp->fn)
+        sg_rate_check_file(rp);
+    gettimeofday(&now, NULL);
+    dt = (now.tv_sec - rp->last.tv_sec) +
+         (0.000001 * (now.tv_usec - rp->last.tv_usec));
+    rp->last = now;
+    if (rp->mbps > 0) {
+        rate = rp->mbps * 1000000.0;
+        cap = rate * SG_RATE_BURST_MS / 1000.0;
+        if (cap < bytes)
+            cap = bytes;
+        rp->byte_tok += dt * rate;
+        if (rp->byte_tok > cap)
+            rp->byte_tok = cap;
+        rp->byte_tok -= bytes;
+        if (rp->byte_tok < 0.0)
+            wait = -rp->byte_tok / rate;
+    } else
+        rp->byte_tok = 0.0;
+    if (rp->iops > 0) {
+        cap = rp->iops * SG_RATE_BURST_MS / 1000.0;
+        if (cap < 1.0)
+            cap = 1.0;
+        rp->op_tok += dt * rp->iops;
+        if (rp->op_tok > cap)
+            rp->op_tok = cap;
+        rp->op_tok -= 1.0;
+        if ((rp->op_tok < 0.0) && ((-rp->op_tok / rp->iops) > wait))
+            wait = -rp->op_tok / rp->iops;
+    } else
+        rp->op_tok = 0.0;
+    if (wait > 0.0)
+        rp->slept += wait;
+    return wait;
+}
+
+void
+sg_rate_sleep(double secs)
+{
+    struct timespec ts;
+
+    if (secs <= 0.0)
+        return;
+    ts.tv_sec = (time_t)secs;
+    ts.tv_nsec = (long)((secs - ts.tv_sec) * 1000000000.0);
+    while ((nanosleep(&ts, &ts) < 0) && (EINTR == errno))
+        ;
+}
+
+void
+sg_rate_wait(struct sg_rate * rp, int bytes)
+{
+    sg_rate_sleep(sg_rate_take(rp, bytes));
+}
+
+/* Writes one JSON line (a single write or datagram) describing the copy.
+ * The averages are since the copy started, the other rates and the
+ * latency percentiles are since the previous line. Only the heartbeat
+ * thread, then (after it is joined) sg_prog_close(), call this. */
+static void
+prog_emit(struct sg_prog * pp, const char * state)
+{
+    int n, res;
+    int64_t d_done, d_xfers;
+    double el, dt, avg_bps;
+    double eta = -1.0;
+    struct timeval now;
+    char b[1024];
+
+    if (pp->failed)
+        return;
+    pthread_mutex_lock(&pp->mutex);
+    gettimeofday(&now, NULL);
+    el = (now.tv_sec - pp->start.tv_sec) +
+         (0.000001 * (now.tv_usec - pp->start.tv_usec));
+    dt = (now.tv_sec - pp->last.tv_sec) +
+         (0.000001 * (now.tv_usec - pp->last.tv_usec));
+    if (el < 0.000001)
+        el = 0.000001;
+    if (dt < 0.000001)
+        dt = 0.000001;
+    d_done = pp->done - pp->last_done;
+    d_xfers = pp->xfers - pp->last_xfers;
+    avg_bps = (double)(pp->done - pp->base) * pp->bs / el;
+    if ((avg_bps > 0.0) && (pp->total >= pp->done))
+        eta = (double)(pp->total - pp->done) * pp->bs / avg_bps;
+    n = snprintf(b, sizeof(b), "{\"prog\":\"%s\",\"pid\":%d,"
+                 "\"state\":\"%s\",\"elapsed\":%.3f,\"blocks\":%" PRId64
+                 ",\"total\":%" PRId64 ",\"bs\":%d,\"mbps\":%.2f,"
+                 "\"avg_mbps\":%.2f,\"iops\":%.1f,\"avg_iops\":%.1f,",
+                 pp->name, (int)getpid(), state, el, pp->done, pp->total,
+                 pp->bs, d_done * pp->bs / (dt * 1000000.0),
+                 avg_bps / 1000000.0, d_xfers / dt, pp->xfers / el);
+    n += snprintf(b + n, sizeof(b) - n, "\"lat_us\":{\"p50\":%" PRId64
+                  ",\"p90\":%" PRId64 ",\"p99\":%" PRId64 ",\"p999\":%"
+                  PRId64 ",\"max\":%" PRId64 "},",
+                  sg_lat_pc(&pp->lat, 50.0), sg_lat_pc(&pp->lat, 90.0),
+                  sg_lat_pc(&pp->lat, 99.0), sg_lat_pc(&pp->lat, 99.9),
+                  pp->lat.max);
+    if (eta >= 0.0)
+        n += snprintf(b + n, sizeof(b) - n, "\"eta\":%.1f", eta);
+    else
+        n += snprintf(b + n, sizeof(b) - n, "\"eta\":null");
+    if (pp->extra)
+        n += pp->extra(pp->extra_arg, b + n, (int)sizeof(b) - n - 2);
+    if (n > (int)sizeof(b) - 3)
+        n = (int)sizeof(b) - 3;
+    b[n++] = '}';
+    b[n++] = '\n';
+    pp->last = now;
+    pp->last_done = pp->done;
+    pp->last_xfers = pp->xfers;
+    memset(&pp->lat, 0, sizeof(pp->lat));
+    pthread_mutex_unlock(&pp->mutex);
+
+    if (pp->is_sock)
+        res = send(pp->fd, b, n, MSG_NOSIGNAL);
+    else
+        res = write(pp->fd, b, n);
+    if (res < n) {
+        pr2ws("progress: unable to write to %s, giving up\n",
+              (pp->fn ? pp->fn : "stderr"));
+        pp->failed = true;
+    }
+}
+
+/* Writes a "running" line pp->secs seconds after the previous one until
+ * told to stop, so lines keep coming while transfers are stalled. */
+static void *
+prog_thread(void * v_pp)
+{
+    struct sg_prog * pp = (struct sg_prog *)v_pp;
+    struct timespec ts;
+    int res;
+
+    pthread_mutex_lock(&pp->mutex);
+    while (! pp->stop) {
+        ts.tv_sec = pp->last.tv_sec + pp->secs;
+        ts.tv_nsec = pp->last.tv_usec * 1000;
+        res = pthread_cond_timedwait(&pp->cv, &pp->mutex, &ts);
+        if ((ETIMEDOUT == res) && (! pp->stop)) {
+            pthread_mutex_unlock(&pp->mutex);
+            prog_emit(pp, "running");
+            pthread_mutex_lock(&pp->mutex);
+        }
+    }
+    pthread_mutex_unlock(&pp->mutex);
+    return NULL;
+}
+
+int
+sg_prog_open(struct sg_prog * pp)
+{
+    int k, err, status;
+    struct stat st;
+    struct sockaddr_un sa;
+
+    gettimeofday(&pp->start, NULL);
+    pp->last = pp->start;
+    pp->done = pp->base;
+    pp->last_done = pp->base;
+    pp->fd = STDERR_FILENO;
+    if (pp->fn && (0 == stat(pp->fn, &st)) && S_ISSOCK(st.st_mode)) {
+        if (strlen(pp->fn) >= sizeof(sa.sun_path)) {
+            pr2ws("progress_file: socket name %s too long\n", pp->fn);
+            return SG_LIB_FILE_ERROR;
+        }
+        memset(&sa, 0, sizeof(sa));
+        sa.sun_family = AF_UNIX;
+        memcpy(sa.sun_path, pp->fn, strlen(pp->fn));
+        err = 0;
+        for (k = 0; k < 2; ++k) {
+            pp->fd = socket(AF_UNIX, (k ? SOCK_DGRAM : SOCK_STREAM), 0);
+            if (pp->fd < 0) {
+                err = errno;
+                break;
+            }
+            if (0 == connect(pp->fd, (struct sockaddr *)&sa, sizeof(sa)))
+                break;
+            err = errno;
+            close(pp->fd);
+            pp->fd = -1;
+            if (EPROTOTYPE != err)
+                break;
+        }
+        if (pp->fd < 0) {
+            pr2ws("progress_file: could not connect to %s: %s\n", pp->fn,
+                  safe_strerror(err));
+            return SG_LIB_FILE_ERROR;
+        }
+        pp->is_sock = true;
+    } else if (pp->fn && ((pp->fd = open(pp->fn, O_WRONLY | O_CREAT |
+                                         O_APPEND, 0644)) < 0)) {
+        pr2ws("progress_file: could not open %s: %s\n", pp->fn,
+              safe_strerror(errno));
+        return SG_LIB_FILE_ERROR;
+    }
+    pthread_mutex_init(&pp->mutex, NULL);
+    pthread_cond_init(&pp->cv, NULL);
+    status = pthread_create(&pp->thr, NULL, prog_thread, pp);
+    if (status) {
+        pr2ws("progress: unable to start thread: %s\n",
+              safe_strerror(status));
+        if (pp->fn)
+            close(pp->fd);
+        return SG_LIB_OS_BASE_ERR + status;
+    }
+    pp->thr_started = true;
+    return 0;
+}
+
+void
+sg_prog_xfer(struct sg_prog * pp, int64_t usecs, int64_t done)
+{
+    pthread_mutex_lock(&pp->mutex);
+    sg_lat_add(&pp->lat, usecs);
+    ++pp->xfers;
+    if (done > pp->done)
+        pp->done = done;
+    pthread_mutex_unlock(&pp->mutex);
+}
+
+void
+sg_prog_close(struct sg_prog * pp, int64_t done, const char * state)
+{
+    if (pp->thr_started) {
+        pthread_mutex_lock(&pp->mutex);
+        pp->stop = true;
+        pthread_cond_signal(&pp->cv);
+        pthread_mutex_unlock(&pp->mutex);
+        pthread_join(pp->thr, NULL);
+        pp->thr_started = false;
+    }
+    pp->done = done;
+    prog_emit(pp, state);
+    if (pp->fn)
+        close(pp->fd);
+    pthread_cond_destroy(&pp->cv);
+    pthread_mutex_destroy(&pp->mutex);
+}
+
+#endif          /* SG_LIB_LINUX */
@@ -1,11 +1,11 @@
 /*
- * Copyright (c) 2005-2018 Douglas Gilbert.
+ * Copyright (c) 2005-2026 Douglas Gilbert.
  * All rights reserved.
  * Use of this source code is governed by a BSD-style
  * license that can be found in the BSD_LICENSE file.
  */
 
-/* sg_pt_linux version 1.40 20180309 */
+/* sg_pt_linux version 1.41 20261018 */
 
 
 #include <stdio.h>
@@ -279,6 +279,8 @@ check_pt_file_handle(int dev_fd, const char * device_name, int verbose)
         sg_bsg_nvme_char_major_checked = true;
         sg_find_bsg_nvme_char_major(verbose);
     }
+    if (sg_loop_fd(dev_fd))
+        return 1;
     if (dev_fd >= 0) {
         bool is_sg, is_bsg, is_nvme;
         int err;
@@ -360,6 +362,10 @@ scsi_pt_open_flags(const char * device_name, int flags, int verbose)
     if (verbose > 1) {
         pr2ws("open %s with flags=0x%x\n", device_name, flags);
     }
+    if (0 == strncmp(device_name, SG_LOOP_DEV_PREFIX,
+                     sizeof(SG_LOOP_DEV_PREFIX) - 1))
+        return sg_loop_open(device_name + sizeof(SG_LOOP_DEV_PREFIX) - 1,
+                            flags, verbose);
     fd = open(device_name, flags);
     if (fd < 0) {
         fd = -errno;
@@ -376,6 +382,8 @@ scsi_pt_close_device(int device_fd)
 {
     int res;
 
+    if (sg_loop_fd(device_fd))
+        return sg_loop_close(device_fd);
     res = close(device_fd);
     if (res < 0)
         res = -errno;
@@ -447,7 +455,7 @@ destruct_scsi_pt_obj(struct sg_pt_base * vp)
 void
 clear_scsi_pt_obj(struct sg_pt_base * vp)
 {
-    bool is_sg, is_bsg, is_nvme;
+    bool is_sg, is_bsg, is_nvme, is_loop;
     int fd;
     uint32_t nvme_nsid;
     struct sg_pt_linux_scsi * ptp = &vp->impl;
@@ -457,6 +465,7 @@ clear_scsi_pt_obj(struct sg_pt_base * vp)
         is_sg = ptp->is_sg;
         is_bsg = ptp->is_bsg;
         is_nvme = ptp->is_nvme;
+        is_loop = ptp->is_loop;
         nvme_nsid = ptp->nvme_nsid;
         if (ptp->free_nvme_id_ctlp)
             free(ptp->free_nvme_id_ctlp);
@@ -472,6 +481,7 @@ clear_scsi_pt_obj(struct sg_pt_base * vp)
         ptp->is_sg = is_sg;
         ptp->is_bsg = is_bsg;
         ptp->is_nvme = is_nvme;
+        ptp->is_loop = is_loop;
         ptp->nvme_direct = false;
         ptp->nvme_nsid = nvme_nsid;
     }
@@ -492,7 +502,15 @@ set_pt_file_handle(struct sg_pt_base * vp, int dev_fd, int verbose)
         sg_find_bsg_nvme_char_major(verbose);
     }
     ptp->dev_fd = dev_fd;
-    if (dev_fd >= 0)
+    ptp->is_loop = sg_loop_fd(dev_fd);
+    if (ptp->is_loop) {         /* looks like a sg device to callers */
+        ptp->is_sg = true;
+        ptp->is_bsg = false;
+        ptp->is_nvme = false;
+        ptp->nvme_direct = false;
+        ptp->nvme_nsid = 0;
+        ptp->os_err = 0;
+    } else if (dev_fd >= 0)
         ptp->is_sg = check_file_type(dev_fd, &a_stat, &ptp->is_bsg,
                                      &ptp->is_nvme, &ptp->nvme_nsid,
                                      &ptp->os_err, verbose);
@@ -930,6 +948,8 @@ do_scsi_pt(struct sg_pt_base * vp, int fd, int time_secs, int verbose)
     }
     if (ptp->os_err)
         return -ptp->os_err;
+    if (ptp->is_loop)
+        return sg_do_loop_pt(vp, fd, time_secs, verbose);
     if (ptp->is_nvme)
         return sg_do_nvme_pt(vp, -1, time_secs, verbose);
     else if (sg_bsg_major <= 0)
@@ -0,0 +1,1194 @@
+/*
+ * Copyright (c) 2026 Douglas Gilbert.
+ * All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the BSD_LICENSE file.
+ */
+
+/* sg_pt_linux_loop version 1.00 20261018 */
+
+/* This file contains a small user space SCSI target ("loopback") that
+ * services commands from RAM. It is selected by giving a device name that
+ * starts with "loop:" to scsi_pt_open_device() or scsi_pt_open_flags(),
+ * optionally followed by a comma separated list of options:
+ *     id=ID        logical unit id (0 to 15, default 0). Opens with the
+ *                  same id share the one logical unit (and its RAM)
+ *     blocks=NUM   number of logical blocks (default 131072)
+ *     lbs=LBS      logical block size in bytes (default 512)
+ *     lat=USECS    delay, in microseconds, added to each command
+ *     medium=LBA[+NUM]  READs and EXTENDED COPY source reads touching
+ *                  those blocks fail with an unrecovered read error
+ *     abort=N      every Nth command yields ABORTED COMMAND
+ *     ua=1         first command (other than INQUIRY, REPORT LUNS and
+ *                  REQUEST SENSE) yields a power on reset UNIT ATTENTION
+ * For example: "loop:blocks=1m,lbs=4096,lat=100". Utilities that use the
+ * sg version 3 interface directly (e.g. sg_dd) can reach it through
+ * sg_loop_sg_io(). The commands supported
+ * are TEST UNIT READY, REQUEST SENSE, INQUIRY (VPD pages 0x0, 0x80, 0x83
+ * and 0xb0), READ CAPACITY(10) and (16), READ(10) and (16), WRITE(10) and
+ * (16), SYNCHRONIZE CACHE(10) and (16), REPORT LUNS, LOG SENSE (pages 0x0,
+ * 0x2, 0x3 and 0xd), EXTENDED COPY(LID1) with block to block segment
+ * descriptors and RECEIVE COPY RESULTS (copy status and operating
+ * parameters). Anything else yields ILLEGAL REQUEST, invalid opcode.
+ *
+ * The file descriptor handed back is the read end of a pipe with no
+ * writer, so the usual Unix calls on it are harmless. Its device and inode
+ * numbers are recorded so that if it is closed with close() rather than
+ * scsi_pt_close_device() and the number reused, it is no longer taken for
+ * a loopback device. Opening, closing and issuing commands may be done
+ * from several threads; each command holds a reference on its logical
+ * unit, so a concurrent close cannot free it, and each logical unit has
+ * a mutex for its state. The data of concurrent commands whose LBA ranges
+ * overlap may be mixed, as with a real device. */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sg_pt.h"
+#include "sg_lib.h"
+#include "sg_linux_inc.h"
+#include "sg_pt_linux.h"
+#include "sg_io_linux.h"
+#include "sg_unaligned.h"
+
+#define SG_LOOP_MAX_LUS 16
+#define SG_LOOP_MAX_FD 1024
+#define SG_LOOP_DEF_BLOCKS 131072       /* 64 MiB when lbs=512 */
+#define SG_LOOP_DEF_LBS 512
+#define SG_LOOP_MAX_CSCD 8      /* copy source/destination descriptors */
+#define SG_LOOP_MAX_SEGS 1024   /* segment descriptors in one xcopy */
+#define SG_LOOP_MAX_SEG_BYTES (64 * 1024 * 1024)
+
+#define LOOP_TUR_OPC 0x0
+#define LOOP_REQUEST_SENSE_OPC 0x3
+#define LOOP_INQUIRY_OPC 0x12
+#define LOOP_READ_CAP10_OPC 0x25
+#define LOOP_READ10_OPC 0x28
+#define LOOP_WRITE10_OPC 0x2a
+#define LOOP_SYNC_CACHE10_OPC 0x35
+#define LOOP_LOG_SENSE_OPC 0x4d
+#define LOOP_XCOPY_OPC 0x83
+#define LOOP_RCV_COPY_RES_OPC 0x84
+#define LOOP_READ16_OPC 0x88
+#define LOOP_WRITE16_OPC 0x8a
+#define LOOP_SYNC_CACHE16_OPC 0x91
+#define LOOP_SAI16_OPC 0x9e
+#define LOOP_REPORT_LUNS_OPC 0xa0
+
+#define LOOP_READ_CAP16_SA 0x10
+#define LOOP_XCOPY_LID1_SA 0x0
+#define LOOP_COPY_STATUS_LID1_SA 0x0
+#define LOOP_COPY_OP_PARAMS_SA 0x3
+
+/* Additional Sense Code (ASC) */
+#define COPY_TARGET_ASC 0xd
+#define THIRD_PARTY_DEV_FAIL_ASCQ 0x1
+#define TARGET_UNREACHABLE_ASCQ 0x2
+#define UNRECOVERED_READ_ERR 0x11
+#define PARAMETER_LIST_LENGTH_ERR 0x1a
+#define INVALID_OPCODE 0x20
+#define LBA_OUT_OF_RANGE 0x21
+#define INVALID_FIELD_IN_CDB 0x24
+#define INVALID_FIELD_IN_PARAM_LIST 0x26
+#define TOO_MANY_CSCD_ASCQ 0x6
+#define UNSUP_CSCD_TYPE_ASCQ 0x7
+#define UNSUP_SEG_DESC_TYPE_ASCQ 0x9
+#define UA_RESET_ASC 0x29
+#define POWER_ON_RESET_ASCQ 0x0
+#define TRANSPORT_PROBLEM 0x4b
+
+struct sg_loop_lu {
+    int id;
+    int refcnt;                 /* fds and commands, under loop_mutex */
+    uint32_t lb_sz;
+    uint32_t lat_us;
+    uint32_t abort_every;       /* 0 --> never */
+    uint64_t num_lbs;
+    uint64_t med_lba;
+    uint64_t med_num;           /* 0 --> no medium errors injected */
+    pthread_mutex_t lock;       /* protects the fields that follow */
+    bool ua_pending;
+    uint64_t cmd_count;
+    uint64_t rd_bytes;
+    uint64_t wr_bytes;
+    uint64_t rd_errs;
+    /* outcome of last EXTENDED COPY, reported by RECEIVE COPY RESULTS */
+    bool xc_valid;
+    uint8_t xc_list_id;
+    uint8_t xc_status;          /* 1: completed, 2: completed with errors */
+    uint16_t xc_segs;
+    uint32_t xc_bytes;
+    uint8_t * ram;
+};
+
+struct sg_loop_fd_ent {
+    struct sg_loop_lu * lup;    /* NULL --> not a loopback fd */
+    dev_t dev;                  /* of the pipe, checked on each lookup */
+    ino_t ino;
+};
+
+/* loop_mutex protects these arrays and each logical unit's refcnt */
+static pthread_mutex_t loop_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct sg_loop_lu * loop_lu_arr[SG_LOOP_MAX_LUS];
+static struct sg_loop_fd_ent loop_fd_arr[SG_LOOP_MAX_FD];
+
+static const char * loop_vendor_str = "SG3UTILS";
+static const char * loop_product_str = "loopback        ";
+static const char * loop_rev_str = "0100";
+static const uint16_t loop_inq_resp_len = 36;
+
+
+#if defined(__GNUC__) || defined(__clang__)
+static int pr2ws(const char * fmt, ...)
+        __attribute__ ((format (printf, 1, 2)));
+#else
+static int pr2ws(const char * fmt, ...);
+#endif
+
+
+static int
+pr2ws(const char * fmt, ...)
+{
+    va_list args;
+    int n;
+
+    va_start(args, fmt);
+    n = vfprintf(sg_warnings_strm ? sg_warnings_strm : stderr, fmt, args);
+    va_end(args);
+    return n;
+}
+
+/* Always builds fixed format sense data. If info_valid is true and info
+ * fits in 32 bits then it is placed in the INFORMATION field. */
+static void
+loop_mk_sense(struct sg_pt_linux_scsi * ptp, int sk, int asc, int ascq,
+              bool info_valid, uint64_t info, int vb)
+{
+    int n;
+    uint8_t * sbp = (uint8_t *)(sg_uintptr_t)ptp->io_hdr.response;
+
+    ptp->io_hdr.device_status = SAM_STAT_CHECK_CONDITION;
+    n = ptp->io_hdr.max_response_len;
+    if ((NULL == sbp) || (n < 14)) {
+        if (vb)
+            pr2ws("%s: max_response_len=%d too short, want 14 or more\n",
+                  __func__, n);
+        return;
+    }
+    ptp->io_hdr.response_len = (n < 18) ? n : 18;
+    memset(sbp, 0, n);
+    sbp[0] = 0x70;      /* fixed, current */
+    sbp[2] = sk;
+    sbp[7] = 0xa;
+    sbp[12] = asc;
+    sbp[13] = ascq;
+    if (info_valid && (info <= UINT32_MAX)) {
+        sbp[0] |= 0x80;
+        sg_put_unaligned_be32((uint32_t)info, sbp + 3);
+    }
+    if (vb > 3)
+        pr2ws("%s:  [sense_key,asc,ascq]: [0x%x,0x%x,0x%x]\n", __func__, sk,
+              asc, ascq);
+}
+
+/* Set in_bit to -1 to indicate no bit position of invalid field */
+static void
+loop_mk_sense_invalid_fld(struct sg_pt_linux_scsi * ptp, bool in_cdb,
+                          int in_byte, int in_bit, int vb)
+{
+    uint8_t * sbp = (uint8_t *)(sg_uintptr_t)ptp->io_hdr.response;
+
+    loop_mk_sense(ptp, SPC_SK_ILLEGAL_REQUEST,
+                  in_cdb ? INVALID_FIELD_IN_CDB : INVALID_FIELD_IN_PARAM_LIST,
+                  0, false, 0, vb);
+    if (ptp->io_hdr.response_len < 18)
+        return;
+    sbp[15] = 0x80;     /* SKSV */
+    if (in_cdb)
+        sbp[15] |= 0x40;
+    if (in_bit >= 0)
+        sbp[15] |= (0x8 | (0x7 & in_bit));
+    sg_put_unaligned_be16(in_byte, sbp + 16);
+}
+
+/* Copies up to rlen bytes of the response in rp to the data-in buffer,
+ * limited by the allocation length and the data-in length. */
+static void
+loop_din(struct sg_pt_linux_scsi * ptp, const uint8_t * rp, uint32_t rlen,
+         uint32_t alloc_len)
+{
+    uint32_t n;
+
+    n = (alloc_len < rlen) ? alloc_len : rlen;
+    n = (n < ptp->io_hdr.din_xfer_len) ? n : ptp->io_hdr.din_xfer_len;
+    ptp->io_hdr.din_resid = ptp->io_hdr.din_xfer_len - n;
+    if (n > 0)
+        memcpy((uint8_t *)(sg_uintptr_t)ptp->io_hdr.din_xferp, rp, n);
+}
+
+/* Builds the NAA-3 (locally assigned) logical unit designation descriptor
+ * of lup in bp which should be at least 12 bytes long. Returns its
+ * length. */
+static int
+loop_mk_naa(const struct sg_loop_lu * lup, uint8_t * bp)
+{
+    bp[0] = 0x1;        /* code set: binary */
+    bp[1] = 0x3;        /* association: LU, designator type: NAA */
+    bp[2] = 0;
+    bp[3] = 8;
+    /* NAA-3 with "SG3U" in the locally administered value */
+    sg_put_unaligned_be64(0x3000000000000000ULL |
+                          ((uint64_t)0x53473355 << 16) | (uint64_t)lup->id,
+                          bp + 4);
+    return 12;
+}
+
+/* Call with loop_mutex held */
+static struct sg_loop_lu *
+loop_find_lu_by_desig(const uint8_t * desig)
+{
+    int k;
+    uint8_t b[12];
+
+    for (k = 0; k < SG_LOOP_MAX_LUS; ++k) {
+        if (NULL == loop_lu_arr[k])
+            continue;
+        loop_mk_naa(loop_lu_arr[k], b);
+        if (0 == memcmp(b, desig, sizeof(b)))
+            return loop_lu_arr[k];
+    }
+    return NULL;
+}
+
+/* Returns true if any of the num blocks starting at lba is in the medium
+ * error range; the first such block is placed in *bad_lbap. */
+static bool
+loop_medium_err(const struct sg_loop_lu * lup, uint64_t lba, uint64_t num,
+                uint64_t * bad_lbap)
+{
+    if ((0 == lup->med_num) || (0 == num))
+        return false;
+    if ((lba >= lup->med_lba + lup->med_num) || (lba + num <= lup->med_lba))
+        return false;
+    *bad_lbap = (lba > lup->med_lba) ? lba : lup->med_lba;
+    return true;
+}
+
+/* Adds to the counters reported by LOG SENSE. Other threads may be
+ * issuing commands to lup, or EXTENDED COPYs that touch it. */
+static void
+loop_count(struct sg_loop_lu * lup, uint64_t rd_bytes, uint64_t wr_bytes,
+           uint64_t rd_errs)
+{
+    pthread_mutex_lock(&lup->lock);
+    lup->rd_bytes += rd_bytes;
+    lup->wr_bytes += wr_bytes;
+    lup->rd_errs += rd_errs;
+    pthread_mutex_unlock(&lup->lock);
+}
+
+static int
+loop_parse_opts(const char * opts, int * idp, uint64_t * num_lbsp,
+                uint32_t * lb_szp, struct sg_loop_lu * tmplp, int vb)
+{
+    char * cp;
+    char * key;
+    char * val;
+    char * sav;
+    char * plus;
+    int64_t ll, ll2;
+    char b[256];
+
+    if (strlen(opts) >= sizeof(b)) {
+        if (vb)
+            pr2ws("%s: options too long\n", __func__);
+        return -EINVAL;
+    }
+    strcpy(b, opts);
+    for (cp = strtok_r(b, ",", &sav); cp; cp = strtok_r(NULL, ",", &sav)) {
+        key = cp;
+        val = strchr(cp, '=');
+        if (NULL == val)
+            goto bad;
+        *val++ = '\0';
+        plus = NULL;
+        if (0 == strcmp(key, "medium")) {
+            plus = strchr(val, '+');
+            if (plus)
+                *plus++ = '\0';
+        }
+        ll = sg_get_llnum(val);
+        if (ll < 0)
+            goto bad;
+        if (0 == strcmp(key, "id")) {
+            if (ll >= SG_LOOP_MAX_LUS)
+                goto bad;
+            *idp = (int)ll;
+        } else if (0 == strcmp(key, "blocks")) {
+            if (0 == ll)
+                goto bad;
+            *num_lbsp = (uint64_t)ll;
+        } else if (0 == strcmp(key, "lbs")) {
+            if ((ll < 512) || (ll > 65536) || (ll & (ll - 1)))
+                goto bad;
+            *lb_szp = (uint32_t)ll;
+        } else if (0 == strcmp(key, "lat")) {
+            if (ll > UINT32_MAX)
+                goto bad;
+            tmplp->lat_us = (uint32_t)ll;
+        } else if (0 == strcmp(key, "medium")) {
+            ll2 = 1;
+            if (plus) {
+                ll2 = sg_get_llnum(plus);
+                if (ll2 < 1)
+                    goto bad;
+            }
+            tmplp->med_lba = (uint64_t)ll;
+            tmplp->med_num = (uint64_t)ll2;
+        } else if (0 == strcmp(key, "abort")) {
+            if (ll > UINT32_MAX)
+                goto bad;
+            tmplp->abort_every = (uint32_t)ll;
+        } else if (0 == strcmp(key, "ua"))
+            tmplp->ua_pending = !! ll;
+        else
+            goto bad;
+    }
+    return 0;
+bad:
+    if (vb)
+        pr2ws("%s: bad loopback option: %s\n", __func__, cp);
+    return -EINVAL;
+}
+
+/* Call with loop_mutex held */
+static void
+loop_lu_free(struct sg_loop_lu * lup)
+{
+    loop_lu_arr[lup->id] = NULL;
+    pthread_mutex_destroy(&lup->lock);
+    free(lup->ram);
+    free(lup);
+}
+
+/* Opens (creating if necessary) the loopback logical unit described by
+ * opts, the part of the device name after "loop:". Returns a file
+ * descriptor (>= 0) or a negated errno value. */
+int
+sg_loop_open(const char * opts, int flags, int vb)
+{
+    int res;
+    int pfd[2];
+    int id = 0;
+    uint32_t lb_sz = SG_LOOP_DEF_LBS;
+    uint64_t num_lbs = SG_LOOP_DEF_BLOCKS;
+    struct sg_loop_lu * lup;
+    struct sg_loop_lu tmpl;
+    struct stat st;
+
+    memset(&tmpl, 0, sizeof(tmpl));
+    res = loop_parse_opts(opts, &id, &num_lbs, &lb_sz, &tmpl, vb);
+    if (res)
+        return res;
+    pthread_mutex_lock(&loop_mutex);
+    lup = loop_lu_arr[id];
+    if (lup) {
+        if (vb > 1)
+            pr2ws("%s: loopback id=%d already exists, other options "
+                  "ignored\n", __func__, id);
+    } else {
+        if (num_lbs > (SIZE_MAX / lb_sz)) {
+            if (vb)
+                pr2ws("%s: blocks=%" PRIu64 " too large\n", __func__,
+                      num_lbs);
+            res = -ENOMEM;
+            goto fini;
+        }
+        lup = (struct sg_loop_lu *)calloc(1, sizeof(*lup));
+        if (NULL == lup) {
+            res = -ENOMEM;
+            goto fini;
+        }
+        *lup = tmpl;
+        lup->id = id;
+        lup->lb_sz = lb_sz;
+        lup->num_lbs = num_lbs;
+        /* large calloc()s are mmap-ed so untouched blocks cost nothing */
+        lup->ram = (uint8_t *)calloc(num_lbs, lb_sz);
+        if (NULL == lup->ram) {
+            if (vb)
+                pr2ws("%s: unable to get %" PRIu64 " bytes of RAM\n",
+                      __func__, num_lbs * lb_sz);
+            free(lup);
+            res = -ENOMEM;
+            goto fini;
+        }
+        pthread_mutex_init(&lup->lock, NULL);
+        loop_lu_arr[id] = lup;
+    }
+    /* a pipe, rather than /dev/null, so the inode identifies this open */
+    if (pipe(pfd) < 0)
+        res = -errno;
+    else {
+        close(pfd[1]);
+        res = pfd[0];
+        if (res >= SG_LOOP_MAX_FD) {
+            close(res);
+            res = -EMFILE;
+        } else if (fstat(res, &st) < 0) {
+            close(res);
+            res = -errno;
+        } else if (O_CLOEXEC & flags)
+            fcntl(res, F_SETFD, FD_CLOEXEC);
+    }
+    if (res < 0) {
+        if (0 == lup->refcnt)
+            loop_lu_free(lup);
+        goto fini;
+    }
+    ++lup->refcnt;
+    loop_fd_arr[res].lup = lup;
+    loop_fd_arr[res].dev = st.st_dev;
+    loop_fd_arr[res].ino = st.st_ino;
+    if (vb > 2)
+        pr2ws("%s: id=%d, blocks=%" PRIu64 ", lbs=%u, fd=%d\n", __func__,
+              lup->id, lup->num_lbs, lup->lb_sz, res);
+fini:
+    pthread_mutex_unlock(&loop_mutex);
+    return res;
+}
+
+/* Returns the logical unit that fd refers to, with a reference taken
+ * that the caller drops with loop_put(), or NULL if fd is not a loopback
+ * device. Loopback fds are pipes, so other fds (e.g. sg devices) are
+ * turned away after an fstat() without taking loop_mutex. An entry whose
+ * fd was closed with close() is dropped here, once the fd number is found
+ * to refer to another pipe. */
+static struct sg_loop_lu *
+loop_get(int fd)
+{
+    struct sg_loop_lu * lup = NULL;
+    struct sg_loop_fd_ent * ep;
+    struct stat st;
+
+    if ((fd < 0) || (fd >= SG_LOOP_MAX_FD) || (fstat(fd, &st) < 0) ||
+        (! S_ISFIFO(st.st_mode)))
+        return NULL;
+    ep = loop_fd_arr + fd;
+    pthread_mutex_lock(&loop_mutex);
+    if (ep->lup) {
+        if ((st.st_dev == ep->dev) && (st.st_ino == ep->ino)) {
+            lup = ep->lup;
+            ++lup->refcnt;
+        } else {
+            if (--ep->lup->refcnt <= 0)
+                loop_lu_free(ep->lup);
+            ep->lup = NULL;
+        }
+    }
+    pthread_mutex_unlock(&loop_mutex);
+    return lup;
+}
+
+/* Drops a reference taken by loop_get() or loop_xcopy() */
+static void
+loop_put(struct sg_loop_lu * lup)
+{
+    pthread_mutex_lock(&loop_mutex);
+    if (--lup->refcnt <= 0)
+        loop_lu_free(lup);
+    pthread_mutex_unlock(&loop_mutex);
+}
+
+bool
+sg_loop_fd(int fd)
+{
+    struct sg_loop_lu * lup = loop_get(fd);
+
+    if (NULL == lup)
+        return false;
+    loop_put(lup);
+    return true;
+}
+
+/* Returns 0 if successful, otherwise negated errno. The logical unit (and
+ * its RAM) is freed when its last file descriptor is closed and no
+ * command is using it. */
+int
+sg_loop_close(int fd)
+{
+    struct sg_loop_lu * lup;
+
+    if (NULL == (lup = loop_get(fd)))
+        return -EBADF;
+    pthread_mutex_lock(&loop_mutex);
+    if (lup == loop_fd_arr[fd].lup) {   /* not raced by another close */
+        loop_fd_arr[fd].lup = NULL;
+        --lup->refcnt;          /* the fd's reference */
+    }
+    pthread_mutex_unlock(&loop_mutex);
+    loop_put(lup);
+    return (close(fd) < 0) ? -errno : 0;
+}
+
+static int
+loop_inquiry(struct sg_loop_lu * lup, struct sg_pt_linux_scsi * ptp,
+             const uint8_t * cdbp, int vb)
+{
+    int n, k;
+    uint8_t pg_cd = cdbp[2];
+    uint16_t alloc_len = sg_get_unaligned_be16(cdbp + 3);
+    uint8_t resp[96];
+    char sn[16];
+
+    if (0x2 & cdbp[1]) {        /* Reject CmdDt=1 */
+        loop_mk_sense_invalid_fld(ptp, true, 1, 1, vb);
+        return 0;
+    }
+    memset(resp, 0, sizeof(resp));
+    snprintf(sn, sizeof(sn), "SGLOOP%04d", lup->id);
+    if (0 == (0x1 & cdbp[1])) {         /* standard INQUIRY response */
+        resp[2] = 6;    /* version: SPC-4 */
+        resp[3] = 0x12; /* HISUP=1, response data format: 2 */
+        resp[4] = loop_inq_resp_len - 5;
+        resp[5] = 0x8;  /* 3PC=1, supports EXTENDED COPY */
+        resp[7] = 0x2;  /* CMDQUE=1 */
+        memcpy(resp + 8, loop_vendor_str, 8);
+        memcpy(resp + 16, loop_product_str, 16);
+        memcpy(resp + 32, loop_rev_str, 4);
+        loop_din(ptp, resp, loop_inq_resp_len, alloc_len);
+        return 0;
+    }
+    resp[1] = pg_cd;
+    switch (pg_cd) {
+    case 0x0:           /* Supported VPD pages */
+        n = 4;
+        resp[n++] = 0x0;
+        resp[n++] = 0x80;
+        resp[n++] = 0x83;
+        resp[n++] = 0xb0;
+        break;
+    case 0x80:          /* Unit serial number */
+        k = strlen(sn);
+        memcpy(resp + 4, sn, k);
+        n = 4 + k;
+        break;
+    case 0x83:          /* Device identification */
+        n = 4 + loop_mk_naa(lup, resp + 4);
+        k = strlen(sn);
+        resp[n] = 0x2;          /* code set: ASCII */
+        resp[n + 1] = 0x1;      /* association: LU, designator: T10 */
+        resp[n + 3] = 16 + k;
+        memcpy(resp + n + 4, loop_vendor_str, 8);
+        memcpy(resp + n + 12, loop_product_str, 8);
+        memcpy(resp + n + 20, sn, k);
+        n += 20 + k;
+        break;
+    case 0xb0:          /* Block limits */
+        n = 64;
+        sg_put_unaligned_be16(1, resp + 6);     /* opt xfer len gran */
+        sg_put_unaligned_be32(SG_LOOP_MAX_SEG_BYTES / lup->lb_sz, resp + 8);
+        break;
+    default:            /* Point to page_code field in cdb */
+        loop_mk_sense_invalid_fld(ptp, true, 2, 7, vb);
+        return 0;
+    }
+    sg_put_unaligned_be16(n - 4, resp + 2);
+    loop_din(ptp, resp, n, alloc_len);
+    return 0;
+}
+
+static int
+loop_req_sense(struct sg_loop_lu * lup, struct sg_pt_linux_scsi * ptp,
+               const uint8_t * cdbp)
+{
+    uint8_t resp[18];
+
+    memset(resp, 0, sizeof(resp));
+    resp[0] = 0x70;
+    resp[7] = 0xa;
+    if (lup->ua_pending) {
+        lup->ua_pending = false;
+        resp[2] = SPC_SK_UNIT_ATTENTION;
+        resp[12] = UA_RESET_ASC;
+        resp[13] = POWER_ON_RESET_ASCQ;
+    }
+    loop_din(ptp, resp, sizeof(resp), cdbp[4]);
+    return 0;
+}
+
+static int
+loop_readcap(struct sg_loop_lu * lup, struct sg_pt_linux_scsi * ptp,
+             const uint8_t * cdbp, bool is_16, int vb)
+{
+    uint64_t last_lba = lup->num_lbs - 1;
+    uint8_t resp[32];
+
+    memset(resp, 0, sizeof(resp));
+    if (is_16) {
+        if (LOOP_READ_CAP16_SA != (0x1f & cdbp[1])) {
+            loop_mk_sense_invalid_fld(ptp, true, 1, 4, vb);
+            return 0;
+        }
+        sg_put_unaligned_be64(last_lba, resp + 0);
+        sg_put_unaligned_be32(lup->lb_sz, resp + 8);
+        loop_din(ptp, resp, 32, sg_get_unaligned_be32(cdbp + 10));
+    } else {
+        sg_put_unaligned_be32((last_lba > UINT32_MAX) ? UINT32_MAX :
+                              (uint32_t)last_lba, resp + 0);
+        sg_put_unaligned_be32(lup->lb_sz, resp + 4);
+        loop_din(ptp, resp, 8, 8);
+    }
+    return 0;
+}
+
+static int
+loop_rw(struct sg_loop_lu * lup, struct sg_pt_linux_scsi * ptp,
+        const uint8_t * cdbp, bool is_16, bool is_write, int vb)
+{
+    uint32_t num, xfer_len, n;
+    uint32_t err = 0;
+    uint64_t lba, nbytes;
+    uint64_t bad_lba = 0;
+    uint8_t * rp;
+
+    if (is_16) {
+        lba = sg_get_unaligned_be64(cdbp + 2);
+        num = sg_get_unaligned_be32(cdbp + 10);
+    } else {
+        lba = sg_get_unaligned_be32(cdbp + 2);
+        num = sg_get_unaligned_be16(cdbp + 7);
+    }
+    if (0 == num)
+        return 0;
+    if ((lba >= lup->num_lbs) || (num > (lup->num_lbs - lba))) {
+        loop_mk_sense(ptp, SPC_SK_ILLEGAL_REQUEST, LBA_OUT_OF_RANGE, 0,
+                      false, 0, vb);
+        return 0;
+    }
+    nbytes = (uint64_t)num * lup->lb_sz;
+    rp = lup->ram + (lba * lup->lb_sz);
+    if (is_write) {
+        xfer_len = ptp->io_hdr.dout_xfer_len;
+        n = (nbytes < xfer_len) ? (uint32_t)nbytes : xfer_len;
+        if (n > 0)
+            memcpy(rp, (const uint8_t *)(sg_uintptr_t)ptp->io_hdr.dout_xferp,
+                   n);
+        ptp->io_hdr.dout_resid = xfer_len - n;
+        loop_count(lup, 0, n, 0);
+        return 0;
+    }
+    xfer_len = ptp->io_hdr.din_xfer_len;
+    if (loop_medium_err(lup, lba, num, &bad_lba)) {
+        /* blocks before the bad one are transferred */
+        nbytes = (bad_lba - lba) * lup->lb_sz;
+        err = 1;
+    }
+    n = (nbytes < xfer_len) ? (uint32_t)nbytes : xfer_len;
+    if (n > 0)
+        memcpy((uint8_t *)(sg_uintptr_t)ptp->io_hdr.din_xferp, rp, n);
+    ptp->io_hdr.din_resid = xfer_len - n;
+    loop_count(lup, n, 0, err);
+    if (nbytes < (uint64_t)num * lup->lb_sz)
+        loop_mk_sense(ptp, SPC_SK_MEDIUM_ERROR, UNRECOVERED_READ_ERR, 0,
+                      true, bad_lba, vb);
+    return 0;
+}
+
+static int
+loop_rluns(struct sg_pt_linux_scsi * ptp, const uint8_t * cdbp, int vb)
+{
+    uint32_t n = 8;
+    uint8_t resp[16];
+
+    memset(resp, 0, sizeof(resp));
+    switch (cdbp[2]) {  /* SELECT REPORT */
+    case 0:
+    case 2:
+    case 0x11:
+        n += 8;         /* LUN 0 (all zeros) */
+        break;
+    case 1:
+    case 0x10:
+    case 0x12:
+        break;
+    default:
+        loop_mk_sense_invalid_fld(ptp, true, 2, 7, vb);
+        return 0;
+    }
+    sg_put_unaligned_be32(n - 8, resp + 0);
+    loop_din(ptp, resp, n, sg_get_unaligned_be32(cdbp + 6));
+    return 0;
+}
+
+/* Appends a log parameter with a value of vlen bytes (1 to 8) */
+static int
+loop_log_param(uint8_t * bp, uint16_t pc, uint8_t ctl, uint64_t val,
+               int vlen)
+{
+    int k;
+
+    sg_put_unaligned_be16(pc, bp + 0);
+    bp[2] = ctl;
+    bp[3] = vlen;
+    for (k = vlen - 1; k >= 0; --k, val >>= 8)
+        bp[4 + k] = val & 0xff;
+    return 4 + vlen;
+}
+
+static const uint8_t loop_log_pages[] = {0x0, 0x2, 0x3, 0xd};
+
+static int
+loop_log_sense(struct sg_loop_lu * lup, struct sg_pt_linux_scsi * ptp,
+               const uint8_t * cdbp, int vb)
+{
+    int n = 4;
+    int k;
+    uint8_t pg_cd = 0x3f & cdbp[2];
+    uint8_t subpg_cd = cdbp[3];
+    uint64_t rd_bytes, wr_bytes, rd_errs;
+    uint8_t resp[64];
+
+    if (0x1 & cdbp[1]) {        /* SP=1, nothing to save */
+        loop_mk_sense_invalid_fld(ptp, true, 1, 0, vb);
+        return 0;
+    }
+    memset(resp, 0, sizeof(resp));
+    resp[0] = pg_cd;
+    if (subpg_cd && (! ((0 == pg_cd) && (0xff == subpg_cd)))) {
+        loop_mk_sense_invalid_fld(ptp, true, 3, 7, vb);
+        return 0;
+    }
+    pthread_mutex_lock(&lup->lock);
+    rd_bytes = lup->rd_bytes;
+    wr_bytes = lup->wr_bytes;
+    rd_errs = lup->rd_errs;
+    pthread_mutex_unlock(&lup->lock);
+    switch (pg_cd) {
+    case 0x0:           /* Supported log pages [and subpages] */
+        if (0xff == subpg_cd) {
+            resp[0] |= 0x40;    /* SPF=1 */
+            resp[1] = subpg_cd;
+            for (k = 0; k < (int)sizeof(loop_log_pages); ++k) {
+                resp[n++] = loop_log_pages[k];
+                resp[n++] = 0x0;
+            }
+            resp[n++] = 0x0;
+            resp[n++] = 0xff;
+        } else {
+            for (k = 0; k < (int)sizeof(loop_log_pages); ++k)
+                resp[n++] = loop_log_pages[k];
+        }
+        break;
+    case 0x2:           /* Write error counters */
+        n += loop_log_param(resp + n, 0x5, 0x0, wr_bytes, 8);
+        n += loop_log_param(resp + n, 0x6, 0x0, 0, 4);
+        break;
+    case 0x3:           /* Read error counters */
+        n += loop_log_param(resp + n, 0x5, 0x0, rd_bytes, 8);
+        n += loop_log_param(resp + n, 0x6, 0x0, rd_errs, 4);
+        break;
+    case 0xd:           /* Temperature */
+        n += loop_log_param(resp + n, 0x0, 0x3, 38, 2);
+        n += loop_log_param(resp + n, 0x1, 0x3, 65, 2);
+        break;
+    default:
+        loop_mk_sense_invalid_fld(ptp, true, 2, 5, vb);
+        return 0;
+    }
+    sg_put_unaligned_be16(n - 4, resp + 2);
+    loop_din(ptp, resp, n, sg_get_unaligned_be16(cdbp + 7));
+    return 0;
+}
+
+/* EXTENDED COPY(LID1) with identification CSCD descriptors (0xe4) that
+ * name loopback logical units and block to block (0x2) segments. */
+static int
+loop_xcopy(struct sg_loop_lu * lup, struct sg_pt_linux_scsi * ptp,
+           const uint8_t * cdbp, int vb)
+{
+    bool started = false;
+    uint8_t status = 2;         /* completed with errors, until done */
+    uint16_t segs = 0;
+    uint32_t pl_len, cscd_len, seg_len, off, end, dlen, k, ncscd, blk_len;
+    uint32_t nblks;
+    uint32_t bytes = 0;
+    uint32_t nref = 0;          /* cscd[] entries holding a reference */
+    uint64_t src_lba, dst_lba, nbytes, bad_lba;
+    const uint8_t * plp = (const uint8_t *)(sg_uintptr_t)
+                          ptp->io_hdr.dout_xferp;
+    const uint8_t * bp;
+    struct sg_loop_lu * src_lup;
+    struct sg_loop_lu * dst_lup;
+    struct sg_loop_lu * cscd[SG_LOOP_MAX_CSCD];
+
+    if (LOOP_XCOPY_LID1_SA != (0x1f & cdbp[1])) {
+        loop_mk_sense_invalid_fld(ptp, true, 1, 4, vb);
+        return 0;
+    }
+    pl_len = sg_get_unaligned_be32(cdbp + 10);
+    if (0 == pl_len)
+        return 0;
+    if ((pl_len < 16) || (pl_len > ptp->io_hdr.dout_xfer_len))
+        goto len_err;
+    cscd_len = sg_get_unaligned_be16(plp + 2);
+    seg_len = sg_get_unaligned_be32(plp + 8);
+    if (sg_get_unaligned_be32(plp + 12)) {      /* no inline data */
+        loop_mk_sense_invalid_fld(ptp, false, 12, -1, vb);
+        return 0;
+    }
+    if ((16 + (uint64_t)cscd_len + seg_len) > pl_len)
+        goto len_err;
+    if (cscd_len % 32) {
+        loop_mk_sense_invalid_fld(ptp, false, 2, -1, vb);
+        return 0;
+    }
+    ncscd = cscd_len / 32;
+    if (ncscd > SG_LOOP_MAX_CSCD) {
+        loop_mk_sense(ptp, SPC_SK_ILLEGAL_REQUEST,
+                      INVALID_FIELD_IN_PARAM_LIST, TOO_MANY_CSCD_ASCQ, false,
+                      0, vb);
+        return 0;
+    }
+    for (k = 0; k < ncscd; ++k) {
+        bp = plp + 16 + (32 * k);
+        if (0xe4 != bp[0]) {
+            loop_mk_sense(ptp, SPC_SK_ILLEGAL_REQUEST,
+                          INVALID_FIELD_IN_PARAM_LIST, UNSUP_CSCD_TYPE_ASCQ,
+                          false, 0, vb);
+            goto fini;
+        }
+        pthread_mutex_lock(&loop_mutex);
+        cscd[k] = loop_find_lu_by_desig(bp + 4);
+        if (cscd[k])
+            ++cscd[k]->refcnt;  /* held until this command is done */
+        pthread_mutex_unlock(&loop_mutex);
+        if (cscd[k])
+            nref = k + 1;
+        else {
+            if (vb > 1)
+                pr2ws("%s: CSCD descriptor %u not a loopback LU\n",
+                      __func__, k);
+            loop_mk_sense(ptp, SPC_SK_COPY_ABORTED, COPY_TARGET_ASC,
+                          TARGET_UNREACHABLE_ASCQ, false, 0, vb);
+            goto fini;
+        }
+        blk_len = sg_get_unaligned_be24(bp + 29);
+        if (blk_len && (blk_len != cscd[k]->lb_sz)) {
+            loop_mk_sense_invalid_fld(ptp, false, 16 + (32 * k) + 29, -1,
+                                      vb);
+            goto fini;
+        }
+    }
+    started = true;
+    end = 16 + cscd_len + seg_len;
+    for (off = 16 + cscd_len; off < end; off += dlen) {
+        bp = plp + off;
+        if ((end - off) < 4)
+            goto len_err;
+        dlen = sg_get_unaligned_be16(bp + 2) + 4;
+        if (0x2 != bp[0]) {
+            loop_mk_sense(ptp, SPC_SK_ILLEGAL_REQUEST,
+                          INVALID_FIELD_IN_PARAM_LIST,
+                          UNSUP_SEG_DESC_TYPE_ASCQ, false, 0, vb);
+            goto fini;
+        }
+        if ((dlen < 28) || (dlen > (end - off)))
+            goto len_err;
+        if ((segs >= SG_LOOP_MAX_SEGS) ||
+            (sg_get_unaligned_be16(bp + 4) >= ncscd) ||
+            (sg_get_unaligned_be16(bp + 6) >= ncscd)) {
+            loop_mk_sense_invalid_fld(ptp, false, off + 4, -1, vb);
+            goto fini;
+        }
+        src_lup = cscd[sg_get_unaligned_be16(bp + 4)];
+        dst_lup = cscd[sg_get_unaligned_be16(bp + 6)];
+        nblks = sg_get_unaligned_be16(bp + 10);
+        src_lba = sg_get_unaligned_be64(bp + 12);
+        dst_lba = sg_get_unaligned_be64(bp + 20);
+        /* DC=1: block count is in destination logical blocks */
+        nbytes = (uint64_t)nblks * ((0x2 & bp[1]) ? dst_lup->lb_sz :
+                                                    src_lup->lb_sz);
+        if ((nbytes % src_lup->lb_sz) || (nbytes % dst_lup->lb_sz)) {
+            loop_mk_sense_invalid_fld(ptp, false, off + 10, -1, vb);
+            goto fini;
+        }
+        if ((src_lba >= src_lup->num_lbs) ||
+            ((nbytes / src_lup->lb_sz) > (src_lup->num_lbs - src_lba)) ||
+            (dst_lba >= dst_lup->num_lbs) ||
+            ((nbytes / dst_lup->lb_sz) > (dst_lup->num_lbs - dst_lba))) {
+            loop_mk_sense(ptp, SPC_SK_COPY_ABORTED, LBA_OUT_OF_RANGE, 0,
+                          false, 0, vb);
+            goto fini;
+        }
+        if (loop_medium_err(src_lup, src_lba, nbytes / src_lup->lb_sz,
+                            &bad_lba)) {
+            loop_count(src_lup, 0, 0, 1);
+            loop_mk_sense(ptp, SPC_SK_COPY_ABORTED, COPY_TARGET_ASC,
+                          THIRD_PARTY_DEV_FAIL_ASCQ, true, bad_lba, vb);
+            goto fini;
+        }
+        memmove(dst_lup->ram + (dst_lba * dst_lup->lb_sz),
+                src_lup->ram + (src_lba * src_lup->lb_sz), nbytes);
+        loop_count(src_lup, nbytes, 0, 0);
+        loop_count(dst_lup, 0, nbytes, 0);
+        ++segs;
+        bytes += (uint32_t)nbytes;
+    }
+    status = 1;                 /* completed, good */
+    goto fini;
+len_err:
+    loop_mk_sense(ptp, SPC_SK_ILLEGAL_REQUEST, PARAMETER_LIST_LENGTH_ERR, 0,
+                  false, 0, vb);
+fini:
+    if (started) {      /* for RECEIVE COPY RESULTS */
+        pthread_mutex_lock(&lup->lock);
+        lup->xc_valid = true;
+        lup->xc_list_id = plp[0];
+        lup->xc_status = status;
+        lup->xc_segs = segs;
+        lup->xc_bytes = bytes;
+        pthread_mutex_unlock(&lup->lock);
+    }
+    for (k = 0; k < nref; ++k)
+        loop_put(cscd[k]);
+    return 0;
+}
+
+static int
+loop_rcv_copy_res(struct sg_loop_lu * lup, struct sg_pt_linux_scsi * ptp,
+                  const uint8_t * cdbp, int vb)
+{
+    bool ok;
+    int n;
+    uint32_t k;
+    uint8_t resp[48];
+
+    memset(resp, 0, sizeof(resp));
+    switch (0x1f & cdbp[1]) {
+    case LOOP_COPY_STATUS_LID1_SA:
+        pthread_mutex_lock(&lup->lock);
+        ok = lup->xc_valid && (cdbp[2] == lup->xc_list_id);
+        resp[4] = lup->xc_status;
+        sg_put_unaligned_be16(lup->xc_segs, resp + 5);
+        resp[7] = 0;            /* transfer count units: bytes */
+        sg_put_unaligned_be32(lup->xc_bytes, resp + 8);
+        pthread_mutex_unlock(&lup->lock);
+        if (! ok) {
+            loop_mk_sense_invalid_fld(ptp, true, 2, -1, vb);
+            return 0;
+        }
+        n = 12;
+        break;
+    case LOOP_COPY_OP_PARAMS_SA:
+        n = 46;
+        resp[4] = 0x1;          /* SNLID=1 */
+        sg_put_unaligned_be16(SG_LOOP_MAX_CSCD, resp + 8);
+        sg_put_unaligned_be16(SG_LOOP_MAX_SEGS, resp + 10);
+        sg_put_unaligned_be32((32 * SG_LOOP_MAX_CSCD) +
+                              (28 * SG_LOOP_MAX_SEGS), resp + 12);
+        sg_put_unaligned_be32(SG_LOOP_MAX_SEG_BYTES, resp + 16);
+        resp[36] = 1;           /* maximum concurrent copies */
+        for (k = lup->lb_sz; k > 1; k >>= 1)
+            ++resp[37];         /* data segment granularity (log2) */
+        resp[43] = 2;
+        resp[44] = 0x2;         /* block to block */
+        resp[45] = 0xe4;        /* identification CSCD descriptor */
+        break;
+    default:
+        loop_mk_sense_invalid_fld(ptp, true, 1, 4, vb);
+        return 0;
+    }
+    sg_put_unaligned_be32(n - 4, resp + 0);
+    loop_din(ptp, resp, n, sg_get_unaligned_be32(cdbp + 10));
+    return 0;
+}
+
+/* Executes the SCSI command in ptp against lup, on which the caller holds
+ * a reference. Return values as for sg_do_loop_pt(). */
+static int
+loop_do_cmd(struct sg_loop_lu * lup, struct sg_pt_linux_scsi * ptp,
+            int time_secs, int vb)
+{
+    bool ua;
+    uint8_t opcode;
+    uint64_t cmd_count;
+    const uint8_t * cdbp;
+
+    cdbp = (const uint8_t *)(sg_uintptr_t)ptp->io_hdr.request;
+    if ((NULL == cdbp) ||
+        ((int)ptp->io_hdr.request_len < sg_get_command_size(cdbp[0]))) {
+        if (vb)
+            pr2ws("No SCSI command (cdb) given (loop)\n");
+        return SCSI_PT_DO_BAD_PARAMS;
+    }
+    if (vb > 4)
+        pr2ws("%s: id=%d, time_secs=%d\n", __func__, lup->id, time_secs);
+    ptp->io_hdr.device_status = SAM_STAT_GOOD;
+    ptp->io_hdr.driver_status = 0;
+    ptp->io_hdr.transport_status = 0;
+    ptp->io_hdr.response_len = 0;
+    ptp->io_hdr.din_resid = 0;
+    ptp->io_hdr.dout_resid = 0;
+    ptp->io_hdr.duration = lup->lat_us / 1000;
+    opcode = cdbp[0];
+    pthread_mutex_lock(&lup->lock);
+    cmd_count = ++lup->cmd_count;
+    ua = lup->ua_pending && (LOOP_INQUIRY_OPC != opcode) &&
+         (LOOP_REPORT_LUNS_OPC != opcode) &&
+         (LOOP_REQUEST_SENSE_OPC != opcode);
+    if (ua)
+        lup->ua_pending = false;
+    pthread_mutex_unlock(&lup->lock);
+    if (lup->lat_us > 0) {
+        struct timespec ts;
+
+        ts.tv_sec = lup->lat_us / 1000000;
+        ts.tv_nsec = (lup->lat_us % 1000000) * 1000;
+        while ((nanosleep(&ts, &ts) < 0) && (EINTR == errno))
+            ;
+    }
+    if (ua) {
+        loop_mk_sense(ptp, SPC_SK_UNIT_ATTENTION, UA_RESET_ASC,
+                      POWER_ON_RESET_ASCQ, false, 0, vb);
+        return 0;
+    }
+    if (lup->abort_every && (0 == (cmd_count % lup->abort_every))) {
+        loop_mk_sense(ptp, SPC_SK_ABORTED_COMMAND, TRANSPORT_PROBLEM, 0,
+                      false, 0, vb);
+        return 0;
+    }
+    switch (opcode) {
+    case LOOP_TUR_OPC:
+    case LOOP_SYNC_CACHE10_OPC:
+    case LOOP_SYNC_CACHE16_OPC:
+        return 0;
+    case LOOP_REQUEST_SENSE_OPC:
+        return loop_req_sense(lup, ptp, cdbp);
+    case LOOP_INQUIRY_OPC:
+        return loop_inquiry(lup, ptp, cdbp, vb);
+    case LOOP_READ_CAP10_OPC:
+        return loop_readcap(lup, ptp, cdbp, false, vb);
+    case LOOP_SAI16_OPC:
+        return loop_readcap(lup, ptp, cdbp, true, vb);
+    case LOOP_READ10_OPC:
+        return loop_rw(lup, ptp, cdbp, false, false, vb);
+    case LOOP_READ16_OPC:
+        return loop_rw(lup, ptp, cdbp, true, false, vb);
+    case LOOP_WRITE10_OPC:
+        return loop_rw(lup, ptp, cdbp, false, true, vb);
+    case LOOP_WRITE16_OPC:
+        return loop_rw(lup, ptp, cdbp, true, true, vb);
+    case LOOP_REPORT_LUNS_OPC:
+        return loop_rluns(ptp, cdbp, vb);
+    case LOOP_LOG_SENSE_OPC:
+        return loop_log_sense(lup, ptp, cdbp, vb);
+    case LOOP_XCOPY_OPC:
+        return loop_xcopy(lup, ptp, cdbp, vb);
+    case LOOP_RCV_COPY_RES_OPC:
+        return loop_rcv_copy_res(lup, ptp, cdbp, vb);
+    default:
+        if (vb > 2)
+            pr2ws("%s: opcode 0x%x not supported\n", __func__, opcode);
+        loop_mk_sense(ptp, SPC_SK_ILLEGAL_REQUEST, INVALID_OPCODE, 0,
+                      false, 0, vb);
+        return 0;
+    }
+}
+
+/* Executes the SCSI command in the object pointed to by vp against the
+ * loopback logical unit associated with fd. Returns 0 when the command was
+ * processed, even if it yields a SCSI status other than GOOD, otherwise
+ * a negated errno value or SCSI_PT_DO_BAD_PARAMS . */
+int
+sg_do_loop_pt(struct sg_pt_base * vp, int fd, int time_secs, int vb)
+{
+    int res;
+    struct sg_loop_lu * lup;
+    struct sg_pt_linux_scsi * ptp = &vp->impl;
+
+    if (fd < 0)
+        fd = ptp->dev_fd;
+    if (NULL == (lup = loop_get(fd))) {
+        ptp->os_err = EBADF;
+        return -EBADF;
+    }
+    res = loop_do_cmd(lup, ptp, time_secs, vb);
+    loop_put(lup);
+    return res;
+}
+
+/* Issues the sg version 3 interface request in hp to the loopback logical
+ * unit associated with fd, as ioctl(fd, SG_IO, hp) would to a sg device.
+ * If fd is not a loopback device then it is that ioctl. Scatter gather
+ * lists (iovec_count > 0) are not supported. Returns 0 when the command
+ * was processed (check hp->status, hp->sb_len_wr, etc), else -1 with
+ * errno set. */
+int
+sg_loop_sg_io(int fd, struct sg_io_hdr * hp)
+{
+    int res;
+    struct sg_loop_lu * lup;
+    struct sg_pt_base pt;
+    struct sg_pt_linux_scsi * ptp = &pt.impl;
+
+    if (NULL == (lup = loop_get(fd)))
+        return ioctl(fd, SG_IO, hp);
+    if ((NULL == hp) || ('S' != hp->interface_id) || (hp->iovec_count > 0)) {
+        loop_put(lup);
+        errno = EINVAL;
+        return -1;
+    }
+    memset(&pt, 0, sizeof(pt));
+    ptp->io_hdr.guard = 'Q';
+    ptp->dev_fd = fd;
+    ptp->is_sg = true;
+    ptp->is_loop = true;
+    ptp->io_hdr.request = (uint64_t)(sg_uintptr_t)hp->cmdp;
+    ptp->io_hdr.request_len = hp->cmd_len;
+    ptp->io_hdr.response = (uint64_t)(sg_uintptr_t)hp->sbp;
+    ptp->io_hdr.max_response_len = hp->mx_sb_len;
+    if (SG_DXFER_TO_DEV == hp->dxfer_direction) {
+        ptp->io_hdr.dout_xferp = (uint64_t)(sg_uintptr_t)hp->dxferp;
+        ptp->io_hdr.dout_xfer_len = hp->dxfer_len;
+    } else if ((SG_DXFER_FROM_DEV == hp->dxfer_direction) ||
+               (SG_DXFER_TO_FROM_DEV == hp->dxfer_direction)) {
+        ptp->io_hdr.din_xferp = (uint64_t)(sg_uintptr_t)hp->dxferp;
+        ptp->io_hdr.din_xfer_len = hp->dxfer_len;
+    }
+    res = loop_do_cmd(lup, ptp, hp->timeout / 1000, 0);
+    loop_put(lup);
+    if (res) {
+        errno = (res < 0) ? -res : EINVAL;
+        return -1;
+    }
+    hp->status = ptp->io_hdr.device_status;
+    hp->masked_status = (hp->status >> 1) & 0x7f;
+    hp->msg_status = 0;
+    hp->host_status = 0;
+    hp->sb_len_wr = ptp->io_hdr.response_len;
+    hp->driver_status = (hp->sb_len_wr > 0) ? SG_LIB_DRIVER_SENSE : 0;
+    hp->resid = (SG_DXFER_TO_DEV == hp->dxfer_direction) ?
+                ptp->io_hdr.dout_resid : ptp->io_hdr.din_resid;
+    hp->duration = ptp->io_hdr.duration;
+    hp->info = (hp->status || hp->driver_status) ? SG_INFO_CHECK : 0;
+    return 0;
+}
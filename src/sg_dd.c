@@ -39,6 +39,7 @@
 #include <string.h>
 #include <signal.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <errno.h>
 #include <limits.h>
 #define __STDC_FORMAT_MACROS 1
@@ -46,6 +47,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/file.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>  /* needed for lseek64() */
@@ -58,11 +60,13 @@
 #include "sg_lib.h"
 #include "sg_cmds_basic.h"
 #include "sg_cmds_extra.h"
+#include "sg_pt.h"
 #include "sg_io_linux.h"
+#include "sg_copy_util.h"
 #include "sg_unaligned.h"
 #include "sg_pr2serr.h"
 
-static const char * version_str = "5.96 20180219";
+static const char * version_str = "6.06 20261018";
 
 
 #define ME "sg_dd: "
@@ -76,6 +80,23 @@ static const char * version_str = "5.96 20180219";
 #define DEF_BLOCK_SIZE 512
 #define DEF_BLOCKS_PER_TRANSFER 128
 #define DEF_BLOCKS_PER_2048TRANSFER 32
+#define DEF_MANIFEST_CHUNK 2048 /* blocks hashed per line of manifest */
+#define DEF_CKPT_SECS 30        /* seconds between checkpoints (ckpt=) */
+#define MAX_OF2 8               /* of2= may be given this many times */
+#define FO_NUM_BUFS 4           /* read buffers shared by of2= writers */
+#define DEF_PROGRESS_SECS 5     /* progress_file= without progress= */
+#define COE_SKIP_FIRST_BYTES 65536      /* coe_skip=: first skip ahead */
+#define THIN_NUM_DESC 512       /* iflag=thin: LBA status descriptors held */
+#define THIN_MAX_HOLE (1 << 22) /* iflag=thin: most blocks bypassed per loop */
+#define THIN_DEF_WS_MAX 65535   /* if Block Limits gives no WRITE SAME max */
+#define WRITE_SAME16_CMD 0x93
+#define AUTO_MIN_BPT 8          /* bpt=auto: first size tried */
+#define AUTO_MAX_BYTES (1024 * 1024)    /* bpt=auto: unless Block Limits */
+#define AUTO_CALIB_BYTES (4 * 1024 * 1024)      /* read per size tried */
+#define AUTO_KNEE_PCT 90        /* within this % of best throughput */
+#define AUTO_SLOW_FACTOR 3      /* transfer this times slower than */
+#define AUTO_SLOW_COUNT 4       /* calibrated, this many times in a row */
+#define AUTO_FAST_COUNT 64      /* transfers at par before growing again */
 #define DEF_SCSI_CDBSZ 10
 #define MAX_SCSI_CDBSZ 16
 
@@ -131,10 +152,15 @@ static int in_partial = 0;
 static int64_t out_full = 0;
 static int out_partial = 0;
 static int64_t out_sparse_num = 0;
+static int64_t out_thin_num = 0;
+static int64_t out_delta_num = 0;
 static int recovered_errs = 0;
 static int unrecovered_errs = 0;
 static int read_longs = 0;
 static int num_retries = 0;
+static int miscompares = 0;
+static int64_t verified_blks = 0;
+static int64_t first_miscomp_lba = -1;
 
 static bool do_time = false;
 static bool start_tm_valid = false;
@@ -148,12 +174,17 @@ static struct timeval start_tm;
 
 static uint8_t * zeros_buff = NULL;
 static uint8_t * free_zeros_buff = NULL;
+static uint8_t * verify_buff = NULL;
+static uint8_t * free_verify_buff = NULL;
+static bool verify_by_read = false;
 static int read_long_blk_inc = READ_LONG_DEF_BLK_INC;
+static int auto_adjusts = 0;
 
 static const char * proc_allow_dio = "/proc/scsi/sg/allow_dio";
 
 struct flags_t {
     bool append;
+    bool delta;
     bool dio;
     bool direct;
     bool dpo;
@@ -161,8 +192,11 @@ struct flags_t {
     bool excl;
     bool flock;
     bool fua;
+    bool loop;          /* set at open: fd is a user space loopback */
     bool sgio;
     bool sparse;
+    bool thin;
+    bool verify;
     int cdbsz;
     int coe;
     int nocache;
@@ -173,6 +207,118 @@ struct flags_t {
 static struct flags_t iflag;
 static struct flags_t oflag;
 
+static struct sg_manifest mfest;
+
+struct delta_ent {          /* one per chunk of manifest given to delta= */
+    int blks;
+    uint32_t crc;
+};
+
+static struct delta_ent * delta_tbl = NULL;
+static int64_t delta_tbl_len = 0;
+static int delta_chunk = 0;
+
+struct ckpt_t {             /* for ckpt=CF */
+    const char * fn;        /* NULL when not checkpointing */
+    const char * inf;
+    const char * outf;
+    int secs;               /* checkpoint every 'secs' seconds ... */
+    int mb;                 /* ... or every 'mb' MiB copied (0: off) */
+    int outfd;
+    int out_type;
+    int64_t skip;           /* skip, seek and count of the whole copy */
+    int64_t seek;
+    int64_t count;
+    int64_t done;           /* blocks copied, contiguous from start */
+    int64_t saved;          /* 'done' in the last checkpoint written */
+    struct timeval tm;      /* when last checkpoint written */
+};
+
+static struct ckpt_t ckpt;
+
+static struct sg_rate rlim;         /* rate=, iops= and rate_file= */
+static volatile sig_atomic_t interrupt_sig = 0; /* set by SIGINT, ... */
+
+struct fo_out {             /* one per of2=OFILE2, each has a writer thread */
+    const char * fn;
+    int fd;
+    int type;
+    struct flags_t flags;   /* copy of oflag (sg_write() may change it) */
+    int64_t next;           /* next segment to write */
+    int64_t blks;           /* blocks written, contiguous from start */
+    bool err;               /* write failed, others are no longer done */
+    pthread_t id;
+};
+
+struct fo_seg {             /* one per read buffer in the ring */
+    uint8_t * bp;
+    uint8_t * free_bp;
+    int blocks;
+    int64_t rel_blk;        /* from start of the copy */
+    int refs;               /* of2= outputs yet to write it */
+};
+
+static struct sg_prog prog;       /* progress= and progress_file= */
+
+enum bm_state {BM_BAD, BM_READ_LONG, BM_SKIPPED};
+
+struct bm_ent {             /* range of blocks in the bad block map */
+    int64_t lba;            /* of IFILE */
+    int64_t num;
+    enum bm_state state;
+};
+
+struct badmap_t {           /* for badmap=BMF */
+    const char * fn;        /* NULL if not given */
+    const char * inf;
+    struct bm_ent * arr;    /* in the order found, not necessarily lba */
+    int num;
+    int alloc;
+    int64_t bad;            /* blocks zero filled */
+    int64_t read_long;      /* blocks taken from READ LONG */
+};
+
+struct rescue_t {           /* for coe_skip=MAXBLKS */
+    int64_t max;            /* largest skip ahead, 0 -> off */
+    int64_t first;          /* skip ahead after a good read */
+    int64_t next;           /* skip ahead at the next read error */
+    int64_t pending;        /* blocks still to skip over */
+    int64_t skipped;        /* blocks skipped in the first pass */
+    int64_t unfilled;       /* of those, left unread by the back-fill */
+    bool filling;           /* in back-fill pass, skip no more */
+};
+
+static struct badmap_t bmap;
+static struct rescue_t resc;
+
+struct thin_ext {           /* from an LBA status descriptor */
+    int64_t lba;
+    int64_t num;
+    bool dealloc;           /* deallocated or anchored, reads as zeros */
+};
+
+struct thin_t {             /* for iflag=thin */
+    bool on;
+    bool no_ws;             /* OFILE refused WRITE SAME(16) with UNMAP */
+    int num;                /* extents held in ext[] */
+    int ws_max;             /* most blocks per WRITE SAME on OFILE */
+    int zero_blks;          /* size of 'zeros' in blocks */
+    uint8_t * resp;         /* GET LBA STATUS response */
+    uint8_t * zeros;
+    uint8_t * free_zeros;
+    struct thin_ext ext[THIN_NUM_DESC];
+};
+
+static struct thin_t thin;
+
+static struct fo_out fo_outs[MAX_OF2];
+static struct fo_seg fo_segs[FO_NUM_BUFS];
+static int fo_num = 0;
+static int64_t fo_posted = 0;   /* segments handed to writers so far */
+static bool fo_stop = false;    /* no more segments will be posted */
+static pthread_mutex_t fo_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fo_cv = PTHREAD_COND_INITIALIZER;
+
 static void calc_duration_throughput(bool contin);
 
 
@@ -194,6 +340,8 @@ install_handler(int sig_num, void (*sig_handler) (int sig))
 static void
 print_stats(const char * str)
 {
+    int k;
+
     if (0 != dd_count)
         pr2serr("  remaining block count=%" PRId64 "\n", dd_count);
     pr2serr("%s%" PRId64 "+%d records in\n", str, in_full - in_partial,
@@ -202,6 +350,28 @@ print_stats(const char * str)
             out_partial);
     if (oflag.sparse)
         pr2serr("%s%" PRId64 " bypassed records out\n", str, out_sparse_num);
+    if (iflag.thin)
+        pr2serr("%s%" PRId64 " deallocated blocks not read (iflag=thin)\n",
+                str, out_thin_num);
+    if (rlim.slept > 0.0)
+        pr2serr("%s%.2f secs waiting for rate=/iops= limits\n", str,
+                rlim.slept);
+    if (oflag.delta || delta_tbl)
+        pr2serr("%s%" PRId64 " unchanged blocks not written\n", str,
+                out_delta_num);
+    if ((resc.skipped > 0) && resc.filling && (0 == resc.unfilled))
+        pr2serr("%s%" PRId64 " blocks skipped over then back-filled "
+                "(coe_skip)\n", str, resc.skipped);
+    else if (resc.skipped > 0)
+        pr2serr("%s%" PRId64 " blocks skipped over, %" PRId64 " not "
+                "back-filled (coe_skip)\n", str, resc.skipped,
+                resc.filling ? resc.unfilled : resc.skipped);
+    if (bmap.fn && (bmap.bad + bmap.read_long > 0))
+        pr2serr("%s%" PRId64 " blocks zero filled, %" PRId64 " from READ "
+                "LONG (see %s)\n", str, bmap.bad, bmap.read_long, bmap.fn);
+    if (auto_adjusts > 0)
+        pr2serr("%s%d transfer size adjustments (bpt=auto)\n", str,
+                auto_adjusts);
     if (recovered_errs > 0)
         pr2serr("%s%d recovered errors\n", str, recovered_errs);
     if (num_retries > 0)
@@ -212,9 +382,23 @@ print_stats(const char * str)
                 str, read_longs);
     } else if (unrecovered_errs)
         pr2serr("%s%d unrecovered error(s)\n", str, unrecovered_errs);
+    for (k = 0; k < fo_num; ++k)
+        pr2serr("%s%" PRId64 " blocks written to of2=%s%s\n", str,
+                fo_outs[k].blks, fo_outs[k].fn,
+                (fo_outs[k].err ? " (failed)" : ""));
+    if (oflag.verify) {
+        pr2serr("%s%" PRId64 " blocks verified\n", str, verified_blks);
+        if (miscompares > 0)
+            pr2serr("%s%d miscompare(s), first at lba=%" PRId64 " [0x%"
+                    PRIx64 "]\n", str, miscompares, first_miscomp_lba,
+                    first_miscomp_lba);
+    }
 }
 
 
+/* Only notes the signal, the copy loop stops at the end of the current
+ * transfer and main() writes the checkpoint, bad block map and final
+ * progress line before raising it again. A second signal is fatal. */
 static void
 interrupt_handler(int sig)
 {
@@ -224,11 +408,7 @@ interrupt_handler(int sig)
     sigemptyset(&sigact.sa_mask);
     sigact.sa_flags = 0;
     sigaction(sig, &sigact, NULL);
-    pr2serr("Interrupted by signal,");
-    if (do_time)
-        calc_duration_throughput(false);
-    print_stats("");
-    kill(getpid (), sig);
+    interrupt_sig = sig;
 }
 
 
@@ -242,6 +422,13 @@ siginfo_handler(int sig)
     print_stats("  ");
 }
 
+static void
+rate_hup_handler(int sig)
+{
+    if (sig) { ; }      /* unused, dummy to suppress warning */
+    rlim.reread = 1;
+}
+
 static bool bsg_major_checked = false;
 static int bsg_major = 0;
 
@@ -292,6 +479,9 @@ dd_filetype(const char * filename)
 
     if ((1 == len) && ('.' == filename[0]))
         return FT_DEV_NULL;
+    if (0 == strncmp(filename, SG_LOOP_DEV_PREFIX,
+                     sizeof(SG_LOOP_DEV_PREFIX) - 1))
+        return FT_SG;       /* user space loopback */
     if (stat(filename, &st) < 0)
         return FT_ERROR;
     if (S_ISCHR(st.st_mode)) {
@@ -354,17 +544,34 @@ usage()
             "              [--help] [--version]\n\n"
             "              [blk_sgio=0|1] [bpt=BPT] [cdbsz=6|10|12|16] "
             "[coe=0|1|2|3]\n"
-            "              [coe_limit=CL] [dio=0|1] [odir=0|1] "
-            "[of2=OFILE2] [retries=RETR]\n"
-            "              [sync=0|1] [time=0|1] [verbose=VERB]\n"
+            "              [coe_limit=CL] [delta=DMF] [dio=0|1] "
+            "[manifest=MF]\n"
+            "              [mchunk=MC] [odir=0|1] [of2=OFILE2] "
+            "[retries=RETR] [sync=0|1]\n"
+            "              [time=0|1] [verbose=VERB] [ckpt=CF] "
+            "[ckpt_int=SECS]\n"
+            "              [ckpt_mb=MB] [iops=IOPS] [rate=MBPS] "
+            "[rate_file=RF]\n"
+            "              [progress=SECS] [progress_file=PF] "
+            "[resume=0|1]\n"
+            "              [badmap=BMF] [coe_skip=MAXBLKS]\n"
             "  where:\n"
+            "    badmap      write ranges of IFILE that could not be read "
+            "to BMF\n"
             "    blk_sgio    0->block device use normal I/O(def), 1->use "
             "SG_IO\n"
             "    bpt         is blocks_per_transfer (default is 128 or 32 "
             "when BS>=2048)\n"
+            "                or 'auto' to choose from Block Limits and "
+            "timed reads\n"
             "    bs          block size (default is 512)\n");
     pr2serr("    cdbsz       size of SCSI READ or WRITE cdb (default is "
             "10)\n"
+            "    ckpt        periodically record blocks copied in "
+            "checkpoint file CF\n"
+            "    ckpt_int    seconds between checkpoints (def: 30)\n"
+            "    ckpt_mb     also checkpoint after each MB MiB copied "
+            "(def: 0 -> off)\n"
             "    coe         0->exit on error (def), 1->continue on sg "
             "error (zero\n"
             "                fill), 2->also try read_long on unrecovered "
@@ -373,14 +580,24 @@ usage()
             "    coe_limit   limit consecutive 'bad' blocks on reads to CL "
             "times\n"
             "                when COE>1 (default: 0 which is no limit)\n"
+            "    coe_skip    with coe, skip ahead over read errors (doubling "
+            "up to\n"
+            "                MAXBLKS blocks) then back-fill after the copy "
+            "(def: 0)\n"
             "    count       number of blocks to copy (def: device size)\n"
+            "    delta       only write chunks whose CRC-32C differs from "
+            "manifest DMF\n"
             "    dio         for direct IO, 1->attempt, 0->indirect IO (def)\n"
             "    ibs         input block size (if given must be same as "
             "'bs=')\n"
             "    if          file or device to read from (def: stdin)\n"
             "    iflag       comma separated list from: [coe,dio,direct,"
             "dpo,dsync,excl,\n"
-            "                flock,fua,nocache,null,sgio]\n"
+            "                flock,fua,nocache,null,sgio,thin]\n"
+            "    iops        cap transfers (a read plus a write) per "
+            "second (def: 0)\n"
+            "    manifest    write CRC-32C of each chunk copied to file MF\n"
+            "    mchunk      blocks per manifest chunk (def: 2048)\n"
             "    obs         output block size (if given must be same as "
             "'bs=')\n"
             "    odir        1->use O_DIRECT when opening block dev, "
@@ -389,12 +606,30 @@ usage()
             "OFILE of '.'\n");
     pr2serr("                treated as /dev/null\n"
             "    of2         additional output file (def: /dev/null), "
-            "OFILE2 should be\n"
-            "                normal file or pipe\n"
+            "may be given up\n"
+            "                to 8 times; each is written by its own "
+            "thread from the\n"
+            "                same read buffers\n"
             "    oflag       comma separated list from: [append,coe,dio,"
             "direct,dpo,\n"
-            "                dsync,excl,flock,fua,nocache,null,sgio,"
-            "sparse]\n"
+            "                delta,dsync,excl,flock,fua,nocache,null,"
+            "sgio,sparse,\n"
+            "                verify]; 'delta' reads OFILE after IFILE, not "
+            "overlapped\n"
+            "    progress    write a JSON line describing progress every "
+            "SECS seconds\n"
+            "                (def: 0 -> off, 5 if PF given)\n"
+            "    progress_file    append progress lines to PF (def: "
+            "stderr), if PF\n"
+            "                     is a Unix socket connect and send them "
+            "there\n"
+            "    rate        cap copy rate at MBPS MB/s (def: 0 -> no "
+            "cap)\n"
+            "    rate_file   file holding 'rate=MBPS iops=IOPS', re-read "
+            "when it\n"
+            "                changes or on SIGHUP\n"
+            "    resume      1->continue copy from checkpoint in CF, "
+            "0->don't(def)\n"
             "    retries     retry sgio errors RETR times (def: 0)\n"
             "    seek        block position to start writing to OFILE\n"
             "    skip        block position to start reading from IFILE\n"
@@ -612,7 +847,8 @@ sg_read_low(int sg_fd, uint8_t * buff, int blocks, int64_t from_block,
             pr2serr("%02x ", rdCmd[k]);
         pr2serr("\n");
     }
-    while (((res = ioctl(sg_fd, SG_IO, &io_hdr)) < 0) &&
+    while (((res = (ifp->loop ? sg_loop_sg_io(sg_fd, &io_hdr) :
+                                ioctl(sg_fd, SG_IO, &io_hdr))) < 0) &&
            ((EINTR == errno) || (EAGAIN == errno)))
         ;
     if (res < 0) {
@@ -709,6 +945,101 @@ sg_read_low(int sg_fd, uint8_t * buff, int blocks, int64_t from_block,
 }
 
 
+/* Adds 'num' blocks of IFILE from 'lba' to the bad block map, merging
+ * with the previous range when it continues it. */
+static void
+badmap_add(int64_t lba, int64_t num, enum bm_state state)
+{
+    struct bm_ent * ep;
+
+    if (BM_BAD == state)
+        bmap.bad += num;
+    else if (BM_READ_LONG == state)
+        bmap.read_long += num;
+    if ((NULL == bmap.fn) && (0 == resc.max))
+        return;     /* coe_skip= needs the skipped ranges, even if no map */
+    if (bmap.num > 0) {
+        ep = bmap.arr + bmap.num - 1;
+        if ((ep->state == state) && ((ep->lba + ep->num) == lba)) {
+            ep->num += num;
+            return;
+        }
+    }
+    if (bmap.num >= bmap.alloc) {
+        int n = bmap.alloc ? (2 * bmap.alloc) : 64;
+
+        ep = (struct bm_ent *)realloc(bmap.arr, n * sizeof(*ep));
+        if (NULL == ep) {
+            pr2serr("badmap: out of memory, map will be incomplete\n");
+            return;
+        }
+        bmap.arr = ep;
+        bmap.alloc = n;
+    }
+    ep = bmap.arr + bmap.num++;
+    ep->lba = lba;
+    ep->num = num;
+    ep->state = state;
+}
+
+static int
+bm_cmp(const void * a, const void * b)
+{
+    const struct bm_ent * ap = (const struct bm_ent *)a;
+    const struct bm_ent * bp = (const struct bm_ent *)b;
+
+    if (ap->lba == bp->lba)
+        return 0;
+    return (ap->lba < bp->lba) ? -1 : 1;
+}
+
+/* Writes the bad block map: one range per line with its first lba (in
+ * hex), the number of blocks and what happened to them. Ranges still
+ * marked skipped were not back-filled (e.g. the copy was interrupted).
+ * Returns 0 on success, else SG_LIB_FILE_ERROR . */
+static int
+badmap_write(void)
+{
+    int k, j;
+    FILE * fp;
+    char ebuff[EBUFF_SZ];
+    static const char * bm_str[] = {"bad", "read_long", "skipped"};
+
+    if (bmap.num > 1) {
+        qsort(bmap.arr, bmap.num, sizeof(struct bm_ent), bm_cmp);
+        for (j = 0, k = 1; k < bmap.num; ++k) {
+            if ((bmap.arr[j].state == bmap.arr[k].state) &&
+                ((bmap.arr[j].lba + bmap.arr[j].num) == bmap.arr[k].lba))
+                bmap.arr[j].num += bmap.arr[k].num;
+            else
+                bmap.arr[++j] = bmap.arr[k];
+        }
+        bmap.num = j + 1;
+    }
+    if (NULL == (fp = fopen(bmap.fn, "w"))) {
+        snprintf(ebuff, EBUFF_SZ, ME "could not open %s for badmap",
+                 bmap.fn);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    fprintf(fp, "# sg3_utils bad block map from sg_dd %s\n", version_str);
+    fprintf(fp, "# if=%s\n", bmap.inf);
+    fprintf(fp, "# lba(hex) blocks state: bad -> zeros written, read_long "
+            "-> data from\n# READ LONG, skipped -> not read (zeros "
+            "written)\n");
+    fprintf(fp, "bs=%d\n", blk_sz);
+    for (k = 0; k < bmap.num; ++k)
+        fprintf(fp, "0x%" PRIx64 " %" PRId64 " %s\n",
+                (uint64_t)bmap.arr[k].lba, bmap.arr[k].num,
+                bm_str[bmap.arr[k].state]);
+    if (fclose(fp)) {
+        snprintf(ebuff, EBUFF_SZ, ME "writing badmap %s", bmap.fn);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    return 0;
+}
+
 /* 0 -> successful, SG_LIB_SYNTAX_ERROR -> unable to build cdb,
    SG_LIB_CAT_UNIT_ATTENTION -> try again, SG_LIB_CAT_NOT_READY,
    SG_LIB_CAT_MEDIUM_HARD, SG_LIB_CAT_ABORTED_COMMAND,
@@ -719,7 +1050,7 @@ sg_read(int sg_fd, uint8_t * buff, int blocks, int64_t from_block,
 {
     bool may_coe = false;
     bool repeat;
-    int res, blks, xferred;
+    int res, blks, xferred, n;
     int ret = 0;
     int retries_tmp;
     uint64_t io_addr;
@@ -729,6 +1060,17 @@ sg_read(int sg_fd, uint8_t * buff, int blocks, int64_t from_block,
     retries_tmp = ifp->retries;
     for (xferred = 0, blks = blocks, lba = from_block, bp = buff;
          blks > 0; blks = blocks - xferred) {
+        if (resc.pending > 0) {     /* coe_skip: still skipping ahead */
+            n = (resc.pending < blks) ? (int)resc.pending : blks;
+            memset(bp, 0, n * bs);
+            badmap_add(lba, n, BM_SKIPPED);
+            resc.pending -= n;
+            resc.skipped += n;
+            xferred += n;
+            bp += (n * bs);
+            lba += n;
+            continue;
+        }
         io_addr = 0;
         repeat = false;
         may_coe = false;
@@ -739,6 +1081,7 @@ sg_read(int sg_fd, uint8_t * buff, int blocks, int64_t from_block,
                 *blks_readp = xferred + blks;
             if (coe_limit > 0)
                 coe_count = 0;  /* good read clears coe_count */
+            resc.next = resc.first;
             return 0;
         case -2:        /* ENOMEM */
             return res;
@@ -865,10 +1208,21 @@ sg_read(int sg_fd, uint8_t * buff, int blocks, int64_t from_block,
         }
         bp += (blks * bs);
         lba += blks;
+        if ((resc.max > 0) && (! resc.filling)) {
+            /* leave the damaged area to the back-fill pass */
+            if (verbose)
+                pr2serr(">> read error at blk=%" PRId64 ", skipping %" PRId64
+                        " blocks\n", lba, resc.next);
+            resc.pending = resc.next;
+            resc.next = (2 * resc.next < resc.max) ? (2 * resc.next) :
+                                                      resc.max;
+            continue;
+        }
         if ((0 != ifp->pdt) || (ifp->coe < 2)) {
             pr2serr(">> unrecovered read error at blk=%" PRId64 ", pdt=%d, "
                     "use zeros\n", lba, ifp->pdt);
             memset(bp, 0, bs);
+            badmap_add(lba, 1, BM_BAD);
         } else if (io_addr < UINT_MAX) {
             bool corrct, ok;
             int offset, nl, r;
@@ -930,15 +1284,19 @@ sg_read(int sg_fd, uint8_t * buff, int blocks, int64_t from_block,
                 pr2serr(">> read_long(10): problem (%d)\n", res);
                 break;
             }
-            if (ok)
+            if (ok) {
                 memcpy(bp, buffp, bs);
-            else
+                badmap_add(lba, 1, BM_READ_LONG);
+            } else {
                 memset(bp, 0, bs);
+                badmap_add(lba, 1, BM_BAD);
+            }
             free(free_buffp);
         } else {
             pr2serr(">> read_long(10) cannot handle blk=%" PRId64 ", use "
                     "zeros\n", lba);
             memset(bp, 0, bs);
+            badmap_add(lba, 1, BM_BAD);
         }
         ++xferred;
         bp += bs;
@@ -959,6 +1317,17 @@ err_out:
         memset(bp, 0, bs * blks);
         pr2serr(">> unable to read at blk=%" PRId64 " for %d bytes, use "
                 "zeros\n", lba, bs * blks);
+        if (! may_coe)
+            ;
+        else if ((resc.max > 0) && (! resc.filling)) {
+            /* no lba in sense, back-fill these then skip on */
+            badmap_add(lba, blks, BM_SKIPPED);
+            resc.skipped += blks;
+            resc.pending = resc.next;
+            resc.next = (2 * resc.next < resc.max) ? (2 * resc.next) :
+                                                      resc.max;
+        } else
+            badmap_add(lba, blks, BM_BAD);
         if (blks > 1)
             pr2serr(">>   try reducing bpt to limit number of zeros written "
                     "near bad block(s)\n");
@@ -1017,7 +1386,8 @@ sg_write(int sg_fd, uint8_t * buff, int blocks, int64_t to_block,
             pr2serr("%02x ", wrCmd[k]);
         pr2serr("\n");
     }
-    while (((res = ioctl(sg_fd, SG_IO, &io_hdr)) < 0) &&
+    while (((res = (ofp->loop ? sg_loop_sg_io(sg_fd, &io_hdr) :
+                                ioctl(sg_fd, SG_IO, &io_hdr))) < 0) &&
            ((EINTR == errno) || (EAGAIN == errno)))
         ;
     if (res < 0) {
@@ -1073,6 +1443,160 @@ sg_write(int sg_fd, uint8_t * buff, int blocks, int64_t to_block,
     return 0;
 }
 
+/* Sends WRITE SAME(16) with the UNMAP bit set for 'num' blocks from 'lba'
+ * with a data-out block of zeros, so the range is deallocated if possible
+ * and otherwise written with zeros; either way it then reads as zeros.
+ * Returns 0 on success else an SG_LIB_CAT_* value (or -1). */
+static int
+sg_write_same_unmap(int sg_fd, int64_t lba, int num)
+{
+    int res, k;
+    uint8_t wsCmd[16];
+    uint8_t senseBuff[SENSE_BUFF_LEN];
+    struct sg_io_hdr io_hdr;
+
+    memset(wsCmd, 0, sizeof(wsCmd));
+    wsCmd[0] = WRITE_SAME16_CMD;
+    wsCmd[1] = 0x8;     /* UNMAP */
+    sg_put_unaligned_be64((uint64_t)lba, wsCmd + 2);
+    sg_put_unaligned_be32((uint32_t)num, wsCmd + 10);
+    memset(&io_hdr, 0, sizeof(struct sg_io_hdr));
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = sizeof(wsCmd);
+    io_hdr.cmdp = wsCmd;
+    io_hdr.dxfer_direction = SG_DXFER_TO_DEV;
+    io_hdr.dxfer_len = blk_sz;
+    io_hdr.dxferp = thin.zeros;
+    io_hdr.mx_sb_len = SENSE_BUFF_LEN;
+    io_hdr.sbp = senseBuff;
+    io_hdr.timeout = DEF_TIMEOUT;
+    io_hdr.pack_id = (int)lba;
+    if (verbose > 2) {
+        pr2serr("    write same cdb: ");
+        for (k = 0; k < (int)sizeof(wsCmd); ++k)
+            pr2serr("%02x ", wsCmd[k]);
+        pr2serr("\n");
+    }
+    while (((res = (oflag.loop ? sg_loop_sg_io(sg_fd, &io_hdr) :
+                                 ioctl(sg_fd, SG_IO, &io_hdr))) < 0) &&
+           ((EINTR == errno) || (EAGAIN == errno)))
+        ;
+    if (res < 0) {
+        perror("write same (SG_IO) on sg device, error");
+        return -1;
+    }
+    res = sg_err_category3(&io_hdr);
+    switch (res) {
+    case SG_LIB_CAT_CLEAN:
+    case SG_LIB_CAT_RECOVERED:
+        return 0;
+    case SG_LIB_CAT_INVALID_OP:
+    case SG_LIB_CAT_ILLEGAL_REQ:
+        if (verbose)
+            sg_chk_n_print3("write same", &io_hdr, verbose > 1);
+        return res;
+    default:
+        sg_chk_n_print3("write same", &io_hdr, verbose > 1);
+        return res;
+    }
+}
+
+/* Checks that the 'blocks' blocks just written to OFILE starting at
+ * 'to_block' hold the same data as 'bp'. For sg devices a VERIFY(16) with
+ * BYTCHK=1 is used so the comparison is done by the device; if that is
+ * not supported the blocks are read back and compared. Other output
+ * files are read back with pread(). Returns 0 if the same,
+ * SG_LIB_CAT_MISCOMPARE if they differ, else some other error. */
+static int
+verify_written(int outfd, int out_type, uint8_t * bp, int blocks,
+               int64_t to_block)
+{
+    int k, res, blks_read;
+    int num = blocks * blk_sz;
+    int64_t lba;
+    uint64_t info = 0;
+    struct flags_t vflag;
+
+    if ((FT_SG & out_type) && (! verify_by_read)) {
+        for (k = 0; k < 2; ++k) {   /* one retry for UA or aborted cmd */
+            res = sg_ll_verify16(outfd, 0, oflag.dpo, 1 /* bytchk */,
+                                 to_block, blocks, 0, bp, num, &info, false,
+                                 verbose);
+            if ((SG_LIB_CAT_UNIT_ATTENTION != res) &&
+                (SG_LIB_CAT_ABORTED_COMMAND != res))
+                break;
+            ++num_retries;
+        }
+        switch (res) {
+        case 0:
+            verified_blks += blocks;
+            return 0;
+        case SG_LIB_CAT_MISCOMPARE:
+            /* info field, if given, is byte offset of first miscompare */
+            lba = to_block;
+            if (info < (uint64_t)num)
+                lba += (int64_t)(info / blk_sz);
+            goto miscompare;
+        case SG_LIB_CAT_INVALID_OP:
+        case SG_LIB_CAT_ILLEGAL_REQ:
+            pr2serr(">> VERIFY(16) with BYTCHK=1 not supported on OFILE, "
+                    "will read back and compare\n");
+            verify_by_read = true;
+            break;
+        default:
+            pr2serr("VERIFY(16) failed, lba=%" PRId64 " [0x%" PRIx64 "]\n",
+                    to_block, to_block);
+            return res;
+        }
+    }
+    if (FT_SG & out_type) {
+        vflag = oflag;
+        vflag.coe = 0;      /* don't want zero fill in the read back */
+        res = sg_read(outfd, verify_buff, blocks, to_block, blk_sz, &vflag,
+                      NULL, &blks_read);
+        if (res) {
+            pr2serr("read back for verify failed, lba=%" PRId64 " [0x%"
+                    PRIx64 "]\n", to_block, to_block);
+            return res;
+        }
+        if (blks_read < blocks)
+            num = blks_read * blk_sz;
+    } else {
+        off64_t offset = to_block;
+
+        offset *= blk_sz;
+        while (((res = pread(outfd, verify_buff, num, offset)) < 0) &&
+               (EINTR == errno))
+            ;
+        if (res < 0) {
+            perror(ME "read back for verify");
+            return SG_LIB_FILE_ERROR;
+        }
+        if (verbose > 2)
+            pr2serr("read back(unix): count=%d, res=%d\n", num, res);
+        num = res;
+    }
+    for (k = 0; k < blocks; ++k) {
+        res = (num < blk_sz) ? num : blk_sz;
+        if ((res < blk_sz) || memcmp(bp + (k * blk_sz),
+                                     verify_buff + (k * blk_sz), res))
+            break;
+        num -= res;
+    }
+    if (k >= blocks) {
+        verified_blks += blocks;
+        return 0;
+    }
+    lba = to_block + k;
+miscompare:
+    ++miscompares;
+    if (first_miscomp_lba < 0)
+        first_miscomp_lba = lba;
+    pr2serr("verify: miscompare at lba=%" PRId64 " [0x%" PRIx64 "]\n", lba,
+            lba);
+    return SG_LIB_CAT_MISCOMPARE;
+}
+
 
 static void
 calc_duration_throughput(bool contin)
@@ -1103,6 +1627,601 @@ calc_duration_throughput(bool contin)
     }
 }
 
+static double
+elapsed_us(const struct timeval * t0)
+{
+    struct timeval t1;
+
+    gettimeofday(&t1, NULL);
+    return ((t1.tv_sec - t0->tv_sec) * 1000000.0) +
+           (t1.tv_usec - t0->tv_usec);
+}
+
+/* For bpt=auto: reads from the sg IFILE with transfer sizes doubling from
+ * AUTO_MIN_BPT up to 'max_bpt' blocks, about AUTO_CALIB_BYTES at each size,
+ * and times them. Each size reads a fresh part of [from_blk, from_blk +
+ * num_blks) so device caching does not flatter later sizes. Returns the
+ * smallest size within AUTO_KNEE_PCT of the best throughput (the knee of
+ * the curve) and the time per block at that size via *us_per_blkp. Returns
+ * 0 if calibration was not possible. */
+static int
+autotune_bpt(int infd, int64_t from_blk, int64_t num_blks, int max_bpt,
+             double * us_per_blkp)
+{
+    bool dio_tmp;
+    int k, n, bpt, blks_read, num_sz, knee;
+    int bpts[32];
+    double mbps[32], us[32];
+    double best = 0.0;
+    int64_t lba = from_blk;
+    uint8_t * bp;
+    uint8_t * free_bp;
+    struct flags_t cflag;
+    struct timeval t0;
+
+    bp = sg_memalign(max_bpt * blk_sz, 0, &free_bp, false);
+    if (NULL == bp)
+        return 0;
+    cflag = iflag;
+    cflag.coe = 0;
+    bpt = (AUTO_MIN_BPT < max_bpt) ? AUTO_MIN_BPT : max_bpt;
+    for (num_sz = 0; num_sz < 32; ) {
+        n = AUTO_CALIB_BYTES / (bpt * blk_sz);
+        if (n < 2)
+            n = 2;
+        if ((int64_t)n * bpt > num_blks)
+            break;      /* copy too short to calibrate at this size */
+        gettimeofday(&t0, NULL);
+        for (k = 0; k < n; ++k) {
+            if ((lba + bpt) > (from_blk + num_blks))
+                lba = from_blk;
+            dio_tmp = cflag.dio;
+            if (sg_read(infd, bp, bpt, lba, blk_sz, &cflag, &dio_tmp,
+                        &blks_read) || (blks_read < bpt))
+                break;
+            lba += bpt;
+        }
+        if (k < n)
+            break;      /* error or short read, stop ramp here */
+        us[num_sz] = elapsed_us(&t0) / ((double)n * bpt);
+        mbps[num_sz] = (us[num_sz] > 0.0) ? (blk_sz / us[num_sz]) : 0.0;
+        bpts[num_sz] = bpt;
+        if (verbose)
+            pr2serr("  bpt=auto: %d blocks per transfer: %.2f MB/sec\n",
+                    bpt, mbps[num_sz]);
+        if (mbps[num_sz] > best)
+            best = mbps[num_sz];
+        ++num_sz;
+        if (bpt >= max_bpt)
+            break;
+        bpt = ((2 * bpt) > max_bpt) ? max_bpt : (2 * bpt);
+    }
+    free(free_bp);
+    if (0 == num_sz)
+        return 0;
+    for (knee = 0; knee < num_sz; ++knee) {
+        if ((mbps[knee] * 100.0) >= (best * AUTO_KNEE_PCT))
+            break;
+    }
+    *us_per_blkp = us[knee];
+    return bpts[knee];
+}
+
+/* For bpt=auto: called after each full sized sg READ that took 'us'
+ * microseconds. Halves the transfer size when reads keep taking much longer
+ * than calibration predicted, and doubles it (up to 'max_bpt') again once
+ * they have been back on par for a while. */
+static void
+auto_readapt(double us, double us_per_blk, int * blocks_perp, int max_bpt)
+{
+    static int slow_count = 0;
+    static int fast_count = 0;
+
+    if (us > (AUTO_SLOW_FACTOR * us_per_blk * *blocks_perp)) {
+        fast_count = 0;
+        if ((++slow_count >= AUTO_SLOW_COUNT) &&
+            (*blocks_perp > AUTO_MIN_BPT)) {
+            *blocks_perp /= 2;
+            slow_count = 0;
+            ++auto_adjusts;
+            if (verbose)
+                pr2serr("bpt=auto: reads slowed, now %d blocks per "
+                        "transfer\n", *blocks_perp);
+        }
+    } else {
+        slow_count = 0;
+        if ((++fast_count >= AUTO_FAST_COUNT) && (*blocks_perp < max_bpt)) {
+            *blocks_perp *= 2;
+            if (*blocks_perp > max_bpt)
+                *blocks_perp = max_bpt;
+            fast_count = 0;
+            ++auto_adjusts;
+            if (verbose)
+                pr2serr("bpt=auto: reads recovered, now %d blocks per "
+                        "transfer\n", *blocks_perp);
+        }
+    }
+}
+
+/* Makes what has been written to 'fd' durable: SYNCHRONIZE CACHE for sg
+ * devices (unless 'fua' when it already is), fdatasync() for others that
+ * support it. Returns 0 on success, else SG_LIB_FILE_ERROR . */
+static int
+ckpt_flush(int fd, int type, bool fua, const char * fn)
+{
+    int res;
+    char ebuff[EBUFF_SZ];
+
+    if (FT_SG & type) {
+        if (fua)
+            return 0;
+        res = sg_ll_sync_cache_10(fd, false, false, 0, 0, 0, true, 0);
+        if (SG_LIB_CAT_UNIT_ATTENTION == res)
+            res = sg_ll_sync_cache_10(fd, false, false, 0, 0, 0, false, 0);
+        if (res) {
+            pr2serr("checkpoint: unable to synchronize cache on %s\n", fn);
+            return SG_LIB_FILE_ERROR;
+        }
+    } else if (((FT_OTHER | FT_BLOCK | FT_RAW) & type) &&
+               (fdatasync(fd) < 0)) {
+        snprintf(ebuff, EBUFF_SZ, ME "checkpoint: fdatasync on %s", fn);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    return 0;
+}
+
+/* Makes the blocks copied so far durable on OFILE and any OFILE2s, then
+ * atomically replaces the checkpoint file with one recording them. That
+ * is ckpt.done or less if an of2= writer thread lags behind. Blocks
+ * copied after that are copied again by resume=1. Returns 0 on success,
+ * else SG_LIB_FILE_ERROR . */
+static int
+ckpt_write(void)
+{
+    int k;
+    int64_t done = ckpt.done;
+    FILE * fp;
+    char tmp[INOUTF_SZ + 8];
+    char ebuff[EBUFF_SZ + (2 * INOUTF_SZ)];    /* room for both names */
+
+    pthread_mutex_lock(&fo_mutex);
+    for (k = 0; k < fo_num; ++k) {
+        if (fo_outs[k].blks < done)
+            done = fo_outs[k].blks;
+    }
+    pthread_mutex_unlock(&fo_mutex);
+    if (ckpt_flush(ckpt.outfd, ckpt.out_type, oflag.fua, ckpt.outf))
+        return SG_LIB_FILE_ERROR;
+    for (k = 0; k < fo_num; ++k) {
+        if (ckpt_flush(fo_outs[k].fd, fo_outs[k].type, fo_outs[k].flags.fua,
+                       fo_outs[k].fn))
+            return SG_LIB_FILE_ERROR;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ckpt.fn);
+    if (NULL == (fp = fopen(tmp, "w"))) {
+        snprintf(ebuff, sizeof(ebuff), ME "could not open %s for checkpoint",
+                 tmp);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    fprintf(fp, "# sg3_utils copy checkpoint from sg_dd %s\n", version_str);
+    fprintf(fp, "# if=%s\n# of=%s\n", ckpt.inf, ckpt.outf);
+    fprintf(fp, "bs=%d skip=%" PRId64 " seek=%" PRId64 " count=%" PRId64
+            " done=%" PRId64 "\n", blk_sz, ckpt.skip, ckpt.seek, ckpt.count,
+            done);
+    if (fflush(fp) || (fsync(fileno(fp)) < 0) || ferror(fp)) {
+        perror(ME "writing checkpoint");
+        fclose(fp);
+        return SG_LIB_FILE_ERROR;
+    }
+    fclose(fp);
+    if (rename(tmp, ckpt.fn) < 0) {
+        snprintf(ebuff, sizeof(ebuff), ME "could not rename %s to %s", tmp,
+                 ckpt.fn);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    ckpt.saved = done;
+    gettimeofday(&ckpt.tm, NULL);
+    if (verbose > 1)
+        pr2serr("checkpoint: %" PRId64 " blocks done\n", done);
+    return 0;
+}
+
+/* Called after each transfer, writes a checkpoint if ckpt.secs seconds
+ * have passed or ckpt.mb MiB have been copied since the last one. */
+static void
+ckpt_maybe(void)
+{
+    struct timeval now;
+
+    if (ckpt.done == ckpt.saved)
+        return;
+    if ((ckpt.mb > 0) &&
+        (((ckpt.done - ckpt.saved) * blk_sz) >= ((int64_t)ckpt.mb << 20))) {
+        ckpt_write();
+        return;
+    }
+    gettimeofday(&now, NULL);
+    if ((ckpt.secs > 0) && ((now.tv_sec - ckpt.tm.tv_sec) >= ckpt.secs))
+        ckpt_write();
+}
+
+/* For resume=1: reads the checkpoint file written by an earlier run with
+ * ckpt=CF and the same bs, skip, seek and count. Yields the number of
+ * blocks already copied via *donep (0 if there is no checkpoint file yet).
+ * Returns 0 on success, else SG_LIB_FILE_ERROR or SG_LIB_SYNTAX_ERROR . */
+static int
+ckpt_load(int64_t * donep)
+{
+    int bs = -1;
+    int lnum, n;
+    int64_t sk, se, cnt, done;
+    FILE * fp;
+    char line[INOUTF_SZ + 16];
+    char ebuff[EBUFF_SZ];
+
+    *donep = 0;
+    if (NULL == (fp = fopen(ckpt.fn, "r"))) {
+        if (ENOENT == errno) {
+            pr2serr("resume: no checkpoint %s, starting at the beginning\n",
+                    ckpt.fn);
+            return 0;
+        }
+        snprintf(ebuff, EBUFF_SZ, ME "could not open checkpoint %s",
+                 ckpt.fn);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    for (lnum = 1; fgets(line, sizeof(line), fp); ++lnum) {
+        n = strlen(line);
+        if ((n > 0) && ('\n' == line[n - 1]))
+            line[--n] = '\0';
+        if (0 == strncmp(line, "# if=", 5)) {
+            if (strcmp(line + 5, ckpt.inf))
+                pr2serr("resume: note, checkpoint was taken with if=%s\n",
+                        line + 5);
+            continue;
+        }
+        if (0 == strncmp(line, "# of=", 5)) {
+            if (strcmp(line + 5, ckpt.outf))
+                pr2serr("resume: note, checkpoint was taken with of=%s\n",
+                        line + 5);
+            continue;
+        }
+        if (('#' == line[0]) || ('\0' == line[0]))
+            continue;
+        if (5 != sscanf(line, "bs=%d skip=%" SCNd64 " seek=%" SCNd64
+                        " count=%" SCNd64 " done=%" SCNd64, &bs, &sk, &se,
+                        &cnt, &done)) {
+            pr2serr("checkpoint %s: unexpected line %d: %s\n", ckpt.fn,
+                    lnum, line);
+            fclose(fp);
+            return SG_LIB_SYNTAX_ERROR;
+        }
+    }
+    fclose(fp);
+    if (bs < 0) {
+        pr2serr("checkpoint %s: no bs= line\n", ckpt.fn);
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if ((bs != blk_sz) || (sk != ckpt.skip) || (se != ckpt.seek) ||
+        (cnt != ckpt.count) || (done < 0) || (done > cnt)) {
+        pr2serr("checkpoint %s is for another copy: bs=%d skip=%" PRId64
+                " seek=%" PRId64 " count=%" PRId64 "\n", ckpt.fn, bs, sk, se,
+                cnt);
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    *donep = done;
+    return 0;
+}
+
+/* Appends the error counts to each progress line */
+static int
+prog_extra(void * arg, char * b, int blen)
+{
+    if (arg) { ; }      /* unused, dummy to suppress warning */
+    return snprintf(b, blen, ",\"retries\":%d,\"recovered\":%d,"
+                    "\"unrecovered\":%d,\"read_longs\":%d", num_retries,
+                    recovered_errs, unrecovered_errs, read_longs);
+}
+
+/* Writes one segment to an of2= output: sg devices at the segment's block
+ * offset from the start of the copy, others sequentially with write(2).
+ * Returns 0 on success. */
+static int
+fo_write(struct fo_out * op, const struct fo_seg * sp)
+{
+    bool dio_tmp;
+    int res, k;
+    char ebuff[EBUFF_SZ];
+
+    if (FT_SG & op->type) {
+        for (k = 0; k < 2; ++k) {   /* one retry for UA or aborted cmd */
+            dio_tmp = op->flags.dio;
+            res = sg_write(op->fd, sp->bp, sp->blocks, sp->rel_blk, blk_sz,
+                           &op->flags, &dio_tmp);
+            if ((SG_LIB_CAT_UNIT_ATTENTION != res) &&
+                (SG_LIB_CAT_ABORTED_COMMAND != res))
+                break;
+        }
+        if (res)
+            pr2serr("sg_write to of2=%s failed,%s rel blk=%" PRId64 "\n",
+                    op->fn, ((-2 == res) ? " try reducing bpt," : ""),
+                    sp->rel_blk);
+        return res;
+    }
+    while (((res = write(op->fd, sp->bp, sp->blocks * blk_sz)) < 0) &&
+           ((EINTR == errno) || (EAGAIN == errno)))
+        ;
+    if (verbose > 2)
+        pr2serr("write to of2=%s: count=%d, res=%d\n", op->fn,
+                sp->blocks * blk_sz, res);
+    if (res < (sp->blocks * blk_sz)) {
+        if (res < 0) {
+            snprintf(ebuff, EBUFF_SZ, ME "writing to of2=%s, rel blk=%"
+                     PRId64 " ", op->fn, sp->rel_blk);
+            perror(ebuff);
+        } else
+            pr2serr("of2=%s probably full, rel blk=%" PRId64 "\n", op->fn,
+                    sp->rel_blk);
+        return -1;
+    }
+#ifdef HAVE_POSIX_FADVISE
+    if ((oflag.nocache & 2) && ((FT_OTHER | FT_BLOCK) & op->type))
+        posix_fadvise(op->fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    return 0;
+}
+
+/* Writer thread for one of2= output. Takes the posted segments in order
+ * and drops its reference on each buffer once written. After a failure
+ * it keeps dropping references (without writing) so the copy can stop
+ * cleanly rather than hang. */
+static void *
+fo_writer(void * v_op)
+{
+    struct fo_out * op = (struct fo_out *)v_op;
+    struct fo_seg * sp;
+    int res;
+
+    pthread_mutex_lock(&fo_mutex);
+    while (1) {
+        while ((op->next >= fo_posted) && (! fo_stop))
+            pthread_cond_wait(&fo_cv, &fo_mutex);
+        if (op->next >= fo_posted)
+            break;      /* stopped and all segments taken */
+        sp = &fo_segs[op->next % FO_NUM_BUFS];
+        pthread_mutex_unlock(&fo_mutex);
+        res = op->err ? 0 : fo_write(op, sp);
+        pthread_mutex_lock(&fo_mutex);
+        if (res)
+            op->err = true;
+        else if (! op->err)
+            op->blks = sp->rel_blk + sp->blocks;
+        --sp->refs;
+        ++op->next;
+        pthread_cond_broadcast(&fo_cv);
+    }
+    pthread_mutex_unlock(&fo_mutex);
+    return NULL;
+}
+
+/* Returns the read buffer for the next segment, waiting until all of2=
+ * writers have finished with its previous use. */
+static uint8_t *
+fo_next_buf(void)
+{
+    struct fo_seg * sp = &fo_segs[fo_posted % FO_NUM_BUFS];
+
+    pthread_mutex_lock(&fo_mutex);
+    while (sp->refs > 0)
+        pthread_cond_wait(&fo_cv, &fo_mutex);
+    pthread_mutex_unlock(&fo_mutex);
+    return sp->bp;
+}
+
+/* Hands the buffer returned by fo_next_buf(), now holding 'blocks' blocks
+ * at 'rel_blk' from the start of the copy, to every of2= writer. */
+static void
+fo_post(int blocks, int64_t rel_blk)
+{
+    struct fo_seg * sp = &fo_segs[fo_posted % FO_NUM_BUFS];
+
+    pthread_mutex_lock(&fo_mutex);
+    sp->blocks = blocks;
+    sp->rel_blk = rel_blk;
+    sp->refs = fo_num;
+    ++fo_posted;
+    pthread_cond_broadcast(&fo_cv);
+    pthread_mutex_unlock(&fo_mutex);
+}
+
+/* Returns true if writing to any of2= output has failed. */
+static bool
+fo_failed(void)
+{
+    int k;
+    bool failed = false;
+
+    pthread_mutex_lock(&fo_mutex);
+    for (k = 0; k < fo_num; ++k) {
+        if (fo_outs[k].err)
+            failed = true;
+    }
+    pthread_mutex_unlock(&fo_mutex);
+    return failed;
+}
+
+/* Lets the of2= writers drain what has been posted, then waits for them
+ * to exit. Returns 0 if all wrote everything, else SG_LIB_FILE_ERROR . */
+static int
+fo_finish(void)
+{
+    int k;
+    int ret = 0;
+
+    pthread_mutex_lock(&fo_mutex);
+    fo_stop = true;
+    pthread_cond_broadcast(&fo_cv);
+    pthread_mutex_unlock(&fo_mutex);
+    for (k = 0; k < fo_num; ++k) {
+        pthread_join(fo_outs[k].id, NULL);
+        if (fo_outs[k].err)
+            ret = SG_LIB_FILE_ERROR;
+    }
+    return ret;
+}
+
+/* Loads the chunk digests from manifest file 'mf' (as written by a prior
+ * manifest=MF) into delta_tbl. The manifest must be for the same bs, skip
+ * and seek as this copy. Returns 0 on success, else SG_LIB_FILE_ERROR or
+ * SG_LIB_SYNTAX_ERROR . */
+static int
+delta_load(const char * mf, int64_t skip, int64_t seek)
+{
+    int bs = 0;
+    int n, num, lnum;
+    int64_t off;
+    int64_t m_skip = -1;
+    int64_t m_seek = -1;
+    int64_t alloc_len = 0;
+    unsigned int crc;
+    FILE * fp;
+    struct delta_ent * dep;
+    char line[256];
+    char ebuff[EBUFF_SZ];
+
+    if (NULL == (fp = fopen(mf, "r"))) {
+        snprintf(ebuff, EBUFF_SZ, ME "could not open %s for delta", mf);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    for (lnum = 1; fgets(line, sizeof(line), fp); ++lnum) {
+        if (('#' == line[0]) || ('\n' == line[0]))
+            continue;
+        if (0 == strncmp(line, "bs=", 3)) {
+            if (4 != sscanf(line, "bs=%d mchunk=%d skip=%" SCNd64 " seek=%"
+                            SCNd64, &bs, &delta_chunk, &m_skip, &m_seek))
+                goto bad_line;
+            continue;
+        }
+        if (0 == strncmp(line, "total", 5))
+            break;
+        num = sscanf(line, "%" SCNd64 " %d %x", &off, &n, &crc);
+        if ((3 != num) || (delta_chunk < 1) || (n < 1) ||
+            (off != (delta_tbl_len * delta_chunk)))
+            goto bad_line;
+        if (delta_tbl_len >= alloc_len) {
+            alloc_len = alloc_len ? (2 * alloc_len) : 1024;
+            dep = (struct delta_ent *)realloc(delta_tbl, alloc_len *
+                                              sizeof(struct delta_ent));
+            if (NULL == dep) {
+                pr2serr("delta_load: out of memory\n");
+                fclose(fp);
+                return sg_convert_errno(ENOMEM);
+            }
+            delta_tbl = dep;
+        }
+        delta_tbl[delta_tbl_len].blks = n;
+        delta_tbl[delta_tbl_len].crc = crc;
+        ++delta_tbl_len;
+    }
+    fclose(fp);
+    if (bs != blk_sz) {
+        pr2serr("delta manifest %s has bs=%d, expected %d\n", mf, bs,
+                blk_sz);
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if ((m_skip != skip) || (m_seek != seek)) {
+        pr2serr("delta manifest %s is for skip=%" PRId64 " seek=%" PRId64
+                ", not skip=%" PRId64 " seek=%" PRId64 "\n", mf, m_skip,
+                m_seek, skip, seek);
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (verbose)
+        pr2serr("delta: %" PRId64 " chunks of %d blocks loaded from %s\n",
+                delta_tbl_len, delta_chunk, mf);
+    return 0;
+
+bad_line:
+    pr2serr("delta manifest %s: unexpected line %d: %s", mf, lnum, line);
+    fclose(fp);
+    return SG_LIB_SYNTAX_ERROR;
+}
+
+/* Returns true if the 'blocks' blocks at 'bp', which are at 'rel_blk'
+ * from the start of the copy, have the same digest as the corresponding
+ * chunk in the delta= manifest. */
+static bool
+delta_chunk_same(const uint8_t * bp, int blocks, int64_t rel_blk)
+{
+    int64_t k;
+
+    if (rel_blk % delta_chunk)
+        return false;
+    k = rel_blk / delta_chunk;
+    if ((k >= delta_tbl_len) || (blocks != delta_tbl[k].blks))
+        return false;
+    return delta_tbl[k].crc == sg_crc32c(0, bp, blocks * blk_sz);
+}
+
+/* Returns the blocks per transfer to fall back to after ENOMEM when the sg
+ * reserved buffer is 'buf_sz' bytes. With delta=DMF this is rounded down
+ * to whole manifest chunks so transfers stay aligned with delta_tbl; then
+ * returns 0 if not even one chunk fits. */
+static int
+enomem_blocks(int buf_sz)
+{
+    int n;
+
+    if (buf_sz < MIN_RESERVED_SIZE)
+        buf_sz = MIN_RESERVED_SIZE;
+    n = (buf_sz + blk_sz - 1) / blk_sz;
+    if (delta_tbl) {
+        n -= (n % delta_chunk);
+        if (0 == n)
+            pr2serr("reserved buffer (%d bytes) is smaller than a delta "
+                    "manifest chunk (%d blocks), use a smaller mchunk=\n",
+                    buf_sz, delta_chunk);
+    }
+    return n;
+}
+
+/* Returns true if the 'blocks' blocks at 'to_block' on OFILE already hold
+ * the contents of 'bp'. If OFILE can't be read (e.g. it is shorter) then
+ * returns false so those blocks get written. sg_dd does one command at a
+ * time, so this READ follows the one from IFILE rather than overlapping
+ * it; sgp_dd gets the overlap from its worker threads. */
+static bool
+ofile_same(int outfd, int out_type, const uint8_t * bp, int blocks,
+           int64_t to_block)
+{
+    int res, blks_read;
+    int num = blocks * blk_sz;
+    struct flags_t vflag;
+
+    if (FT_SG & out_type) {
+        vflag = oflag;
+        vflag.coe = 0;
+        res = sg_read(outfd, verify_buff, blocks, to_block, blk_sz, &vflag,
+                      NULL, &blks_read);
+        if (res || (blks_read < blocks))
+            return false;
+    } else {
+        off64_t offset = to_block;
+
+        offset *= blk_sz;
+        while (((res = pread(outfd, verify_buff, num, offset)) < 0) &&
+               (EINTR == errno))
+            ;
+        if (res < num)
+            return false;
+    }
+    return (0 == memcmp(bp, verify_buff, num));
+}
+
 /* Process arguments given to 'iflag=" or 'oflag=" options. Returns 0
  * on success, 1 on error. */
 static int
@@ -1127,6 +2246,8 @@ process_flags(const char * arg, struct flags_t * fp)
             fp->append = true;
         else if (0 == strcmp(cp, "coe"))
             ++fp->coe;
+        else if (0 == strcmp(cp, "delta"))
+            fp->delta = true;
         else if (0 == strcmp(cp, "dio"))
             fp->dio = true;
         else if (0 == strcmp(cp, "direct"))
@@ -1149,6 +2270,10 @@ process_flags(const char * arg, struct flags_t * fp)
             fp->sgio = true;
         else if (0 == strcmp(cp, "sparse"))
             fp->sparse = true;
+        else if (0 == strcmp(cp, "thin"))
+            fp->thin = true;
+        else if (0 == strcmp(cp, "verify"))
+            fp->verify = true;
         else {
             pr2serr("unrecognised flag: %s\n", cp);
             return 1;
@@ -1245,9 +2370,10 @@ open_if(const char * inf, int64_t skip, int bpt, struct flags_t * ifp,
         if (ifp->dsync)
             flags |= O_SYNC;
         fl = O_RDWR;
-        if ((infd = open(inf, fl | flags)) < 0) {
+        if ((infd = scsi_pt_open_flags(inf, fl | flags, 0)) < 0) {
             fl = O_RDONLY;
-            if ((infd = open(inf, fl | flags)) < 0) {
+            if ((infd = scsi_pt_open_flags(inf, fl | flags, 0)) < 0) {
+                errno = -infd;
                 snprintf(ebuff, EBUFF_SZ,
                          ME "could not open %s for sg reading", inf);
                 perror(ebuff);
@@ -1264,7 +2390,8 @@ open_if(const char * inf, int64_t skip, int bpt, struct flags_t * ifp,
         if (vb)
             pr2serr("    %s: %.8s  %.16s  %.4s  [pdt=%d]\n", inf, sir.vendor,
                     sir.product, sir.revision, ifp->pdt);
-        if (! (FT_BLOCK & *in_typep)) {
+        ifp->loop = sg_loop_fd(infd);
+        if (! ((FT_BLOCK & *in_typep) || ifp->loop)) {
             t = blk_sz * bpt;
             res = ioctl(infd, SG_SET_RESERVED_SIZE, &t);
             if (res < 0)
@@ -1370,7 +2497,8 @@ open_of(const char * outf, int64_t seek, int bpt, struct flags_t * ofp,
             flags |= O_EXCL;
         if (ofp->dsync)
             flags |= O_SYNC;
-        if ((outfd = open(outf, flags)) < 0) {
+        if ((outfd = scsi_pt_open_flags(outf, flags, 0)) < 0) {
+            errno = -outfd;
             snprintf(ebuff, EBUFF_SZ,
                      ME "could not open %s for sg writing", outf);
             perror(ebuff);
@@ -1386,7 +2514,8 @@ open_of(const char * outf, int64_t seek, int bpt, struct flags_t * ofp,
         if (vb)
             pr2serr("    %s: %.8s  %.16s  %.4s  [pdt=%d]\n", outf, sir.vendor,
                     sir.product, sir.revision, ofp->pdt);
-        if (! (FT_BLOCK & *out_typep)) {
+        ofp->loop = sg_loop_fd(outfd);
+        if (! ((FT_BLOCK & *out_typep) || ofp->loop)) {
             t = blk_sz * bpt;
             res = ioctl(outfd, SG_SET_RESERVED_SIZE, &t);
             if (res < 0)
@@ -1401,7 +2530,8 @@ open_of(const char * outf, int64_t seek, int bpt, struct flags_t * ofp,
         outfd = -1; /* don't bother opening */
     else {
         if (! (FT_RAW & *out_typep)) {
-            flags = O_WRONLY | O_CREAT;
+            flags = ((ofp->verify || ofp->delta) ? O_RDWR : O_WRONLY) |
+                    O_CREAT;
             if (ofp->direct)
                 flags |= O_DIRECT;
             if (ofp->excl)
@@ -1417,7 +2547,7 @@ open_of(const char * outf, int64_t seek, int bpt, struct flags_t * ofp,
                 goto file_err;
             }
         } else {
-            flags = O_WRONLY;
+            flags = (ofp->verify || ofp->delta) ? O_RDWR : O_WRONLY;
             if (ofp->direct)
                 flags |= O_DIRECT;
             if (ofp->excl)
@@ -1467,32 +2597,367 @@ other_err:
     return -SG_LIB_CAT_OTHER;
 }
 
+/* For iflag=thin: returns the number of blocks from 'lba' of IFILE that
+ * share its provisioning status, which is yielded via *deallocp. Extents
+ * are taken from GET LBA STATUS(16) which describes a stretch of IFILE
+ * from 'lba' on, so the command is only needed about once per
+ * THIN_NUM_DESC extents. Returns 0 (and turns iflag=thin off) if the
+ * device can not tell. */
+static int64_t
+thin_run(int fd, int64_t lba, bool * deallocp)
+{
+    int k, j, n, res, rlen, tries;
+    int len = 8 + (16 * THIN_NUM_DESC);
+    int64_t run;
+    const uint8_t * bp;
+    struct thin_ext * ep;
+
+    for (tries = 0; tries < 2; ++tries) {
+        for (k = 0; k < thin.num; ++k) {
+            ep = thin.ext + k;
+            if ((lba < ep->lba) || (lba >= (ep->lba + ep->num)))
+                continue;
+            *deallocp = ep->dealloc;
+            run = ep->lba + ep->num - lba;
+            for (j = k + 1; j < thin.num; ++j) {
+                if ((thin.ext[j].dealloc != ep->dealloc) ||
+                    (thin.ext[j].lba !=
+                     (thin.ext[j - 1].lba + thin.ext[j - 1].num)))
+                    break;
+                run += thin.ext[j].num;
+            }
+            return run;
+        }
+        if (tries)
+            break;
+        for (k = 0; k < 2; ++k) {   /* one retry for UA or aborted cmd */
+            res = sg_ll_get_lba_status16(fd, lba, 0, thin.resp, len, false,
+                                         (verbose > 1) ? (verbose - 2) : 0);
+            if ((SG_LIB_CAT_UNIT_ATTENTION != res) &&
+                (SG_LIB_CAT_ABORTED_COMMAND != res))
+                break;
+        }
+        if (res) {
+            pr2serr("iflag=thin: GET LBA STATUS failed at lba=0x%" PRIx64
+                    ", reading all blocks from here\n", (uint64_t)lba);
+            thin.on = false;
+            return 0;
+        }
+        rlen = (int)sg_get_unaligned_be32(thin.resp) + 4;
+        if (rlen > len)
+            rlen = len;
+        n = (rlen - 8) / 16;
+        thin.num = 0;
+        for (k = 0, bp = thin.resp + 8; k < n; ++k, bp += 16) {
+            ep = thin.ext + thin.num;
+            ep->lba = (int64_t)sg_get_unaligned_be64(bp + 0);
+            ep->num = sg_get_unaligned_be32(bp + 8);
+            /* 1: deallocated, 2: anchored */
+            ep->dealloc = ((1 == (bp[12] & 0xf)) || (2 == (bp[12] & 0xf)));
+            if (ep->num > 0)
+                ++thin.num;
+        }
+        if (verbose > 2)
+            pr2serr("iflag=thin: %d extents from lba=0x%" PRIx64 "\n",
+                    thin.num, (uint64_t)lba);
+    }
+    pr2serr("iflag=thin: no LBA status for lba=0x%" PRIx64 ", reading all "
+            "blocks from here\n", (uint64_t)lba);
+    thin.on = false;
+    return 0;
+}
+
+/* Writes 'blocks' blocks of zeros to OFILE at 'seek' (sg devices) or its
+ * current position (others). Returns 0 on success. */
+static int
+thin_zeros(int outfd, int out_type, int64_t seek, int64_t blocks)
+{
+    bool dio_tmp;
+    int n, res;
+    char ebuff[EBUFF_SZ];
+
+    for ( ; blocks > 0; blocks -= n, seek += n) {
+        n = (blocks > thin.zero_blks) ? thin.zero_blks : (int)blocks;
+        if (FT_SG & out_type) {
+            dio_tmp = false;
+            res = sg_write(outfd, thin.zeros, n, seek, blk_sz, &oflag,
+                           &dio_tmp);
+            if (res) {
+                pr2serr("sg_write of zeros failed, seek=%" PRId64 "\n",
+                        seek);
+                return res;
+            }
+            continue;
+        }
+        while (((res = write(outfd, thin.zeros, n * blk_sz)) < 0) &&
+               ((EINTR == errno) || (EAGAIN == errno)))
+            ;
+        if (res < (n * blk_sz)) {
+            snprintf(ebuff, EBUFF_SZ, ME "writing zeros, seek=%" PRId64
+                     " ", seek);
+            perror(ebuff);
+            return SG_LIB_FILE_ERROR;
+        }
+    }
+    return 0;
+}
+
+/* For iflag=thin: makes 'blocks' blocks of OFILE from 'seek' read as zeros
+ * without writing them where possible. sg devices get WRITE SAME(16) with
+ * UNMAP, block devices BLKZEROOUT and normal files a hole (punched if
+ * within the file, else skipped over); otherwise zeros are written. 'last'
+ * is set for the final segment of the copy so a normal file is extended
+ * to its full length. Returns 0 on success. */
+static int
+thin_hole(int outfd, int out_type, int64_t seek, int64_t blocks, bool last)
+{
+    int k, n, res;
+    off64_t off, len;
+    struct stat st;
+
+    if (FT_DEV_NULL & out_type)
+        return 0;
+    if (FT_SG & out_type) {
+        for ( ; blocks > 0; blocks -= n, seek += n) {
+            n = (blocks > thin.ws_max) ? thin.ws_max : (int)blocks;
+            if (! thin.no_ws) {
+                for (k = 0; k < 2; ++k) {
+                    res = sg_write_same_unmap(outfd, seek, n);
+                    if ((SG_LIB_CAT_UNIT_ATTENTION != res) &&
+                        (SG_LIB_CAT_ABORTED_COMMAND != res))
+                        break;
+                }
+                if (0 == res)
+                    continue;
+                if ((SG_LIB_CAT_INVALID_OP != res) &&
+                    (SG_LIB_CAT_ILLEGAL_REQ != res))
+                    return res;
+                pr2serr("iflag=thin: %s refused WRITE SAME(16) with UNMAP, "
+                        "writing zeros\n", "OFILE");
+                thin.no_ws = true;
+            }
+            res = thin_zeros(outfd, out_type, seek, n);
+            if (res)
+                return res;
+        }
+        return 0;
+    }
+    len = blocks * blk_sz;
+    off = lseek64(outfd, 0, SEEK_CUR);
+    if (off < 0)        /* e.g. a pipe */
+        return thin_zeros(outfd, out_type, seek, blocks);
+    if (FT_BLOCK & out_type) {
+#ifdef BLKZEROOUT
+        uint64_t range[2];
+
+        range[0] = off;
+        range[1] = len;
+        if (0 == ioctl(outfd, BLKZEROOUT, range)) {
+            if (lseek64(outfd, off + len, SEEK_SET) < 0) {
+                perror(ME "iflag=thin: lseek64 on output");
+                return SG_LIB_FILE_ERROR;
+            }
+            return 0;
+        }
+#endif
+        return thin_zeros(outfd, out_type, seek, blocks);
+    }
+    if (fstat(outfd, &st) < 0)
+        return thin_zeros(outfd, out_type, seek, blocks);
+    /* OFILE is not truncated, so old data within it must go */
+#ifdef FALLOC_FL_PUNCH_HOLE
+    if ((off < st.st_size) &&
+        (fallocate(outfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off,
+                   len) < 0))
+        return thin_zeros(outfd, out_type, seek, blocks);
+#else
+    if (off < st.st_size)
+        return thin_zeros(outfd, out_type, seek, blocks);
+#endif
+    if (lseek64(outfd, off + len, SEEK_SET) < 0) {
+        perror(ME "iflag=thin: lseek64 on output");
+        return SG_LIB_FILE_ERROR;
+    }
+    if (last && ((off + len) > st.st_size) &&
+        (ftruncate(outfd, off + len) < 0)) {
+        perror(ME "iflag=thin: ftruncate on output");
+        return SG_LIB_FILE_ERROR;
+    }
+    return 0;
+}
+
+/* For coe_skip=MAXBLKS: after the first pass, reads the ranges of IFILE
+ * that were skipped over, this time grinding through the bad blocks as
+ * coe=COE directs, and writes them to their place in OFILE. 'skip0' and
+ * 'seek0' are those of the start of the copy. Ranges not back-filled due
+ * to an error stay marked as skipped in the bad block map. Returns 0 on
+ * success. */
+static int
+coe_backfill(int infd, int outfd, int out_type, int64_t skip0,
+             int64_t seek0, uint8_t * bp, int bpt)
+{
+    bool dio_tmp;
+    int k, j, n, res, blks_read;
+    int num = 0;
+    int ret = 0;
+    int64_t lba, left, oblk;
+    struct bm_ent * todo;
+    char ebuff[EBUFF_SZ];
+
+    resc.filling = true;
+    resc.pending = 0;
+    if ((0 == resc.skipped) || (0 == bmap.num))
+        return 0;
+    todo = (struct bm_ent *)malloc(bmap.num * sizeof(struct bm_ent));
+    if (NULL == todo) {
+        pr2serr("coe_backfill: out of memory\n");
+        return sg_convert_errno(ENOMEM);
+    }
+    for (k = 0, j = 0; k < bmap.num; ++k) {
+        if (BM_SKIPPED == bmap.arr[k].state)
+            todo[num++] = bmap.arr[k];
+        else
+            bmap.arr[j++] = bmap.arr[k];
+    }
+    bmap.num = j;
+    pr2serr(">> coe_skip: back-filling %" PRId64 " blocks skipped over\n",
+            resc.skipped);
+    for (k = 0; k < num; ++k) {
+        lba = todo[k].lba;
+        left = todo[k].num;
+        while ((left > 0) && (0 == ret) && (0 == interrupt_sig)) {
+            n = (left > bpt) ? bpt : (int)left;
+            oblk = seek0 + (lba - skip0);
+            dio_tmp = iflag.dio;
+            res = sg_read(infd, bp, n, lba, blk_sz, &iflag, &dio_tmp,
+                          &blks_read);
+            if (res) {
+                pr2serr("back-fill read failed at lba=%" PRId64 " [0x%"
+                        PRIx64 "]\n", lba, (uint64_t)lba);
+                ret = res;
+                break;
+            }
+            if (FT_SG & out_type) {
+                dio_tmp = oflag.dio;
+                res = sg_write(outfd, bp, n, oblk, blk_sz, &oflag, &dio_tmp);
+                if (res) {
+                    pr2serr("back-fill write failed at lba=%" PRId64 " [0x%"
+                            PRIx64 "]\n", oblk, (uint64_t)oblk);
+                    ret = res;
+                    break;
+                }
+            } else if (! (FT_DEV_NULL & out_type)) {
+                if (lseek64(outfd, oblk * blk_sz, SEEK_SET) < 0) {
+                    perror(ME "back-fill: lseek64 on output");
+                    ret = SG_LIB_FILE_ERROR;
+                    break;
+                }
+                while (((res = write(outfd, bp, n * blk_sz)) < 0) &&
+                       ((EINTR == errno) || (EAGAIN == errno)))
+                    ;
+                if (res < (n * blk_sz)) {
+                    snprintf(ebuff, EBUFF_SZ, ME "back-fill: writing, seek=%"
+                             PRId64 " ", oblk);
+                    perror(ebuff);
+                    ret = SG_LIB_FILE_ERROR;
+                    break;
+                }
+            }
+            lba += n;
+            left -= n;
+        }
+        if (left > 0) {     /* error or interrupted */
+            badmap_add(lba, left, BM_SKIPPED);
+            resc.unfilled += left;
+        }
+    }
+    free(todo);
+    return ret;
+}
+
+/* Opens each of2= output, allocates the shared read buffers and starts a
+ * writer thread per output. sg devices are opened like OFILE (with the
+ * oflag= flags), anything else as before: created if need be and written
+ * from its start. Returns 0 on success. */
+static int
+fo_start(int bpt)
+{
+    int k, status;
+    struct fo_out * op;
+    char ebuff[EBUFF_SZ];
+
+    for (k = 0; k < fo_num; ++k) {
+        op = fo_outs + k;
+        op->flags = oflag;
+        op->type = dd_filetype(op->fn);
+        if ((FT_SG & op->type) ||
+            ((FT_BLOCK & op->type) && op->flags.sgio)) {
+            op->fd = open_of(op->fn, 0, bpt, &op->flags, &op->type, verbose);
+            if (op->fd < 0)
+                return -op->fd;
+        } else if ((op->fd = open(op->fn, O_WRONLY | O_CREAT, 0666)) < 0) {
+            snprintf(ebuff, EBUFF_SZ, ME "could not open %s for writing",
+                     op->fn);
+            perror(ebuff);
+            return SG_LIB_FILE_ERROR;
+        }
+    }
+    for (k = 0; k < FO_NUM_BUFS; ++k) {
+        fo_segs[k].bp = sg_memalign(blk_sz * bpt, 0, &fo_segs[k].free_bp,
+                                    verbose > 3);
+        if (NULL == fo_segs[k].bp) {
+            pr2serr("fo_start: out of memory\n");
+            return sg_convert_errno(ENOMEM);
+        }
+    }
+    for (k = 0; k < fo_num; ++k) {
+        status = pthread_create(&fo_outs[k].id, NULL, fo_writer,
+                                (void *)(fo_outs + k));
+        if (status) {
+            pr2serr("pthread_create for of2=%s: %s\n", fo_outs[k].fn,
+                    safe_strerror(status));
+            return SG_LIB_CAT_OTHER;
+        }
+    }
+    return 0;
+}
+
 
 int
 main(int argc, char * argv[])
 {
+    bool bpt_auto = false;
     bool bpt_given = false;
     bool cdbsz_given = false;
     bool dio_tmp, first;
     bool do_sync = false;
+    bool do_resume = false;
+    bool delta_skip = false;
     bool penult_sparse_skip = false;
     bool sparse_skip = false;
-    int res, k, t, buf_sz, blocks_per, infd, outfd, out2fd;
-    int retries_tmp, blks_read, bytes_read, bytes_of2, bytes_of;
+    bool thin_skip = false;
+    bool dealloc = false;
+    int64_t run;
+    int res, k, t, buf_sz, blocks_per, infd, outfd;
+    int retries_tmp, blks_read, bytes_read, bytes_of;
     int in_sect_sz, out_sect_sz;
     int blocks = 0;
     int bpt = DEF_BLOCKS_PER_TRANSFER;
     int dio_incomplete_count = 0;
     int ibs = 0;
     int in_type = FT_OTHER;
+    int mchunk = DEF_MANIFEST_CHUNK;
     int obs = 0;
     int out_type = FT_OTHER;
-    int out2_type = FT_OTHER;
     int penult_blocks = 0;
     int ret = 0;
+    double auto_us_per_blk = 0.0;
+    struct timeval io_tm;
+    struct timeval xfer_tm;
+    int64_t skip0, seek0;
     int64_t skip = 0;
     int64_t seek = 0;
-    int64_t out2_off = 0;
+    int64_t rel_blk = 0;
     int64_t in_num_sect = -1;
     int64_t out_num_sect = -1;
     char * key;
@@ -1501,13 +2966,25 @@ main(int argc, char * argv[])
     uint8_t * wrkPos;
     char inf[INOUTF_SZ];
     char outf[INOUTF_SZ];
-    char out2f[INOUTF_SZ];
+    char out2f[MAX_OF2][INOUTF_SZ];
+    char mf[INOUTF_SZ];
+    char dmf[INOUTF_SZ];
+    char ckf[INOUTF_SZ];
+    char rf[INOUTF_SZ];
+    char pf[INOUTF_SZ];
+    char bmf[INOUTF_SZ];
     char str[STR_SZ];
     char ebuff[EBUFF_SZ];
 
     inf[0] = '\0';
     outf[0] = '\0';
-    out2f[0] = '\0';
+    mf[0] = '\0';
+    dmf[0] = '\0';
+    ckf[0] = '\0';
+    rf[0] = '\0';
+    pf[0] = '\0';
+    bmf[0] = '\0';
+    ckpt.secs = DEF_CKPT_SECS;
     iflag.cdbsz = DEF_SCSI_CDBSZ;
     oflag.cdbsz = DEF_SCSI_CDBSZ;
     if (argc < 2) {
@@ -1532,7 +3009,18 @@ main(int argc, char * argv[])
         } else if (0 == strcmp(key, "blk_sgio")) {
             iflag.sgio = !! sg_get_num(buf);
             oflag.sgio = iflag.sgio;
+        } else if (0 == strcmp(key, "badmap")) {
+            if ('\0' != bmf[0]) {
+                pr2serr("Second badmap argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(bmf, sizeof(bmf), "%s", buf);
+            bmap.fn = bmf;
         } else if (0 == strcmp(key, "bpt")) {
+            if (0 == strcmp(buf, "auto")) {
+                bpt_auto = true;
+                continue;
+            }
             bpt = sg_get_num(buf);
             if (-1 == bpt) {
                 pr2serr(ME "bad argument to 'bpt='\n");
@@ -1549,6 +3037,24 @@ main(int argc, char * argv[])
             iflag.cdbsz = sg_get_num(buf);
             oflag.cdbsz = iflag.cdbsz;
             cdbsz_given = true;
+        } else if (0 == strcmp(key, "ckpt")) {
+            if ('\0' != ckf[0]) {
+                pr2serr("Second checkpoint argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(ckf, sizeof(ckf), "%s", buf);
+        } else if (0 == strcmp(key, "ckpt_int")) {
+            ckpt.secs = sg_get_num(buf);
+            if (ckpt.secs < 0) {
+                pr2serr(ME "bad argument to 'ckpt_int='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key, "ckpt_mb")) {
+            ckpt.mb = sg_get_num(buf);
+            if (ckpt.mb < 0) {
+                pr2serr(ME "bad argument to 'ckpt_mb='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
         } else if (0 == strcmp(key, "coe")) {
             iflag.coe = sg_get_num(buf);
             oflag.coe = iflag.coe;
@@ -1558,6 +3064,12 @@ main(int argc, char * argv[])
                 pr2serr(ME "bad argument to 'coe_limit='\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
+        } else if (0 == strcmp(key, "coe_skip")) {
+            resc.max = sg_get_llnum(buf);
+            if (resc.max < 0) {
+                pr2serr(ME "bad argument to 'coe_skip='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
         } else if (0 == strcmp(key, "conv")) {
             if (process_conv(buf, &iflag, &oflag)) {
                 pr2serr(ME "bad argument to 'conv='\n");
@@ -1571,6 +3083,12 @@ main(int argc, char * argv[])
                     return SG_LIB_SYNTAX_ERROR;
                 }
             }   /* treat 'count=-1' as calculate count (same as not given) */
+        } else if (0 == strcmp(key, "delta")) {
+            if ('\0' != dmf[0]) {
+                pr2serr("Second delta manifest argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(dmf, sizeof(dmf), "%s", buf);
         } else if (0 == strcmp(key, "dio")) {
             oflag.dio = !! sg_get_num(buf);
             iflag.dio = oflag.dio;
@@ -1578,6 +3096,18 @@ main(int argc, char * argv[])
             t = sg_get_num(buf);
             oflag.fua = !! (t & 1);
             iflag.fua = !! (t & 2);
+        } else if (0 == strcmp(key, "manifest")) {
+            if ('\0' != mf[0]) {
+                pr2serr("Second manifest argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(mf, sizeof(mf), "%s", buf);
+        } else if (0 == strcmp(key, "mchunk")) {
+            mchunk = sg_get_num(buf);
+            if (mchunk < 1) {
+                pr2serr(ME "bad argument to 'mchunk='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
         } else if (0 == strcmp(key, "ibs"))
             ibs = sg_get_num(buf);
         else if (strcmp(key, "if") == 0) {
@@ -1591,6 +3121,13 @@ main(int argc, char * argv[])
                 pr2serr(ME "bad argument to 'iflag='\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
+        } else if (0 == strcmp(key, "iops")) {
+            rlim.iops = sg_get_num(buf);
+            if (rlim.iops < 0) {
+                pr2serr(ME "bad argument to 'iops='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            rlim.on = true;
         } else if (0 == strcmp(key, "obs"))
             obs = sg_get_num(buf);
         else if (0 == strcmp(key, "odir")) {
@@ -1603,16 +3140,31 @@ main(int argc, char * argv[])
             } else
                 strncpy(outf, buf, INOUTF_SZ);
         } else if (strcmp(key, "of2") == 0) {
-            if ('\0' != out2f[0]) {
-                pr2serr("Second OFILE2 argument??\n");
+            if (fo_num >= MAX_OF2) {
+                pr2serr("Too many OFILE2 arguments, max is %d\n", MAX_OF2);
                 return SG_LIB_SYNTAX_ERROR;
-            } else
-                strncpy(out2f, buf, INOUTF_SZ);
+            }
+            snprintf(out2f[fo_num], INOUTF_SZ, "%s", buf);
+            fo_outs[fo_num].fn = out2f[fo_num];
+            ++fo_num;
         } else if (0 == strcmp(key, "oflag")) {
             if (process_flags(buf, &oflag)) {
                 pr2serr(ME "bad argument to 'oflag='\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
+        } else if (0 == strcmp(key, "progress")) {
+            prog.secs = sg_get_num(buf);
+            if (prog.secs < 0) {
+                pr2serr(ME "bad argument to 'progress='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key, "progress_file")) {
+            if ('\0' != pf[0]) {
+                pr2serr("Second progress_file argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(pf, sizeof(pf), "%s", buf);
+            prog.fn = pf;
         } else if (0 == strcmp(key, "retries")) {
             iflag.retries = sg_get_num(buf);
             oflag.retries = iflag.retries;
@@ -1620,7 +3172,24 @@ main(int argc, char * argv[])
                 pr2serr(ME "bad argument to 'retries='\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
-        } else if (0 == strcmp(key, "seek")) {
+        } else if (0 == strcmp(key, "rate")) {
+            rlim.mbps = sg_get_num(buf);
+            if (rlim.mbps < 0) {
+                pr2serr(ME "bad argument to 'rate='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            rlim.on = true;
+        } else if (0 == strcmp(key, "rate_file")) {
+            if ('\0' != rf[0]) {
+                pr2serr("Second rate_file argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(rf, sizeof(rf), "%s", buf);
+            rlim.fn = rf;
+            rlim.on = true;
+        } else if (0 == strcmp(key, "resume"))
+            do_resume = !! sg_get_num(buf);
+        else if (0 == strcmp(key, "seek")) {
             seek = sg_get_llnum(buf);
             if (-1LL == seek) {
                 pr2serr(ME "bad argument to 'seek='\n");
@@ -1676,6 +3245,42 @@ main(int argc, char * argv[])
     }
     if (iflag.sparse)
         pr2serr("sparse flag ignored for iflag\n");
+    if (iflag.verify)
+        pr2serr("verify flag ignored for iflag\n");
+    if (oflag.verify && oflag.append) {
+        pr2serr("Can't use both append and verify flags\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if ((oflag.delta || dmf[0]) && oflag.append) {
+        pr2serr("Can't use append with a delta copy\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (iflag.delta)
+        pr2serr("delta flag ignored for iflag\n");
+    if (dmf[0]) {
+        if (oflag.delta) {
+            pr2serr("oflag=delta ignored since delta=MF given\n");
+            oflag.delta = false;
+        }
+        ret = delta_load(dmf, skip, seek);
+        if (ret)
+            return ret;
+        if (bpt_given && (bpt != delta_chunk))
+            pr2serr("bpt=%d changed to %d to match delta manifest\n", bpt,
+                    delta_chunk);
+        bpt = delta_chunk;      /* each transfer is one manifest chunk */
+        bpt_given = true;
+        if (bpt_auto) {
+            pr2serr("bpt=auto ignored since delta=DMF given\n");
+            bpt_auto = false;
+        }
+    }
+    if (bpt_auto) {     /* provisional, sizes sg reserved buffers */
+        bpt = AUTO_MAX_BYTES / blk_sz;
+        if (bpt < 1)
+            bpt = 1;
+        bpt_given = true;
+    }
 
     /* defaulting transfer size to 128*2048 for CD/DVDs is too large
        for the block layer in lk 2.6 and results in an EIO on the
@@ -1690,6 +3295,8 @@ main(int argc, char * argv[])
     install_handler(SIGQUIT, interrupt_handler);
     install_handler(SIGPIPE, interrupt_handler);
     install_handler(SIGUSR1, siginfo_handler);
+    if (rlim.fn)
+        install_handler(SIGHUP, rate_hup_handler);
 
     infd = STDIN_FILENO;
     outfd = STDOUT_FILENO;
@@ -1707,17 +3314,11 @@ main(int argc, char * argv[])
             return -outfd;
     }
 
-    if (out2f[0]) {
-        out2_type = dd_filetype(out2f);
-        if ((out2fd = open(out2f, O_WRONLY | O_CREAT, 0666)) < 0) {
-            res = errno;
-            snprintf(ebuff, EBUFF_SZ,
-                     ME "could not open %s for writing", out2f);
-            perror(ebuff);
-            return res;
-        }
-    } else
-        out2fd = -1;
+    if (fo_num > 0) {
+        ret = fo_start(bpt);
+        if (ret)
+            return ret;
+    }
 
     if ((STDIN_FILENO == infd) && (STDOUT_FILENO == outfd)) {
         pr2serr("Can't have both 'if' as stdin _and_ 'of' as stdout\n");
@@ -1730,6 +3331,71 @@ main(int argc, char * argv[])
             return SG_LIB_SYNTAX_ERROR;
         }
     }
+    if (oflag.verify) {
+        if ((STDOUT_FILENO == outfd) || (FT_FIFO & out_type)) {
+            pr2serr("oflag=verify needs output file that can be read "
+                    "back\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        if (FT_DEV_NULL & out_type)
+            oflag.verify = false;
+    }
+    if (oflag.delta || dmf[0]) {
+        if ((STDOUT_FILENO == outfd) || (FT_FIFO & out_type)) {
+            pr2serr("delta copy needs output file that can be read and "
+                    "seeked\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (prog.fn && (0 == prog.secs))
+        prog.secs = DEF_PROGRESS_SECS;
+    bmap.inf = inf;
+    if (iflag.thin) {
+        if (! (FT_SG & in_type)) {
+            pr2serr("iflag=thin needs IFILE to be a sg device\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        if ((fo_num > 0) || mf[0] || oflag.delta || dmf[0] ||
+            oflag.verify || (resc.max > 0)) {
+            pr2serr("iflag=thin can not be used with of2=, manifest=, "
+                    "delta=, oflag=verify or\ncoe_skip=\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        thin.on = true;
+    }
+    if (resc.max > 0) {
+        if (! ((FT_SG & in_type) && iflag.coe)) {
+            pr2serr("coe_skip= needs IFILE to be a sg device and coe=1 (or "
+                    "iflag=coe)\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        if ((STDOUT_FILENO == outfd) || (FT_FIFO & out_type) ||
+            oflag.append || (fo_num > 0) || mf[0] || ckf[0] ||
+            oflag.delta || dmf[0]) {
+            pr2serr("coe_skip= writes OFILE out of order so OFILE must be "
+                    "seekable and\nit can not be used with oflag=append, "
+                    "of2=, manifest=, delta= or ckpt=\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        resc.first = COE_SKIP_FIRST_BYTES / blk_sz;
+        if (resc.first < 1)
+            resc.first = 1;
+        if (resc.first > resc.max)
+            resc.first = resc.max;
+        resc.next = resc.first;
+    }
+    if (do_resume && ('\0' == ckf[0])) {
+        pr2serr("resume=1 needs ckpt=CF\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (ckf[0]) {
+        if ((STDIN_FILENO == infd) || (FT_FIFO & in_type) ||
+            (STDOUT_FILENO == outfd) || (FT_FIFO & out_type) ||
+            (FT_ST & (in_type | out_type))) {
+            pr2serr("ckpt= needs IFILE and OFILE that can be seeked\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+    }
 
     if ((dd_count < 0) || ((verbose > 0) && (0 == dd_count))) {
         in_num_sect = -1;
@@ -1822,6 +3488,82 @@ main(int argc, char * argv[])
         pr2serr("Couldn't calculate count, please give one\n");
         return SG_LIB_CAT_OTHER;
     }
+    if (ckf[0]) {
+        ckpt.inf = inf;
+        ckpt.outf = outf;
+        ckpt.outfd = outfd;
+        ckpt.out_type = out_type;
+        ckpt.skip = skip;
+        ckpt.seek = seek;
+        ckpt.count = dd_count;
+        ckpt.fn = ckf;
+        if (do_resume) {
+            ret = ckpt_load(&ckpt.done);
+            if (ret)
+                return ret;
+        }
+        if (ckpt.done > 0) {
+            if (mf[0]) {
+                pr2serr("manifest= can not cover a resumed copy, drop it or "
+                        "start again\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            for (k = 0; k < fo_num; ++k) {
+                fo_outs[k].blks = ckpt.done;
+                if (FT_SG & fo_outs[k].type)
+                    continue;   /* written at rel_blk, need not seek */
+                if ((FT_FIFO & fo_outs[k].type) ||
+                    (lseek64(fo_outs[k].fd, ckpt.done * blk_sz,
+                             SEEK_SET) < 0)) {
+                    pr2serr("resume: unable to position of2=%s\n",
+                            fo_outs[k].fn);
+                    return SG_LIB_FILE_ERROR;
+                }
+            }
+            skip += ckpt.done;
+            seek += ckpt.done;
+            dd_count -= ckpt.done;
+            rel_blk = ckpt.done;
+            pr2serr("resume: %" PRId64 " blocks already copied, continuing "
+                    "at skip=%" PRId64 " seek=%" PRId64 "\n", ckpt.done,
+                    skip, seek);
+            if ((! (FT_SG & in_type)) &&
+                (lseek64(infd, skip * blk_sz, SEEK_SET) < 0)) {
+                perror(ME "resume: lseek64 on input");
+                return SG_LIB_FILE_ERROR;
+            }
+            if ((! ((FT_SG | FT_DEV_NULL) & out_type)) &&
+                (lseek64(outfd, seek * blk_sz, SEEK_SET) < 0)) {
+                perror(ME "resume: lseek64 on output");
+                return SG_LIB_FILE_ERROR;
+            }
+        }
+        ckpt.saved = ckpt.done;
+        gettimeofday(&ckpt.tm, NULL);
+    }
+    if (bpt_auto) {
+        struct sg_simple_block_limits_resp bl;
+
+        /* bpt is still AUTO_MAX_BYTES / blk_sz here, trim to what the
+         * Block Limits VPD pages of sg IFILE and OFILE allow */
+        for (k = 0; k < 2; ++k) {
+            if ((! (FT_SG & (k ? out_type : in_type))) ||
+                sg_simple_block_limits((k ? outfd : infd), &bl, false,
+                                       (verbose > 1) ? (verbose - 2) : 0))
+                continue;
+            if ((bl.max_xfer_len > 0) && (bl.max_xfer_len < (uint32_t)bpt))
+                bpt = (int)bl.max_xfer_len;
+            if ((bl.opt_xfer_len > 0) && (bl.opt_xfer_len < (uint32_t)bpt))
+                bpt = (int)bl.opt_xfer_len;
+        }
+        if ((FT_SG & in_type) && (! iflag.coe)) {
+            k = autotune_bpt(infd, skip, dd_count, bpt, &auto_us_per_blk);
+            if (k > 0)
+                bpt = k;
+        }
+        pr2serr("bpt=auto: %d blocks per transfer%s\n", bpt,
+                ((auto_us_per_blk > 0.0) ? "" : " (not calibrated)"));
+    }
     if (! cdbsz_given) {
         if ((FT_SG & in_type) && (MAX_SCSI_CDBSZ != iflag.cdbsz) &&
             (((dd_count + skip) > UINT_MAX) || (bpt > USHRT_MAX))) {
@@ -1852,6 +3594,47 @@ main(int argc, char * argv[])
             return sg_convert_errno(ENOMEM);
         }
     }
+    if (thin.on) {
+        thin.zero_blks = bpt;
+        thin.zeros = sg_memalign(blk_sz * bpt, 0, &thin.free_zeros, false);
+        thin.resp = (uint8_t *)malloc(8 + (16 * THIN_NUM_DESC));
+        if ((NULL == thin.zeros) || (NULL == thin.resp)) {
+            pr2serr("iflag=thin: out of memory\n");
+            return sg_convert_errno(ENOMEM);
+        }
+        memset(thin.zeros, 0, blk_sz * bpt);
+        if (FT_SG & out_type) {
+            struct sg_simple_block_limits_resp bl;
+
+            run = sg_simple_block_limits(outfd, &bl, false,
+                                         (verbose > 1) ? (verbose - 2) : 0) ?
+                  0 : (int64_t)(bl.max_ws_len & INT64_MAX);
+            thin.ws_max = ((run > 0) && (run < THIN_MAX_HOLE)) ? (int)run :
+                          ((0 == run) ? THIN_DEF_WS_MAX : THIN_MAX_HOLE);
+            if (verbose)
+                pr2serr("iflag=thin: up to %d blocks per WRITE SAME\n",
+                        thin.ws_max);
+        }
+    }
+
+    if (mf[0]) {
+        snprintf(ebuff, EBUFF_SZ, "sg_dd %s", version_str);
+        if (sg_manifest_open(&mfest, mf, ebuff, blk_sz, mchunk, skip,
+                             seek)) {
+            snprintf(ebuff, EBUFF_SZ, ME "could not open %s for manifest",
+                     mf);
+            perror(ebuff);
+            return SG_LIB_FILE_ERROR;
+        }
+    }
+    if (oflag.verify || oflag.delta) {
+        verify_buff = sg_memalign(blk_sz * bpt, 0, &free_verify_buff,
+                                  verbose > 3);
+        if (NULL == verify_buff) {
+            pr2serr("verify_buff sg_memalign failed\n");
+            return sg_convert_errno(ENOMEM);
+        }
+    }
 
     blocks_per = bpt;
 #ifdef SG_DEBUG
@@ -1865,18 +3648,57 @@ main(int argc, char * argv[])
         start_tm_valid = true;
     }
     req_count = dd_count;
+    if (rlim.on)
+        sg_rate_start(&rlim);
+    if (prog.secs > 0) {
+        prog.name = "sg_dd";
+        prog.bs = blk_sz;
+        prog.base = rel_blk;
+        prog.total = rel_blk + dd_count;
+        prog.extra = prog_extra;
+        res = sg_prog_open(&prog);
+        if (res)
+            return res;
+    }
 
+    skip0 = skip;
+    seek0 = seek;
     /* <<< main loop that does the copy >>> */
-    while (dd_count > 0) {
+    while ((dd_count > 0) && (0 == interrupt_sig)) {
         bytes_read = 0;
         bytes_of = 0;
-        bytes_of2 = 0;
         penult_sparse_skip = sparse_skip;
         penult_blocks = penult_sparse_skip ? blocks : 0;
         sparse_skip = false;
+        delta_skip = false;
+        thin_skip = false;
         blocks = (dd_count > blocks_per) ? blocks_per : dd_count;
-        if (FT_SG & in_type) {
+        if (thin.on && ((run = thin_run(infd, skip, &dealloc)) > 0)) {
+            if (dealloc) {      /* no need to read it, it is all zeros */
+                thin_skip = true;
+                if (run > dd_count)
+                    run = dd_count;
+                blocks = (run > THIN_MAX_HOLE) ? THIN_MAX_HOLE : (int)run;
+            } else if (run < blocks)
+                blocks = (int)run;  /* stop at the next deallocated extent */
+        }
+        if (rlim.on && (! thin_skip))
+            sg_rate_wait(&rlim, blocks * blk_sz);
+        if (fo_num > 0) {
+            if (fo_failed()) {
+                ret = SG_LIB_FILE_ERROR;
+                break;
+            }
+            wrkPos = fo_next_buf();
+        }
+        if (prog.secs > 0)
+            gettimeofday(&xfer_tm, NULL);
+        if (thin_skip)
+            ;
+        else if (FT_SG & in_type) {
             dio_tmp = iflag.dio;
+            if (auto_us_per_blk > 0.0)
+                gettimeofday(&io_tm, NULL);
             res = sg_read(infd, wrkPos, blocks, skip, blk_sz, &iflag,
                           &dio_tmp, &blks_read);
             if (-2 == res) {     /* ENOMEM, find what's available+try that */
@@ -1885,10 +3707,9 @@ main(int argc, char * argv[])
                     ret = res;
                     break;
                 }
-                if (buf_sz < MIN_RESERVED_SIZE)
-                    buf_sz = MIN_RESERVED_SIZE;
-                blocks_per = (buf_sz + blk_sz - 1) / blk_sz;
-                if (blocks_per < blocks) {
+                k = enomem_blocks(buf_sz);
+                if ((k > 0) && (k < blocks)) {
+                    blocks_per = k;
                     blocks = blocks_per;
                     pr2serr("Reducing read to %d blocks per loop\n",
                             blocks_per);
@@ -1906,7 +3727,9 @@ main(int argc, char * argv[])
                 if (blks_read < blocks) {
                     dd_count = 0;   /* force exit after write */
                     blocks = blks_read;
-                }
+                } else if ((auto_us_per_blk > 0.0) && (blocks == blocks_per))
+                    auto_readapt(elapsed_us(&io_tm), auto_us_per_blk,
+                                 &blocks_per, bpt);
                 in_full += blocks;
                 if (iflag.dio && (! dio_tmp))
                     dio_incomplete_count++;
@@ -1939,25 +3762,17 @@ main(int argc, char * argv[])
         if (0 == blocks)
             break;      /* nothing read so leave loop */
 
-        if (out2f[0]) {
-            while (((res = write(out2fd, wrkPos, blocks * blk_sz)) < 0) &&
-                   ((EINTR == errno) || (EAGAIN == errno)))
-                ;
-            if (verbose > 2)
-                pr2serr("write to of2: count=%d, res=%d\n", blocks * blk_sz,
-                        res);
-            if (res < 0) {
-                snprintf(ebuff, EBUFF_SZ, ME "writing to of2, seek=%" PRId64
-                         " ", seek);
-                perror(ebuff);
-                ret = -1;
-                break;
-            }
-            bytes_of2 = res;
-            out2_off += res;
-        }
+        if ((mfest.fp || delta_tbl) && (bytes_read > 0) &&
+            (bytes_read < (blocks * blk_sz)))
+            /* zero tail of partial block so digest is repeatable */
+            memset(wrkPos + bytes_read, 0, (blocks * blk_sz) - bytes_read);
+        if (mfest.fp)
+            sg_manifest_add(&mfest, wrkPos, blocks);
 
-        if (oflag.sparse && (dd_count > blocks) &&
+        if (fo_num > 0)     /* of2= writers take it from here */
+            fo_post(blocks, rel_blk);
+
+        if (oflag.sparse && (dd_count > blocks) && (! thin_skip) &&
             (! (FT_DEV_NULL & out_type))) {
             if (NULL == zeros_buff) {
                 zeros_buff = sg_memalign(blocks * blk_sz, 0, &free_zeros_buff,
@@ -1971,12 +3786,34 @@ main(int argc, char * argv[])
             if (0 == memcmp(wrkPos, zeros_buff, blocks * blk_sz))
                 sparse_skip = true;
         }
-        if (sparse_skip) {
+        if ((! sparse_skip) && (! thin_skip) &&
+            (! (FT_DEV_NULL & out_type))) {
+            if (delta_tbl)
+                delta_skip = delta_chunk_same(wrkPos, blocks, rel_blk);
+            else if (oflag.delta)
+                delta_skip = ofile_same(outfd, out_type, wrkPos, blocks,
+                                        seek);
+        }
+        if (thin_skip) {
+            res = thin_hole(outfd, out_type, seek, blocks,
+                            (dd_count <= blocks));
+            if (res) {
+                pr2serr("iflag=thin: unable to zero OFILE at seek=%" PRId64
+                        " for %d blocks\n", seek, blocks);
+                ret = res;
+                break;
+            }
+            out_thin_num += blocks;
+        } else if (sparse_skip || delta_skip) {
             if (FT_SG & out_type) {
-                out_sparse_num += blocks;
+                if (delta_skip)
+                    out_delta_num += blocks;
+                else
+                    out_sparse_num += blocks;
                 if (verbose > 2)
-                    pr2serr("sparse bypassing sg_write: seek blk=%" PRId64
-                            ", offset blks=%d\n", seek, blocks);
+                    pr2serr("%s bypassing sg_write: seek blk=%" PRId64
+                            ", offset blks=%d\n",
+                            (delta_skip ? "delta" : "sparse"), seek, blocks);
             } else if (FT_DEV_NULL & out_type)
                 ;
             else {
@@ -1984,21 +3821,26 @@ main(int argc, char * argv[])
                 off64_t off_res;
 
                 if (verbose > 2)
-                    pr2serr("sparse bypassing write: seek=%" PRId64 ", rel "
-                            "offset=%" PRId64 "\n", (seek * blk_sz),
-                            (int64_t)offset);
+                    pr2serr("%s bypassing write: seek=%" PRId64 ", rel "
+                            "offset=%" PRId64 "\n",
+                            (delta_skip ? "delta" : "sparse"),
+                            (seek * blk_sz), (int64_t)offset);
                 off_res = lseek64(outfd, offset, SEEK_CUR);
                 if (off_res < 0) {
-                    pr2serr("sparse tried to bypass write: seek=%" PRId64
+                    pr2serr("%s tried to bypass write: seek=%" PRId64
                             ", rel offset=%" PRId64 " but ...\n",
+                            (delta_skip ? "delta" : "sparse"),
                             (seek * blk_sz), (int64_t)offset);
                     perror("lseek64 on output");
                     ret = SG_LIB_FILE_ERROR;
                     break;
                 } else if (verbose > 4)
-                    pr2serr("oflag=sparse lseek64 result=%" PRId64 "\n",
+                    pr2serr("bypass lseek64 result=%" PRId64 "\n",
                             (int64_t)off_res);
-                out_sparse_num += blocks;
+                if (delta_skip)
+                    out_delta_num += blocks;
+                else
+                    out_sparse_num += blocks;
             }
         } else if (FT_SG & out_type) {
             dio_tmp = oflag.dio;
@@ -2018,10 +3860,9 @@ main(int argc, char * argv[])
                         perror("RESERVED_SIZE ioctls failed");
                         break;
                     }
-                    if (buf_sz < MIN_RESERVED_SIZE)
-                        buf_sz = MIN_RESERVED_SIZE;
-                    blocks_per = (buf_sz + blk_sz - 1) / blk_sz;
-                    if (blocks_per < blocks) {
+                    k = enomem_blocks(buf_sz);
+                    if ((k > 0) && (k < blocks)) {
+                        blocks_per = k;
                         blocks = blocks_per;
                         pr2serr("Reducing write to %d blocks per loop\n",
                                 blocks);
@@ -2091,12 +3932,24 @@ main(int argc, char * argv[])
                 bytes_of = res;
             }
         }
+        if (oflag.verify && (! sparse_skip) && (! delta_skip) &&
+            (! thin_skip)) {
+            res = verify_written(outfd, out_type, wrkPos, blocks, seek);
+            if (SG_LIB_CAT_MISCOMPARE == res) {
+                if (! oflag.coe) {
+                    ret = res;
+                    break;
+                }
+            } else if (res) {
+                ret = res;
+                break;
+            }
+        }
 #ifdef HAVE_POSIX_FADVISE
         {
-            int rt, in_valid, out2_valid, out_valid;
+            int rt, in_valid, out_valid;
 
             in_valid = ((FT_OTHER == in_type) || (FT_BLOCK == in_type));
-            out2_valid = ((FT_OTHER == out2_type) || (FT_BLOCK == out2_type));
             out_valid = ((FT_OTHER == out_type) || (FT_BLOCK == out_type));
             if (iflag.nocache && (bytes_read > 0) && in_valid) {
                 rt = posix_fadvise(infd, 0, (skip * blk_sz) + bytes_read,
@@ -2108,12 +3961,6 @@ main(int argc, char * argv[])
                     pr2serr("posix_fadvise on read, skip=%" PRId64
                             " ,err=%d\n", skip, rt);
             }
-            if ((oflag.nocache & 2) && (bytes_of2 > 0) && out2_valid) {
-                rt = posix_fadvise(out2fd, 0, 0, POSIX_FADV_DONTNEED);
-                if (rt)
-                    pr2serr("posix_fadvise on of2, seek=%" PRId64
-                            " ,err=%d\n", seek, rt);
-            }
             if ((oflag.nocache & 1) && (bytes_of > 0) && out_valid) {
                 rt = posix_fadvise(outfd, 0, 0, POSIX_FADV_DONTNEED);
                 if (rt)
@@ -2126,6 +3973,13 @@ main(int argc, char * argv[])
             dd_count -= blocks;
         skip += blocks;
         seek += blocks;
+        rel_blk += blocks;
+        if (ckpt.fn) {
+            ckpt.done = rel_blk;
+            ckpt_maybe();
+        }
+        if (prog.secs > 0)
+            sg_prog_xfer(&prog, (int64_t)elapsed_us(&xfer_tm), rel_blk);
     } /* end of main loop that does the copy ... */
     if (ret && penult_sparse_skip && (penult_blocks > 0)) {
         /* if error and skipped last output due to sparse ... */
@@ -2147,10 +4001,27 @@ main(int argc, char * argv[])
         }
     }
 
+    if ((resc.max > 0) && (0 == ret) && (0 == dd_count)) {
+        res = coe_backfill(infd, outfd, out_type, skip0, seek0, wrkPos, bpt);
+        if (res)
+            ret = res;
+    }
+    if (fo_num > 0) {
+        res = fo_finish();
+        if (res && (0 == ret))
+            ret = res;
+    }
     if (do_time)
         calc_duration_throughput(false);
 
     if (do_sync) {
+        for (k = 0; k < fo_num; ++k) {
+            if ((FT_SG & fo_outs[k].type) &&
+                sg_ll_sync_cache_10(fo_outs[k].fd, false, false, 0, 0, 0,
+                                    true, 0))
+                pr2serr("Unable to synchronize cache on %s\n",
+                        fo_outs[k].fn);
+        }
         if (FT_SG & out_type) {
             pr2serr(">> Synchronizing cache on %s\n", outf);
             res = sg_ll_sync_cache_10(outfd, false, false, 0, 0, 0, true, 0);
@@ -2163,18 +4034,61 @@ main(int argc, char * argv[])
                 pr2serr("Unable to synchronize cache\n");
         }
     }
+    if (ckpt.fn && (ckpt.done > ckpt.saved)) {
+        res = ckpt_write();
+        if (res && (0 == ret))
+            ret = res;
+    }
+    if (bmap.fn) {
+        res = badmap_write();
+        if (res && (0 == ret))
+            ret = res;
+    }
+    if (prog.secs > 0)
+        sg_prog_close(&prog, rel_blk, (interrupt_sig ? "interrupted" :
+                      ((ret || (0 != dd_count)) ? "error" : "done")));
     free(wrkBuff);
+    if (bmap.arr)
+        free(bmap.arr);
+    if (thin.free_zeros)
+        free(thin.free_zeros);
+    if (thin.resp)
+        free(thin.resp);
+    for (k = 0; k < fo_num; ++k)
+        close(fo_outs[k].fd);
+    for (k = 0; k < FO_NUM_BUFS; ++k) {
+        if (fo_segs[k].free_bp)
+            free(fo_segs[k].free_bp);
+    }
     if (free_zeros_buff)
         free(free_zeros_buff);
+    if (free_verify_buff)
+        free(free_verify_buff);
+    if (delta_tbl)
+        free(delta_tbl);
     if (STDIN_FILENO != infd)
         close(infd);
     if (! ((STDOUT_FILENO == outfd) || (FT_DEV_NULL & out_type)))
         close(outfd);
-    if (0 != dd_count) {
+    if (interrupt_sig)
+        pr2serr("Interrupted by signal,");
+    else if (0 != dd_count) {
         pr2serr("Some error occurred,");
         if (0 == ret)
             ret = SG_LIB_CAT_OTHER;
     }
+    if ((miscompares > 0) && (0 == ret))
+        ret = SG_LIB_CAT_MISCOMPARE;
+    if (mfest.fp) {
+        res = sg_manifest_close(&mfest);
+        pr2serr("crc32c of %" PRId64 " blocks copied: 0x%08x\n",
+                mfest.chunk_start, mfest.total_crc);
+        if (res) {
+            perror(ME "writing manifest");
+            if (0 == ret)
+                ret = res;
+        }
+    }
     print_stats("");
     if (dio_incomplete_count) {
         int fd;
@@ -2193,5 +4107,7 @@ main(int argc, char * argv[])
     }
     if (sum_of_resids)
         pr2serr(">> Non-zero sum of residual counts=%d\n", sum_of_resids);
+    if (interrupt_sig)
+        kill(getpid(), interrupt_sig);  /* handler now SIG_DFL */
     return (ret >= 0) ? ret : SG_LIB_CAT_OTHER;
 }
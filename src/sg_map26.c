@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2005-2018 Douglas Gilbert.
+ * Copyright (c) 2005-2026 Douglas Gilbert.
  * All rights reserved.
  * Use of this source code is governed by a BSD-style
  * license that can be found in the BSD_LICENSE file.
@@ -11,6 +11,8 @@
  * This program maps a primary SCSI device node name to the corresponding
  * SCSI generic device node name (or vice versa). Targets linux
  * kernel 2.6, 3 and 4 series. Sysfs device names can also be mapped.
+ * With --all the whole sg <--> sd/sr/st/sch/osst <--> bsg table is built
+ * from one pass over sysfs, spread over several worker threads.
  */
 
 /* #define _XOPEN_SOURCE 500 */
@@ -32,6 +34,8 @@
 #include <getopt.h>
 #include <dirent.h>
 #include <libgen.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/sysmacros.h>      /* new location for major + minor */
@@ -45,7 +49,7 @@
 #endif
 #include "sg_lib.h"
 
-static const char * version_str = "1.15 20171019";
+static const char * version_str = "1.16 20261018";
 
 #define ME "sg_map26: "
 
@@ -63,6 +67,9 @@ static const char * version_str = "1.15 20171019";
 #define NAME_LEN_MAX 260
 #define D_NAME_LEN_MAX 516
 
+#define MAX_JOBS 256
+#define DEF_MAX_JOBS 16     /* when --jobs= not given: min(cpus, this) */
+
 #ifndef SCSI_CHANGER_MAJOR
 #define SCSI_CHANGER_MAJOR 86
 #endif
@@ -106,9 +113,11 @@ static const char * def_dev_dir = "/dev";
 
 
 static struct option long_options[] = {
+        {"all", no_argument, 0, 'a'},
         {"dev_dir", required_argument, 0, 'd'},
         {"given_is", required_argument, 0, 'g'},
         {"help", no_argument, 0, 'h'},
+        {"jobs", required_argument, 0, 'j'},
         {"result", required_argument, 0, 'r'},
         {"symlink", no_argument, 0, 's'},
         {"verbose", no_argument, 0, 'v'},
@@ -156,7 +165,11 @@ usage()
                 "[--result=0...3]\n"
                 "                [--symlink] [--verbose] [--version] "
                 "DEVICE\n"
+                "       sg_map26 --all [--dev_dir=DIR] [--jobs=J] "
+                "[--verbose]\n"
                 "  where:\n"
+                "    --all | -a        output mapping of every sg device, "
+                "one per line\n"
                 "    --dev_dir=DIR | -d DIR    search in DIR for "
                 "resulting special\n"
                 "                            (def: directory of DEVICE "
@@ -168,6 +181,9 @@ usage()
                 "                                   1->sysfs device, 'dev' or "
                 "parent\n"
                 "    --help | -h       print out usage message\n"
+                "    --jobs=J | -j J    number of worker threads used by "
+                "--all\n"
+                "                       (def: number of cpus, at most %d)\n"
                 "    --result=0...3 | -r 0...3    variety of file(s) to "
                 "find\n"
                 "                                 0->mapped block or char "
@@ -182,7 +198,7 @@ usage()
                 "    --verbose | -v    increase verbosity of output\n"
                 "    --version | -V    print version string and exit\n\n"
                 "Maps SCSI device node to corresponding generic node (and "
-                "vv)\n"
+                "vv)\n", DEF_MAX_JOBS
                 );
 }
 
@@ -1038,11 +1054,355 @@ map_sg(const char * device_name, const char * device_dir, int ma, int mi,
 }
 
 
+/* Bulk (--all) mapping. The scsi_generic class directory is read once to
+ * find every sg device, then worker threads take sg devices in turn and
+ * read what they need from sysfs with openat() relative to a directory
+ * file descriptor, so there is no chdir() (which is per process) and
+ * no path rebuilding. Results go into a table that is output, in sg
+ * number order, when all workers have finished. */
+
+struct bulk_item_t {
+        int sg_num;
+        int ma;                 /* of the sg device */
+        int mi;
+        int nt;                 /* NT_* of mapped device, if any */
+        char hctl[D_NAME_LEN_MAX];      /* from a readlink() of 'device' */
+        char mapped[NAME_LEN_MAX];
+        char bsg[NAME_LEN_MAX];
+};
+
+struct bulk_ctl_t {
+        int cls_fd;             /* /sys/class/scsi_generic */
+        int num;
+        int next;               /* next item to process, under lock */
+        int verbose;
+        struct bulk_item_t * items;
+        pthread_mutex_t lock;
+};
+
+/* Reads first line of sysfs attribute 'name' in directory dfd into value.
+ * Return 1 if found, else 0 */
+static int
+get_value_at(int dfd, const char * name, char * value, int max_value_len)
+{
+        int fd, n;
+        char * cp;
+
+        fd = openat(dfd, name, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return 0;
+        n = read(fd, value, max_value_len - 1);
+        close(fd);
+        if (n <= 0)
+                return 0;
+        value[n] = '\0';
+        cp = strchr(value, '\n');
+        if (cp)
+                *cp = '\0';
+        return 1;
+}
+
+/* Copies to name the first entry in sub-directory 'sub' of dfd that starts
+ * with 'prefix' and, if 'digit_end' is true, ends with a digit (e.g.
+ * 'st3' but not 'st3a'). Return 1 if found, else 0 */
+static int
+first_entry_at(int dfd, const char * sub, const char * prefix,
+               bool digit_end, char * name, int max_name_len)
+{
+        int fd, len;
+        int plen = strlen(prefix);
+        int found = 0;
+        DIR * dirp;
+        struct dirent * dp;
+
+        fd = openat(dfd, sub, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+                return 0;
+        if (NULL == (dirp = fdopendir(fd))) {
+                close(fd);
+                return 0;
+        }
+        while ((dp = readdir(dirp))) {
+                if ('.' == dp->d_name[0])
+                        continue;
+                if (strncmp(dp->d_name, prefix, plen))
+                        continue;
+                len = strlen(dp->d_name);
+                if (digit_end && (! isdigit(dp->d_name[len - 1])))
+                        continue;
+                snprintf(name, max_name_len, "%s", dp->d_name);
+                found = 1;
+                break;
+        }
+        closedir(dirp);         /* also closes fd */
+        return found;
+}
+
+/* One pass over the sysfs 'device' directory of a sg device. Handles the
+ * current layout (e.g. 'block/sda') and the older one in which the
+ * entries are symlinks named like 'block:sda'. */
+static void
+bulk_scan_device(int dev_fd, struct bulk_item_t * ip)
+{
+        int fd, len;
+        const char * cp;
+        DIR * dirp;
+        struct dirent * dp;
+
+        fd = openat(dev_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+                return;
+        if (NULL == (dirp = fdopendir(fd))) {
+                close(fd);
+                return;
+        }
+        while ((dp = readdir(dirp))) {
+                cp = dp->d_name;
+                if ('.' == cp[0])
+                        continue;
+                if (NT_NO_MATCH != ip->nt)
+                        ;       /* have mapping, only look for bsg */
+                else if (0 == strcmp("block", cp)) {
+                        if (first_entry_at(dev_fd, cp, "", false, ip->mapped,
+                                           NAME_LEN_MAX))
+                                ip->nt = strncmp(ip->mapped, "sr", 2) ?
+                                         NT_SD : NT_SR;
+                        continue;
+                } else if (0 == strncmp("block:", cp, 6)) {
+                        snprintf(ip->mapped, NAME_LEN_MAX, "%s", cp + 6);
+                        ip->nt = strncmp(ip->mapped, "sr", 2) ? NT_SD : NT_SR;
+                        continue;
+                } else if (0 == strcmp("scsi_tape", cp)) {
+                        if (first_entry_at(dev_fd, cp, "st", true, ip->mapped,
+                                           NAME_LEN_MAX))
+                                ip->nt = NT_ST;
+                        continue;
+                } else if (0 == strncmp("scsi_tape:st", cp, 12)) {
+                        len = strlen(cp);
+                        if (isdigit(cp[len - 1])) {
+                                snprintf(ip->mapped, NAME_LEN_MAX, "%s",
+                                         cp + 10);
+                                ip->nt = NT_ST;
+                        }
+                        continue;
+                } else if (0 == strcmp("scsi_changer", cp)) {
+                        if (first_entry_at(dev_fd, cp, "", false, ip->mapped,
+                                           NAME_LEN_MAX))
+                                ip->nt = NT_CH;
+                        continue;
+                } else if (0 == strncmp("scsi_changer:", cp, 13)) {
+                        snprintf(ip->mapped, NAME_LEN_MAX, "%s", cp + 13);
+                        ip->nt = NT_CH;
+                        continue;
+                } else if (0 == strcmp("onstream_tape", cp)) {
+                        if (first_entry_at(dev_fd, cp, "os", true, ip->mapped,
+                                           NAME_LEN_MAX))
+                                ip->nt = NT_OSST;
+                        continue;
+                } else if (0 == strncmp("onstream_tape:os", cp, 16)) {
+                        snprintf(ip->mapped, NAME_LEN_MAX, "%s", cp + 14);
+                        ip->nt = NT_OSST;
+                        continue;
+                }
+                if ('\0' != ip->bsg[0])
+                        ;
+                else if (0 == strcmp("bsg", cp))
+                        first_entry_at(dev_fd, cp, "", false, ip->bsg,
+                                       NAME_LEN_MAX);
+                else if (0 == strncmp("bsg:", cp, 4))
+                        snprintf(ip->bsg, NAME_LEN_MAX, "%s", cp + 4);
+        }
+        closedir(dirp);
+}
+
+static void
+bulk_map_one(const struct bulk_ctl_t * bcp, struct bulk_item_t * ip)
+{
+        int sg_fd, dev_fd, n;
+        char name[NAME_LEN_MAX];
+        char value[D_NAME_LEN_MAX];
+        char * cp;
+
+        snprintf(name, sizeof(name), "sg%d", ip->sg_num);
+        sg_fd = openat(bcp->cls_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (sg_fd < 0) {
+                if (bcp->verbose)
+                        pr2serr("openat(%s%s): %s\n", sys_sg_dir, name,
+                                ssafe_strerror(errno));
+                return;
+        }
+        if (get_value_at(sg_fd, "dev", value, sizeof(value)) &&
+            (2 != sscanf(value, "%d:%d", &ip->ma, &ip->mi)) &&
+            bcp->verbose)
+                pr2serr("%s: couldn't decode dev: %s\n", name, value);
+        /* 'device' is a symlink whose last component is <h:c:t:l> */
+        n = readlinkat(sg_fd, "device", value, sizeof(value) - 1);
+        if (n > 0) {
+                value[n] = '\0';
+                cp = strrchr(value, '/');
+                snprintf(ip->hctl, sizeof(ip->hctl), "%s",
+                         cp ? cp + 1 : value);
+        }
+        dev_fd = openat(sg_fd, "device", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(sg_fd);
+        if (dev_fd < 0) {
+                if (bcp->verbose > 1)
+                        pr2serr("%s: no sysfs device directory\n", name);
+                return;
+        }
+        bulk_scan_device(dev_fd, ip);
+        close(dev_fd);
+}
+
+static void *
+bulk_worker(void * v_bcp)
+{
+        int k;
+        struct bulk_ctl_t * bcp = (struct bulk_ctl_t *)v_bcp;
+
+        while (1) {
+                pthread_mutex_lock(&bcp->lock);
+                k = bcp->next++;
+                pthread_mutex_unlock(&bcp->lock);
+                if (k >= bcp->num)
+                        break;
+                bulk_map_one(bcp, bcp->items + k);
+        }
+        return NULL;
+}
+
+static int
+bulk_item_cmp(const void * a, const void * b)
+{
+        const struct bulk_item_t * lhs = (const struct bulk_item_t *)a;
+        const struct bulk_item_t * rhs = (const struct bulk_item_t *)b;
+
+        return (lhs->sg_num > rhs->sg_num) - (lhs->sg_num < rhs->sg_num);
+}
+
+/* Outputs one line per sg device: sg node, <h:c:t:l>, type and node of
+ * the mapped device then the bsg node. '-' when there is none. */
+static int
+map_all(const char * device_dir, int num_jobs, int verbose)
+{
+        int k, fd, n, res, num_thr;
+        int max_items = 0;
+        int ret = 0;
+        DIR * dirp;
+        struct dirent * dp;
+        struct bulk_item_t * ip;
+        struct timespec start_tm, end_tm;
+        struct bulk_ctl_t bc;
+        pthread_t tids[MAX_JOBS];
+        char b[D_NAME_LEN_MAX + NAME_LEN_MAX];  /* device_dir/mapped */
+
+        memset(&bc, 0, sizeof(bc));
+        bc.verbose = verbose;
+        clock_gettime(CLOCK_MONOTONIC, &start_tm);
+        bc.cls_fd = open(sys_sg_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (bc.cls_fd < 0) {
+                pr2serr("open(%s): %s\n", sys_sg_dir, ssafe_strerror(errno));
+                pr2serr("    perhaps sg module is not loaded\n");
+                return SG_LIB_FILE_ERROR;
+        }
+        fd = dup(bc.cls_fd);
+        if ((fd < 0) || (NULL == (dirp = fdopendir(fd)))) {
+                pr2serr("fdopendir(%s): %s\n", sys_sg_dir,
+                        ssafe_strerror(errno));
+                if (fd >= 0)
+                        close(fd);
+                close(bc.cls_fd);
+                return SG_LIB_FILE_ERROR;
+        }
+        while ((dp = readdir(dirp))) {
+                if (1 != sscanf(dp->d_name, "sg%d", &n))
+                        continue;
+                if (bc.num >= max_items) {
+                        max_items = max_items ? (2 * max_items) : 256;
+                        ip = (struct bulk_item_t *)realloc(bc.items,
+                                        max_items * sizeof(*ip));
+                        if (NULL == ip) {
+                                pr2serr("out of memory for %d sg devices\n",
+                                        max_items);
+                                ret = SG_LIB_OS_BASE_ERR + ENOMEM;
+                                goto fini;
+                        }
+                        bc.items = ip;
+                }
+                ip = bc.items + bc.num++;
+                memset(ip, 0, sizeof(*ip));
+                ip->sg_num = n;
+                ip->nt = NT_NO_MATCH;
+        }
+        if (0 == bc.num) {
+                if (verbose)
+                        pr2serr("no sg devices found in %s\n", sys_sg_dir);
+                goto fini;
+        }
+        qsort(bc.items, bc.num, sizeof(*bc.items), bulk_item_cmp);
+
+        num_thr = (num_jobs < bc.num) ? num_jobs : bc.num;
+        pthread_mutex_init(&bc.lock, NULL);
+        if (num_thr <= 1)
+                bulk_worker(&bc);
+        else {
+                for (k = 0; k < num_thr; ++k) {
+                        res = pthread_create(tids + k, NULL, bulk_worker,
+                                             &bc);
+                        if (res) {
+                                pr2serr("pthread_create: %s\n",
+                                        ssafe_strerror(res));
+                                break;
+                        }
+                }
+                if (0 == k)             /* no threads: do it ourselves */
+                        bulk_worker(&bc);
+                num_thr = k;
+                for (k = 0; k < num_thr; ++k)
+                        pthread_join(tids[k], NULL);
+        }
+        pthread_mutex_destroy(&bc.lock);
+
+        for (k = 0, ip = bc.items; k < bc.num; ++k, ++ip) {
+                snprintf(b, sizeof(b), "%s/sg%d", device_dir, ip->sg_num);
+                printf("%-14s %-12s ", b, ip->hctl[0] ? ip->hctl : "-");
+                if (NT_NO_MATCH == ip->nt)
+                        printf("%-12s %-14s ", "-", "-");
+                else {
+                        snprintf(b, sizeof(b), "%s/%s", device_dir,
+                                 ip->mapped);
+                        printf("%-12s %-14s ", nt_names[ip->nt], b);
+                }
+                if (ip->bsg[0])
+                        printf("%s/bsg/%s\n", device_dir, ip->bsg);
+                else
+                        printf("-\n");
+        }
+        if (verbose) {
+                double ms;
+
+                clock_gettime(CLOCK_MONOTONIC, &end_tm);
+                ms = (end_tm.tv_sec - start_tm.tv_sec) * 1000.0 +
+                     (end_tm.tv_nsec - start_tm.tv_nsec) / 1000000.0;
+                pr2serr("mapped %d sg devices in %.3f ms with %d worker "
+                        "thread%s\n", bc.num, ms, (num_thr > 1) ? num_thr : 1,
+                        (num_thr > 1) ? "s" : "");
+        }
+fini:
+        closedir(dirp);
+        close(bc.cls_fd);
+        free(bc.items);
+        return ret;
+}
+
+
 int
 main(int argc, char * argv[])
 {
         bool cont;
+        bool do_all = false;
         int c, num, tt, res;
+        int num_jobs = 0;
         int given_is = -1;
         int result = 0;
         int verbose = 0;
@@ -1059,12 +1419,15 @@ main(int argc, char * argv[])
         while (1) {
                 int option_index = 0;
 
-                c = getopt_long(argc, argv, "d:hg:r:svV", long_options,
+                c = getopt_long(argc, argv, "ad:hg:j:r:svV", long_options,
                                 &option_index);
                 if (c == -1)
                         break;
 
                 switch (c) {
+                case 'a':
+                        do_all = true;
+                        break;
                 case 'd':
                         strncpy(device_dir, optarg, sizeof(device_dir));
                         do_dev_dir = true;
@@ -1083,6 +1446,16 @@ main(int argc, char * argv[])
                 case '?':
                         usage();
                         return 0;
+                case 'j':
+                        num = sscanf(optarg, "%d", &res);
+                        if ((1 == num) && (res > 0) && (res <= MAX_JOBS))
+                                num_jobs = res;
+                        else {
+                                pr2serr("value for '--jobs=' must be 1.."
+                                        "%d\n", MAX_JOBS);
+                                return SG_LIB_SYNTAX_ERROR;
+                        }
+                        break;
                 case 'r':
                         num = sscanf(optarg, "%d", &res);
                         if ((1 == num) && (res >= 0) && (res < 4))
@@ -1124,6 +1497,23 @@ main(int argc, char * argv[])
                 }
         }
 
+        if (do_all) {
+                if (device_name[0]) {
+                        pr2serr("--all does not take a DEVICE\n");
+                        usage();
+                        return SG_LIB_SYNTAX_ERROR;
+                }
+                if (0 == num_jobs) {
+                        long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+                        num_jobs = (ncpus < 1) ? 1 :
+                                   ((ncpus > DEF_MAX_JOBS) ? DEF_MAX_JOBS :
+                                                             (int)ncpus);
+                }
+                if (! do_dev_dir)
+                        strcpy(device_dir, def_dev_dir);
+                return map_all(device_dir, num_jobs, verbose);
+        }
         if (0 == device_name[0]) {
                 pr2serr("missing device name!\n");
                 usage();
@@ -1,5 +1,5 @@
 /* A utility program originally written for the Linux OS SCSI subsystem.
- *  Copyright (C) 1999-2018 D. Gilbert
+ *  Copyright (C) 1999-2026 D. Gilbert
  *  This program is free software; you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
  *  the Free Software Foundation; either version 2, or (at your option)
@@ -7,7 +7,9 @@
  *
  * This program uses the SCSI command READ BUFFER on the given
  * device, first to find out how big it is and then to read that
- * buffer (data mode, buffer id 0).
+ * buffer (data mode, buffer id 0). With --sweep it measures the
+ * throughput over a range of buffer sizes, queue depths and transfer
+ * modes.
  */
 
 
@@ -25,6 +27,7 @@
 #include <string.h>
 #include <errno.h>
 #include <getopt.h>
+#include <poll.h>
 #define __STDC_FORMAT_MACROS 1
 #include <inttypes.h>
 #include <sys/ioctl.h>
@@ -32,6 +35,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -49,6 +53,7 @@
 #define RB_DEF_SIZE (200*1024*1024)
 #define RB_OPCODE 0x3C
 #define RB_CMD_LEN 10
+#define MAX_QD 16       /* the sg driver's SG_MAX_QUEUE, per file descriptor */
 
 /* #define SG_DEBUG */
 
@@ -57,7 +62,7 @@
 #endif
 
 
-static const char * version_str = "5.03 20180302";
+static const char * version_str = "5.04 20261018";
 
 static struct option long_options[] = {
         {"buffer", required_argument, 0, 'b'},
@@ -67,8 +72,10 @@ static struct option long_options[] = {
         {"mmap", no_argument, 0, 'm'},
         {"new", no_argument, 0, 'N'},
         {"old", no_argument, 0, 'O'},
+        {"qd", required_argument, 0, 'Q'},
         {"quick", no_argument, 0, 'q'},
         {"size", required_argument, 0, 's'},
+        {"sweep", no_argument, 0, 'S'},
         {"time", no_argument, 0, 't'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
@@ -80,12 +87,15 @@ struct opts_t {
     bool do_echo;
     bool do_mmap;
     bool do_quick;
+    bool do_sweep;
     bool do_time;
     bool do_version;
     bool opt_new;
     int do_buffer;
     int do_help;
     int do_verbose;
+    int num_qd;
+    int qds[MAX_QD];    /* queue depths for --sweep */
     int64_t do_size;
     const char * device_name;
 };
@@ -96,18 +106,27 @@ usage()
 {
     pr2serr("Usage: sg_rbuf [--buffer=EACH] [--dio] [--echo] "
             "[--help] [--mmap]\n"
-            "               [--quick] [--size=OVERALL] [--time] [--verbose] "
-            "[--version]\n"
-            "               SG_DEVICE\n");
+            "               [--qd=QDL] [--quick] [--size=OVERALL] [--sweep] "
+            "[--time]\n"
+            "               [--verbose] [--version] SG_DEVICE\n");
     pr2serr("  where:\n"
             "    --buffer=EACH|-b EACH    buffer size to use (in bytes)\n"
             "    --dio|-d        requests dio ('-q' overrides it)\n"
             "    --echo|-e       use echo buffer (def: use data mode)\n"
             "    --help|-h       print usage message then exit\n"
             "    --mmap|-m       requests mmap-ed IO (overrides -q, -d)\n"
+            "    --qd=QDL|-Q QDL    comma separated queue depths for "
+            "--sweep\n"
+            "                       (def: 1,2,4,8,16)\n"
             "    --quick|-q      quick, don't xfer to user space\n");
     pr2serr("    --size=OVERALL|-s OVERALL    total size to read (in bytes)\n"
-            "                    default: 200 MiB\n"
+            "                    default: 200 MiB (per cell with "
+            "--sweep)\n"
+            "    --sweep|-S      sweep buffer sizes, queue depths and "
+            "indirect, dio\n"
+            "                    and mmap IO (and quick if given) then "
+            "output MB/sec\n"
+            "                    and CPU utilization for each\n"
             "    --time|-t       time the data transfer\n"
             "    --verbose|-v    increase verbosity (more debug)\n"
             "    --old|-O        use old interface (use as first option)\n"
@@ -152,13 +171,14 @@ usage_for(const struct opts_t * optsp)
 static int
 new_parse_cmd_line(struct opts_t * optsp, int argc, char * argv[])
 {
-    int c, n;
+    int c, k, n;
     int64_t nn;
+    const char * cp;
 
     while (1) {
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "b:dehmNOqs:tvV", long_options,
+        c = getopt_long(argc, argv, "b:dehmNOqQ:s:StvV", long_options,
                         &option_index);
         if (c == -1)
             break;
@@ -194,6 +214,25 @@ new_parse_cmd_line(struct opts_t * optsp, int argc, char * argv[])
         case 'q':
             optsp->do_quick = true;
             break;
+        case 'Q':
+            for (cp = optarg, n = 0; cp && *cp; ++n) {
+                if (n >= MAX_QD) {
+                    pr2serr("too many queue depths in '--qd'\n");
+                    return SG_LIB_SYNTAX_ERROR;
+                }
+                k = sg_get_num_nomult(cp);
+                if ((k < 1) || (k > MAX_QD)) {
+                    pr2serr("queue depths in '--qd' should be from 1 to "
+                            "%d\n", MAX_QD);
+                    return SG_LIB_SYNTAX_ERROR;
+                }
+                optsp->qds[n] = k;
+                cp = strchr(cp, ',');
+                if (cp)
+                    ++cp;
+            }
+            optsp->num_qd = n;
+            break;
         case 's':
            nn = sg_get_llnum(optarg);
            if (nn < 0) {
@@ -203,6 +242,9 @@ new_parse_cmd_line(struct opts_t * optsp, int argc, char * argv[])
             }
             optsp->do_size = nn;
             break;
+        case 'S':
+            optsp->do_sweep = true;
+            break;
         case 't':
             optsp->do_time = true;
             break;
@@ -348,6 +390,268 @@ parse_cmd_line(struct opts_t * optsp, int argc, char * argv[])
     return res;
 }
 
+enum rb_io_mode {
+    RB_IO_INDIRECT = 0,
+    RB_IO_DIO,
+    RB_IO_MMAP,
+    RB_IO_QUICK,        /* no transfer to user space */
+    RB_IO_NUM_MODES,
+};
+
+static const char * rb_io_mode_s[] = {"indirect", "dio", "mmap", "quick"};
+
+struct rb_cell {        /* result of one buffer size, queue depth and mode */
+    bool dio_incomplete;
+    double mbps;
+    double cpu_pc;      /* user plus system CPU time over elapsed time */
+};
+
+static double
+tv_secs(const struct timeval * tvp)
+{
+    return tvp->tv_sec + (0.000001 * tvp->tv_usec);
+}
+
+/* Waits for, then collects, one completed READ BUFFER on 'sg_fd' (which
+ * is O_NONBLOCK) into 'hp'. Returns 0 on success. */
+static int
+rb_collect(int sg_fd, struct sg_io_hdr * hp)
+{
+    int res;
+    struct pollfd pfd;
+
+    while (1) {
+        memset(hp, 0, sizeof(struct sg_io_hdr));
+        hp->interface_id = 'S';
+        hp->pack_id = -1;
+        res = read(sg_fd, hp, sizeof(struct sg_io_hdr));
+        if (res >= 0)
+            return 0;
+        if (EAGAIN == errno) {
+            pfd.fd = sg_fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            poll(&pfd, 1, -1);
+        } else if (EINTR != errno)
+            return -1;
+    }
+}
+
+/* Issues 'num' READ BUFFER (data) commands of 'buf_size' bytes each, with
+ * up to 'qd' of them in flight, transferring as 'mode' dictates. Fills
+ * in 'cp'. Returns 0 on success, -1 if the sg driver refuses (e.g. out of
+ * memory for this size or depth), else an exit status. */
+static int
+rb_sweep_cell(int sg_fd, const struct opts_t * op, int buf_size, int qd,
+              enum rb_io_mode mode, unsigned int num, struct rb_cell * cp)
+{
+    int k, res, inflight;
+    int ret = 0;
+    size_t psz;
+    unsigned int submitted, done;
+    uint8_t * mmp = NULL;
+    uint8_t * bufs[MAX_QD];
+    uint8_t * free_bufs[MAX_QD];
+    uint8_t cdbs[MAX_QD][RB_CMD_LEN];
+    uint8_t senses[MAX_QD][32];
+    struct sg_io_hdr io_hdr;
+    struct timeval start_tm, end_tm;
+    struct rusage start_ru, end_ru;
+    double elapsed, cpu;
+
+#if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
+    psz = sysconf(_SC_PAGESIZE);
+#else
+    psz = 4096;
+#endif
+    memset(cp, 0, sizeof(*cp));
+    memset(cdbs, 0, sizeof(cdbs));
+    memset(bufs, 0, sizeof(bufs));
+    memset(free_bufs, 0, sizeof(free_bufs));
+    if (RB_IO_DIO != mode) {
+        k = buf_size;
+        if ((RB_IO_MMAP == mode) && (0 != (k % psz)))
+            k = ((k / psz) + 1) * psz;
+        if (ioctl(sg_fd, SG_SET_RESERVED_SIZE, &k) < 0)
+            perror("SG_SET_RESERVED_SIZE error");
+    }
+    if (RB_IO_MMAP == mode) {
+        mmp = (uint8_t *)mmap(NULL, buf_size, PROT_READ, MAP_SHARED, sg_fd,
+                              0);
+        if (MAP_FAILED == mmp)
+            return -1;
+    } else if (RB_IO_QUICK != mode) {
+        for (k = 0; k < qd; ++k) {
+            bufs[k] = sg_memalign(buf_size, 0, &free_bufs[k], false);
+            if (NULL == bufs[k]) {
+                ret = -1;
+                goto fini;
+            }
+        }
+    }
+    getrusage(RUSAGE_SELF, &start_ru);
+    gettimeofday(&start_tm, NULL);
+    for (submitted = 0, done = 0, inflight = 0; done < num; ) {
+        while ((submitted < num) && (inflight < qd) && (0 == ret)) {
+            /* slot k is free: commands complete in submission order or
+             * not, the slot travels in usr_ptr */
+            for (k = 0; k < qd; ++k) {
+                if (0 == cdbs[k][0])
+                    break;
+            }
+            memset(cdbs[k], 0, RB_CMD_LEN);
+            cdbs[k][0] = RB_OPCODE;
+            cdbs[k][1] = op->do_echo ? RB_MODE_ECHO_DATA : RB_MODE_DATA;
+            sg_put_unaligned_be24((uint32_t)buf_size, cdbs[k] + 6);
+            memset(&io_hdr, 0, sizeof(struct sg_io_hdr));
+            io_hdr.interface_id = 'S';
+            io_hdr.cmd_len = RB_CMD_LEN;
+            io_hdr.cmdp = cdbs[k];
+            io_hdr.mx_sb_len = sizeof(senses[k]);
+            io_hdr.sbp = senses[k];
+            io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+            io_hdr.dxfer_len = buf_size;
+            io_hdr.dxferp = bufs[k];
+            io_hdr.timeout = 20000;     /* 20000 millisecs == 20 seconds */
+            io_hdr.pack_id = (int)submitted;
+            io_hdr.usr_ptr = (void *)(sg_uintptr_t)k;
+            if (RB_IO_MMAP == mode)
+                io_hdr.flags |= SG_FLAG_MMAP_IO;
+            else if (RB_IO_DIO == mode)
+                io_hdr.flags |= SG_FLAG_DIRECT_IO;
+            else if (RB_IO_QUICK == mode)
+                io_hdr.flags |= SG_FLAG_NO_DXFER;
+            while (((res = write(sg_fd, &io_hdr, sizeof(io_hdr))) < 0) &&
+                   (EINTR == errno))
+                ;
+            if (res < 0) {
+                if ((ENOMEM == errno) || (EDOM == errno))
+                    ret = -1;
+                else {
+                    perror("write(sg) READ BUFFER data error");
+                    ret = SG_LIB_CAT_OTHER;
+                }
+                cdbs[k][0] = 0;
+                break;
+            }
+            ++submitted;
+            ++inflight;
+        }
+        if (0 == inflight)
+            break;
+        if (rb_collect(sg_fd, &io_hdr)) {
+            perror("read(sg) READ BUFFER data error");
+            ret = SG_LIB_CAT_OTHER;
+            break;      /* commands still in flight die with the close */
+        }
+        k = (int)(sg_uintptr_t)io_hdr.usr_ptr;
+        cdbs[k][0] = 0;
+        --inflight;
+        ++done;
+        res = sg_err_category3(&io_hdr);
+        if ((SG_LIB_CAT_CLEAN != res) && (SG_LIB_CAT_RECOVERED != res)) {
+            sg_chk_n_print3("READ BUFFER data error", &io_hdr,
+                            op->do_verbose > 1);
+            if (0 == ret)
+                ret = (res >= 0) ? res : SG_LIB_CAT_OTHER;
+        } else if ((RB_IO_DIO == mode) &&
+                   ((io_hdr.info & SG_INFO_DIRECT_IO_MASK) !=
+                    SG_INFO_DIRECT_IO))
+            cp->dio_incomplete = true;
+        if (ret && (0 == inflight))
+            break;
+    }
+    gettimeofday(&end_tm, NULL);
+    getrusage(RUSAGE_SELF, &end_ru);
+    elapsed = tv_secs(&end_tm) - tv_secs(&start_tm);
+    cpu = (tv_secs(&end_ru.ru_utime) - tv_secs(&start_ru.ru_utime)) +
+          (tv_secs(&end_ru.ru_stime) - tv_secs(&start_ru.ru_stime));
+    if (elapsed > 0.00001) {
+        cp->mbps = ((double)buf_size * done) / (elapsed * 1000000.0);
+        cp->cpu_pc = (100.0 * cpu) / elapsed;
+    }
+fini:
+    if (mmp && (MAP_FAILED != mmp))
+        munmap(mmp, buf_size);
+    for (k = 0; k < qd; ++k) {
+        if (free_bufs[k])
+            free(free_bufs[k]);
+    }
+    return ret;
+}
+
+/* Measures READ BUFFER throughput for each transfer mode, queue depth and
+ * buffer size (powers of 2 up to 'max_size') and outputs one matrix per
+ * mode. Returns 0 on success else an exit status. */
+static int
+rb_sweep(int sg_fd, const struct opts_t * op, int max_size,
+         int64_t total_size)
+{
+    bool any_dio_incomplete = false;
+    int k, j, m, res, sz, n_sz;
+    int sizes[32];
+    unsigned int num;
+    enum rb_io_mode mode;
+    struct rb_cell cell;
+    char b[32];
+
+    for (n_sz = 0, sz = (max_size < 4096) ? max_size : 4096;
+         (sz <= max_size) && (n_sz < 31); sz *= 2)
+        sizes[n_sz++] = sz;
+    if ((n_sz > 0) && (sizes[n_sz - 1] < max_size))
+        sizes[n_sz++] = max_size;
+    if (n_sz < 1) {
+        pr2serr("buffer too small to sweep\n");
+        return SG_LIB_CAT_OTHER;
+    }
+    printf("READ BUFFER sweep, %" PRId64 " MiB per cell, MB/sec (CPU "
+           "%%):\n", total_size / (1024 * 1024));
+    for (m = RB_IO_INDIRECT; m < RB_IO_NUM_MODES; ++m) {
+        mode = (enum rb_io_mode)m;
+        if ((RB_IO_QUICK == mode) && (! op->do_quick))
+            continue;
+        printf("%-10s", rb_io_mode_s[mode]);
+        for (j = 0; j < op->num_qd; ++j) {
+            snprintf(b, sizeof(b), "qd=%d", op->qds[j]);
+            printf("%16s", b);
+        }
+        printf("\n");
+        for (k = 0; k < n_sz; ++k) {
+            printf("%10d", sizes[k]);
+            num = total_size / sizes[k];
+            if (0 == num)
+                num = 1;
+            for (j = 0; j < op->num_qd; ++j) {
+                if ((RB_IO_MMAP == mode) && (op->qds[j] > 1)) {
+                    /* one reserved buffer per fd, so one command at once */
+                    printf("%16s", "-");
+                    continue;
+                }
+                res = rb_sweep_cell(sg_fd, op, sizes[k], op->qds[j], mode,
+                                    num, &cell);
+                if (res > 0) {
+                    printf("\n");
+                    return res;
+                } else if (res < 0) {
+                    printf("%16s", "no mem");
+                    continue;
+                }
+                snprintf(b, sizeof(b), "%.1f%s (%.0f%%)", cell.mbps,
+                         (cell.dio_incomplete ? "*" : ""), cell.cpu_pc);
+                printf("%16s", b);
+                if (cell.dio_incomplete)
+                    any_dio_incomplete = true;
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+    if (any_dio_incomplete)
+        printf("* direct IO requested but not done (see "
+               "/proc/scsi/sg/allow_dio)\n");
+    return 0;
+}
+
 
 int
 main(int argc, char * argv[])
@@ -401,7 +705,10 @@ main(int argc, char * argv[])
     if (op->do_size > 0)
         total_size = op->do_size;
 
-    sg_fd = open(op->device_name, O_RDONLY | O_NONBLOCK);
+    /* the sg async interface submits with write(), so --sweep needs a
+     * read-write file descriptor */
+    sg_fd = open(op->device_name,
+                 (op->do_sweep ? O_RDWR : O_RDONLY) | O_NONBLOCK);
     if (sg_fd < 0) {
         perror("device open error");
         return SG_LIB_FILE_ERROR;
@@ -491,6 +798,15 @@ main(int argc, char * argv[])
         free(rawp);
         rawp = NULL;
     }
+    if (op->do_sweep) {
+        if (0 == op->num_qd) {
+            for (k = 1; k <= MAX_QD; k *= 2)
+                op->qds[op->num_qd++] = k;
+        }
+        res = rb_sweep(sg_fd, op, buf_size, total_size);
+        close(sg_fd);
+        return res;
+    }
 
     if (! op->do_dio) {
         k = buf_size;
@@ -1,5 +1,5 @@
 /* A utility program for the Linux OS SCSI generic ("sg") device driver.
-*  Copyright (C) 2001 - 2018 D. Gilbert
+*  Copyright (C) 2001 - 2026 D. Gilbert
 *  This program is free software; you can redistribute it and/or modify
 *  it under the terms of the GNU General Public License as published by
 *  the Free Software Foundation; either version 2, or (at your option)
@@ -13,6 +13,12 @@
    a raw device or a seekable file. Streams such as stdin are not acceptable.
    The block size ('bs') is assumed to be 512 if not given.
 
+   Alternatively a workload can be given: random (uniform or zipf) or
+   sequential addresses over a range, a read/write mix and a queue depth
+   (via the sg driver's asynchronous write()/read() interface), run by
+   one or more threads. Then IOPS, throughput and latency percentiles are
+   reported.
+
    This version should compile with Linux sg drivers with version numbers
    >= 30000 . For mmap-ed IO the sg version number >= 30122 .
 
@@ -33,6 +39,7 @@
 #include <signal.h>
 #include <ctype.h>
 #include <errno.h>
+#include <math.h>
 #define __STDC_FORMAT_MACROS 1
 #include <inttypes.h>
 #include <sys/ioctl.h>
@@ -42,18 +49,22 @@
 #include <sys/mman.h>
 #include <sys/time.h>
 #include <linux/major.h>
+#include <linux/fs.h>   /* for BLKGETSIZE64 */
+#include <pthread.h>
+#include <sched.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
 #include "sg_lib.h"
+#include "sg_cmds_basic.h"
 #include "sg_io_linux.h"
 #include "sg_unaligned.h"
 #include "sg_pr2serr.h"
 
 
-static const char * version_str = "1.30 20180219";
+static const char * version_str = "1.32 20261018";
 
 #define DEF_BLOCK_SIZE 512
 #define DEF_BLOCKS_PER_TRANSFER 128
@@ -80,12 +91,16 @@ static const char * version_str = "1.30 20180219";
 #define FT_ERROR 64             /* couldn't "stat" file */
 
 #define MIN_RESERVED_SIZE 8192
+#define MAX_QD 16       /* the sg driver's SG_MAX_QUEUE, per file descriptor */
+#define DEF_ZIPF_THETA 0.99
+#define MAX_THREADS 1024
 
 static int sum_of_resids = 0;
 
 static int64_t dd_count = -1;
 static int64_t orig_count = 0;
 static int64_t in_full = 0;
+static int64_t out_full = 0;
 static int in_partial = 0;
 
 static int pack_id_count = 0;
@@ -113,6 +128,8 @@ static void print_stats(int iters, const char * str)
             pr2serr("  remaining block count=%" PRId64 "\n", dd_count);
         pr2serr("%" PRId64 "+%d records in", in_full - in_partial,
                 in_partial);
+        if (out_full > 0)
+            pr2serr(", %" PRId64 "+0 records out", out_full);
         if (iters > 0)
             pr2serr(", %s commands issued: %d\n", (str ? str : ""), iters);
         else
@@ -167,6 +184,11 @@ static void usage()
             "[skip=SKIP]\n"
             "                [time=TI] [verbose=VERB] [--help] "
             "[--version]\n"
+            "                [dist=same|seq|uniform|zipf[:THETA]] "
+            "[qd=QD] [range=RANGE]\n"
+            "                [pin=0|1] [rwmix=PC] [seed=SEED] "
+            "[share_fd=0|1]\n"
+            "                [threads=NT]\n"
             "  where:\n"
             "    blk_sgio 0->normal IO for block devices, 1->SCSI commands "
             "via SG_IO\n"
@@ -182,7 +204,11 @@ static void usage()
             "error)\n"
             "             (if negative, do |COUNT| zero block SCSI READs)\n"
             "    dio      1-> attempt direct IO on sg device, 0->indirect IO "
-            "(def)\n");
+            "(def)\n"
+            "    dist     where each command starts: same->at SKIP (def), "
+            "seq->\n"
+            "             sequential, uniform->random, zipf->random with "
+            "hot spots\n");
     pr2serr("    dpo      1-> set disable page out (DPO) in SCSI READs\n"
             "    fua      1-> set force unit access (FUA) in SCSI READs\n"
             "    if       an sg, block or raw device, or a seekable file (not "
@@ -192,15 +218,32 @@ static void usage()
             "    no_dxfer 1->DMA to kernel buffers only, not user space, "
             "0->normal(def)\n"
             "    odir     1->open block device O_DIRECT, 0->don't (def)\n"
+            "    pin      1->pin each workload thread to its own CPU, "
+            "0->don't (def)\n"
+            "    qd       commands in flight on an sg device (def: 1, max: "
+            "%d)\n"
+            "             (per thread)\n"
+            "    range    blocks from SKIP that dist= addresses (def: to "
+            "end)\n"
+            "    rwmix    percentage of commands that are reads (def: 100)\n"
+            "             WARNING: writes overwrite IFILE with junk\n"
+            "    seed     for random addresses and mix (def: from time)\n"
+            "    share_fd 1->workload threads share one file descriptor, "
+            "0->each\n"
+            "             thread opens IFILE (def)\n"
             "    skip     each transfer starts at this logical address "
             "(def=0)\n"
+            "    threads  number of threads running the workload, COUNT "
+            "shared (def: 1)\n"
             "    time     0->do nothing(def), 1->time from 1st cmd, 2->time "
             "from 2nd, ...\n"
             "    verbose  increase level of verbosity (def: 0)\n"
             "    --help   print this usage message then exit\n"
             "    --version  print version number then exit\n\n"
             "Issue SCSI READ commands, each starting from the same logical "
-            "block address\n");
+            "block address\n"
+            "or, when dist=, qd=, range=, rwmix= or threads= is given, run "
+            "that workload\n", MAX_QD);
 }
 
 static int sg_build_scsi_cdb(uint8_t * cdbp, int cdb_sz,
@@ -366,6 +409,676 @@ static int sg_bread(int sg_fd, uint8_t * buff, int blocks,
     return 0;
 }
 
+enum wl_dist {
+    WL_SAME = 0,        /* every command at SKIP, the classic sg_read */
+    WL_SEQ,             /* sequential through the range, wrapping */
+    WL_UNIFORM,
+    WL_ZIPF,
+};
+
+struct wl_t {           /* set when dist=, range=, rwmix= or qd= given */
+    bool on;
+    bool async;         /* qd > 1, uses the sg driver's write()/read() */
+    bool dio;
+    bool dpo;
+    bool fua;
+    bool no_dxfer;
+    bool pin;           /* pin thread k to the k-th permitted CPU */
+    bool share_fd;      /* all threads use the one file descriptor */
+    enum wl_dist dist;
+    int bs;
+    int bpt;
+    int cdbsz;
+    int in_type;
+    int qd;
+    int rwmix;          /* percentage of commands that are reads */
+    int threads;
+    int oflags;         /* flags IFILE was opened with */
+    const char * inf;
+    int64_t skip;
+    int64_t range;      /* in blocks, starting at skip */
+    int64_t items;      /* number of bpt sized chunks in range */
+    uint64_t seed;
+    double theta;       /* zipf exponent */
+    double zh_x1;       /* zipf rejection-inversion constants */
+    double zh_n;
+    double zs;
+};
+
+struct wl_stats_t {     /* index 0 for reads, 1 for writes */
+    int64_t blks[2];
+    struct sg_lat_hist lat[2];  /* lat[d].num is the number of commands */
+};
+
+struct wl_slot {        /* one per command that may be in flight */
+    bool is_write;
+    int retries;
+    int blocks;
+    int64_t lba;
+    int64_t start_us;
+    uint8_t * buf;
+    uint8_t * free_buf;
+    uint8_t cdb[MAX_SCSI_CDBSZ];
+    uint8_t sense[SENSE_BUFF_LEN];
+    struct sg_io_hdr io_hdr;
+};
+
+struct wl_thr {
+    int id;
+    int fd;
+    int ret;
+    int dio_incomplete;
+    int resids;         /* sum of residual counts */
+    int pack_id;
+    int cpu;            /* -1 if not pinned */
+    int64_t elapsed_us;
+    uint64_t rng;
+    int64_t cmds_todo;  /* commands still to issue */
+    int64_t blks_todo;  /* blocks still to issue */
+    int64_t seq_next;   /* next chunk for dist=seq */
+    struct wl_slot slots[MAX_QD];
+    struct wl_stats_t st;
+};
+
+static struct wl_t wl;
+
+
+static int64_t
+now_us(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((int64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+}
+
+/* Returns a double in the range [0, 1) */
+static double
+wl_rand_dbl(uint64_t * sp)
+{
+    return (sg_xorshift64s(sp) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Zipf distributed ranks from 1 to wl.items using rejection-inversion
+ * sampling (W. Hormann and G. Derflinger, 1996) which needs no table and
+ * only constant time setup, whatever the number of items. */
+static double
+zipf_helper1(double x)  /* log(1 + x) / x */
+{
+    if (fabs(x) > 1e-8)
+        return log1p(x) / x;
+    return 1.0 - (x * (0.5 - (x * ((1.0 / 3.0) - (0.25 * x)))));
+}
+
+static double
+zipf_helper2(double x)  /* (exp(x) - 1) / x */
+{
+    if (fabs(x) > 1e-8)
+        return expm1(x) / x;
+    return 1.0 + (x * 0.5 * (1.0 + ((x / 3.0) * (1.0 + (0.25 * x)))));
+}
+
+static double
+zipf_h_integral(double x)
+{
+    double log_x = log(x);
+
+    return zipf_helper2((1.0 - wl.theta) * log_x) * log_x;
+}
+
+static double
+zipf_h(double x)
+{
+    return exp(-wl.theta * log(x));
+}
+
+static double
+zipf_h_integral_inv(double x)
+{
+    double t = x * (1.0 - wl.theta);
+
+    if (t < -1.0)
+        t = -1.0;
+    return exp(zipf_helper1(t) * x);
+}
+
+static void
+zipf_init(void)
+{
+    wl.zh_x1 = zipf_h_integral(1.5) - 1.0;
+    wl.zh_n = zipf_h_integral(wl.items + 0.5);
+    wl.zs = 2.0 - zipf_h_integral_inv(zipf_h_integral(2.5) - zipf_h(2.0));
+}
+
+static int64_t
+zipf_next(uint64_t * sp)
+{
+    int64_t k;
+    double u, x;
+
+    while (1) {
+        u = wl.zh_n + (wl_rand_dbl(sp) * (wl.zh_x1 - wl.zh_n));
+        x = zipf_h_integral_inv(u);
+        k = (int64_t)(x + 0.5);
+        if (k < 1)
+            k = 1;
+        else if (k > wl.items)
+            k = wl.items;
+        if (((k - x) <= wl.zs) ||
+            (u >= (zipf_h_integral(k + 0.5) - zipf_h((double)k))))
+            return k;
+    }
+}
+
+/* Returns the next chunk number, from 0 to wl.items - 1 */
+static int64_t
+wl_next_item(struct wl_thr * tp)
+{
+    uint64_t h;
+    int64_t k;
+
+    switch (wl.dist) {
+    case WL_SEQ:
+        k = tp->seq_next++;
+        if (tp->seq_next >= wl.items)
+            tp->seq_next = 0;
+        return k;
+    case WL_UNIFORM:
+        return (int64_t)(sg_xorshift64s(&tp->rng) % (uint64_t)wl.items);
+    case WL_ZIPF:
+        /* scatter the popular ranks over the range (FNV-1a of the rank) */
+        k = zipf_next(&tp->rng);
+        h = 0xcbf29ce484222325ULL ^ (uint64_t)k;
+        h *= 0x100000001b3ULL;
+        h ^= h >> 29;
+        h *= 0x100000001b3ULL;
+        return (int64_t)(h % (uint64_t)wl.items);
+    case WL_SAME:
+    default:
+        return 0;
+    }
+}
+
+/* Picks the address and direction of the next command for slot 'sp' and
+ * builds its cdb. Returns 0 on success. */
+static int
+wl_setup(struct wl_thr * tp, struct wl_slot * sp)
+{
+    sp->blocks = (tp->blks_todo < wl.bpt) ? (int)tp->blks_todo : wl.bpt;
+    sp->lba = wl.skip + (wl_next_item(tp) * wl.bpt);
+    sp->is_write = (wl.rwmix < 100) &&
+                   ((int)(sg_xorshift64s(&tp->rng) % 100) >= wl.rwmix);
+    sp->retries = 0;
+    if (! (FT_SG & wl.in_type))
+        return 0;
+    if (sg_build_scsi_cdb(sp->cdb, wl.cdbsz, sp->blocks, sp->lba,
+                          sp->is_write, wl.fua, wl.dpo)) {
+        pr2serr(ME "bad cdb build, lba=%" PRId64 ", blocks=%d\n", sp->lba,
+                sp->blocks);
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    return 0;
+}
+
+/* Starts (when wl.async) or performs the command in slot 'sp'. Returns 0
+ * on success. */
+static int
+wl_submit(struct wl_thr * tp, struct wl_slot * sp)
+{
+    int res;
+    off64_t off;
+    struct sg_io_hdr * hp = &sp->io_hdr;
+
+    sp->start_us = now_us();
+    if (! (FT_SG & wl.in_type)) {
+        off = (off64_t)sp->lba * wl.bs;
+        if (sp->is_write)
+            res = pwrite64(tp->fd, sp->buf, sp->blocks * wl.bs, off);
+        else
+            res = pread64(tp->fd, sp->buf, sp->blocks * wl.bs, off);
+        if (res < 0) {
+            perror(sp->is_write ? ME "pwrite64" : ME "pread64");
+            return SG_LIB_FILE_ERROR;
+        } else if (res < (sp->blocks * wl.bs)) {
+            pr2serr(ME "short %s at lba=%" PRId64 ": wanted/got=%d/%d "
+                    "bytes\n", (sp->is_write ? "write" : "read"), sp->lba,
+                    sp->blocks * wl.bs, res);
+            return SG_LIB_CAT_OTHER;
+        }
+        return 0;
+    }
+    memset(hp, 0, sizeof(struct sg_io_hdr));
+    hp->interface_id = 'S';
+    hp->cmd_len = wl.cdbsz;
+    hp->cmdp = sp->cdb;
+    hp->dxfer_direction = sp->is_write ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
+    hp->dxfer_len = wl.bs * sp->blocks;
+    hp->dxferp = sp->buf;
+    if (wl.dio)
+        hp->flags |= SG_FLAG_DIRECT_IO;
+    else if (wl.no_dxfer)
+        hp->flags |= SG_FLAG_NO_DXFER;
+    hp->mx_sb_len = SENSE_BUFF_LEN;
+    hp->sbp = sp->sense;
+    hp->timeout = DEF_TIMEOUT;
+    hp->pack_id = tp->pack_id++;
+    hp->usr_ptr = sp;
+    if (verbose > 2)
+        pr2serr("    %s lba=%" PRId64 " blocks=%d\n",
+                (sp->is_write ? "write" : "read"), sp->lba, sp->blocks);
+    if (wl.async) {
+        while (((res = write(tp->fd, hp, sizeof(struct sg_io_hdr))) < 0) &&
+               ((EINTR == errno) || (EAGAIN == errno)))
+            ;
+        if (res < 0) {
+            perror(ME "write(sg) to submit command");
+            return sg_convert_errno(errno);
+        }
+        return 0;
+    }
+    while (((res = ioctl(tp->fd, SG_IO, hp)) < 0) &&
+           ((EINTR == errno) || (EAGAIN == errno)))
+        ;
+    if (res < 0) {
+        perror(ME "SG_IO ioctl error");
+        return sg_convert_errno(errno);
+    }
+    return 0;
+}
+
+/* Accounts for the completed command in slot 'sp'. Returns 0 if it was
+ * good, 1 if it should be resubmitted, else an exit status. */
+static int
+wl_done(struct wl_thr * tp, struct wl_slot * sp)
+{
+    int d = sp->is_write ? 1 : 0;
+    int res;
+    int64_t lat = now_us() - sp->start_us;
+    const char * leadin = sp->is_write ? "writing" : "reading";
+
+    if (FT_SG & wl.in_type) {
+        res = sg_err_category3(&sp->io_hdr);
+        switch (res) {
+        case SG_LIB_CAT_CLEAN:
+            break;
+        case SG_LIB_CAT_RECOVERED:
+            if (verbose > 1)
+                sg_chk_n_print3(leadin, &sp->io_hdr, true);
+            break;
+        case SG_LIB_CAT_UNIT_ATTENTION:
+        case SG_LIB_CAT_ABORTED_COMMAND:
+            if (verbose)
+                sg_chk_n_print3(leadin, &sp->io_hdr, (verbose > 1));
+            if (sp->retries++ < 1)
+                return 1;
+            return res;
+        default:
+            sg_chk_n_print3(leadin, &sp->io_hdr, !! verbose);
+            pr2serr(ME "%s failed at lba=%" PRId64 "\n", leadin, sp->lba);
+            return res;
+        }
+        if (wl.dio && ((sp->io_hdr.info & SG_INFO_DIRECT_IO_MASK) !=
+                       SG_INFO_DIRECT_IO))
+            ++tp->dio_incomplete;
+        tp->resids += sp->io_hdr.resid;
+    }
+    sg_lat_add(&tp->st.lat[d], lat);
+    tp->st.blks[d] += sp->blocks;
+    return 0;
+}
+
+/* Issues tp->cmds_todo commands keeping up to wl.qd in flight. Returns 0
+ * on success, else the exit status of the first failure. */
+static int
+wl_run(struct wl_thr * tp)
+{
+    bool stop = false;
+    int k, res, inflight;
+    struct wl_slot * sp;
+    struct wl_slot * free_slots[MAX_QD];
+    struct sg_io_hdr io_hdr;
+
+    for (k = 0; k < wl.qd; ++k)
+        free_slots[k] = tp->slots + k;
+    inflight = 0;
+    while (((tp->cmds_todo > 0) && (! stop)) || (inflight > 0)) {
+        while ((! stop) && (tp->cmds_todo > 0) && (inflight < wl.qd)) {
+            sp = free_slots[wl.qd - inflight - 1];
+            res = wl_setup(tp, sp);
+            if (0 == res) {
+                --tp->cmds_todo;
+                tp->blks_todo -= sp->blocks;
+                do {
+                    res = wl_submit(tp, sp);
+                    if (res || wl.async)
+                        break;
+                    res = wl_done(tp, sp);
+                } while (1 == res);
+            }
+            if (res) {
+                tp->ret = res;
+                stop = true;
+            } else if (wl.async)
+                ++inflight;
+        }
+        if (0 == inflight)
+            continue;
+        memset(&io_hdr, 0, sizeof(io_hdr));
+        io_hdr.interface_id = 'S';
+        io_hdr.pack_id = -1;    /* any completed command */
+        while (((res = read(tp->fd, &io_hdr, sizeof(io_hdr))) < 0) &&
+               ((EINTR == errno) || (EAGAIN == errno)))
+            ;
+        if (res < 0) {
+            perror(ME "read(sg) for a completion");
+            if (0 == tp->ret)
+                tp->ret = sg_convert_errno(errno);
+            break;      /* can not recover the commands in flight */
+        }
+        sp = (struct wl_slot *)io_hdr.usr_ptr;
+        sp->io_hdr = io_hdr;
+        res = wl_done(tp, sp);
+        if (1 == res) {
+            res = wl_submit(tp, sp);
+            if (0 == res)
+                continue;       /* still in flight */
+        }
+        --inflight;
+        free_slots[wl.qd - inflight - 1] = sp;
+        if (res) {
+            if (0 == tp->ret)
+                tp->ret = res;
+            stop = true;
+        }
+    }
+    return tp->ret;
+}
+
+static void
+wl_report(const struct wl_stats_t * stp, int64_t elapsed_us)
+{
+    int d;
+    double secs = elapsed_us / 1000000.0;
+    const struct sg_lat_hist * hp;
+
+    if (secs < 0.000001)
+        secs = 0.000001;
+    pr2serr("Workload of %" PRId64 " commands took %.6f secs, queue depth "
+            "%d", stp->lat[0].num + stp->lat[1].num, secs, wl.qd);
+    if (wl.threads > 1)
+        pr2serr(", %d threads", wl.threads);
+    pr2serr(":\n");
+    for (d = 0; d < 2; ++d) {
+        hp = stp->lat + d;
+        if (0 == hp->num)
+            continue;
+        pr2serr("  %s: %" PRId64 " commands, %.2f IOPS, %.2f MB/sec\n",
+                (d ? "writes" : "reads"), hp->num, hp->num / secs,
+                ((double)stp->blks[d] * wl.bs) / (secs * 1000000.0));
+        pr2serr("    latency (usecs): min=%" PRId64 " p50=%" PRId64 " p90=%"
+                PRId64 " p99=%" PRId64 " p99.9=%" PRId64 " max=%" PRId64
+                " mean=%.1f\n", hp->min, sg_lat_pc(hp, 50.0),
+                sg_lat_pc(hp, 90.0), sg_lat_pc(hp, 99.0),
+                sg_lat_pc(hp, 99.9), hp->max, (double)hp->sum / hp->num);
+    }
+}
+
+/* One line per thread so contention shows up as threads falling behind */
+static void
+wl_report_thr(const struct wl_thr * tp)
+{
+    int64_t cmds = tp->st.lat[0].num + tp->st.lat[1].num;
+    double secs = tp->elapsed_us / 1000000.0;
+    char b[32];
+
+    if (secs < 0.000001)
+        secs = 0.000001;
+    if (tp->cpu >= 0)
+        snprintf(b, sizeof(b), ", cpu %d", tp->cpu);
+    else
+        b[0] = '\0';
+    pr2serr("  thread %d%s: %" PRId64 " commands in %.6f secs, %.2f IOPS, "
+            "%.2f MB/sec\n", tp->id, b, cmds, secs, cmds / secs,
+            ((double)(tp->st.blks[0] + tp->st.blks[1]) * wl.bs) /
+            (secs * 1000000.0));
+}
+
+static void *
+wl_thread(void * v_tp)
+{
+    int64_t start;
+    struct wl_thr * tp = (struct wl_thr *)v_tp;
+
+#ifdef CPU_SET
+    if (tp->cpu >= 0) {
+        cpu_set_t cs;
+        int res;
+
+        CPU_ZERO(&cs);
+        CPU_SET(tp->cpu, &cs);
+        res = pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+        if (res)
+            pr2serr("thread %d: unable to pin to cpu %d: %s\n", tp->id,
+                    tp->cpu, safe_strerror(res));
+    }
+#endif
+    start = now_us();
+    wl_run(tp);
+    tp->elapsed_us = now_us() - start;
+    return NULL;
+}
+
+/* Opens IFILE again for another thread, as main() did. Returns the file
+ * descriptor or -1. */
+static int
+wl_open(void)
+{
+    int fd, t;
+    char ebuff[256];
+
+    fd = open(wl.inf, wl.oflags);
+    if (fd < 0) {
+        snprintf(ebuff, sizeof(ebuff), ME "could not open %s for thread",
+                 wl.inf);
+        perror(ebuff);
+        return -1;
+    }
+    if ((FT_SG & wl.in_type) && (! (FT_BLOCK & wl.in_type))) {
+        t = wl.bs * wl.bpt;
+        if (ioctl(fd, SG_SET_RESERVED_SIZE, &t) < 0)
+            perror(ME "SG_SET_RESERVED_SIZE error");
+    }
+    return fd;
+}
+
+/* Returns the number of blocks in IFILE or 0 if unknown */
+static int64_t
+wl_capacity(int fd)
+{
+    uint8_t b[32];
+    uint64_t u;
+    struct stat st;
+
+    if (FT_SG & wl.in_type) {
+        if (0 == sg_ll_readcap_16(fd, false, 0, b, sizeof(b), false,
+                                  (verbose > 1) ? verbose - 1 : 0))
+            return (int64_t)sg_get_unaligned_be64(b + 0) + 1;
+        if (0 == sg_ll_readcap_10(fd, false, 0, b, 8, false,
+                                  (verbose > 1) ? verbose - 1 : 0))
+            return (int64_t)sg_get_unaligned_be32(b + 0) + 1;
+        return 0;
+    }
+#ifdef BLKGETSIZE64
+    if (FT_BLOCK & wl.in_type) {
+        if (ioctl(fd, BLKGETSIZE64, &u) < 0)
+            return 0;
+        return (int64_t)(u / wl.bs);
+    }
+#endif
+    if (fstat(fd, &st) < 0)
+        return 0;
+    u = st.st_size;
+    return (int64_t)(u / wl.bs);
+}
+
+/* Sets up and runs a workload (rather than the classic loop) on 'infd',
+ * and on file descriptors of its own for each further thread unless
+ * wl.share_fd. Returns the exit status. */
+static int
+wl_main(int infd)
+{
+    int k, j, d, res, ret, ncpus;
+    int cpus[CPU_SETSIZE];
+    int64_t cap, start, elapsed, cmds, blks;
+    struct wl_thr * thr;
+    struct wl_thr * tp;
+    pthread_t * tids = NULL;
+    struct wl_stats_t * stp = NULL;
+
+    if (wl.range <= 0) {
+        cap = wl_capacity(infd);
+        if (cap <= wl.skip) {
+            pr2serr(ME "unable to find the size of IFILE beyond SKIP, give "
+                    "range=\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        wl.range = cap - wl.skip;
+        if (verbose)
+            pr2serr("range is %" PRId64 " blocks from skip=%" PRId64 "\n",
+                    wl.range, wl.skip);
+    }
+    wl.items = wl.range / wl.bpt;
+    if (wl.items < 1) {
+        pr2serr(ME "range= must be at least bpt= blocks\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (WL_ZIPF == wl.dist)
+        zipf_init();
+    ncpus = 0;
+    if (wl.pin) {
+        cpu_set_t cs;
+
+        CPU_ZERO(&cs);
+        if (sched_getaffinity(0, sizeof(cs), &cs) < 0)
+            perror(ME "sched_getaffinity, not pinning");
+        else {
+            for (k = 0; k < CPU_SETSIZE; ++k) {
+                if (CPU_ISSET(k, &cs))
+                    cpus[ncpus++] = k;
+            }
+        }
+    }
+    thr = (struct wl_thr *)calloc(wl.threads, sizeof(struct wl_thr));
+    tids = (pthread_t *)calloc(wl.threads, sizeof(pthread_t));
+    stp = (struct wl_stats_t *)calloc(1, sizeof(struct wl_stats_t));
+    if ((NULL == thr) || (NULL == tids) || (NULL == stp)) {
+        pr2serr("Not enough user memory\n");
+        ret = sg_convert_errno(ENOMEM);
+        goto fini;
+    }
+    ret = 0;
+    cmds = (dd_count + wl.bpt - 1) / wl.bpt;
+    blks = dd_count;
+    for (k = 0; k < wl.threads; ++k) {
+        tp = thr + k;
+        tp->id = k;
+        tp->fd = -1;
+        tp->cpu = (ncpus > 0) ? cpus[k % ncpus] : -1;
+        /* splitmix64 step so each thread gets its own stream */
+        tp->rng = wl.seed + ((uint64_t)(k + 1) * 0x9e3779b97f4a7c15ULL);
+        tp->rng ^= tp->rng >> 31;
+        if (0 == tp->rng)
+            tp->rng = 1;
+        tp->seq_next = (wl.items / wl.threads) * k;
+        tp->cmds_todo = (cmds / wl.threads) +
+                        ((k < (cmds % wl.threads)) ? 1 : 0);
+        tp->blks_todo = tp->cmds_todo * wl.bpt;
+        if (tp->blks_todo > blks)
+            tp->blks_todo = blks;
+        blks -= tp->blks_todo;
+        if ((0 == k) || wl.share_fd)
+            tp->fd = infd;
+        else if ((tp->fd = wl_open()) < 0) {
+            ret = SG_LIB_FILE_ERROR;
+            goto fini;
+        }
+        for (j = 0; j < wl.qd; ++j) {
+            tp->slots[j].buf = sg_memalign(wl.bs * wl.bpt, 0,
+                                           &tp->slots[j].free_buf, false);
+            if (NULL == tp->slots[j].buf) {
+                pr2serr("Not enough user memory\n");
+                ret = sg_convert_errno(ENOMEM);
+                goto fini;
+            }
+            memset(tp->slots[j].buf, 0, wl.bs * wl.bpt);
+        }
+    }
+    if (verbose)
+        pr2serr("About to issue %" PRId64 " commands, %d%% reads, queue "
+                "depth %d, %d thread%s%s\n", cmds, wl.rwmix, wl.qd,
+                wl.threads, ((wl.threads > 1) ? "s" : ""),
+                (((wl.threads > 1) && wl.share_fd) ? " sharing one fd" : ""));
+    start = now_us();
+    for (k = 0; k < wl.threads; ++k) {
+        res = pthread_create(tids + k, NULL, wl_thread, thr + k);
+        if (res) {
+            pr2serr(ME "pthread_create: %s\n", safe_strerror(res));
+            ret = sg_convert_errno(res);
+            break;
+        }
+    }
+    for (j = 0; j < k; ++j)
+        pthread_join(tids[j], NULL);
+    elapsed = now_us() - start;
+
+    for (k = 0; k < wl.threads; ++k) {
+        tp = thr + k;
+        for (d = 0; d < 2; ++d) {
+            stp->blks[d] += tp->st.blks[d];
+            sg_lat_merge(stp->lat + d, tp->st.lat + d);
+        }
+        if (tp->ret && (0 == ret))
+            ret = tp->ret;
+        if (tp->dio_incomplete)
+            pr2serr(">> Direct IO requested but incomplete %d times\n",
+                    tp->dio_incomplete);
+        sum_of_resids += tp->resids;
+    }
+    wl_report(stp, elapsed);
+    if (wl.threads > 1) {
+        for (k = 0; k < wl.threads; ++k)
+            wl_report_thr(thr + k);
+    }
+    in_full = stp->blks[0];
+    out_full = stp->blks[1];
+    dd_count -= stp->blks[0] + stp->blks[1];
+    if (sum_of_resids)
+        pr2serr(">> Non-zero sum of residual counts=%d\n", sum_of_resids);
+    if ((0 != dd_count) && (0 == ret))
+        ret = SG_LIB_CAT_OTHER;
+    print_stats((int)(stp->lat[0].num + stp->lat[1].num),
+                (FT_SG & wl.in_type) ? "SCSI READ/WRITE" : "read/write");
+fini:
+    if (thr) {
+        for (k = 0; k < wl.threads; ++k) {
+            tp = thr + k;
+            for (j = 0; j < wl.qd; ++j) {
+                if (tp->slots[j].free_buf)
+                    free(tp->slots[j].free_buf);
+            }
+            if ((tp->fd >= 0) && (tp->fd != infd))
+                close(tp->fd);
+        }
+        free(thr);
+    }
+    if (tids)
+        free(tids);
+    if (stp)
+        free(stp);
+    return ret;
+}
+
+
 #define STR_SZ 1024
 #define INF_SZ 512
 #define EBUFF_SZ 512
@@ -394,6 +1107,7 @@ int main(int argc, char * argv[])
     int64_t skip = 0;
     char * key;
     char * buf;
+    char * cp;
     uint8_t * wrkBuff = NULL;
     uint8_t * wrkPos = NULL;
     char inf[INF_SZ];
@@ -409,6 +1123,10 @@ int main(int argc, char * argv[])
     psz = 4096;     /* give up, pick likely figure */
 #endif
     inf[0] = '\0';
+    wl.qd = 1;
+    wl.rwmix = 100;
+    wl.threads = 1;
+    wl.theta = DEF_ZIPF_THETA;
 
     for (k = 1; k < argc; k++) {
         if (argv[k]) {
@@ -454,7 +1172,31 @@ int main(int argc, char * argv[])
             }
         } else if (0 == strcmp(key,"dio"))
             do_dio = !! sg_get_num(buf);
-        else if (0 == strcmp(key,"dpo"))
+        else if (0 == strcmp(key,"dist")) {
+            wl.on = true;
+            if (0 == strcmp(buf, "same"))
+                wl.dist = WL_SAME;
+            else if (0 == strcmp(buf, "seq"))
+                wl.dist = WL_SEQ;
+            else if (0 == strcmp(buf, "uniform"))
+                wl.dist = WL_UNIFORM;
+            else if (0 == strncmp(buf, "zipf", 4)) {
+                wl.dist = WL_ZIPF;
+                if (':' == buf[4]) {
+                    wl.theta = strtod(buf + 5, &cp);
+                    if ((cp == (buf + 5)) || *cp || (wl.theta <= 0.0)) {
+                        pr2serr(ME "bad zipf THETA in 'dist'\n");
+                        return SG_LIB_SYNTAX_ERROR;
+                    }
+                } else if (buf[4]) {
+                    pr2serr(ME "bad argument to 'dist'\n");
+                    return SG_LIB_SYNTAX_ERROR;
+                }
+            } else {
+                pr2serr(ME "bad argument to 'dist'\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key,"dpo"))
             dpo = !! sg_get_num(buf);
         else if (0 == strcmp(key,"fua"))
             fua = !! sg_get_num(buf);
@@ -466,14 +1208,53 @@ int main(int argc, char * argv[])
             no_dxfer = !! sg_get_num(buf);
         else if (0 == strcmp(key,"odir"))
             do_odir = !! sg_get_num(buf);
+        else if (0 == strcmp(key,"pin"))
+            wl.pin = !! sg_get_num(buf);
         else if (strcmp(key,"of") == 0)
             strncpy(outf, buf, INF_SZ);
+        else if (0 == strcmp(key,"qd")) {
+            wl.on = true;
+            wl.qd = sg_get_num(buf);
+            if ((wl.qd < 1) || (wl.qd > MAX_QD)) {
+                pr2serr(ME "'qd' should be from 1 to %d\n", MAX_QD);
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key,"range")) {
+            wl.on = true;
+            wl.range = sg_get_llnum(buf);
+            if (wl.range < 1) {
+                pr2serr(ME "bad argument to 'range'\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key,"rwmix")) {
+            wl.on = true;
+            wl.rwmix = sg_get_num(buf);
+            if ((wl.rwmix < 0) || (wl.rwmix > 100)) {
+                pr2serr(ME "'rwmix' should be from 0 to 100\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key,"seed")) {
+            wl.seed = (uint64_t)sg_get_llnum(buf);
+            if ((int64_t)wl.seed < 0) {
+                pr2serr(ME "bad argument to 'seed'\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key,"share_fd"))
+            wl.share_fd = !! sg_get_num(buf);
         else if (0 == strcmp(key,"skip")) {
             skip = sg_get_llnum(buf);
             if (-1 == skip) {
                 pr2serr( ME "bad argument to 'skip'\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
+        } else if (0 == strcmp(key,"threads")) {
+            wl.on = true;
+            wl.threads = sg_get_num(buf);
+            if ((wl.threads < 1) || (wl.threads > MAX_THREADS)) {
+                pr2serr(ME "'threads' should be from 1 to %d\n",
+                        MAX_THREADS);
+                return SG_LIB_SYNTAX_ERROR;
+            }
         } else if (0 == strcmp(key,"time"))
             do_time = sg_get_num(buf);
         else if (0 == strncmp(key, "verb", 4))
@@ -521,6 +1302,24 @@ int main(int argc, char * argv[])
         pr2serr("cannot select no_dxfer with dio or mmap\n");
         return SG_LIB_SYNTAX_ERROR;
     }
+    if (wl.on) {
+        if ((dd_count <= 0) || (bpt < 1)) {
+            pr2serr("a workload (dist=, qd=, range= or rwmix=) needs "
+                    "positive count and bpt\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        if (do_mmap) {
+            pr2serr("cannot select mmap with a workload\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        if (wl.share_fd && (wl.threads > 1) && (wl.qd > 1)) {
+            /* read() on a shared fd may collect another thread's command */
+            pr2serr("share_fd=1 with several threads needs qd=1\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        if (0 == wl.seed)
+            wl.seed = (uint64_t)now_us() ^ ((uint64_t)getpid() << 32);
+    }
 
     install_handler (SIGINT, interrupt_handler);
     install_handler (SIGQUIT, interrupt_handler);
@@ -595,7 +1394,7 @@ int main(int argc, char * argv[])
             pr2serr(ME "negative 'count' only supported with SCSI READs\n");
             return SG_LIB_CAT_OTHER;
         }
-        flags = O_RDONLY;
+        flags = (wl.rwmix < 100) ? O_RDWR : O_RDONLY;
         if (do_odir)
             flags |= O_DIRECT;
         if ((infd = open(inf, flags)) < 0) {
@@ -623,6 +1422,36 @@ int main(int argc, char * argv[])
         return 0;
     orig_count = dd_count;
 
+    if (wl.on) {
+        if ((wl.qd > 1) && ((! (FT_SG & in_type)) || (FT_BLOCK & in_type))) {
+            pr2serr(ME "qd= greater than 1 needs an sg device\n");
+            close(infd);
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        if (wl.share_fd && (wl.threads > MAX_QD) && (FT_SG & in_type) &&
+            (! (FT_BLOCK & in_type))) {
+            pr2serr(ME "at most %d threads can share an sg file "
+                    "descriptor\n", MAX_QD);
+            close(infd);
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        wl.async = (wl.qd > 1);
+        wl.inf = inf;
+        wl.oflags = flags;
+        wl.dio = do_dio;
+        wl.dpo = dpo;
+        wl.fua = fua;
+        wl.no_dxfer = no_dxfer;
+        wl.bs = bs;
+        wl.bpt = bpt;
+        wl.cdbsz = scsi_cdbsz;
+        wl.in_type = in_type;
+        wl.skip = skip;
+        ret = wl_main(infd);
+        close(infd);
+        return (ret >= 0) ? ret : SG_LIB_CAT_OTHER;
+    }
+
     if (dd_count > 0) {
         if (do_dio || do_odir || (FT_RAW & in_type)) {
             wrkBuff = (uint8_t *)malloc(bs * bpt + psz);
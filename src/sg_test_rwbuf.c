@@ -1,7 +1,7 @@
 /*
  * (c) 2000 Kurt Garloff <garloff at suse dot de>
  * heavily based on Douglas Gilbert's sg_rbuf program.
- * (c) 1999-2018 Douglas Gilbert
+ * (c) 1999-2026 Douglas Gilbert
  *
  * Program to test the SCSI host adapter by issuing
  * write and read operations on a device's buffer
@@ -20,6 +20,8 @@
  *
  *   2003/11/11  switch sg3_utils version to use SG_IO ioctl [dpg]
  *   2004/06/08  remove SG_GET_VERSION_NUM check [dpg]
+ *   2026/10/18  add --stress mode with several write/read pairs in
+ *               flight [dpg]
  */
 
 #include <unistd.h>
@@ -29,10 +31,18 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
 #include <getopt.h>
+#include <poll.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <time.h>
+#include <linux/major.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -44,13 +54,17 @@
 #include "sg_pr2serr.h"
 
 
-static const char * version_str = "1.15 20180219";
+static const char * version_str = "1.16 20261018";
 
 #define BPI (signed)(sizeof(int))
 
 #define RB_MODE_DESC 3
 #define RWB_MODE_DATA 2
 #define RB_DESC_LEN 4
+#define RWB_CMD_LEN 10
+
+#define MAX_QD 16               /* sg driver queues at most 16 per fd */
+#define CMP_CHUNK 4096          /* memcmp() this much at a time */
 
 /*  The microcode in a SCSI device is _not_ modified by doing a WRITE BUFFER
  *  with mode set to "data" (0x2) as done by this utility. Therefore this
@@ -72,12 +86,38 @@ static bool do_quick = false;
 static int addwrite  = 0;
 static int addread   = 0;
 static int verbose   = 0;
+static bool do_stress = false;
+static int qd = 1;
+static int duration = -1;       /* seconds, -1 -> not given */
+static uint64_t seed = 0;
+static bool seed_given = false;
+
+struct st_slot {        /* one write/read pair in --stress mode */
+        bool reading;           /* WRITE BUFFER done, READ BUFFER issued */
+        uint32_t offset;        /* of this slot's slice of device buffer */
+        uint64_t pat_seed;      /* pattern now in wbuf came from this */
+        int64_t cmd_start;
+        int64_t pair_start;
+        uint8_t * wbuf;
+        uint8_t * rbuf;
+        uint8_t cdb[RWB_CMD_LEN];
+        uint8_t sense[32];
+        struct sg_io_hdr io_hdr;
+};
+
+static struct sg_lat_hist wr_lat;       /* latencies in microseconds */
+static struct sg_lat_hist rd_lat;
+static struct sg_lat_hist pair_lat;
 
 static struct option long_options[] = {
+        {"duration", required_argument, 0, 'D'},
         {"help", no_argument, 0, 'h'},
+        {"qd", required_argument, 0, 'Q'},
         {"quick", no_argument, 0, 'q'},
         {"addrd", required_argument, 0, 'r'},
+        {"seed", required_argument, 0, 'e'},
         {"size", required_argument, 0, 's'},
+        {"stress", no_argument, 0, 'S'},
         {"times", required_argument, 0, 't'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
@@ -344,27 +384,366 @@ int write_buffer (int sg_fd, unsigned ssize)
         return res;
 }
 
+/* Returns a monotonic time in microseconds, or 0 if not available */
+static int64_t
+now_usecs(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+        struct timespec ts;
+
+        if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+                return 0;
+        return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#else
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return ((int64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+#endif
+}
+
+static void
+lat_line(const char * name, const struct sg_lat_hist * hp)
+{
+        if (hp->num < 1)
+                return;
+        printf("  %-16s %8" PRId64 " %8" PRId64 " %8" PRId64 " %8" PRId64
+               " %8" PRId64 " %8" PRId64 " %8" PRId64 "\n", name, hp->min,
+               hp->sum / hp->num, sg_lat_pc(hp, 50.0), sg_lat_pc(hp, 90.0),
+               sg_lat_pc(hp, 99.0), sg_lat_pc(hp, 99.9), hp->max);
+}
+
+/* Fills 'len' bytes at 'bp' with the pattern that follows from 'pseed' */
+static void
+st_fill(uint8_t * bp, int len, uint64_t pseed)
+{
+        int k;
+        uint64_t s = pseed ? pseed : 0x9e3779b97f4a7c15ULL;
+        uint64_t v;
+
+        for (k = 0; (k + 8) <= len; k += 8) {
+                v = sg_xorshift64s(&s);
+                memcpy(bp + k, &v, 8);
+        }
+        if (k < len) {
+                v = sg_xorshift64s(&s);
+                memcpy(bp + k, &v, len - k);
+        }
+}
+
+/* Returns the offset of the first byte that differs, or -1 if the 'len'
+ * bytes are the same. The C library's memcmp() uses vector instructions
+ * where it can, so it does the bulk of the work; only a chunk that
+ * differs is scanned a byte at a time. */
+static int
+st_cmp(uint8_t * bf1, uint8_t * bf2, int len)
+{
+        int k, n;
+
+        for (k = 0; k < len; k += n) {
+                n = ((len - k) < CMP_CHUNK) ? (len - k) : CMP_CHUNK;
+                if (memcmp(bf1 + k, bf2 + k, n))
+                        return k + mymemcmp(bf1 + k, bf2 + k, n);
+        }
+        return -1;
+}
+
+/* Issues the next command (WRITE BUFFER or READ BUFFER) of the pair held
+ * in 'sp'. When 'sync' is true uses the SG_IO ioctl so the command has
+ * completed on return, otherwise queues it with write(2). Returns 0 if
+ * ok, else -1 . */
+static int
+st_submit(int sg_fd, struct st_slot * sp, bool sync)
+{
+        bool wr = ! sp->reading;
+        int k;
+        struct sg_io_hdr * hp = &sp->io_hdr;
+
+        memset(sp->cdb, 0, sizeof(sp->cdb));
+        sp->cdb[0] = wr ? WRITE_BUFFER : READ_BUFFER;
+        sp->cdb[1] = RWB_MODE_DATA;
+        sg_put_unaligned_be24(sp->offset, sp->cdb + 3);
+        sg_put_unaligned_be24((uint32_t)size, sp->cdb + 6);
+        memset(hp, 0, sizeof(struct sg_io_hdr));
+        hp->interface_id = 'S';
+        hp->cmd_len = sizeof(sp->cdb);
+        hp->mx_sb_len = sizeof(sp->sense);
+        hp->dxfer_direction = wr ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
+        hp->dxfer_len = size;
+        hp->dxferp = wr ? sp->wbuf : sp->rbuf;
+        hp->cmdp = sp->cdb;
+        hp->sbp = sp->sense;
+        hp->usr_ptr = sp;
+        hp->timeout = 60000;     /* 60000 millisecs == 60 seconds */
+        if (verbose > 2) {
+                pr2serr("    %s buffer [mode data] cdb: ", wr ? "write" :
+                        "read");
+                for (k = 0; k < (int)sizeof(sp->cdb); ++k)
+                        pr2serr("%02x ", sp->cdb[k]);
+                pr2serr("\n");
+        }
+        sp->cmd_start = now_usecs();
+        if (sync) {
+                if (ioctl(sg_fd, SG_IO, hp) < 0) {
+                        perror(wr ? ME "SG_IO WRITE BUFFER data error" :
+                                    ME "SG_IO READ BUFFER data error");
+                        return -1;
+                }
+                return 0;
+        }
+        while (write(sg_fd, hp, sizeof(struct sg_io_hdr)) < 0) {
+                if (EINTR != errno) {
+                        perror(wr ? ME "write(sg) WRITE BUFFER error" :
+                                    ME "write(sg) READ BUFFER error");
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+/* Waits for any queued command to complete and returns its slot, or NULL
+ * on error. */
+static struct st_slot *
+st_collect(int sg_fd)
+{
+        struct st_slot * sp;
+        struct sg_io_hdr io_hdr;
+        struct pollfd pfd;
+
+        while (1) {
+                memset(&io_hdr, 0, sizeof(io_hdr));
+                io_hdr.interface_id = 'S';
+                io_hdr.pack_id = -1;
+                if (read(sg_fd, &io_hdr, sizeof(io_hdr)) >= 0)
+                        break;
+                if (EAGAIN == errno) {
+                        pfd.fd = sg_fd;
+                        pfd.events = POLLIN;
+                        pfd.revents = 0;
+                        poll(&pfd, 1, -1);
+                } else if (EINTR != errno) {
+                        perror(ME "read(sg) error");
+                        return NULL;
+                }
+        }
+        sp = (struct st_slot *)io_hdr.usr_ptr;
+        sp->io_hdr = io_hdr;
+        return sp;
+}
+
+/* Generates a new pattern for 'sp' and issues its WRITE BUFFER */
+static int
+st_start_pair(int sg_fd, struct st_slot * sp, int64_t num, bool sync)
+{
+        sp->reading = false;
+        sp->pat_seed = seed ^ ((uint64_t)(num + 1) * 0x9e3779b97f4a7c15ULL);
+        st_fill(sp->wbuf, size, sp->pat_seed);
+        sp->pair_start = now_usecs();
+        return st_submit(sg_fd, sp, sync);
+}
+
+static void
+st_show_diff(const struct st_slot * sp, int diff)
+{
+        int i;
+
+        printf(ME "miscompare at buffer offset %u, pattern seed 0x%" PRIx64
+               "\n", sp->offset, sp->pat_seed);
+        printf("Differ at pos %i/%i:\n", diff, size);
+        for (i = 0; i < 24 && i+diff < size; i++)
+                printf(" %02x", sp->wbuf[i+diff]);
+        printf("\n");
+        for (i = 0; i < 24 && i+diff < size; i++)
+                printf(" %02x", sp->rbuf[i+diff]);
+        printf("\n");
+}
+
+/* Keeps up to 'qd' write/read pairs in flight for 'times' pairs or for
+ * 'duration' seconds (whichever ends first), each pair owning a separate
+ * slice of the device's data buffer. Every pair writes a fresh pattern,
+ * reads it back and compares. Returns 0 if all went well, else an exit
+ * status. */
+static int
+do_stress_test(int sg_fd, int times)
+{
+        bool sync;
+        int k, res, diff, slot_sz, max_slots, inflight;
+        int ret = 0;
+        int64_t start, now, deadline, issued, pairs, miscmp;
+        double secs;
+        struct st_slot * sp;
+        struct st_slot * slots = NULL;
+
+        slot_sz = size;
+        if ((buf_granul >= 24) || (0 == size))
+                max_slots = 1;  /* 0xff: only offset 0 is permitted */
+        else {
+                slot_sz = ((size + (1 << buf_granul) - 1) >> buf_granul) <<
+                          buf_granul;
+                max_slots = buf_capacity / slot_sz;
+                if (max_slots < 1)
+                        max_slots = 1;
+        }
+        if (qd > max_slots) {
+                pr2serr(ME "device buffer only has room for %d slice%s of %d "
+                        "bytes, reducing qd to %d\n", max_slots,
+                        ((1 == max_slots) ? "" : "s"), slot_sz, max_slots);
+                qd = max_slots;
+        }
+        sync = (1 == qd);
+        slots = (struct st_slot *)calloc(qd, sizeof(struct st_slot));
+        if (NULL == slots) {
+                pr2serr(ME "out of memory\n");
+                return sg_convert_errno(ENOMEM);
+        }
+        for (k = 0; k < qd; ++k) {
+                slots[k].offset = (uint32_t)k * slot_sz;
+                slots[k].wbuf = (uint8_t *)malloc(size);
+                slots[k].rbuf = (uint8_t *)malloc(size);
+                if ((NULL == slots[k].wbuf) || (NULL == slots[k].rbuf)) {
+                        pr2serr(ME "out of memory\n");
+                        ret = sg_convert_errno(ENOMEM);
+                        goto fini;
+                }
+        }
+        if (! seed_given)
+                seed = ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid();
+        if (verbose)
+                printf("Stress: size=%d, qd=%d, seed=0x%" PRIx64 "\n", size,
+                       qd, seed);
+
+        issued = 0;
+        pairs = 0;
+        miscmp = 0;
+        inflight = 0;
+        start = now_usecs();
+        deadline = (duration > 0) ? start + ((int64_t)duration * 1000000) :
+                                    0;
+        for (k = 0; (k < qd) && ((times <= 0) || (issued < times)); ++k) {
+                if (st_start_pair(sg_fd, slots + k, issued, sync)) {
+                        ret = SG_LIB_CAT_OTHER;
+                        break;
+                }
+                ++issued;
+                ++inflight;
+        }
+        while (inflight > 0) {
+                if (sync)
+                        sp = slots;     /* SG_IO already completed it */
+                else {
+                        sp = st_collect(sg_fd);
+                        if (NULL == sp) {
+                                ret = SG_LIB_CAT_OTHER;
+                                break;  /* close() discards the others */
+                        }
+                }
+                now = now_usecs();
+                sg_lat_add(sp->reading ? &rd_lat : &wr_lat,
+                           now - sp->cmd_start);
+                res = sg_err_category3(&sp->io_hdr);
+                if ((SG_LIB_CAT_CLEAN != res) &&
+                    (SG_LIB_CAT_RECOVERED != res)) {
+                        sg_chk_n_print3(sp->reading ?
+                                        "READ BUFFER data error" :
+                                        "WRITE BUFFER data error",
+                                        &sp->io_hdr, true);
+                        if (0 == ret)
+                                ret = (res > 0) ? res : SG_LIB_CAT_OTHER;
+                        --inflight;
+                        continue;
+                }
+                if (! sp->reading) {
+                        sp->reading = true;
+                        if (st_submit(sg_fd, sp, sync)) {
+                                ret = SG_LIB_CAT_OTHER;
+                                --inflight;
+                        }
+                        continue;
+                }
+                sg_lat_add(&pair_lat, now - sp->pair_start);
+                ++pairs;
+                --inflight;
+                diff = st_cmp(sp->wbuf, sp->rbuf, size);
+                if (diff >= 0) {
+                        if ((0 == miscmp) || verbose)
+                                st_show_diff(sp, diff);
+                        ++miscmp;
+                }
+                if (ret || ((times > 0) && (issued >= times)) ||
+                    ((deadline > 0) && (now >= deadline)))
+                        continue;
+                if (st_start_pair(sg_fd, sp, issued, sync)) {
+                        ret = SG_LIB_CAT_OTHER;
+                        continue;
+                }
+                ++issued;
+                ++inflight;
+        }
+        secs = (double)(now_usecs() - start) / 1000000.0;
+
+        printf("Stress: %" PRId64 " write/read pairs of %d bytes, qd=%d, "
+               "in %.2f secs\n", pairs, size, qd, secs);
+        if (secs > 0.0)
+                printf("  %.2f MB/s (write plus read), %.1f pairs/sec\n",
+                       (2.0 * size * pairs) / (secs * 1000000.0),
+                       pairs / secs);
+        printf("  %" PRId64 " miscompare%s, seed=0x%" PRIx64 "\n", miscmp,
+               ((1 == miscmp) ? "" : "s"), seed);
+        if (pair_lat.num > 0) {
+                printf("Latency (usecs):        min     mean      p50      "
+                       "p90      p99    p99.9      max\n");
+                lat_line("WRITE BUFFER", &wr_lat);
+                lat_line("READ BUFFER", &rd_lat);
+                lat_line("write+read pair", &pair_lat);
+        }
+        if ((0 == ret) && miscmp)
+                ret = SG_LIB_CAT_MALFORMED;
+fini:
+        for (k = 0; k < qd; ++k) {
+                if (slots[k].wbuf)
+                        free(slots[k].wbuf);
+                if (slots[k].rbuf)
+                        free(slots[k].rbuf);
+        }
+        free(slots);
+        return ret;
+}
+
 void usage ()
 {
-        printf ("Usage: sg_test_rwbuf [--addrd=AR] [--addwr=AW] [--help] "
-                "[--quick]\n");
-        printf ("                     --size=SZ [--times=NUM] [--verbose] "
-                "[--version]\n"
-                "                     DEVICE\n"
+        printf ("Usage: sg_test_rwbuf [--addrd=AR] [--addwr=AW] "
+                "[--duration=SECS] [--help]\n"
+                "                     [--qd=QD] [--quick] [--seed=SEED] "
+                "--size=SZ [--stress]\n");
+        printf ("                     [--times=NUM] [--verbose] "
+                "[--version] DEVICE\n"
                 " or\n"
                 "       sg_test_rwbuf DEVICE SZ [AW] [AR]\n");
         printf ("  where:\n"
                 "    --addrd=AR|-r    extra bytes to fetch during READ "
                 "BUFFER\n"
                 "    --addwr=AW|-w    extra bytes to send to WRITE BUFFER\n"
+                "    --duration=SECS|-D    with --stress: stop after SECS "
+                "seconds (def: 10\n"
+                "                          when --times not given)\n"
                 "    --help|-l        output this usage message then exit\n"
+                "    --qd=QD|-Q       with --stress: write/read pairs in "
+                "flight (def: 1,\n"
+                "                     max: %d; more than 1 needs an sg "
+                "device)\n"
                 "    --quick|-q       output read buffer size then exit\n"
+                "    --seed=SEED|-e   with --stress: seed for the random "
+                "patterns (def:\n"
+                "                     from time of day)\n"
                 "    --size=SZ|-s     size of buffer (in bytes) to write "
                 "then read back\n"
+                "    --stress|-S      sustained stress: fresh pattern each "
+                "pair, report\n"
+                "                     throughput and latency\n"
                 "    --times=NUM|-t   number of times to run test "
                 "(default 1)\n"
                 "    --verbose|-v     increase verbosity of output\n"
-                "    --version|-V     output version then exit\n");
+                "    --version|-V     output version then exit\n", MAX_QD);
         printf ("\nWARNING: If you access the device at the same time, e.g. "
                 "because it's a\n");
         printf (" mounted hard disk, the device's buffer may be used by the "
@@ -372,7 +751,7 @@ void usage ()
         printf (" for other data at the same time, and overwriting it may or "
                 "may not\n");
         printf (" cause data corruption!\n");
-        printf ("(c) Douglas Gilbert, Kurt Garloff, 2000-2007, GNU GPL\n");
+        printf ("(c) Douglas Gilbert, Kurt Garloff, 2000-2026, GNU GPL\n");
 }
 
 
@@ -383,23 +762,50 @@ int main (int argc, char * argv[])
         int times = 1;
         int ret = 0;
         int k = 0;
+        bool times_given = false;
+        int64_t ll;
+        struct stat st;
 
         while (1) {
                 int option_index = 0;
                 int c;
 
-                c = getopt_long(argc, argv, "hqr:s:t:w:vV",
+                c = getopt_long(argc, argv, "D:e:hqQ:r:s:St:w:vV",
                                 long_options, &option_index);
                 if (c == -1)
                         break;
 
                 switch (c) {
+                case 'D':
+                        duration = sg_get_num(optarg);
+                        if (duration < 0) {
+                                pr2serr("bad argument to '--duration'\n");
+                                return SG_LIB_SYNTAX_ERROR;
+                        }
+                        break;
+                case 'e':
+                        ll = sg_get_llnum(optarg);
+                        if (-1 == ll) {
+                                pr2serr("bad argument to '--seed'\n");
+                                return SG_LIB_SYNTAX_ERROR;
+                        }
+                        seed = (uint64_t)ll;
+                        seed_given = true;
+                        break;
                 case 'h':
                         usage();
                         return 0;
                 case 'q':
                         do_quick = true;
                         break;
+                case 'Q':
+                        qd = sg_get_num(optarg);
+                        if ((qd < 1) || (qd > MAX_QD)) {
+                                pr2serr("'--qd' should be from 1 to %d\n",
+                                        MAX_QD);
+                                return SG_LIB_SYNTAX_ERROR;
+                        }
+                        break;
                 case 'r':
                         addread = sg_get_num(optarg);
                         if (-1 == addread) {
@@ -414,12 +820,16 @@ int main (int argc, char * argv[])
                                 return SG_LIB_SYNTAX_ERROR;
                         }
                         break;
+                case 'S':
+                        do_stress = true;
+                        break;
                 case 't':
                         times = sg_get_num(optarg);
                         if (-1 == times) {
                                 pr2serr("bad argument to '--times'\n");
                                 return SG_LIB_SYNTAX_ERROR;
                         }
+                        times_given = true;
                         break;
                 case 'v':
                         verbose++;
@@ -490,12 +900,41 @@ int main (int argc, char * argv[])
                 usage();
                 return SG_LIB_SYNTAX_ERROR;
         }
+        if (do_stress) {
+                if (addread || addwrite) {
+                        pr2serr("'--addrd' and '--addwr' can't be used with "
+                                "'--stress'\n");
+                        return SG_LIB_SYNTAX_ERROR;
+                }
+                if (duration < 0)
+                        duration = times_given ? 0 : 10;
+                if (! times_given)
+                        times = 0;      /* only stop on duration */
+                else if ((times < 1) && (0 == duration)) {
+                        pr2serr("'--stress' needs '--times' or "
+                                "'--duration' greater than 0\n");
+                        return SG_LIB_SYNTAX_ERROR;
+                }
+        } else if ((qd > 1) || (duration >= 0) || seed_given) {
+                pr2serr("'--duration', '--qd' and '--seed' need "
+                        "'--stress'\n");
+                return SG_LIB_SYNTAX_ERROR;
+        }
 
         sg_fd = open(device_name, O_RDWR | O_NONBLOCK);
         if (sg_fd < 0) {
                 perror("sg_test_rwbuf: open error");
                 return SG_LIB_FILE_ERROR;
         }
+        if (do_stress && (qd > 1)) {
+                if ((fstat(sg_fd, &st) < 0) || (! S_ISCHR(st.st_mode)) ||
+                    (SCSI_GENERIC_MAJOR != major(st.st_rdev))) {
+                        pr2serr(ME "'--qd' greater than 1 needs an sg "
+                                "device\n");
+                        ret = SG_LIB_FILE_ERROR;
+                        goto err_out;
+                }
+        }
         ret = find_out_about_buffer(sg_fd);
         if (ret)
                 goto err_out;
@@ -511,6 +950,10 @@ int main (int argc, char * argv[])
                 goto err_out;
         }
 
+        if (do_stress) {
+                ret = do_stress_test(sg_fd, times);
+                goto err_out;
+        }
         cmpbuf = (uint8_t *)malloc(size);
         for (k = 0; k < times; ++k) {
                 ret = write_buffer (sg_fd, size);
@@ -536,7 +979,7 @@ err_out:
         }
         if ((0 == ret) && (! do_quick))
                 printf ("Success\n");
-        else if (times > 1)
+        else if ((times > 1) && (! do_stress))
                 printf ("Failed after %d successful cycles\n", k);
         return (ret >= 0) ? ret : SG_LIB_CAT_OTHER;
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2000-2018 D. Gilbert
+ * Copyright (C) 2000-2026 D. Gilbert
  * This program is free software; you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
  * the Free Software Foundation; either version 2, or (at your option)
@@ -11,9 +11,17 @@
  * This program sends a user specified number of TEST UNIT READY ("tur")
  * commands to the given sg device. Since TUR is a simple command involing
  * no data transfer (and no REQUEST SENSE command iff the unit is ready)
- * then this can be used for timing per SCSI command overheads.
+ * then this can be used for timing per SCSI command overheads. With
+ * '--time' given twice the latency of each command is recorded in a log
+ * linear histogram and percentiles are reported. When several devices
+ * are given (or '--all') one TUR is sent to each of them concurrently and
+ * their states are reported.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1   /* for versionsort() */
+#endif
+
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -23,6 +31,8 @@
 #include <string.h>
 #include <errno.h>
 #include <getopt.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -35,13 +45,20 @@
 #include <sys/time.h>
 #endif
 
+#ifdef SG_LIB_LINUX
+#include <pthread.h>
+#include <glob.h>
+#include <dirent.h>
+#define SWEEP_SUPPORTED 1
+#endif
+
 #include "sg_lib.h"
 #include "sg_cmds_basic.h"
 #include "sg_pt.h"
 #include "sg_pr2serr.h"
 
 
-static const char * version_str = "3.40 20180321";
+static const char * version_str = "3.42 20261018";
 
 #if defined(MSC_VER) || defined(__MINGW32__)
 #define HAVE_MS_SLEEP
@@ -56,9 +73,17 @@ static const char * version_str = "3.40 20180321";
 
 #define DEF_PT_TIMEOUT  60       /* 60 seconds */
 
+#define DEF_SWEEP_TIMEOUT 10    /* seconds, per device when sweeping */
+#define SWEEP_GRACE 5           /* seconds beyond that for a hung open */
+#define MAX_SWEEP_JOBS 256
+#define SG_SYSFS_CLASS "/sys/class/scsi_generic"
+
 
 static struct option long_options[] = {
+        {"all", no_argument, 0, 'a'},
         {"help", no_argument, 0, 'h'},
+        {"interval", required_argument, 0, 'i'},
+        {"jobs", required_argument, 0, 'j'},
         {"low", no_argument, 0, 'l'},
         {"new", no_argument, 0, 'N'},
         {"number", required_argument, 0, 'n'},
@@ -67,21 +92,28 @@ static struct option long_options[] = {
         {"old", no_argument, 0, 'O'},
         {"progress", no_argument, 0, 'p'},
         {"time", no_argument, 0, 't'},
+        {"timeout", required_argument, 0, 'T'},
         {"verbose", no_argument, 0, 'v'},
         {"version", no_argument, 0, 'V'},
         {0, 0, 0, 0},
 };
 
 struct opts_t {
+    bool do_all;
     bool do_low;
     bool do_progress;
-    bool do_time;
     bool do_version;
     bool opts_new;
     int do_help;
+    int do_interval;
+    int do_jobs;
     int do_number;
+    int do_time;
+    int do_timeout;
     int do_verbose;
-    const char * device_name;
+    int num_devs;               /* number of DEVICE arguments */
+    const char * device_name;   /* first DEVICE argument */
+    char ** dev_argv;           /* all DEVICE arguments */
 };
 
 struct loop_res_t {
@@ -90,17 +122,45 @@ struct loop_res_t {
     int ret;
 };
 
+struct lat_t {          /* per command latencies, in microseconds */
+    bool on;
+    struct sg_lat_hist h;
+    int64_t prev;       /* latency of previous command */
+    double sum_diff;    /* of |latency - previous latency| */
+    /* per interval, for --interval=SECS */
+    int64_t start;
+    int64_t int_start;
+    int64_t int_num;
+    int64_t int_min;
+    int64_t int_max;
+    int64_t int_sum;
+    int int_errs;
+};
+
+static struct lat_t lat_stats;
+
 
 static void
 usage()
 {
-    printf("Usage: sg_turs [--help] [--low] [--number=NUM] [--num=NUM] "
-           "[--progress]\n"
-           "               [--time] [--verbose] [--version] DEVICE\n"
+    printf("Usage: sg_turs [--help] [--interval=SECS] [--low] [--number=NUM] "
+           "[--num=NUM]\n"
+           "               [--progress] [--time] [--verbose] [--version] "
+           "DEVICE\n"
+           "       sg_turs [--all] [--jobs=J] [--time] [--timeout=SECS] "
+           "[--verbose]\n"
+           "               [DEVICE...]\n"
            "  where:\n"
+           "    --all|-a         sweep all sg devices (in " SG_SYSFS_CLASS
+           ")\n"
            "    --help|-h        print usage message then exit\n"
+           "    --interval=SECS|-i SECS    output command latencies every "
+           "SECS seconds\n"
            "    --low|-l         use low level (sg_pt) interface for "
            "speed\n"
+           "    --jobs=J|-j J    when sweeping, TURs in flight at once "
+           "(def: one per\n"
+           "                     device, up to %d)\n"
            "    --number=NUM|-n NUM    number of test_unit_ready commands "
            "(def: 1)\n"
            "    --num=NUM|-n NUM       same action as '--number=NUM'\n"
@@ -109,9 +169,18 @@ usage()
            "if available\n"
            "    --time|-t        outputs total duration and commands per "
            "second\n"
+           "                     twice: also per command latency "
+           "percentiles;\n"
+           "                     thrice: also the latency histogram\n"
+           "    --timeout=SECS|-T SECS    when sweeping, command timeout "
+           "per device\n"
+           "                              (def: %d seconds)\n"
            "    --verbose|-v     increase verbosity\n"
            "    --version|-V     print version string then exit\n\n"
-           "Performs a SCSI TEST UNIT READY command (or many of them).\n");
+           "Performs a SCSI TEST UNIT READY command (or many of them). "
+           "Given more than\none DEVICE (or a quoted wildcard) or --all, "
+           "sends one TUR to each device\nconcurrently and reports the state "
+           "of each.\n", MAX_SWEEP_JOBS, DEF_SWEEP_TIMEOUT);
 }
 
 static void
@@ -150,16 +219,38 @@ new_parse_cmd_line(struct opts_t * op, int argc, char * argv[])
     while (1) {
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "hln:NOptvV", long_options,
+        c = getopt_long(argc, argv, "ahi:j:ln:NOptT:vV", long_options,
                         &option_index);
         if (c == -1)
             break;
 
         switch (c) {
+        case 'a':
+            op->do_all = true;
+            break;
         case 'h':
         case '?':
             ++op->do_help;
             break;
+        case 'i':
+            n = sg_get_num(optarg);
+            if (n <= 0) {
+                pr2serr("bad argument to '--interval='\n");
+                usage();
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            op->do_interval = n;
+            break;
+        case 'j':
+            n = sg_get_num(optarg);
+            if ((n <= 0) || (n > MAX_SWEEP_JOBS)) {
+                pr2serr("argument to '--jobs=' should be from 1 to %d\n",
+                        MAX_SWEEP_JOBS);
+                usage();
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            op->do_jobs = n;
+            break;
         case 'l':
             op->do_low = true;
             break;
@@ -181,7 +272,16 @@ new_parse_cmd_line(struct opts_t * op, int argc, char * argv[])
             op->do_progress = true;
             break;
         case 't':
-            op->do_time = true;
+            ++op->do_time;
+            break;
+        case 'T':
+            n = sg_get_num(optarg);
+            if (n <= 0) {
+                pr2serr("bad argument to '--timeout='\n");
+                usage();
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            op->do_timeout = n;
             break;
         case 'v':
             ++op->do_verbose;
@@ -200,13 +300,8 @@ new_parse_cmd_line(struct opts_t * op, int argc, char * argv[])
     if (optind < argc) {
         if (NULL == op->device_name) {
             op->device_name = argv[optind];
-            ++optind;
-        }
-        if (optind < argc) {
-            for (; optind < argc; ++optind)
-                pr2serr("Unexpected extra argument: %s\n", argv[optind]);
-            usage();
-            return SG_LIB_SYNTAX_ERROR;
+            op->dev_argv = argv + optind;
+            op->num_devs = argc - optind;
         }
     }
     return 0;
@@ -239,7 +334,7 @@ old_parse_cmd_line(struct opts_t * op, int argc, char * argv[])
                     op->do_progress = true;
                     break;
                 case 't':
-                    op->do_time = true;
+                    ++op->do_time;
                     break;
                 case 'v':
                     ++op->do_verbose;
@@ -306,14 +401,117 @@ parse_cmd_line(struct opts_t * op, int argc, char * argv[])
     return res;
 }
 
+/* Returns a monotonic time in microseconds, or 0 if not available */
+static int64_t
+now_usecs(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        return 0;
+    return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+#elif defined(HAVE_GETTIMEOFDAY)
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((int64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+#else
+    return 0;
+#endif
+}
+
+static void
+lat_interval_out(struct lat_t * lp, int64_t now)
+{
+    double t = (double)(now - lp->start) / 1000000.0;
+
+    if (lp->int_num > 0)
+        printf("  t=%.3f: %" PRId64 " cmds, %d errors; latency usecs: "
+               "min=%" PRId64 " avg=%" PRId64 " max=%" PRId64 "\n", t,
+               lp->int_num, lp->int_errs, lp->int_min,
+               lp->int_sum / lp->int_num, lp->int_max);
+    else
+        printf("  t=%.3f: 0 cmds\n", t);
+    lp->int_start = now;
+    lp->int_num = 0;
+    lp->int_min = 0;
+    lp->int_max = 0;
+    lp->int_sum = 0;
+    lp->int_errs = 0;
+}
+
+/* Called after each command with its start time and when it finished */
+static void
+lat_add(struct lat_t * lp, const struct opts_t * op, int64_t start,
+        int64_t end, bool err)
+{
+    int64_t v = end - start;
+
+    if (v < 0)
+        v = 0;
+    if (lp->h.num > 0)
+        lp->sum_diff += (v > lp->prev) ? (v - lp->prev) : (lp->prev - v);
+    lp->prev = v;
+    sg_lat_add(&lp->h, v);
+    if (op->do_interval <= 0)
+        return;
+    if ((0 == lp->int_num) || (v < lp->int_min))
+        lp->int_min = v;
+    if (v > lp->int_max)
+        lp->int_max = v;
+    lp->int_sum += v;
+    ++lp->int_num;
+    if (err)
+        ++lp->int_errs;
+    if ((end - lp->int_start) >= ((int64_t)op->do_interval * 1000000))
+        lat_interval_out(lp, end);
+}
+
+static void
+lat_report(const struct lat_t * lp, const struct opts_t * op)
+{
+    int k;
+    int64_t lo;
+    const struct sg_lat_hist * hp = &lp->h;
+
+    if (hp->num < 1)
+        return;
+    printf("Latency (usecs) over %" PRId64 " commands:\n", hp->num);
+    printf("  min=%" PRId64 " p50=%" PRId64 " p90=%" PRId64 " p99=%" PRId64
+           " p99.9=%" PRId64 " max=%" PRId64 "\n", hp->min,
+           sg_lat_pc(hp, 50.0), sg_lat_pc(hp, 90.0), sg_lat_pc(hp, 99.0),
+           sg_lat_pc(hp, 99.9), hp->max);
+    /* jitter: mean difference between successive latencies (RFC 3550) */
+    printf("  mean=%.1f jitter=%.1f\n", (double)hp->sum / hp->num,
+           (hp->num > 1) ? (lp->sum_diff / (hp->num - 1)) : 0.0);
+    if (op->do_time < 3)
+        return;
+    printf("Latency histogram (usecs):\n");
+    for (k = 0, lo = 0; k < SG_LAT_BKTS; lo = sg_lat_bkt_top(k) + 1, ++k) {
+        if (0 == hp->bkt[k])
+            continue;
+        printf("  %10" PRId64 " .. %-10" PRId64 " %12" PRId64 " %6.2f%%\n",
+               lo, sg_lat_bkt_top(k), hp->bkt[k],
+               (100.0 * hp->bkt[k]) / hp->num);
+    }
+}
+
 /* Returns number of TURs performed */
 static int
-loop_turs(int sg_fd, struct loop_res_t * resp, struct opts_t * op)
+loop_turs(int sg_fd, struct loop_res_t * resp, struct lat_t * lp,
+          struct opts_t * op)
 {
     int k, res;
     int vb = op->do_verbose;
+    int64_t t_start = 0;
     char b[80];
 
+    if (lp->on) {
+        lp->start = now_usecs();
+        lp->int_start = lp->start;
+    }
+
     if (op->do_low) {
         int err, rs, n, sense_cat;
         struct sg_pt_base * pbp;
@@ -331,7 +529,12 @@ loop_turs(int sg_fd, struct loop_res_t * resp, struct opts_t * op)
             memset(cdb, 0, sizeof(cdb));    /* TUR's cdb is 6 zeros */
             set_scsi_pt_cdb(pbp, cdb, sizeof(cdb));
             set_scsi_pt_sense(pbp, sense_b, sizeof(sense_b));
+            if (lp->on)
+                t_start = now_usecs();
             rs = do_scsi_pt(pbp, -1, DEF_PT_TIMEOUT, vb);
+            if (lp->on)
+                lat_add(lp, op, t_start, now_usecs(),
+                        (0 != rs) || (0 != get_scsi_pt_status_response(pbp)));
             n = sg_cmds_process_resp(pbp, "Test unit ready", rs,
                                      SG_NO_DATA_IN, sense_b,
                                      (0 == k), vb, &sense_cat);
@@ -376,7 +579,11 @@ loop_turs(int sg_fd, struct loop_res_t * resp, struct opts_t * op)
     } else {
         for (k = 0; k < op->do_number; ++k) {
             /* Might get Unit Attention on first invocation */
+            if (lp->on)
+                t_start = now_usecs();
             res = sg_ll_test_unit_ready(sg_fd, k, (0 == k), vb);
+            if (lp->on)
+                lat_add(lp, op, t_start, now_usecs(), (0 != res));
             if (res) {
                 ++resp->num_errs;
                 resp->ret = res;
@@ -396,6 +603,362 @@ loop_turs(int sg_fd, struct loop_res_t * resp, struct opts_t * op)
     }
 }
 
+#ifdef SWEEP_SUPPORTED
+
+enum sweep_state {
+    SW_PENDING = 0,
+    SW_BUSY,            /* a worker has it, TUR (or open) under way */
+    SW_READY,
+    SW_NOT_READY,
+    SW_UA,
+    SW_OPEN_ERR,
+    SW_OS_ERR,
+    SW_OTHER,           /* some other sense category, in 'cat' */
+};
+
+struct sweep_dev {
+    const char * name;
+    enum sweep_state state;
+    int cat;            /* SG_LIB_CAT_* or errno for SW_OPEN_ERR/OS_ERR */
+    int64_t usecs;      /* time for open and TUR */
+};
+
+/* Shared by main and the workers, on the heap since workers that hang
+ * in the kernel may outlive sweep_turs(). The last reference frees it. */
+struct sweep_t {
+    bool stop;          /* set when main has stopped waiting */
+    int refs;           /* main plus each worker still running */
+    int num;
+    int next;           /* next device for a worker to take */
+    int num_done;
+    const struct opts_t * op;
+    struct sweep_dev * devs;
+    glob_t gl;          /* holds the device names */
+    pthread_mutex_t mutex;
+    pthread_cond_t cv;
+};
+
+/* Drops a reference to sp, freeing it (and the device names) when that
+ * was the last one. */
+static void
+sweep_put(struct sweep_t * sp)
+{
+    int refs;
+
+    pthread_mutex_lock(&sp->mutex);
+    refs = --sp->refs;
+    pthread_mutex_unlock(&sp->mutex);
+    if (refs > 0)
+        return;
+    pthread_cond_destroy(&sp->cv);
+    pthread_mutex_destroy(&sp->mutex);
+    if (sp->devs)
+        free(sp->devs);
+    globfree(&sp->gl);
+    free(sp);
+}
+
+static void
+sweep_tur(struct sweep_dev * dp, const struct opts_t * op)
+{
+    int fd, rs, n, sense_cat;
+    int vb = (op->do_verbose > 1) ? (op->do_verbose - 1) : 0;
+    struct sg_pt_base * pbp;
+    uint8_t cdb[6];
+    uint8_t sense_b[32];
+
+    fd = sg_cmds_open_device(dp->name, true /* ro */, vb);
+    if (fd < 0) {
+        dp->state = SW_OPEN_ERR;
+        dp->cat = -fd;
+        return;
+    }
+    pbp = construct_scsi_pt_obj_with_fd(fd, vb);
+    if ((NULL == pbp) || get_scsi_pt_os_err(pbp)) {
+        dp->state = SW_OS_ERR;
+        dp->cat = pbp ? get_scsi_pt_os_err(pbp) : ENOMEM;
+        goto fini;
+    }
+    memset(cdb, 0, sizeof(cdb));        /* TUR's cdb is 6 zeros */
+    set_scsi_pt_cdb(pbp, cdb, sizeof(cdb));
+    set_scsi_pt_sense(pbp, sense_b, sizeof(sense_b));
+    rs = do_scsi_pt(pbp, -1, op->do_timeout, vb);
+    n = sg_cmds_process_resp(pbp, "Test unit ready", rs, SG_NO_DATA_IN,
+                             sense_b, false, vb, &sense_cat);
+    if (-1 == n) {
+        dp->state = SW_OS_ERR;
+        dp->cat = get_scsi_pt_os_err(pbp);
+    } else if (-2 == n) {
+        switch (sense_cat) {
+        case SG_LIB_CAT_RECOVERED:
+        case SG_LIB_CAT_NO_SENSE:
+            dp->state = SW_READY;
+            break;
+        case SG_LIB_CAT_NOT_READY:
+            dp->state = SW_NOT_READY;
+            break;
+        case SG_LIB_CAT_UNIT_ATTENTION:
+            dp->state = SW_UA;
+            break;
+        default:
+            dp->state = SW_OTHER;
+            dp->cat = sense_cat;
+            break;
+        }
+    } else
+        dp->state = SW_READY;
+fini:
+    if (pbp)
+        destruct_scsi_pt_obj(pbp);
+    sg_cmds_close_device(fd);
+}
+
+static void *
+sweep_worker(void * v_sp)
+{
+    int k;
+    int64_t t_start;
+    struct sweep_t * sp = (struct sweep_t *)v_sp;
+    struct sweep_dev a_dev;
+
+    while (1) {
+        if (pthread_mutex_lock(&sp->mutex))
+            break;
+        k = sp->next;
+        if ((k < sp->num) && (! sp->stop)) {
+            ++sp->next;
+            sp->devs[k].state = SW_BUSY;
+            a_dev = sp->devs[k];
+        } else
+            k = sp->num;
+        pthread_mutex_unlock(&sp->mutex);
+        if (k >= sp->num)
+            break;
+        t_start = now_usecs();
+        sweep_tur(&a_dev, sp->op);
+        a_dev.usecs = now_usecs() - t_start;
+        pthread_mutex_lock(&sp->mutex);
+        if (! sp->stop) {   /* else main has already reported it as hung */
+            sp->devs[k] = a_dev;
+            ++sp->num_done;
+            pthread_cond_signal(&sp->cv);
+        }
+        pthread_mutex_unlock(&sp->mutex);
+    }
+    sweep_put(sp);
+    return NULL;
+}
+
+/* Adds the sg devices found in sysfs to 'gp' */
+static int
+sweep_scan_sysfs(glob_t * gp, int vb)
+{
+    int k, res;
+    char b[300];
+    struct dirent ** namelist = NULL;
+
+    res = scandir(SG_SYSFS_CLASS, &namelist, NULL, versionsort);
+    if (res < 0) {
+        pr2serr("unable to scan %s: %s\n", SG_SYSFS_CLASS,
+                safe_strerror(errno));
+        return sg_convert_errno(errno);
+    }
+    for (k = 0; k < res; ++k) {
+        if ('.' != namelist[k]->d_name[0]) {
+            snprintf(b, sizeof(b), "/dev/%s", namelist[k]->d_name);
+            /* glob() of a name without wildcards just appends it */
+            if (glob(b, GLOB_NOCHECK | (gp->gl_pathc ? GLOB_APPEND : 0),
+                     NULL, gp)) {
+                pr2serr("out of memory listing devices\n");
+                break;
+            }
+        }
+        free(namelist[k]);
+    }
+    if (k < res) {
+        for ( ; k < res; ++k)
+            free(namelist[k]);
+        free(namelist);
+        return sg_convert_errno(ENOMEM);
+    }
+    free(namelist);
+    if (vb)
+        pr2serr("%d sg devices found in %s\n", (int)gp->gl_pathc,
+                SG_SYSFS_CLASS);
+    return 0;
+}
+
+/* Sends one TEST UNIT READY to each device, up to op->do_jobs at once,
+ * then reports the state of each device in the order given. Returns 0 if
+ * all are ready, else the exit status for the first device that is not. */
+static int
+sweep_turs(struct opts_t * op)
+{
+    int k, n, res, status, num_thr, per_thr;
+    int ret = 0;
+    int cnt[SW_OTHER + 1];
+    int64_t wait_ms;
+    const char * cp;
+    pthread_t * thrs = NULL;
+    struct sweep_dev * dp;
+    struct timespec deadline;
+    struct sweep_t * sp;
+    char b[128];
+
+    memset(cnt, 0, sizeof(cnt));
+    sp = (struct sweep_t *)calloc(1, sizeof(struct sweep_t));
+    if (NULL == sp) {
+        pr2serr("out of memory\n");
+        return sg_convert_errno(ENOMEM);
+    }
+    sp->refs = 1;
+    pthread_mutex_init(&sp->mutex, NULL);
+    pthread_cond_init(&sp->cv, NULL);
+    if (op->do_all && (ret = sweep_scan_sysfs(&sp->gl, op->do_verbose)))
+        goto fini;
+    for (k = 0; k < op->num_devs; ++k) {
+        /* a quoted wildcard avoids the shell's argument length limit */
+        res = glob(op->dev_argv[k], GLOB_NOCHECK |
+                   (sp->gl.gl_pathc ? GLOB_APPEND : 0), NULL, &sp->gl);
+        if (res) {
+            pr2serr("out of memory listing devices\n");
+            ret = sg_convert_errno(ENOMEM);
+            goto fini;
+        }
+    }
+    sp->num = sp->gl.gl_pathc;
+    if (0 == sp->num) {
+        pr2serr("no devices found\n");
+        goto fini;
+    }
+    sp->op = op;
+    sp->devs = (struct sweep_dev *)calloc(sp->num, sizeof(struct sweep_dev));
+    num_thr = op->do_jobs ? op->do_jobs : MAX_SWEEP_JOBS;
+    if (num_thr > sp->num)
+        num_thr = sp->num;
+    thrs = (pthread_t *)calloc(num_thr, sizeof(pthread_t));
+    if ((NULL == sp->devs) || (NULL == thrs)) {
+        pr2serr("out of memory\n");
+        ret = sg_convert_errno(ENOMEM);
+        goto fini;
+    }
+    for (k = 0; k < sp->num; ++k)
+        sp->devs[k].name = sp->gl.gl_pathv[k];
+
+    /* Each worker may need to wait out a timeout for each of its devices,
+     * plus some grace for a hung open or a slow abort */
+    per_thr = (sp->num + num_thr - 1) / num_thr;
+    wait_ms = (int64_t)per_thr * (op->do_timeout + SWEEP_GRACE) * 1000;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_ms / 1000;
+    for (k = 0; k < num_thr; ++k) {
+        pthread_mutex_lock(&sp->mutex);
+        ++sp->refs;             /* dropped by the worker as it exits */
+        pthread_mutex_unlock(&sp->mutex);
+        status = pthread_create(thrs + k, NULL, sweep_worker, sp);
+        if (status) {
+            pthread_mutex_lock(&sp->mutex);
+            --sp->refs;
+            pthread_mutex_unlock(&sp->mutex);
+            pr2serr("pthread_create: %s\n", safe_strerror(status));
+            if (0 == k) {
+                ret = sg_convert_errno(status);
+                goto fini;
+            }
+            num_thr = k;    /* carry on with the threads we have */
+            break;
+        }
+    }
+    if (op->do_verbose)
+        pr2serr("sweeping %d devices with %d threads, timeout %d seconds\n",
+                sp->num, num_thr, op->do_timeout);
+
+    pthread_mutex_lock(&sp->mutex);
+    while (sp->num_done < sp->num) {
+        status = pthread_cond_timedwait(&sp->cv, &sp->mutex, &deadline);
+        if (ETIMEDOUT == status)
+            break;
+    }
+    /* workers still out no longer touch sp->devs */
+    sp->stop = true;
+    n = sp->num_done;
+    pthread_mutex_unlock(&sp->mutex);
+
+    for (k = 0; k < sp->num; ++k) {
+        dp = sp->devs + k;
+        res = 0;
+        switch (dp->state) {
+        case SW_READY:
+            cp = "ready";
+            break;
+        case SW_NOT_READY:
+            cp = "not ready";
+            res = SG_LIB_CAT_NOT_READY;
+            break;
+        case SW_UA:
+            cp = "unit attention";
+            res = SG_LIB_CAT_UNIT_ATTENTION;
+            break;
+        case SW_OPEN_ERR:
+            snprintf(b, sizeof(b), "open error: %s", safe_strerror(dp->cat));
+            cp = b;
+            res = sg_convert_errno(dp->cat);
+            break;
+        case SW_OS_ERR:
+            snprintf(b, sizeof(b), "pass-through error: %s",
+                     safe_strerror(dp->cat));
+            cp = b;
+            res = sg_convert_errno(dp->cat);
+            break;
+        case SW_OTHER:
+            sg_get_category_sense_str(dp->cat, sizeof(b), b, 0);
+            cp = b;
+            res = dp->cat;
+            break;
+        case SW_BUSY:
+            cp = "no response (hung?)";
+            res = SG_LIB_CAT_TIMEOUT;
+            break;
+        case SW_PENDING:
+        default:
+            cp = "not tried (timed out)";
+            res = SG_LIB_CAT_TIMEOUT;
+            break;
+        }
+        ++cnt[(dp->state <= SW_OTHER) ? dp->state : SW_PENDING];
+        if (op->do_time && (SW_BUSY != dp->state) &&
+            (SW_PENDING != dp->state))
+            printf("%s: %s  [%" PRId64 ".%03d ms]\n", dp->name, cp,
+                   dp->usecs / 1000, (int)(dp->usecs % 1000));
+        else
+            printf("%s: %s\n", dp->name, cp);
+        if ((0 == ret) && (SW_READY != dp->state))
+            ret = res;
+    }
+    printf("Swept %d devices: %d ready, %d not ready, %d unit attention, %d "
+           "other errors,\n  %d no response\n", sp->num, cnt[SW_READY],
+           cnt[SW_NOT_READY], cnt[SW_UA],
+           cnt[SW_OPEN_ERR] + cnt[SW_OS_ERR] + cnt[SW_OTHER],
+           sp->num - n);
+    if (n < sp->num) {
+        /* some workers are stuck in the kernel, don't wait for them; the
+         * last of them to finish (if any do before exit) frees sp */
+        for (k = 0; k < num_thr; ++k)
+            pthread_detach(thrs[k]);
+        free(thrs);
+        sweep_put(sp);
+        fflush(stdout);
+        exit((ret >= 0) ? ret : SG_LIB_CAT_OTHER);
+    }
+    for (k = 0; k < num_thr; ++k)
+        pthread_join(thrs[k], NULL);
+fini:
+    if (thrs)
+        free(thrs);
+    sweep_put(sp);
+    return ret;
+}
+#endif  /* SWEEP_SUPPORTED */
 
 int
 main(int argc, char * argv[])
@@ -411,6 +974,7 @@ main(int argc, char * argv[])
 #endif
     struct loop_res_t loop_res;
     struct loop_res_t * resp = &loop_res;
+    struct lat_t * lp = &lat_stats;
     struct opts_t opts;
     struct opts_t * op = &opts;
 
@@ -430,6 +994,23 @@ main(int argc, char * argv[])
         return 0;
     }
 
+    if (op->do_all || (op->num_devs > 1) ||
+        (op->device_name && strpbrk(op->device_name, "*?["))) {
+        if (op->do_progress || (op->do_number > 1) || op->do_low ||
+            op->do_interval) {
+            pr2serr("--low, --number=, --interval= and --progress can not be "
+                    "used when\nsweeping several devices\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+#ifdef SWEEP_SUPPORTED
+        if (0 == op->do_timeout)
+            op->do_timeout = DEF_SWEEP_TIMEOUT;
+        return sweep_turs(op);
+#else
+        pr2serr("sweeping several devices is only supported on Linux\n");
+        return SG_LIB_SYNTAX_ERROR;
+#endif
+    }
     if (NULL == op->device_name) {
         pr2serr("No DEVICE argument given\n");
         usage_for(op);
@@ -482,7 +1063,14 @@ main(int argc, char * argv[])
         start_tm_valid = false;
 #endif
 
-        num_done = loop_turs(sg_fd, resp, op);
+        if ((op->do_time > 1) || (op->do_interval > 0)) {
+            lp->on = (now_usecs() > 0);
+            if (! lp->on)
+                pr2serr("no clock available, so no latencies\n");
+        }
+        num_done = loop_turs(sg_fd, resp, lp, op);
+        if (lp->on && (op->do_interval > 0) && (lp->int_num > 0))
+            lat_interval_out(lp, now_usecs());
 
         if (op->do_time && start_tm_valid) {
 #if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
@@ -519,6 +1107,8 @@ main(int argc, char * argv[])
             } else
                 printf("Recorded 0 or less elapsed microseconds ??\n");
         }
+        if (lp->on)
+            lat_report(lp, op);
         if (((op->do_number > 1) || (resp->num_errs > 0)) &&
             (! resp->reported))
             printf("Completed %d Test Unit Ready commands with %d errors\n",
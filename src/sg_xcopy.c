@@ -41,6 +41,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <signal.h>
+#include <pthread.h>
 #include <ctype.h>
 #include <errno.h>
 #include <limits.h>
@@ -49,6 +50,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/file.h>
 #include <sys/sysmacros.h>
 #ifndef major
@@ -64,11 +66,12 @@
 #include "sg_lib.h"
 #include "sg_cmds_basic.h"
 #include "sg_cmds_extra.h"
+#include "sg_pt.h"
 #include "sg_io_linux.h"
 #include "sg_unaligned.h"
 #include "sg_pr2serr.h"
 
-static const char * version_str = "0.63 20180219";
+static const char * version_str = "0.66 20261018";
 
 #define ME "sg_xcopy: "
 
@@ -79,6 +82,8 @@ static const char * version_str = "0.63 20180219";
 #define DEF_BLOCK_SIZE 512
 #define DEF_BLOCKS_PER_TRANSFER 128
 #define MAX_BLOCKS_PER_TRANSFER 65535
+#define XCOPY_HDR_LEN 16        /* parameter list header */
+#define B2B_SEG_DESC_LEN 28     /* block to block segment descriptor */
 
 #define DEF_MODE_RESP_LEN 252
 #define RW_ERR_RECOVERY_MP 1
@@ -158,6 +163,16 @@ static const char * version_str = "0.63 20180219";
 
 #define MIN_RESERVED_SIZE 8192
 
+#define MAX_NUM_THREADS 64
+
+#define ODX_ROD_TOKEN_LEN 512   /* ROD token in WRITE USING TOKEN */
+#define ODX_RANGE_DESC_LEN 16   /* block device range descriptor */
+#define DEF_ODX_TOKENS 4        /* WRITE USING TOKENs in flight */
+#define MAX_ODX_TOKENS 64
+#define DEF_ODX_BLOCKS_PER_TOKEN 0x200000       /* if not in 3PC VPD */
+#define ODX_MAX_POLL_MS 1000
+#define ODX_MIN_POLL_MS 10
+
 #define MAX_UNIT_ATTENTIONS 10
 #define MAX_ABORTED_CMDS 256
 
@@ -190,6 +205,9 @@ struct xcopy_fp_t {
     dev_t devno;
     uint32_t min_bytes;
     uint32_t max_bytes;
+    uint32_t max_segs;          /* maximum segment descriptor count */
+    uint32_t max_desc_len;      /* maximum descriptor list length */
+    uint32_t max_conc;          /* maximum concurrent copies */
     int64_t num_sect;
     char fname[INOUTF_SZ];
 };
@@ -197,6 +215,56 @@ struct xcopy_fp_t {
 static struct xcopy_fp_t ixcf;
 static struct xcopy_fp_t oxcf;
 
+struct xcopy_op_t {     /* shared by all stripes, constant during copy */
+    int fd;             /* EXTENDED COPY commands sent via this fd */
+    int seg_desc_type;
+    int segs_per_cmd;
+    int bpt;
+    int src_desc_len;
+    int dst_desc_len;
+    uint8_t * src_desc;
+    uint8_t * dst_desc;
+};
+
+struct xcopy_stripe_t { /* one per stripe, each with its own list id */
+    const struct xcopy_op_t * op;
+    int index;
+    int res;
+    int num_xcopy;
+    int num_segs;
+    uint8_t list_id;
+    int64_t start_blk;  /* first block of stripe, relative to skip */
+    int64_t num_blks;
+    int64_t src_lba;    /* next block to copy from IFILE */
+    int64_t dst_lba;    /* next block to copy to OFILE */
+    int64_t rem_blks;
+};
+
+/* protects dd_count, in_full and xc_stop once stripe threads start */
+static pthread_mutex_t xc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool xc_stop = false;
+
+struct odx_slot_t {     /* one per ROD token in flight */
+    bool busy;
+    bool have_tok;              /* token populated, not yet deleted */
+    uint32_t wut_list_id;       /* of WRITE USING TOKEN being polled */
+    uint32_t est_delay_ms;      /* from last RRTI */
+    int64_t src_lba;
+    int64_t dst_lba;
+    int64_t num_blks;           /* represented by token */
+    int64_t done_blks;          /* written using token so far */
+    uint8_t token[ODX_ROD_TOKEN_LEN];
+};
+
+struct odx_status_t {   /* decoded RECEIVE ROD TOKEN INFORMATION */
+    int cstat;                  /* copy operation status */
+    int xc_status;              /* SCSI status of the copy operation */
+    uint32_t est_delay_ms;
+    int64_t xfer_count;         /* in blocks */
+    bool have_token;
+    uint8_t token[ODX_ROD_TOKEN_LEN];
+};
+
 static const char * read_cap_str = "Read capacity";
 static const char * rec_copy_op_params_str = "Receive copy operating "
                                              "parameters";
@@ -364,6 +432,11 @@ dd_filetype(struct xcopy_fp_t * fp)
 
     if ((1 == len) && ('.' == fp->fname[0]))
         return FT_DEV_NULL;
+    if (0 == strncmp(fp->fname, SG_LOOP_DEV_PREFIX,
+                     sizeof(SG_LOOP_DEV_PREFIX) - 1)) {
+        fp->devno = 0;
+        return FT_SG;       /* user space loopback */
+    }
     if (stat(fp->fname, &st) < 0)
         return FT_ERROR;
     if (S_ISCHR(st.st_mode)) {
@@ -518,10 +591,11 @@ primary_help:
             "[iflag=FLAGS]\n"
             "                [list_id=ID] [obs=BS] [of=OFILE] "
             "[oflag=FLAGS] [prio=PRIO]\n"
-            "                [seek=SEEK] [skip=SKIP] [time=0|1] "
-            "[verbose=VERB]\n"
-            "                [--help] [--on_dst|--on_src] [--verbose] "
-            "[--version]\n\n"
+            "                [seek=SEEK] [segs=SEGS] [skip=SKIP] [thr=THR] "
+            "[time=0|1]\n"
+            "                [tokens=NT] [verbose=VERB]\n"
+            "                [--help] [--odx] [--on_dst|--on_src] "
+            "[--verbose] [--version]\n\n"
             "  where:\n"
             "    app         if argument is 1 then open OFILE in append "
             "mode\n"
@@ -550,18 +624,33 @@ primary_help:
             "OFILE\n"
             "    prio        set xcopy priority field to PRIO (def: 1)\n"
             "    seek        block position to start writing to OFILE\n"
+            "    segs        maximum segment descriptors per xcopy command "
+            "(def: 0\n"
+            "                -> as many as copy manager allows)\n"
             "    skip        block position to start reading from IFILE\n"
+            "    thr         split copy into THR stripes, each copied by "
+            "its own\n"
+            "                concurrent xcopy with list_id ID+stripe (def: "
+            "1)\n"
             "    time        0->no timing(def), 1->time plus calculate "
             "throughput\n"
+            "    tokens      with --odx: number of ROD tokens written at "
+            "the same\n"
+            "                time (def: 4)\n"
             "    verbose     0->quiet(def), 1->some noise, 2->more noise, "
             "etc\n"
             "    --help|-h   print out this usage message then exit\n"
+            "    --odx       token based copy: POPULATE TOKEN + WRITE USING "
+            "TOKEN;\n"
+            "                not with bpt=, segs=, thr=, --on_dst or "
+            "--on_src\n"
             "    --on_dst    send XCOPY command to OFILE\n"
             "    --on_src    send XCOPY command to IFILE\n"
             "    --verbose|-v   same action as verbose=1\n"
             "    --version|-V   print version information then exit\n\n"
             "Copy from IFILE to OFILE, similar to dd command; "
-            "but using the SCSI\nEXTENDED COPY (XCOPY(LID1)) command. For "
+            "but using the SCSI\nEXTENDED COPY (XCOPY(LID1)) command (or "
+            "with --odx: POPULATE TOKEN\nand WRITE USING TOKEN). For "
             "list of flags, use '-hh'.\n");
     return;
 
@@ -608,34 +697,52 @@ scsi_encode_seg_desc(uint8_t *seg_desc, int seg_desc_type,
     return seg_desc_len + 4;
 }
 
+/* Sends one EXTENDED COPY(LID1) command holding 'num_segs' segment
+ * descriptors which together copy 'num_blk' blocks. Each segment copies
+ * at most 'bpt' blocks, the last one may be shorter. */
 static int
 scsi_extended_copy(int sg_fd, uint8_t list_id,
                    uint8_t *src_desc, int src_desc_len,
                    uint8_t *dst_desc, int dst_desc_len,
-                   int seg_desc_type, int64_t num_blk,
+                   int seg_desc_type, int num_segs, int bpt, int64_t num_blk,
                    uint64_t src_lba, uint64_t dst_lba)
 {
-    uint8_t xcopyBuff[256];
-    int desc_offset = 16;
-    int seg_desc_len;
-    int verb, res;
+    int desc_offset = XCOPY_HDR_LEN;
+    int seg_desc_len = 0;
+    int k, n, verb, res;
+    int xcopy_len = XCOPY_HDR_LEN + src_desc_len + dst_desc_len +
+                    (num_segs * B2B_SEG_DESC_LEN);
+    uint8_t * xcopyBuff;
     char b[80];
 
     verb = (verbose > 1) ? (verbose - 2) : 0;
-    memset(xcopyBuff, 0, 256);
+    xcopyBuff = (uint8_t *)calloc(xcopy_len, 1);
+    if (NULL == xcopyBuff) {
+        pr2serr("Xcopy(LID1): out of memory\n");
+        return sg_convert_errno(ENOMEM);
+    }
     xcopyBuff[0] = list_id;
     xcopyBuff[1] = (list_id_usage << 3) | priority;
-    xcopyBuff[2] = 0;
-    xcopyBuff[3] = src_desc_len + dst_desc_len; /* Two target descriptors */
+    /* Two target descriptors */
+    sg_put_unaligned_be16(src_desc_len + dst_desc_len, xcopyBuff + 2);
     memcpy(xcopyBuff + desc_offset, src_desc, src_desc_len);
     desc_offset += src_desc_len;
     memcpy(xcopyBuff + desc_offset, dst_desc, dst_desc_len);
     desc_offset += dst_desc_len;
-    seg_desc_len = scsi_encode_seg_desc(xcopyBuff + desc_offset,
-                                        seg_desc_type, num_blk,
-                                        src_lba, dst_lba);
-    xcopyBuff[11] = seg_desc_len; /* One segment descriptor */
-    desc_offset += seg_desc_len;
+    for (k = 0; (k < num_segs) && (num_blk > 0); ++k) {
+        n = (num_blk > bpt) ? bpt : (int)num_blk;
+        res = scsi_encode_seg_desc(xcopyBuff + desc_offset, seg_desc_type,
+                                   n, src_lba, dst_lba);
+        desc_offset += res;
+        seg_desc_len += res;
+        src_lba += n;
+        dst_lba += n;
+        num_blk -= n;
+    }
+    sg_put_unaligned_be32(seg_desc_len, xcopyBuff + 8);
+    if (verbose > 1)
+        pr2serr("    Xcopy(LID1): %d segment descriptor%s, list_id=%d\n", k,
+                ((k > 1) ? "s" : ""), list_id);
     /* set noisy so if a UA happens it will be printed to stderr */
     res = sg_ll_3party_copy_out(sg_fd, SA_XCOPY_LID1, list_id,
                                 DEF_GROUP_NUM, DEF_3PC_OUT_TIMEOUT,
@@ -644,6 +751,493 @@ scsi_extended_copy(int sg_fd, uint8_t list_id,
         sg_get_category_sense_str(res, sizeof(b), b, verb);
         pr2serr("Xcopy(LID1): %s\n", b);
     }
+    free(xcopyBuff);
+    return res;
+}
+
+static void
+stripe_advance(struct xcopy_stripe_t * sp, int segs, int64_t blks)
+{
+    sp->src_lba += blks;
+    sp->dst_lba += blks;
+    sp->rem_blks -= blks;
+    sp->num_segs += segs;
+    pthread_mutex_lock(&xc_mutex);
+    in_full += blks;
+    dd_count -= blks;
+    pthread_mutex_unlock(&xc_mutex);
+}
+
+/* Called after an EXTENDED COPY for stripe 'sp' (of 'num_segs' segments
+ * and 'num_blk' blocks) has failed. Fetches the copy status held for the
+ * stripe's list identifier and moves the stripe past the segments that
+ * completed, so the final report shows how far each stripe got. */
+static void
+stripe_copy_status(struct xcopy_stripe_t * sp, int num_segs, int64_t num_blk)
+{
+    int res, verb, cm_status, segs_done;
+    int64_t blks;
+    uint8_t rcBuff[12];
+    char b[80];
+
+    if (3 == list_id_usage)     /* list id disabled: nothing to query */
+        return;
+    verb = (verbose > 1) ? (verbose - 2) : 0;
+    memset(rcBuff, 0, sizeof(rcBuff));
+    res = sg_ll_receive_copy_results(sp->op->fd, SA_COPY_STATUS_LID1,
+                                     sp->list_id, rcBuff, sizeof(rcBuff),
+                                     false, verb);
+    if (res) {
+        sg_get_category_sense_str(res, sizeof(b), b, verb);
+        pr2serr("  stripe %d, list_id=%d: copy status: %s\n", sp->index,
+                sp->list_id, b);
+        return;
+    }
+    cm_status = rcBuff[4] & 0x7f;
+    segs_done = sg_get_unaligned_be16(rcBuff + 5);
+    pr2serr("  stripe %d, list_id=%d: copy manager status: %s, %d of %d "
+            "segments processed\n", sp->index, sp->list_id,
+            ((0 == cm_status) ? "in progress" :
+             ((1 == cm_status) ? "completed" :
+              ((2 == cm_status) ? "completed with errors" : "reserved"))),
+            segs_done, num_segs);
+    /* the segment being processed when the error occurred is counted */
+    if ((1 != cm_status) && (segs_done > 0))
+        --segs_done;
+    if (segs_done > num_segs)
+        segs_done = num_segs;
+    blks = (int64_t)segs_done * sp->op->bpt;
+    if (blks > num_blk)
+        blks = num_blk;
+    if (blks > 0)
+        stripe_advance(sp, segs_done, blks);
+}
+
+/* Copies one stripe with as few EXTENDED COPY commands as the segment
+ * limits allow. Runs as a thread when thr= is greater than 1. Stops early
+ * if another stripe has failed. */
+static void *
+copy_stripe(void * v_sp)
+{
+    bool stop;
+    int n;
+    int64_t num_blk;
+    struct xcopy_stripe_t * sp = (struct xcopy_stripe_t *)v_sp;
+    const struct xcopy_op_t * op = sp->op;
+
+    while (sp->rem_blks > 0) {
+        pthread_mutex_lock(&xc_mutex);
+        stop = xc_stop;
+        pthread_mutex_unlock(&xc_mutex);
+        if (stop)
+            break;
+        num_blk = (int64_t)op->segs_per_cmd * op->bpt;
+        if (num_blk > sp->rem_blks)
+            num_blk = sp->rem_blks;
+        n = (int)((num_blk + op->bpt - 1) / op->bpt);
+        sp->res = scsi_extended_copy(op->fd, sp->list_id, op->src_desc,
+                                     op->src_desc_len, op->dst_desc,
+                                     op->dst_desc_len, op->seg_desc_type,
+                                     n, op->bpt, num_blk, sp->src_lba,
+                                     sp->dst_lba);
+        ++sp->num_xcopy;
+        if (sp->res) {
+            pthread_mutex_lock(&xc_mutex);
+            xc_stop = true;
+            pthread_mutex_unlock(&xc_mutex);
+            stripe_copy_status(sp, n, num_blk);
+            break;
+        }
+        stripe_advance(sp, n, num_blk);
+    }
+    return sp;
+}
+
+/* Sends RECEIVE ROD TOKEN INFORMATION for 'list_id' and decodes the
+ * response into 'osp' (including the ROD token if one is returned). Blocks
+ * counts are converted from the transfer count units. Returns 0 on
+ * success. */
+static int
+odx_rrti(int sg_fd, uint32_t list_id, int bs, struct odx_status_t * osp)
+{
+    int res, verb, len, off;
+    uint8_t rb[1024];
+    char b[80];
+
+    verb = (verbose > 1) ? (verbose - 2) : 0;
+    memset(rb, 0, sizeof(rb));
+    memset(osp, 0, sizeof(*osp));
+    res = sg_ll_receive_copy_results(sg_fd, SA_ROD_TOK_INFO, list_id, rb,
+                                     sizeof(rb), true, verb);
+    if (res) {
+        sg_get_category_sense_str(res, sizeof(b), b, verb);
+        pr2serr("Receive ROD token information, list_id=%u: %s\n", list_id,
+                b);
+        return res;
+    }
+    len = sg_get_unaligned_be32(rb + 0) + 4;
+    if (len > (int)sizeof(rb))
+        len = sizeof(rb);
+    if (len < 32) {
+        pr2serr("Receive ROD token information response too short\n");
+        return SG_LIB_CAT_MALFORMED;
+    }
+    osp->cstat = rb[5] & 0x7f;
+    osp->est_delay_ms = sg_get_unaligned_be32(rb + 8);
+    osp->xc_status = rb[12];
+    osp->xfer_count = (int64_t)sg_get_unaligned_be64(rb + 16);
+    switch (rb[15]) {           /* transfer count units */
+    case 0xf1:                  /* logical blocks */
+        break;
+    case 0x0:                   /* bytes */
+        osp->xfer_count /= bs;
+        break;
+    default:                    /* kibibytes, mebibytes ... */
+        if (rb[15] < 7)
+            osp->xfer_count = (osp->xfer_count << (10 * rb[15])) / bs;
+        break;
+    }
+    off = 32 + rb[13];          /* skip sense data */
+    if ((off + 6 + ODX_ROD_TOKEN_LEN) <= len) {
+        if (sg_get_unaligned_be32(rb + off) >= (2 + ODX_ROD_TOKEN_LEN)) {
+            memcpy(osp->token, rb + off + 6, ODX_ROD_TOKEN_LEN);
+            osp->have_token = true;
+        }
+    }
+    if (verbose > 2)
+        pr2serr("    RRTI list_id=%u: copy status=0x%x, scsi status=0x%x, "
+                "transfer count=%" PRId64 "\n", list_id, osp->cstat,
+                osp->xc_status, osp->xfer_count);
+    return 0;
+}
+
+/* POPULATE TOKEN (not immediate) on 'sg_fd' covering 'num_blks' from
+ * 'lba', then fetches the ROD token into 'token'. Returns 0 on success. */
+static int
+odx_populate(int sg_fd, uint32_t list_id, int bs, int64_t lba,
+             int64_t num_blks, uint8_t * token)
+{
+    int res, verb;
+    uint8_t pl[16 + ODX_RANGE_DESC_LEN];
+    struct odx_status_t ost;
+    char b[80];
+
+    verb = (verbose > 1) ? (verbose - 2) : 0;
+    memset(pl, 0, sizeof(pl));
+    sg_put_unaligned_be16(sizeof(pl) - 2, pl + 0);
+    /* inactivity timeout and ROD type of 0 leave choice to copy manager */
+    sg_put_unaligned_be16(ODX_RANGE_DESC_LEN, pl + 14);
+    sg_put_unaligned_be64((uint64_t)lba, pl + 16);
+    sg_put_unaligned_be32((uint32_t)num_blks, pl + 24);
+    res = sg_ll_3party_copy_out(sg_fd, SA_POP_TOK, list_id, DEF_GROUP_NUM,
+                                DEF_3PC_OUT_TIMEOUT, pl, sizeof(pl), true,
+                                verb);
+    if (res) {
+        sg_get_category_sense_str(res, sizeof(b), b, verb);
+        pr2serr("Populate token, lba=%" PRId64 ": %s\n", lba, b);
+        return res;
+    }
+    res = odx_rrti(sg_fd, list_id, bs, &ost);
+    if (res)
+        return res;
+    if (! ost.have_token) {
+        pr2serr("Populate token, lba=%" PRId64 ": no ROD token returned "
+                "(copy status=0x%x)\n", lba, ost.cstat);
+        return SG_LIB_CAT_OTHER;
+    }
+    memcpy(token, ost.token, ODX_ROD_TOKEN_LEN);
+    return 0;
+}
+
+/* WRITE USING TOKEN with the IMMED bit set, so the copy proceeds in the
+ * background and is polled with RRTI. Writes 'num_blks' at 'lba' from
+ * 'rod_off' blocks into the ROD. With 'del_tkn' the command is instead
+ * sent without IMMED to delete the token, normally with 'num_blks' of 0:
+ * a partial completion may need the token again, so it is only deleted
+ * once its range is written. Returns 0 on success. */
+static int
+odx_write_using_token(int sg_fd, uint32_t list_id, const uint8_t * token,
+                      int64_t rod_off, int64_t lba, int64_t num_blks,
+                      bool del_tkn)
+{
+    int res, verb;
+    uint8_t pl[536 + ODX_RANGE_DESC_LEN];
+    char b[80];
+
+    verb = (verbose > 1) ? (verbose - 2) : 0;
+    memset(pl, 0, sizeof(pl));
+    sg_put_unaligned_be16(sizeof(pl) - 2, pl + 0);
+    pl[2] = del_tkn ? 0x2 : 0x1;        /* DEL_TKN or IMMED */
+    sg_put_unaligned_be64((uint64_t)rod_off, pl + 8);
+    memcpy(pl + 16, token, ODX_ROD_TOKEN_LEN);
+    sg_put_unaligned_be16(ODX_RANGE_DESC_LEN, pl + 534);
+    sg_put_unaligned_be64((uint64_t)lba, pl + 536);
+    sg_put_unaligned_be32((uint32_t)num_blks, pl + 544);
+    res = sg_ll_3party_copy_out(sg_fd, SA_WR_USING_TOK, list_id,
+                                DEF_GROUP_NUM, DEF_3PC_OUT_TIMEOUT, pl,
+                                sizeof(pl), true, verb);
+    if (res) {
+        sg_get_category_sense_str(res, sizeof(b), b, verb);
+        pr2serr("Write using token, lba=%" PRId64 ": %s\n", lba, b);
+    }
+    return res;
+}
+
+/* Returns the blocks, of the 'left' asked for, that a finished WRITE
+ * USING TOKEN wrote according to its RRTI status 'osp'. Only a partial
+ * completion (ROD token usage) or a terminated copy reports fewer than
+ * all of them, as its transfer count; failures report none. */
+static int64_t
+odx_wut_blks(const struct odx_status_t * osp, int64_t left)
+{
+    if (osp->xc_status)
+        return 0;
+    switch (osp->cstat) {
+    case 0x1:                   /* completed without errors */
+    case 0x4:                   /* ... with residual data */
+        return left;
+    case 0x3:                   /* ... with partial ROD token usage */
+    case 0x60:                  /* terminated */
+        if (osp->xfer_count <= 0)
+            return 0;
+        return (osp->xfer_count < left) ? osp->xfer_count : left;
+    default:
+        return 0;
+    }
+}
+
+/* After an error elsewhere, stops the WRITE USING TOKEN still in flight
+ * on 'osp' with COPY OPERATION ABORT and reports how far it got. Returns
+ * the number of blocks it wrote. */
+static int64_t
+odx_abort(int sg_fd, int bs, struct odx_slot_t * osp)
+{
+    int verb;
+    int64_t left = osp->num_blks - osp->done_blks;
+    int64_t n = 0;
+    struct odx_status_t ost;
+
+    verb = (verbose > 1) ? (verbose - 2) : 0;
+    /* fails harmlessly if the copy has just finished */
+    sg_ll_3party_copy_out(sg_fd, SA_COPY_ABORT, osp->wut_list_id,
+                          DEF_GROUP_NUM, DEF_3PC_OUT_TIMEOUT, NULL, 0, false,
+                          verb);
+    osp->busy = false;
+    if (odx_rrti(sg_fd, osp->wut_list_id, bs, &ost)) {
+        pr2serr("Write using token, lba=%" PRId64 ": status unknown after "
+                "abort\n", osp->dst_lba + osp->done_blks);
+        return 0;
+    }
+    if ((ost.cstat >= 0x10) && (ost.cstat <= 0x12))
+        pr2serr("Write using token, lba=%" PRId64 ": still in progress "
+                "after abort\n", osp->dst_lba + osp->done_blks);
+    else {
+        n = odx_wut_blks(&ost, left);
+        pr2serr("Write using token, lba=%" PRId64 ": stopped with copy "
+                "status=0x%x, %" PRId64 " of %" PRId64 " blocks written\n",
+                osp->dst_lba + osp->done_blks, ost.cstat, n, left);
+    }
+    osp->done_blks += n;
+    return n;
+}
+
+/* Fetches the Block Device ROD Token Limits descriptor from the Third
+ * Party Copy VPD page and returns a sensible number of blocks to place in
+ * each ROD token. */
+static int64_t
+odx_blocks_per_token(int sg_fd, int bs)
+{
+    int res, len, k, d_len;
+    int64_t n = 0;
+    uint64_t max_ttl = 0;
+    uint64_t opt_tc = 0;
+    uint8_t rb[4096];
+    const uint8_t * bp;
+
+    res = sg_ll_inquiry(sg_fd, false, true, VPD_3PARTY_COPY, rb, sizeof(rb),
+                        false, (verbose > 1) ? (verbose - 2) : 0);
+    if (0 == res) {
+        len = sg_get_unaligned_be16(rb + 2) + 4;
+        if (len > (int)sizeof(rb))
+            len = sizeof(rb);
+        for (k = 4; (k + 4) <= len; k += d_len) {
+            bp = rb + k;
+            d_len = sg_get_unaligned_be16(bp + 2) + 4;
+            if ((0 == sg_get_unaligned_be16(bp)) && ((k + 36) <= len)) {
+                max_ttl = sg_get_unaligned_be64(bp + 20);
+                opt_tc = sg_get_unaligned_be64(bp + 28);
+                break;
+            }
+        }
+    } else if (verbose)
+        pr2serr("  >> unable to fetch Third Party Copy VPD page\n");
+    n = opt_tc ? (int64_t)opt_tc : DEF_ODX_BLOCKS_PER_TOKEN;
+    if (max_ttl && ((uint64_t)n > max_ttl))
+        n = (int64_t)max_ttl;
+    if (n > UINT32_MAX)         /* range descriptor NUMBER OF BLOCKS */
+        n = UINT32_MAX;
+    if (verbose)
+        pr2serr("  >> ROD token limits: max transfer=%" PRIu64 ", optimal="
+                "%" PRIu64 ", using %" PRId64 " blocks (%d bytes each) per "
+                "token\n", max_ttl, opt_tc, n, bs);
+    return n;
+}
+
+/* Token based offloaded copy (ODX): POPULATE TOKEN on the source, then
+ * WRITE USING TOKEN (immediate) on the destination. Up to 'num_tok'
+ * tokens are written at the same time, each polled with RECEIVE ROD TOKEN
+ * INFORMATION. The data does not pass through this host. On an error the
+ * writes still in flight are aborted and reported. */
+static int
+odx_copy(int in_fd, int out_fd, int bs, int num_tok, uint32_t base_lid,
+         int64_t skip, int64_t seek, int * num_cmdsp)
+{
+    int k, res, busy, delay_ms;
+    uint32_t lid = base_lid;
+    int64_t n, blks_per_tok, left;
+    int64_t off = 0;                /* blocks handed to tokens so far */
+    int64_t total = dd_count;
+    struct odx_slot_t * slots;
+    struct odx_slot_t * osp;
+    struct odx_status_t ost;
+    struct timespec ts;
+
+    blks_per_tok = odx_blocks_per_token(in_fd, bs);
+    slots = (struct odx_slot_t *)calloc(num_tok, sizeof(struct odx_slot_t));
+    if (NULL == slots) {
+        pr2serr("odx_copy: out of memory\n");
+        return sg_convert_errno(ENOMEM);
+    }
+    res = 0;
+    while (1) {
+        /* keep every slot busy while there is more to copy */
+        for (k = 0, busy = 0; k < num_tok; ++k) {
+            osp = slots + k;
+            if ((! osp->busy) && (off < total)) {
+                n = total - off;
+                if (n > blks_per_tok)
+                    n = blks_per_tok;
+                osp->src_lba = skip + off;
+                osp->dst_lba = seek + off;
+                osp->num_blks = n;
+                osp->done_blks = 0;
+                res = odx_populate(in_fd, lid++, bs, osp->src_lba, n,
+                                   osp->token);
+                if (res)
+                    break;
+                osp->have_tok = true;
+                osp->wut_list_id = lid++;
+                res = odx_write_using_token(out_fd, osp->wut_list_id,
+                                            osp->token, 0, osp->dst_lba, n,
+                                            false);
+                if (res)
+                    break;
+                osp->busy = true;
+                osp->est_delay_ms = 0;
+                off += n;
+                *num_cmdsp += 2;
+            }
+            if (osp->busy)
+                ++busy;
+        }
+        if (res || (0 == busy))
+            break;
+        /* poll the writes, then back off by the shortest estimated delay */
+        delay_ms = ODX_MAX_POLL_MS;
+        for (k = 0; k < num_tok; ++k) {
+            osp = slots + k;
+            if (! osp->busy)
+                continue;
+            res = odx_rrti(out_fd, osp->wut_list_id, bs, &ost);
+            if (res)
+                break;
+            if ((ost.cstat >= 0x10) && (ost.cstat <= 0x12)) {
+                /* still in progress */
+                if ((int)ost.est_delay_ms < delay_ms)
+                    delay_ms = ost.est_delay_ms;
+                continue;
+            }
+            left = osp->num_blks - osp->done_blks;
+            n = odx_wut_blks(&ost, left);
+            if (0 == n) {
+                if (0x3 == ost.cstat)
+                    pr2serr("Write using token, lba=%" PRId64 ": partial "
+                            "completion with no progress\n",
+                            osp->dst_lba + osp->done_blks);
+                else
+                    pr2serr("Write using token, lba=%" PRId64 " failed: "
+                            "copy status=0x%x, scsi status=0x%x\n",
+                            osp->dst_lba + osp->done_blks, ost.cstat,
+                            ost.xc_status);
+                osp->busy = false;
+                res = SG_LIB_CAT_OTHER;
+                break;
+            }
+            osp->done_blks += n;
+            pthread_mutex_lock(&xc_mutex);
+            in_full += n;
+            dd_count -= n;
+            pthread_mutex_unlock(&xc_mutex);
+            if (osp->done_blks < osp->num_blks) {
+                /* partial ROD token usage: write the rest from the same
+                 * token, starting at the offset reached */
+                if (verbose)
+                    pr2serr("  >> token for lba=%" PRId64 " only wrote %"
+                            PRId64 " blocks, resuming\n", osp->src_lba,
+                            osp->done_blks);
+                osp->wut_list_id = lid++;
+                res = odx_write_using_token(out_fd, osp->wut_list_id,
+                                            osp->token, osp->done_blks,
+                                            osp->dst_lba + osp->done_blks,
+                                            osp->num_blks - osp->done_blks,
+                                            false);
+                if (res) {
+                    osp->busy = false;
+                    break;
+                }
+                ++*num_cmdsp;
+                delay_ms = ODX_MIN_POLL_MS;
+            } else {
+                osp->busy = false;
+                osp->have_tok = false;
+                odx_write_using_token(out_fd, lid++, osp->token, 0,
+                                      osp->dst_lba, 0, true);
+                ++*num_cmdsp;
+            }
+        }
+        if (res)
+            break;
+        if (delay_ms < ODX_MIN_POLL_MS)
+            delay_ms = ODX_MIN_POLL_MS;
+        for (k = 0; k < num_tok; ++k) {
+            if (slots[k].busy)
+                break;
+        }
+        if (k < num_tok) {      /* something still in progress */
+            ts.tv_sec = delay_ms / 1000;
+            ts.tv_nsec = (delay_ms % 1000) * 1000000;
+            nanosleep(&ts, NULL);
+        }
+    }
+    if (res) {
+        for (k = 0; k < num_tok; ++k) {
+            osp = slots + k;
+            if (osp->busy) {
+                n = odx_abort(out_fd, bs, osp);
+                ++*num_cmdsp;
+                pthread_mutex_lock(&xc_mutex);
+                in_full += n;
+                dd_count -= n;
+                pthread_mutex_unlock(&xc_mutex);
+            }
+            if (osp->have_tok) {
+                odx_write_using_token(out_fd, lid++, osp->token, 0,
+                                      osp->dst_lba, 0, true);
+                ++*num_cmdsp;
+            }
+        }
+    }
+    free(slots);
     return res;
 }
 
@@ -736,6 +1330,9 @@ scsi_operating_parameter(struct xcopy_fp_t *xfp, int is_target)
     max_segment_len = sg_get_unaligned_be32(rcBuff + 16);
     xfp->max_bytes = max_segment_len ? max_segment_len : UINT32_MAX;
     max_inline_data = sg_get_unaligned_be32(rcBuff + 20);
+    xfp->max_segs = max_segment_num;
+    xfp->max_desc_len = max_desc_len;
+    xfp->max_conc = rcBuff[36];
     if (verbose) {
         pr2serr(" >> %s response:\n", rec_copy_op_params_str);
         pr2serr("    Support No List IDentifier (SNLID): %d\n", snlid);
@@ -1213,9 +1810,10 @@ open_if(struct xcopy_fp_t * ifp, int vb)
     if (ifp->excl)
         flags |= O_EXCL;
     fl = O_RDWR;
-    if ((infd = open(ifp->fname, fl | flags)) < 0) {
+    if ((infd = scsi_pt_open_flags(ifp->fname, fl | flags, 0)) < 0) {
         fl = O_RDONLY;
-        if ((infd = open(ifp->fname, fl | flags)) < 0) {
+        if ((infd = scsi_pt_open_flags(ifp->fname, fl | flags, 0)) < 0) {
+            errno = -infd;
             snprintf(ebuff, EBUFF_SZ,
                      ME "could not open %.500s for sg reading", ifp->fname);
             perror(ebuff);
@@ -1258,7 +1856,8 @@ open_of(struct xcopy_fp_t * ofp, int vb)
         flags = O_RDWR | O_NONBLOCK;
         if (ofp->excl)
             flags |= O_EXCL;
-        if ((outfd = open(ofp->fname, flags)) < 0) {
+        if ((outfd = scsi_pt_open_flags(ofp->fname, flags, 0)) < 0) {
+            errno = -outfd;
             snprintf(ebuff, EBUFF_SZ,
                      ME "could not open %.500s for sg writing", ofp->fname);
             perror(ebuff);
@@ -1301,14 +1900,23 @@ main(int argc, char * argv[])
     bool list_id_given = false;
     bool on_src = false;
     bool on_src_dst_given = false;
+    bool do_odx = false;
+    bool segs_given = false;
+    bool thr_given = false;
     int res, k, n, keylen, infd, outfd, xcopy_fd;
-    int blocks = 0;
     int bpt = DEF_BLOCKS_PER_TRANSFER;
     int dst_desc_len;
     int ibs = 0;
     int num_help = 0;
     int num_xcopy = 0;
+    int num_segs = 0;
+    int num_started;
+    int num_stripes;
+    int num_thr = 1;
+    int num_tok = DEF_ODX_TOKENS;
     int obs = 0;
+    int segs = 0;
+    int segs_per_cmd;
     int ret = 0;
     int seg_desc_type;
     int src_desc_len;
@@ -1320,6 +1928,10 @@ main(int argc, char * argv[])
     char str[STR_SZ];
     uint8_t src_desc[256];
     uint8_t dst_desc[256];
+    int64_t stripe_blks;
+    struct xcopy_op_t xop;
+    struct xcopy_stripe_t stripes[MAX_NUM_THREADS];
+    pthread_t tids[MAX_NUM_THREADS];
 
     ixcf.fname[0] = '\0';
     oxcf.fname[0] = '\0';
@@ -1436,19 +2048,44 @@ main(int argc, char * argv[])
                 pr2serr(ME "bad argument to 'seek='\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
+        } else if (0 == strcmp(key, "segs")) {
+            segs = sg_get_num(buf);
+            if (segs < 0) {
+                pr2serr(ME "bad argument to 'segs='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            segs_given = true;
         } else if (0 == strcmp(key, "skip")) {
             skip = sg_get_llnum(buf);
             if (-1LL == skip) {
                 pr2serr(ME "bad argument to 'skip='\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
+        } else if (0 == strcmp(key, "thr")) {
+            num_thr = sg_get_num(buf);
+            if ((num_thr < 1) || (num_thr > MAX_NUM_THREADS)) {
+                pr2serr(ME "'thr=' should be from 1 to %d\n",
+                        MAX_NUM_THREADS);
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            thr_given = true;
         } else if (0 == strcmp(key, "time"))
             do_time = !! sg_get_num(buf);
+        else if (0 == strcmp(key, "tokens")) {
+            num_tok = sg_get_num(buf);
+            if ((num_tok < 1) || (num_tok > MAX_ODX_TOKENS)) {
+                pr2serr(ME "'tokens=' should be from 1 to %d\n",
+                        MAX_ODX_TOKENS);
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        }
         else if (0 == strncmp(key, "verb", 4))
             verbose = sg_get_num(buf);
         /* look for long options that start with '--' */
         else if (0 == strncmp(key, "--help", 6))
             ++num_help;
+        else if (0 == strncmp(key, "--odx", 5))
+            do_odx = true;
         else if (0 == strncmp(key, "--on_dst", 8)) {
             on_src = false;
             if (on_src_dst_given) {
@@ -1511,6 +2148,24 @@ main(int argc, char * argv[])
         usage(num_help);
         return 0;
     }
+    if (do_odx) {
+        const char * ccp = NULL;
+
+        /* these shape EXTENDED COPY commands, --odx does not send any */
+        if (bpt_given)
+            ccp = "bpt=";
+        else if (segs_given)
+            ccp = "segs=";
+        else if (thr_given)
+            ccp = "thr=";
+        else if (on_src_dst_given)
+            ccp = on_src ? "--on_src" : "--on_dst";
+        if (ccp) {
+            pr2serr("Syntax error - %s cannot be used with --odx\n", ccp);
+            pr2serr("For more information use '--help'\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+    }
     if (! on_src_dst_given) {
         if (ixcf.xcopy_given == oxcf.xcopy_given) {
             char * csp;
@@ -1572,6 +2227,16 @@ main(int argc, char * argv[])
             pr2serr("list_id disabled by id_usage flag\n");
             return SG_LIB_SYNTAX_ERROR;
         }
+        if (num_thr > 1) {
+            pr2serr("thr= greater than 1 needs a distinct list_id for each "
+                    "stripe\nso can't be used with id_usage=disable\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+    }
+    if ((list_id + num_thr - 1) > 0xff) {
+        pr2serr("list_id=%d plus thr=%d exceeds the largest list "
+                "identifier (255)\n", list_id, num_thr);
+        return SG_LIB_SYNTAX_ERROR;
     }
 
     if (verbose > 1)
@@ -1710,6 +2375,35 @@ main(int argc, char * argv[])
         }
     }
 
+    if (do_odx) {
+        if (ixcf.sect_sz != oxcf.sect_sz) {
+            pr2serr("--odx needs IFILE and OFILE to have the same block "
+                    "size\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+        if (do_time) {
+            start_tm.tv_sec = 0;
+            start_tm.tv_usec = 0;
+            gettimeofday(&start_tm, NULL);
+            start_tm_valid = true;
+        }
+        if (verbose)
+            pr2serr("Start of ODX copy, count=%" PRId64 ", tokens=%d, lba_in="
+                    "%" PRId64 ", lba_out=%" PRId64 "\n", dd_count, num_tok,
+                    skip, seek);
+        res = odx_copy(infd, outfd, ixcf.sect_sz, num_tok, list_id, skip,
+                       seek, &num_xcopy);
+        if (do_time)
+            calc_duration_throughput(0);
+        if (res)
+            pr2serr("sg_xcopy: ODX copy failed with error %d (%" PRId64
+                    " blocks left)\n", res, dd_count);
+        else
+            pr2serr("sg_xcopy: %" PRId64 " blocks, %d token command%s\n",
+                    in_full, num_xcopy, ((num_xcopy > 1) ? "s" : ""));
+        return res;
+    }
+
     res = scsi_operating_parameter(&ixcf, 0);
     if (res < 0) {
         if (SG_LIB_CAT_UNIT_ATTENTION == -res) {
@@ -1827,6 +2521,35 @@ main(int argc, char * argv[])
     seg_desc_type = seg_desc_from_dd_type(simplified_ft(&ixcf), 0,
                                           simplified_ft(&oxcf), 0);
 
+    /* Pack as many segment descriptors into each XCOPY as the copy
+     * manager that receives it allows: bounded by its maximum segment
+     * descriptor count and by its maximum descriptor list length (which
+     * covers both target and segment descriptors). */
+    {
+        const struct xcopy_fp_t * cmp = on_src ? &ixcf : &oxcf;
+        int64_t r;
+
+        segs_per_cmd = cmp->max_segs ? (int)cmp->max_segs : 1;
+        if (cmp->max_desc_len) {
+            r = ((int64_t)cmp->max_desc_len - src_desc_len - dst_desc_len) /
+                B2B_SEG_DESC_LEN;
+            if (r < segs_per_cmd)
+                segs_per_cmd = (r > 0) ? (int)r : 1;
+        }
+        if ((segs > 0) && (segs < segs_per_cmd))
+            segs_per_cmd = segs;
+        if (verbose)
+            pr2serr("  >> up to %d segment descriptor%s per Xcopy(LID1) "
+                    "command\n", segs_per_cmd,
+                    ((segs_per_cmd > 1) ? "s" : ""));
+        if ((num_thr > 1) && (cmp->max_conc > 0) &&
+            ((uint32_t)num_thr > cmp->max_conc)) {
+            pr2serr(">> copy manager allows %u concurrent copies, so "
+                    "reducing thr=%d to that\n", cmp->max_conc, num_thr);
+            num_thr = cmp->max_conc;
+        }
+    }
+
     if (do_time) {
         start_tm.tv_sec = 0;
         start_tm.tv_usec = 0;
@@ -1839,23 +2562,90 @@ main(int argc, char * argv[])
                 ", lba_out=%" PRId64 "\n", dd_count, bpt, skip, seek);
 
     xcopy_fd = (on_src) ? infd : outfd;
-
-    while (dd_count > 0) {
-        if (dd_count > bpt)
-            blocks = bpt;
+    xop.fd = xcopy_fd;
+    xop.seg_desc_type = seg_desc_type;
+    xop.segs_per_cmd = segs_per_cmd;
+    xop.bpt = bpt;
+    xop.src_desc = src_desc;
+    xop.src_desc_len = src_desc_len;
+    xop.dst_desc = dst_desc;
+    xop.dst_desc_len = dst_desc_len;
+
+    /* Split the copy into num_thr stripes (each a multiple of bpt blocks
+     * apart from the last), each with its own list identifier */
+    stripe_blks = (dd_count + num_thr - 1) / num_thr;
+    stripe_blks = ((stripe_blks + bpt - 1) / bpt) * bpt;
+    if (stripe_blks < 1)
+        stripe_blks = 1;
+    num_stripes = (int)((dd_count + stripe_blks - 1) / stripe_blks);
+    if (num_stripes < 1)
+        num_stripes = 1;
+    for (k = 0; k < num_stripes; ++k) {
+        struct xcopy_stripe_t * sp = stripes + k;
+
+        memset(sp, 0, sizeof(*sp));
+        sp->op = &xop;
+        sp->index = k;
+        sp->list_id = list_id + k;
+        sp->start_blk = k * stripe_blks;
+        sp->num_blks = dd_count - sp->start_blk;
+        if (sp->num_blks > stripe_blks)
+            sp->num_blks = stripe_blks;
+        sp->src_lba = skip + sp->start_blk;
+        sp->dst_lba = seek + sp->start_blk;
+        sp->rem_blks = sp->num_blks;
+    }
+    if ((verbose > 1) && (num_stripes > 1))
+        pr2serr(" >>> %d stripes of up to %" PRId64 " blocks, list_ids %d "
+                "to %d\n", num_stripes, stripe_blks, list_id,
+                list_id + num_stripes - 1);
+
+    res = 0;
+    num_started = num_stripes;
+    if (1 == num_stripes)
+        copy_stripe(stripes);
+    else {
+        for (k = 0; k < num_stripes; ++k) {
+            res = pthread_create(tids + k, NULL, copy_stripe, stripes + k);
+            if (res) {
+                pr2serr("pthread_create: %s\n", safe_strerror(res));
+                pthread_mutex_lock(&xc_mutex);
+                xc_stop = true;
+                pthread_mutex_unlock(&xc_mutex);
+                break;
+            }
+        }
+        num_started = k;        /* only join those started */
+        for (k = 0; k < num_started; ++k)
+            pthread_join(tids[k], NULL);
+    }
+
+    ret = 0;
+    for (k = 0; k < num_stripes; ++k) {
+        struct xcopy_stripe_t * sp = stripes + k;
+        const char * ccp;
+
+        num_xcopy += sp->num_xcopy;
+        num_segs += sp->num_segs;
+        if (sp->res && (0 == ret))
+            ret = sp->res;
+        if (sp->res)
+            ccp = ", failed";
+        else if (k >= num_started)
+            ccp = ", not started";
+        else if (sp->rem_blks)
+            ccp = ", stopped";
         else
-            blocks = dd_count;
-        res = scsi_extended_copy(xcopy_fd, list_id, src_desc, src_desc_len,
-                                 dst_desc, dst_desc_len, seg_desc_type,
-                                 blocks, skip, seek);
-        if (res != 0)
-            break;
-        in_full += blocks;
-        skip += blocks;
-        seek += blocks;
-        dd_count -= blocks;
-        num_xcopy++;
+            ccp = "";
+        if ((num_stripes > 1) && (sp->res || sp->rem_blks || verbose))
+            pr2serr("  stripe %d, list_id=%d: lba_in=%" PRId64 ", %" PRId64
+                    " of %" PRId64 " blocks copied%s\n", k, sp->list_id,
+                    skip + sp->start_blk, sp->num_blks - sp->rem_blks,
+                    sp->num_blks, ccp);
     }
+    if ((0 == ret) && (0 != res))
+        ret = SG_LIB_CAT_OTHER;         /* thread(s) not started */
+    res = ret;
 
     if (do_time)
         calc_duration_throughput(0);
@@ -1863,8 +2653,9 @@ main(int argc, char * argv[])
         pr2serr("sg_xcopy: failed with error %d (%" PRId64 " blocks left)\n",
                 res, dd_count);
     else
-        pr2serr("sg_xcopy: %" PRId64 " blocks, %d command%s\n", in_full,
-                num_xcopy, ((num_xcopy > 1) ? "s" : ""));
+        pr2serr("sg_xcopy: %" PRId64 " blocks, %d command%s, %d segment%s\n",
+                in_full, num_xcopy, ((num_xcopy > 1) ? "s" : ""), num_segs,
+                ((num_segs > 1) ? "s" : ""));
 
     return res;
 }
@@ -26,6 +26,11 @@
    then only the read side will be mmap-ed, while the write side will
    use normal IO.
 
+   When 'qd' (queue depth) is greater than 1 and the read side is a sg
+   device then 'qd' file descriptors are opened on it, each with its own
+   mmap-ed reserved buffer (a "slot"). READs are queued on all slots so
+   that the READ into one slot overlaps the WRITE from another slot.
+
    This version is designed for the linux kernel 2.4, 2.6, 3 and 4 series.
 */
 
@@ -51,6 +56,7 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/mman.h>
+#include <poll.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>  /* needed for lseek64() */
 #include <linux/major.h>
@@ -66,11 +72,13 @@
 #include "sg_pr2serr.h"
 
 
-static const char * version_str = "1.51 20171209";
+static const char * version_str = "1.54 20261018";
 
 #define DEF_BLOCK_SIZE 512
 #define DEF_BLOCKS_PER_TRANSFER 128
 #define DEF_BLOCKS_PER_2048TRANSFER 32
+#define DEF_MANIFEST_CHUNK 2048 /* blocks hashed per line of manifest */
+#define AUTO_MAX_BYTES (1024 * 1024)    /* bpt=auto: unless Block Limits */
 #define DEF_SCSI_CDBSZ 10
 #define MAX_SCSI_CDBSZ 16
 
@@ -104,6 +112,13 @@ static const char * version_str = "1.51 20171209";
 
 #define MIN_RESERVED_SIZE 8192
 
+#define DEF_QUEUE_DEPTH 1
+#define MAX_QUEUE_DEPTH 16
+
+#define STR_SZ 1024
+#define INOUTF_SZ 512
+#define EBUFF_SZ 512
+
 static int sum_of_resids = 0;
 
 static int64_t dd_count = -1;
@@ -131,6 +146,19 @@ struct flags_t {
     bool fua;
 };
 
+static struct sg_manifest mfest;
+
+struct mmap_slot {      /* one per sg fd on the read side when qd > 1 */
+    int fd;
+    bool busy;          /* READ queued, not yet collected */
+    int blocks;
+    int64_t blk;
+    uint8_t * mmp;      /* mmap-ed reserved buffer of 'fd' */
+    struct sg_io_hdr io_hdr;
+    uint8_t cmd[MAX_SCSI_CDBSZ];
+    uint8_t sb[SENSE_BUFF_LEN];
+};
+
 
 static void
 install_handler(int sig_num, void (*sig_handler) (int sig))
@@ -266,9 +294,13 @@ usage()
             "               [--help] [--version]\n\n");
     pr2serr("               [bpt=BPT] [cdbsz=6|10|12|16] [dio=0|1] "
             "[fua=0|1|2|3]\n"
-            "               [sync=0|1] [time=0|1] [verbose=VERB]\n\n"
+            "               [manifest=MF] [mchunk=MC] [qd=QD] [sync=0|1] "
+            "[time=0|1]\n"
+            "               [verbose=VERB]\n\n"
             "  where:\n"
-            "    bpt         is blocks_per_transfer (default is 128)\n"
+            "    bpt         is blocks_per_transfer (default is 128), "
+            "'auto' to use\n"
+            "                Block Limits VPD page (max 1 MiB)\n"
             "    bs          must be device block size (default 512)\n"
             "    cdbsz       size of SCSI READ or WRITE cdb (default is 10)\n"
             "    count       number of blocks to copy (def: device size)\n"
@@ -281,12 +313,18 @@ usage()
     pr2serr("    iflag       comma separated list from: [direct,dpo,dsync,"
             "excl,fua,\n"
             "                null]\n"
+            "    manifest    write CRC-32C of each chunk copied to file MF\n"
+            "    mchunk      blocks per manifest chunk (def: 2048)\n"
             "    of          file or device to write to (def: stdout), "
             "OFILE of '.'\n"
             "                treated as /dev/null\n"
             "    oflag       comma separated list from: [append,dio,direct,"
             "dpo,dsync,\n"
             "                excl,fua,null]\n"
+            "    qd          queue depth: number of mmap-ed READs "
+            "outstanding on IFILE\n"
+            "                (def: 1, max: 16; only when IFILE is sg "
+            "device)\n"
             "    seek        block position to start writing to OFILE\n"
             "    skip        block position to start reading from IFILE\n"
             "    sync        0->no sync(def), 1->SYNCHRONIZE CACHE on OFILE "
@@ -634,6 +672,268 @@ sg_write(int sg_fd, uint8_t * buff, int blocks, int64_t to_block,
     return 0;
 }
 
+/* Queues a mmap-ed READ on the slot's sg fd (asynchronously). Returns 0 ->
+ * successful, -2 -> recoverable (ENOMEM), -1 -> unrecoverable error */
+static int
+sg_start_mmap_read(struct mmap_slot * sp, int blocks, int64_t from_block,
+                   int bs, int cdbsz, bool fua, bool dpo)
+{
+    int k, res;
+    struct sg_io_hdr * hp = &sp->io_hdr;
+
+    if (sg_build_scsi_cdb(sp->cmd, cdbsz, blocks, from_block, false, fua,
+                          dpo)) {
+        pr2serr(ME "bad rd cdb build, from_block=%" PRId64 ", blocks=%d\n",
+                from_block, blocks);
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    memset(hp, 0, sizeof(struct sg_io_hdr));
+    hp->interface_id = 'S';
+    hp->cmd_len = cdbsz;
+    hp->cmdp = sp->cmd;
+    hp->dxfer_direction = SG_DXFER_FROM_DEV;
+    hp->dxfer_len = bs * blocks;
+    hp->mx_sb_len = SENSE_BUFF_LEN;
+    hp->sbp = sp->sb;
+    hp->timeout = DEF_TIMEOUT;
+    hp->pack_id = (int)from_block;
+    hp->flags |= SG_FLAG_MMAP_IO;
+    if (verbose > 2) {
+        pr2serr("    read cdb (slot fd=%d): ", sp->fd);
+        for (k = 0; k < cdbsz; ++k)
+            pr2serr("%02x ", sp->cmd[k]);
+        pr2serr("\n");
+    }
+    while (((res = write(sp->fd, hp, sizeof(struct sg_io_hdr))) < 0) &&
+           ((EINTR == errno) || (EAGAIN == errno)))
+        ;
+    if (res < 0) {
+        if (ENOMEM == errno)
+            return -2;
+        perror("reading (wr) on sg device, error");
+        return -1;
+    }
+    sp->busy = true;
+    sp->blocks = blocks;
+    sp->blk = from_block;
+    return 0;
+}
+
+/* Waits for the READ queued on the slot to complete. Returns 0 ->
+ * successful, various SG_LIB_CAT_* positive values, -1 -> unrecoverable
+ * error */
+static int
+sg_finish_mmap_read(struct mmap_slot * sp)
+{
+    int res;
+    struct pollfd a_pollfd;
+    struct sg_io_hdr * hp = &sp->io_hdr;
+
+    a_pollfd.fd = sp->fd;
+    a_pollfd.events = POLLIN;
+    /* sg fds are opened O_NONBLOCK so sleep here rather than spin */
+    while (((res = poll(&a_pollfd, 1, -1)) < 0) && (EINTR == errno))
+        ;
+    while (((res = read(sp->fd, hp, sizeof(struct sg_io_hdr))) < 0) &&
+           ((EINTR == errno) || (EAGAIN == errno)))
+        ;
+    sp->busy = false;
+    if (res < 0) {
+        perror("reading (rd) on sg device, error");
+        return -1;
+    }
+    if (verbose > 2)
+        pr2serr("      duration=%u ms\n", hp->duration);
+    res = sg_err_category3(hp);
+    switch (res) {
+    case SG_LIB_CAT_CLEAN:
+        break;
+    case SG_LIB_CAT_RECOVERED:
+        sg_chk_n_print3("Reading, continuing", hp, verbose > 1);
+        break;
+    case SG_LIB_CAT_NOT_READY:
+    case SG_LIB_CAT_MEDIUM_HARD:
+        return res;
+    case SG_LIB_CAT_ABORTED_COMMAND:
+    case SG_LIB_CAT_UNIT_ATTENTION:
+    case SG_LIB_CAT_ILLEGAL_REQ:
+    default:
+        sg_chk_n_print3("reading", hp, verbose > 1);
+        return res;
+    }
+    sum_of_resids += hp->resid;
+    return 0;
+}
+
+/* Opens (when k > 0) and mmaps the reserved buffer of each read side slot.
+ * Slot 0 uses the already opened 'infd' and its mmap-ed buffer. Returns 0
+ * if okay, else SG_LIB_FILE_ERROR */
+static int
+prepare_mmap_slots(struct mmap_slot * slots, int qd, const char * inf,
+                   int infd, uint8_t * wrkMmap, int in_res_sz, int flags)
+{
+    int k, t;
+    char ebuff[EBUFF_SZ];
+
+    slots[0].fd = infd;
+    slots[0].mmp = wrkMmap;
+    for (k = 1; k < qd; ++k) {
+        if ((slots[k].fd = open(inf, flags)) < 0) {
+            snprintf(ebuff, EBUFF_SZ,
+                     ME "could not open %s for sg reading (slot %d)", inf, k);
+            perror(ebuff);
+            return SG_LIB_FILE_ERROR;
+        }
+        if (ioctl(slots[k].fd, SG_GET_RESERVED_SIZE, &t) < 0) {
+            perror(ME "SG_GET_RESERVED_SIZE error");
+            return SG_LIB_FILE_ERROR;
+        }
+        if ((in_res_sz > t) &&
+            (ioctl(slots[k].fd, SG_SET_RESERVED_SIZE, &in_res_sz) < 0)) {
+            perror(ME "SG_SET_RESERVED_SIZE error");
+            return SG_LIB_FILE_ERROR;
+        }
+        slots[k].mmp = (uint8_t *)mmap(NULL, in_res_sz,
+                                       PROT_READ | PROT_WRITE, MAP_SHARED,
+                                       slots[k].fd, 0);
+        if (MAP_FAILED == slots[k].mmp) {
+            slots[k].mmp = NULL;
+            snprintf(ebuff, EBUFF_SZ,
+                     ME "error using mmap() on file: %s (slot %d)", inf, k);
+            perror(ebuff);
+            return SG_LIB_FILE_ERROR;
+        }
+    }
+    return 0;
+}
+
+static void
+release_mmap_slots(struct mmap_slot * slots, int qd, int in_res_sz)
+{
+    int k;
+
+    for (k = 1; k < qd; ++k) {
+        if (slots[k].mmp)
+            munmap(slots[k].mmp, in_res_sz);
+        if (slots[k].fd >= 0)
+            close(slots[k].fd);
+    }
+}
+
+/* Copy loop used when qd > 1 (and IFILE is a sg device). Up to 'qd' READs
+ * are kept queued, one per slot. Slots are collected in order, so each
+ * WRITE is issued in sequence while READs into the other slots proceed.
+ * Returns 0 when okay, else an error code as for sg_read() */
+static int
+pipelined_copy(struct mmap_slot * slots, int qd, int outfd, int out_type,
+               int bpt, int64_t * skipp, int64_t * seekp, int cdbsz_in,
+               int cdbsz_out, const struct flags_t * ifp,
+               const struct flags_t * ofp, int * num_dio_not_donep)
+{
+    bool dio_res;
+    int k, res, blocks;
+    int ret = 0;
+    int64_t rd_count = dd_count;        /* blocks not yet queued */
+    int64_t rd_blk = *skipp;
+    struct mmap_slot * sp;
+    char ebuff[EBUFF_SZ];
+
+    for (k = 0; (k < qd) && (rd_count > 0); ++k) {
+        blocks = (rd_count > bpt) ? bpt : rd_count;
+        ret = sg_start_mmap_read(slots + k, blocks, rd_blk, blk_sz, cdbsz_in,
+                                 ifp->fua, ifp->dpo);
+        if (0 != ret) {
+            pr2serr("sg_read failed, skip=%" PRId64 "\n", rd_blk);
+            return ret;
+        }
+        rd_blk += blocks;
+        rd_count -= blocks;
+    }
+    for (k = 0; dd_count > 0; k = (k + 1) % qd) {
+        sp = slots + k;
+        if (! sp->busy)
+            break;
+        blocks = sp->blocks;
+        ret = sg_finish_mmap_read(sp);
+        if ((SG_LIB_CAT_UNIT_ATTENTION == ret) ||
+            (SG_LIB_CAT_ABORTED_COMMAND == ret)) {
+            pr2serr("Unit attention or aborted command, continuing (r)\n");
+            ret = sg_start_mmap_read(sp, blocks, sp->blk, blk_sz, cdbsz_in,
+                                     ifp->fua, ifp->dpo);
+            if (0 == ret)
+                ret = sg_finish_mmap_read(sp);
+        }
+        if (0 != ret) {
+            pr2serr("sg_read failed, skip=%" PRId64 "\n", sp->blk);
+            break;
+        }
+        in_full += blocks;
+        if (mfest.fp)
+            sg_manifest_add(&mfest, sp->mmp, blocks);
+
+        if (FT_SG == out_type) {
+            dio_res = ofp->dio;
+            ret = sg_write(outfd, sp->mmp, blocks, *seekp, blk_sz, cdbsz_out,
+                           ofp->fua, ofp->dpo, false, &dio_res);
+            if ((SG_LIB_CAT_UNIT_ATTENTION == ret) ||
+                (SG_LIB_CAT_ABORTED_COMMAND == ret)) {
+                pr2serr("Unit attention or aborted command, continuing (w)\n");
+                dio_res = ofp->dio;
+                ret = sg_write(outfd, sp->mmp, blocks, *seekp, blk_sz,
+                               cdbsz_out, ofp->fua, ofp->dpo, false,
+                               &dio_res);
+            }
+            if (0 != ret) {
+                pr2serr("sg_write failed, seek=%" PRId64 "\n", *seekp);
+                break;
+            }
+            out_full += blocks;
+            if (ofp->dio && (! dio_res))
+                ++*num_dio_not_donep;
+        } else if (FT_DEV_NULL == out_type)
+            out_full += blocks; /* act as if written out without error */
+        else {
+            while (((res = write(outfd, sp->mmp, blocks * blk_sz)) < 0) &&
+                   ((EINTR == errno) || (EAGAIN == errno)))
+                ;
+            if (verbose > 2)
+                pr2serr("write(unix): count=%d, res=%d\n", blocks * blk_sz,
+                        res);
+            if (res < 0) {
+                snprintf(ebuff, EBUFF_SZ, ME "writing, seek=%" PRId64 " ",
+                         *seekp);
+                perror(ebuff);
+                break;
+            } else if (res < blocks * blk_sz) {
+                pr2serr("output file probably full, seek=%" PRId64 " ",
+                        *seekp);
+                blocks = res / blk_sz;
+                out_full += blocks;
+                if ((res % blk_sz) > 0)
+                    out_partial++;
+                break;
+            } else
+                out_full += blocks;
+        }
+        dd_count -= blocks;
+        *skipp += blocks;
+        *seekp += blocks;
+
+        if (rd_count > 0) {     /* re-use this slot for the next READ */
+            blocks = (rd_count > bpt) ? bpt : rd_count;
+            ret = sg_start_mmap_read(sp, blocks, rd_blk, blk_sz, cdbsz_in,
+                                     ifp->fua, ifp->dpo);
+            if (0 != ret) {
+                pr2serr("sg_read failed, skip=%" PRId64 "\n", rd_blk);
+                break;
+            }
+            rd_blk += blocks;
+            rd_count -= blocks;
+        }
+    }
+    return ret;
+}
+
 static int
 process_flags(const char * arg, struct flags_t * fp)
 {
@@ -678,14 +978,10 @@ process_flags(const char * arg, struct flags_t * fp)
 }
 
 
-#define STR_SZ 1024
-#define INOUTF_SZ 512
-#define EBUFF_SZ 512
-
-
 int
 main(int argc, char * argv[])
 {
+    bool bpt_auto = false;
     bool bpt_given = false;
     bool cdbsz_given = false;
     bool do_coe = false;     /* dummy, just accept + ignore */
@@ -696,11 +992,14 @@ main(int argc, char * argv[])
     int ibs = 0;
     int in_res_sz = 0;
     int in_sect_sz;
+    int in_open_flags = 0;
     int in_type = FT_OTHER;
+    int mchunk = DEF_MANIFEST_CHUNK;
     int obs = 0;
     int out_res_sz = 0;
     int out_sect_sz;
     int out_type = FT_OTHER;
+    int qd = DEF_QUEUE_DEPTH;
     int num_dio_not_done = 0;
     int ret = 0;
     int scsi_cdbsz_in = DEF_SCSI_CDBSZ;
@@ -718,10 +1017,12 @@ main(int argc, char * argv[])
     char inf[INOUTF_SZ];
     char str[STR_SZ];
     char outf[INOUTF_SZ];
+    char mf[INOUTF_SZ];
     char ebuff[EBUFF_SZ];
     char b[80];
     struct flags_t in_flags;
     struct flags_t out_flags;
+    struct mmap_slot slots[MAX_QUEUE_DEPTH];
 
 #if defined(HAVE_SYSCONF) && defined(_SC_PAGESIZE)
     psz = sysconf(_SC_PAGESIZE); /* POSIX.1 (was getpagesize()) */
@@ -730,8 +1031,12 @@ main(int argc, char * argv[])
 #endif
     inf[0] = '\0';
     outf[0] = '\0';
+    mf[0] = '\0';
     memset(&in_flags, 0, sizeof(in_flags));
     memset(&out_flags, 0, sizeof(out_flags));
+    memset(slots, 0, sizeof(slots));
+    for (k = 0; k < MAX_QUEUE_DEPTH; ++k)
+        slots[k].fd = -1;
 
     for (k = 1; k < argc; k++) {
         if (argv[k])
@@ -742,7 +1047,9 @@ main(int argc, char * argv[])
             buf++;
         if (*buf)
             *buf++ = '\0';
-        if (0 == strcmp(key,"bpt")) {
+        if ((0 == strcmp(key,"bpt")) && (0 == strcmp(buf, "auto")))
+            bpt_auto = true;
+        else if (0 == strcmp(key,"bpt")) {
             bpt = sg_get_num(buf);
             if (-1 == bpt) {
                 pr2serr(ME "bad argument to 'bpt'\n");
@@ -806,12 +1113,31 @@ main(int argc, char * argv[])
                 pr2serr(ME "bad argument to 'oflag'\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
+        } else if (0 == strcmp(key, "manifest")) {
+            if ('\0' != mf[0]) {
+                pr2serr("Second 'manifest=' argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(mf, sizeof(mf), "%s", buf);
+        } else if (0 == strcmp(key, "mchunk")) {
+            mchunk = sg_get_num(buf);
+            if (mchunk < 1) {
+                pr2serr(ME "bad argument to 'mchunk'\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
         } else if (0 == strcmp(key,"obs")) {
             obs = sg_get_num(buf);
             if (-1 == obs) {
                 pr2serr(ME "bad argument to 'obs'\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
+        } else if (0 == strcmp(key,"qd")) {
+            qd = sg_get_num(buf);
+            if ((qd < 1) || (qd > MAX_QUEUE_DEPTH)) {
+                pr2serr(ME "bad argument to 'qd', expect 1 to %d\n",
+                        MAX_QUEUE_DEPTH);
+                return SG_LIB_SYNTAX_ERROR;
+            }
         } else if (0 == strcmp(key,"seek")) {
             seek = sg_get_llnum(buf);
             if (-1LL == seek) {
@@ -869,6 +1195,12 @@ main(int argc, char * argv[])
     /* defaulting transfer size to 128*2048 for CD/DVDs is too large
        for the block layer in lk 2.6 and results in an EIO on the
        SG_IO ioctl. So reduce it in that case. */
+    if (bpt_auto) {     /* provisional, sizes mmap-ed reserved buffers */
+        bpt = AUTO_MAX_BYTES / blk_sz;
+        if (bpt < 1)
+            bpt = 1;
+        bpt_given = true;
+    }
     if ((blk_sz >= 2048) && (! bpt_given))
         bpt = DEF_BLOCKS_PER_2048TRANSFER;
 
@@ -909,6 +1241,7 @@ main(int argc, char * argv[])
                 perror(ebuff);
                 return SG_LIB_FILE_ERROR;
             }
+            in_open_flags = flags;
             res = ioctl(infd, SG_GET_VERSION_NUM, &t);
             if ((res < 0) || (t < 30122)) {
                 pr2serr(ME "sg driver prior to 3.1.22\n");
@@ -1150,6 +1483,23 @@ main(int argc, char * argv[])
         pr2serr("Couldn't calculate count, please give one\n");
         return SG_LIB_SYNTAX_ERROR;
     }
+    if (bpt_auto) {
+        struct sg_simple_block_limits_resp bl;
+
+        /* trim to what the Block Limits VPD pages of sg IFILE and OFILE
+         * allow; the mmap-ed buffers were sized for AUTO_MAX_BYTES */
+        for (k = 0; k < 2; ++k) {
+            if ((FT_SG != (k ? out_type : in_type)) ||
+                sg_simple_block_limits((k ? outfd : infd), &bl, false,
+                                       (verbose > 1) ? (verbose - 2) : 0))
+                continue;
+            if ((bl.max_xfer_len > 0) && (bl.max_xfer_len < (uint32_t)bpt))
+                bpt = (int)bl.max_xfer_len;
+            if ((bl.opt_xfer_len > 0) && (bl.opt_xfer_len < (uint32_t)bpt))
+                bpt = (int)bl.opt_xfer_len;
+        }
+        pr2serr("bpt=auto: %d blocks per transfer\n", bpt);
+    }
     if (! cdbsz_given) {
         if ((FT_SG == in_type) && (MAX_SCSI_CDBSZ != scsi_cdbsz_in) &&
             (((dd_count + skip) > UINT_MAX) || (bpt > USHRT_MAX))) {
@@ -1184,6 +1534,19 @@ main(int argc, char * argv[])
         }
     }
 
+    if ((qd > 1) && (FT_SG != in_type)) {
+        pr2serr(">>> qd only active when 'if' is an sg device, ignored\n");
+        qd = 1;
+    }
+    if (qd > 1) {
+        res = prepare_mmap_slots(slots, qd, inf, infd, wrkMmap, in_res_sz,
+                                 in_open_flags);
+        if (res) {
+            release_mmap_slots(slots, qd, in_res_sz);
+            return res;
+        }
+    }
+
     if (wrkMmap) {
         wrkPos = wrkMmap;
     } else {
@@ -1207,6 +1570,17 @@ main(int argc, char * argv[])
         }
     }
 
+    if (mf[0]) {
+        snprintf(ebuff, EBUFF_SZ, "sgm_dd %s", version_str);
+        if (sg_manifest_open(&mfest, mf, ebuff, blk_sz, mchunk, skip,
+                             seek)) {
+            snprintf(ebuff, EBUFF_SZ, ME "could not open %s for manifest",
+                     mf);
+            perror(ebuff);
+            return SG_LIB_FILE_ERROR;
+        }
+    }
+
     blocks_per = bpt;
 #ifdef SG_DEBUG
     pr2serr("Start of loop, count=%" PRId64 ", blocks_per=%d\n", dd_count,
@@ -1225,6 +1599,16 @@ main(int argc, char * argv[])
         pr2serr("Since both 'if' and 'of' are sg devices, only do mmap-ed "
                 "transfers on 'if'\n");
 
+    if (qd > 1) {
+        if (verbose)
+            pr2serr("Pipelined copy with %d mmap-ed READs queued on 'if'\n",
+                    qd);
+        ret = pipelined_copy(slots, qd, outfd, out_type, blocks_per, &skip,
+                             &seek, scsi_cdbsz_in, scsi_cdbsz_out, &in_flags,
+                             &out_flags, &num_dio_not_done);
+        goto copy_end;
+    }
+
     while (dd_count > 0) {
         blocks = (dd_count > blocks_per) ? blocks_per : dd_count;
         if (FT_SG == in_type) {
@@ -1265,6 +1649,8 @@ main(int argc, char * argv[])
                 if ((res % blk_sz) > 0) {
                     blocks++;
                     in_partial++;
+                    if (mfest.fp)   /* zero tail so digest is repeatable */
+                        memset(wrkPos + res, 0, (blocks * blk_sz) - res);
                 }
             }
             in_full += blocks;
@@ -1272,6 +1658,8 @@ main(int argc, char * argv[])
 
         if (0 == blocks)
             break;      /* read nothing so leave loop */
+        if (mfest.fp)
+            sg_manifest_add(&mfest, wrkPos, blocks);
 
         if (FT_SG == out_type) {
             bool dio_res = out_flags.dio;
@@ -1329,6 +1717,7 @@ main(int argc, char * argv[])
         seek += blocks;
     }
 
+copy_end:
     if (do_time)
         calc_duration_throughput(false);
     if (do_sync) {
@@ -1348,6 +1737,8 @@ main(int argc, char * argv[])
 
     if (wrkBuff)
         free(wrkBuff);
+    if (qd > 1)
+        release_mmap_slots(slots, qd, in_res_sz);
     if (STDIN_FILENO != infd)
         close(infd);
     if ((STDOUT_FILENO != outfd) && (FT_DEV_NULL != out_type))
@@ -1357,6 +1748,16 @@ main(int argc, char * argv[])
         if (0 == ret)
             ret = SG_LIB_CAT_OTHER;
     }
+    if (mfest.fp) {
+        res = sg_manifest_close(&mfest);
+        pr2serr("crc32c of %" PRId64 " blocks copied: 0x%08x\n",
+                mfest.chunk_start, mfest.total_crc);
+        if (res) {
+            perror(ME "writing manifest");
+            if (0 == ret)
+                ret = res;
+        }
+    }
     print_stats();
     if (sum_of_resids)
         pr2serr(">> Non-zero sum of residual counts=%d\n", sum_of_resids);
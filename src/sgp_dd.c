@@ -47,6 +47,7 @@
 #include <sys/sysmacros.h>
 #include <sys/types.h>  /* needed for lseek64() */
 #include <sys/time.h>
+#include <time.h>
 #include <linux/major.h>
 #include <linux/fs.h>   /* <sys/mount.h> */
 
@@ -55,16 +56,23 @@
 #endif
 #include "sg_lib.h"
 #include "sg_cmds_basic.h"
+#include "sg_cmds_extra.h"
+#include "sg_pt.h"
 #include "sg_io_linux.h"
+#include "sg_copy_util.h"
 #include "sg_unaligned.h"
 #include "sg_pr2serr.h"
 
 
-static const char * version_str = "5.62 20180219";
+static const char * version_str = "5.69 20261018";
 
 #define DEF_BLOCK_SIZE 512
 #define DEF_BLOCKS_PER_TRANSFER 128
 #define DEF_BLOCKS_PER_2048TRANSFER 32
+#define DEF_MANIFEST_CHUNK 2048 /* blocks hashed per line of manifest */
+#define DEF_CKPT_SECS 30        /* seconds between checkpoints (ckpt=) */
+#define DEF_PROGRESS_SECS 5     /* progress_file= without progress= */
+#define AUTO_MAX_BYTES (1024 * 1024)    /* bpt=auto: unless Block Limits */
 #define DEF_SCSI_CDBSZ 10
 #define MAX_SCSI_CDBSZ 16
 
@@ -98,6 +106,7 @@ static const char * version_str = "5.62 20180219";
 #define DEV_NULL_MINOR_NUM 3
 
 #define EBUFF_SZ 512
+#define INOUTF_SZ 512
 
 struct flags_t {
     bool append;
@@ -108,6 +117,9 @@ struct flags_t {
     bool dsync;
     bool excl;
     bool fua;
+    bool verify;
+    bool delta;
+    bool loop;          /* set at open: fd is a user space loopback */
 };
 
 typedef struct request_collection
@@ -133,12 +145,22 @@ typedef struct request_collection
     int64_t out_rem_count;          /*  | count of remaining out blocks */
     int out_partial;                  /*  | */
     bool out_stop;                    /*  | */
+    struct sg_manifest mfest;          /*  | fed in write order */
+    int64_t out_delta_num;            /*  | unchanged blocks not written */
+    int64_t wr_start[MAX_NUM_THREADS];/*  | in flight write start, else -1 */
     pthread_mutex_t out_mutex;        /*  | */
     pthread_cond_t out_sync_cv;       /* -/ hold writes until "in order" */
     int bs;
     int bpt;
+    int num_ids;                /* worker threads started (in_mutex) */
     int dio_incomplete_count;   /* -\ */
     int sum_of_resids;          /*  | */
+    int miscompares;            /*  | */
+    int64_t verified_blks;      /*  | */
+    int64_t first_miscomp_lba;  /*  | */
+    bool verify_by_read;        /*  | */
+    int num_retries;            /*  | after UA or aborted command */
+    int coe_errs;               /*  | errors continued past (coe) */
     pthread_mutex_t aux_mutex;  /* -/ (also serializes some printf()s */
     int debug;
 } Rq_coll;
@@ -146,12 +168,17 @@ typedef struct request_collection
 typedef struct request_element
 {       /* one instance per worker thread */
     bool wr;
+    int id;                     /* index into clp->wr_start[] */
     int infd;
     int outfd;
     int64_t blk;
     int num_blks;
     uint8_t * buffp;
     uint8_t * alloc_bp;
+    uint8_t * vbuffp;           /* read back buffer for oflag=verify */
+    uint8_t * alloc_vbp;
+    bool out_err;
+    bool delta_skip;            /* OFILE already holds this segment */
     struct sg_io_hdr io_hdr;
     uint8_t cmd[MAX_SCSI_CDBSZ];
     uint8_t sb[SENSE_BUFF_LEN];
@@ -171,9 +198,15 @@ static pthread_t sig_listen_thread_id;
 static const char * proc_allow_dio = "/proc/scsi/sg/allow_dio";
 
 static void sg_in_operation(Rq_coll * clp, Rq_elem * rep);
+static void ckpt_maybe(Rq_coll * clp);
+static void rate_wait(int bytes);
 static void sg_out_operation(Rq_coll * clp, Rq_elem * rep);
 static bool normal_in_operation(Rq_coll * clp, Rq_elem * rep, int blocks);
 static void normal_out_operation(Rq_coll * clp, Rq_elem * rep, int blocks);
+static void verify_out_operation(Rq_coll * clp, Rq_elem * rep);
+static bool delta_chunk_same(const uint8_t * bp, int blocks, int64_t rel_blk,
+                             int bs);
+static bool ofile_same(Rq_coll * clp, Rq_elem * rep, int64_t out_blk);
 static int sg_start_io(Rq_elem * rep);
 static int sg_finish_io(bool wr, Rq_elem * rep, pthread_mutex_t * a_mutp);
 
@@ -190,6 +223,37 @@ static int64_t dd_count = -1;
 static int num_threads = DEF_NUM_THREADS;
 static int exit_status = 0;
 
+struct ckpt_t {             /* for ckpt=CF */
+    const char * fn;        /* NULL when not checkpointing */
+    const char * inf;
+    const char * outf;
+    int secs;               /* checkpoint every 'secs' seconds ... */
+    int mb;                 /* ... or every 'mb' MiB copied (0: off) */
+    int64_t skip;           /* skip, seek and count of the whole copy */
+    int64_t seek;
+    int64_t count;
+    int64_t base;           /* blocks done by earlier runs (resume=1) */
+    int64_t saved;          /* blocks done in the last checkpoint written */
+    struct timeval tm;      /* when last checkpoint written */
+};
+
+static struct ckpt_t ckpt;
+static pthread_mutex_t ckpt_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct sg_rate rlim;         /* rate=, iops= and rate_file= */
+static pthread_mutex_t rate_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct sg_prog prog;       /* progress= and progress_file= */
+static bool prog_intr = false;  /* SIGINT seen, last line "interrupted" */
+
+struct delta_ent {          /* one per chunk of manifest given to delta= */
+    int blks;
+    uint32_t crc;
+};
+
+static struct delta_ent * delta_tbl = NULL;     /* constant once threads */
+static int64_t delta_tbl_len = 0;               /* are started */
+static int delta_chunk = 0;
 
 static void
 calc_duration_throughput(int contin)
@@ -231,6 +295,23 @@ print_stats(const char * str)
     outfull = dd_count - rcoll.out_rem_count;
     pr2serr("%s%" PRId64 "+%d records out\n", str,
             outfull - rcoll.out_partial, rcoll.out_partial);
+    if (rcoll.out_flags.verify) {
+        pr2serr("%s%" PRId64 " blocks verified\n", str, rcoll.verified_blks);
+        if (rcoll.miscompares > 0)
+            pr2serr("%s%d miscompare(s), first at lba=%" PRId64 " [0x%"
+                    PRIx64 "]\n", str, rcoll.miscompares,
+                    rcoll.first_miscomp_lba, rcoll.first_miscomp_lba);
+    }
+    if (rlim.slept > 0.0)
+        pr2serr("%s%.2f secs (summed over threads) waiting for rate=/iops= "
+                "limits\n", str, rlim.slept);
+    if (rcoll.out_flags.delta || delta_tbl)
+        pr2serr("%s%" PRId64 " unchanged blocks not written\n", str,
+                rcoll.out_delta_num);
+    if (rcoll.num_retries > 0)
+        pr2serr("%s%d retries attempted\n", str, rcoll.num_retries);
+    if (rcoll.coe_errs > 0)
+        pr2serr("%s%d errors continued past (coe)\n", str, rcoll.coe_errs);
 }
 
 static void
@@ -289,10 +370,8 @@ tsafe_strerror(int code, char * ebp)
 
     pthread_mutex_lock(&strerr_mut);
     cp = safe_strerror(code);
-    strncpy(ebp, cp, STRERR_BUFF_LEN);
+    snprintf(ebp, STRERR_BUFF_LEN, "%s", cp);
     pthread_mutex_unlock(&strerr_mut);
-
-    ebp[STRERR_BUFF_LEN - 1] = '\0';
     return ebp;
 }
 
@@ -316,6 +395,9 @@ dd_filetype(const char * filename)
 
     if ((1 == len) && ('.' == filename[0]))
         return FT_DEV_NULL;
+    if (0 == strncmp(filename, SG_LOOP_DEV_PREFIX,
+                     sizeof(SG_LOOP_DEV_PREFIX) - 1))
+        return FT_SG;       /* user space loopback */
     if (stat(filename, &st) < 0)
         return FT_ERROR;
     if (S_ISCHR(st.st_mode)) {
@@ -343,17 +425,31 @@ usage()
             "               [--help] [--version]\n\n");
     pr2serr("               [bpt=BPT] [cdbsz=6|10|12|16] [coe=0|1] "
             "[deb=VERB] [dio=0|1]\n"
-            "               [fua=0|1|2|3] [sync=0|1] [thr=THR] "
-            "[time=0|1] [verbose=VERB]\n"
+            "               [delta=DMF] [fua=0|1|2|3] [manifest=MF] "
+            "[mchunk=MC]\n"
+            "               [sync=0|1] [thr=THR] [time=0|1] [verbose=VERB]\n"
+            "               [ckpt=CF] [ckpt_int=SECS] [ckpt_mb=MB] "
+            "[iops=IOPS]\n"
+            "               [progress=SECS] [progress_file=PF] [rate=MBPS]\n"
+            "               [rate_file=RF] [resume=0|1]\n"
             "  where:\n"
-            "    bpt         is blocks_per_transfer (default is 128)\n"
+            "    bpt         is blocks_per_transfer (default is 128), "
+            "'auto' to use\n"
+            "                Block Limits VPD page (max 1 MiB)\n"
             "    bs          must be device block size (default 512)\n"
             "    cdbsz       size of SCSI READ or WRITE cdb (default is 10)\n"
+            "    ckpt        periodically record blocks copied in "
+            "checkpoint file CF\n"
+            "    ckpt_int    seconds between checkpoints (def: 30)\n"
+            "    ckpt_mb     also checkpoint after each MB MiB copied "
+            "(def: 0 -> off)\n"
             "    coe         continue on error, 0->exit (def), "
             "1->zero + continue\n"
             "    count       number of blocks to copy (def: device size)\n"
             "    deb         for debug, 0->none (def), > 0->varying degrees "
-            "of debug\n");
+            "of debug\n"
+            "    delta       only write chunks whose CRC-32C differs from "
+            "manifest DMF\n");
     pr2serr("    dio         is direct IO, 1->attempt, 0->indirect IO (def)\n"
             "    fua         force unit access: 0->don't(def), 1->OFILE, "
             "2->IFILE,\n"
@@ -362,12 +458,30 @@ usage()
             "    iflag       comma separated list from: [coe,dio,direct,dpo,"
             "dsync,excl,\n"
             "                fua, null]\n"
+            "    iops        cap transfers (a read plus a write) per "
+            "second (def: 0)\n"
+            "    manifest    write CRC-32C of each chunk copied to file MF\n"
+            "    mchunk      blocks per manifest chunk (def: 2048)\n"
             "    of          file or device to write to (def: stdout), "
             "OFILE of '.'\n"
             "                treated as /dev/null\n"
             "    oflag       comma separated list from: [append,coe,dio,"
-            "direct,dpo,dsync,\n"
-            "                excl,fua,null]\n"
+            "delta,direct,dpo,\n"
+            "                dsync,excl,fua,null,verify]\n"
+            "    progress    write a JSON line describing progress every "
+            "SECS seconds\n"
+            "                (def: 0 -> off, 5 if PF given)\n"
+            "    progress_file    append progress lines to PF (def: "
+            "stderr), if PF\n"
+            "                     is a Unix socket connect and send them "
+            "there\n"
+            "    rate        cap copy rate at MBPS MB/s (def: 0 -> no "
+            "cap)\n"
+            "    rate_file   file holding 'rate=MBPS iops=IOPS', re-read "
+            "when it\n"
+            "                changes or on SIGHUP\n"
+            "    resume      1->continue copy from checkpoint in CF, "
+            "0->don't(def)\n"
             "    seek        block position to start writing to OFILE\n"
             "    skip        block position to start reading from IFILE\n"
             "    sync        0->no sync(def), 1->SYNCHRONIZE CACHE on OFILE "
@@ -399,6 +513,19 @@ guarded_stop_out(Rq_coll * clp)
     pthread_mutex_unlock(&clp->out_mutex);
 }
 
+/* Bumps one of the event counts (e.g. clp->num_retries) in clp */
+static void
+count_event(Rq_coll * clp, int * cntp)
+{
+    int status;
+
+    status = pthread_mutex_lock(&clp->aux_mutex);
+    if (0 != status) err_exit(status, "lock aux_mutex");
+    ++*cntp;
+    status = pthread_mutex_unlock(&clp->aux_mutex);
+    if (0 != status) err_exit(status, "unlock aux_mutex");
+}
+
 static void
 guarded_stop_both(Rq_coll * clp)
 {
@@ -483,9 +610,11 @@ sig_listen_thread(void * v_clp)
             break;
         if (SIGINT == sig_number) {
             pr2serr(ME "interrupted by SIGINT\n");
+            prog_intr = true;
             guarded_stop_both(clp);
             pthread_cond_broadcast(&clp->out_sync_cv);
-        }
+        } else if (SIGHUP == sig_number)
+            rlim.reread = 1;
     }
     return NULL;
 }
@@ -521,9 +650,11 @@ read_write_thread(void * v_clp)
     Rq_elem rel;
     Rq_elem * rep = &rel;
     int sz;
+    bool more;
     volatile bool stop_after_write = false;
     int64_t seek_skip;
     int blocks, status;
+    struct timeval xfer_tm;
 
     clp = (Rq_coll *)v_clp;
     sz = clp->bpt * clp->bs;
@@ -532,6 +663,17 @@ read_write_thread(void * v_clp)
     rep->buffp = sg_memalign(sz, 0 /* page align */, &rep->alloc_bp, false);
     if (NULL == rep->buffp)
         err_exit(ENOMEM, "out of memory creating user buffers\n");
+    if (clp->out_flags.verify || clp->out_flags.delta) {
+        rep->vbuffp = sg_memalign(sz, 0, &rep->alloc_vbp, false);
+        if (NULL == rep->vbuffp)
+            err_exit(ENOMEM, "out of memory creating verify buffers\n");
+    }
+
+    status = pthread_mutex_lock(&clp->in_mutex);
+    if (0 != status) err_exit(status, "lock in_mutex");
+    rep->id = clp->num_ids++;
+    status = pthread_mutex_unlock(&clp->in_mutex);
+    if (0 != status) err_exit(status, "unlock in_mutex");
 
     /* Following clp members are constant during lifetime of thread */
     rep->bs = clp->bs;
@@ -544,6 +686,17 @@ read_write_thread(void * v_clp)
     rep->out_flags = clp->out_flags;
 
     while(1) {
+        /* wait outside in_mutex so other threads keep going; a brief look
+         * at in_count spares threads about to exit from waiting */
+        if (rlim.on) {
+            status = pthread_mutex_lock(&clp->in_mutex);
+            if (0 != status) err_exit(status, "lock in_mutex");
+            more = (! clp->in_stop) && (clp->in_count > 0);
+            status = pthread_mutex_unlock(&clp->in_mutex);
+            if (0 != status) err_exit(status, "unlock in_mutex");
+            if (more)
+                rate_wait(clp->bpt * clp->bs);
+        }
         status = pthread_mutex_lock(&clp->in_mutex);
         if (0 != status) err_exit(status, "lock in_mutex");
         if (clp->in_stop || (clp->in_count <= 0)) {
@@ -552,6 +705,8 @@ read_write_thread(void * v_clp)
             if (0 != status) err_exit(status, "unlock in_mutex");
             break;
         }
+        if (prog.secs > 0)
+            gettimeofday(&xfer_tm, NULL);
         blocks = (clp->in_count > clp->bpt) ? clp->bpt : clp->in_count;
         rep->wr = false;
         rep->blk = clp->in_blk;
@@ -569,9 +724,20 @@ read_write_thread(void * v_clp)
         }
         pthread_cleanup_pop(0);
 
+        /* decide before taking out_mutex so threads compare in parallel */
+        rep->delta_skip = false;
+        if ((rep->num_blks > 0) && (FT_DEV_NULL != clp->out_type)) {
+            if (delta_tbl)
+                rep->delta_skip = delta_chunk_same(rep->buffp, rep->num_blks,
+                                                   rep->blk - clp->skip,
+                                                   clp->bs);
+            else if (clp->out_flags.delta)
+                rep->delta_skip = ofile_same(clp, rep, rep->blk + seek_skip);
+        }
+
         status = pthread_mutex_lock(&clp->out_mutex);
         if (0 != status) err_exit(status, "lock out_mutex");
-        if (FT_DEV_NULL != clp->out_type) {
+        if ((FT_DEV_NULL != clp->out_type) || clp->mfest.fp) {
             while ((! clp->out_stop) &&
                    ((rep->blk + seek_skip) != clp->out_blk)) {
                 /* if write would be out of sequence then wait */
@@ -593,6 +759,7 @@ read_write_thread(void * v_clp)
             clp->out_stop = true;
         rep->wr = true;
         rep->blk = clp->out_blk;
+        clp->wr_start[rep->id] = rep->blk;  /* cleared once written */
         clp->out_blk += blocks;
         clp->out_count -= blocks;
 
@@ -604,8 +771,25 @@ read_write_thread(void * v_clp)
             break;      /* read nothing so leave loop */
         }
 
+        rep->out_err = false;
         pthread_cleanup_push(cleanup_out, (void *)clp);
-        if (FT_SG == clp->out_type)
+        if (clp->mfest.fp)      /* in write order since out_mutex held */
+            sg_manifest_add(&clp->mfest, rep->buffp, rep->num_blks);
+        if (rep->delta_skip) {
+            if ((FT_SG != clp->out_type) &&
+                (lseek64(clp->outfd, (off64_t)rep->num_blks * clp->bs,
+                         SEEK_CUR) < 0)) {
+                perror("lseek64 on output to bypass delta write");
+                guarded_stop_in(clp);
+                clp->out_stop = true;
+                rep->out_err = true;
+            } else {
+                clp->out_rem_count -= rep->num_blks;
+                clp->out_delta_num += rep->num_blks;
+            }
+            status = pthread_mutex_unlock(&clp->out_mutex);
+            if (0 != status) err_exit(status, "unlock out_mutex");
+        } else if (FT_SG == clp->out_type)
             sg_out_operation(clp, rep); /* releases out_mutex mid operation */
         else if (FT_DEV_NULL == clp->out_type) {
             /* skip actual write operation */
@@ -619,13 +803,43 @@ read_write_thread(void * v_clp)
             if (0 != status) err_exit(status, "unlock out_mutex");
         }
         pthread_cleanup_pop(0);
+        /* let the writer of the next segment in before verifying this one */
+        pthread_cond_broadcast(&clp->out_sync_cv);
+        if (! rep->out_err) {
+            int64_t done = 0;
+            struct timeval now;
+
+            status = pthread_mutex_lock(&clp->out_mutex);
+            if (0 != status) err_exit(status, "lock out_mutex");
+            /* a short segment is the last, keep checkpoints before its end */
+            clp->wr_start[rep->id] = (rep->num_blks < blocks) ?
+                                     (rep->blk + rep->num_blks) : -1;
+            if (prog.secs > 0)
+                done = prog.base + dd_count - clp->out_rem_count;
+            status = pthread_mutex_unlock(&clp->out_mutex);
+            if (0 != status) err_exit(status, "unlock out_mutex");
+            if (ckpt.fn)
+                ckpt_maybe(clp);
+            if (prog.secs > 0) {
+                gettimeofday(&now, NULL);
+                sg_prog_xfer(&prog, ((now.tv_sec - xfer_tm.tv_sec) *
+                                     1000000LL) +
+                                    (now.tv_usec - xfer_tm.tv_usec), done);
+            }
+        }
+        /* no mutex held and the next writer already woken, so this verify
+         * overlaps with other threads' reads, writes and verifies */
+        if (clp->out_flags.verify && (! rep->out_err) &&
+            (! rep->delta_skip) && (FT_DEV_NULL != clp->out_type))
+            verify_out_operation(clp, rep);
 
         if (stop_after_write)
             break;
-        pthread_cond_broadcast(&clp->out_sync_cv);
     } /* end of while loop */
     if (rep->alloc_bp)
         free(rep->alloc_bp);
+    if (rep->alloc_vbp)
+        free(rep->alloc_vbp);
     status = pthread_mutex_lock(&clp->in_mutex);
     if (0 != status) err_exit(status, "lock in_mutex");
     if (! clp->in_stop)
@@ -649,6 +863,7 @@ normal_in_operation(Rq_coll * clp, Rq_elem * rep, int blocks)
         ;
     if (res < 0) {
         if (clp->in_flags.coe) {
+            count_event(clp, &clp->coe_errs);
             memset(rep->buffp, 0, rep->num_blks * rep->bs);
             pr2serr(">> substituted zeros for in blk=%" PRId64 " for %d "
                     "bytes, %s\n", rep->blk,
@@ -671,6 +886,9 @@ normal_in_operation(Rq_coll * clp, Rq_elem * rep, int blocks)
         if ((res % clp->bs) > 0) {
             blocks++;
             clp->in_partial++;
+            /* zero tail so digest is repeatable */
+            if (clp->mfest.fp || delta_tbl)
+                memset(rep->buffp + res, 0, (blocks * clp->bs) - res);
         }
         /* Reverse out + re-apply blocks on clp */
         clp->in_blk -= o_blocks;
@@ -695,6 +913,7 @@ normal_out_operation(Rq_coll * clp, Rq_elem * rep, int blocks)
         ;
     if (res < 0) {
         if (clp->out_flags.coe) {
+            count_event(clp, &clp->coe_errs);
             pr2serr(">> ignored error for out blk=%" PRId64 " for %d bytes, "
                     "%s\n", rep->blk, rep->num_blks * rep->bs,
                     tsafe_strerror(errno, strerr_buff));
@@ -705,6 +924,7 @@ normal_out_operation(Rq_coll * clp, Rq_elem * rep, int blocks)
                     tsafe_strerror(errno, strerr_buff));
             guarded_stop_in(clp);
             clp->out_stop = true;
+            rep->out_err = true;
             return;
         }
     }
@@ -818,6 +1038,7 @@ sg_in_operation(Rq_coll * clp, Rq_elem * rep)
             /* try again with same addr, count info */
             /* now re-acquire in mutex for balance */
             /* N.B. This re-read could now be out of read sequence */
+            count_event(clp, &clp->num_retries);
             status = pthread_mutex_lock(&clp->in_mutex);
             if (0 != status) err_exit(status, "lock in_mutex");
             break;
@@ -829,6 +1050,7 @@ sg_in_operation(Rq_coll * clp, Rq_elem * rep)
                 guarded_stop_both(clp);
                 return;
             } else {
+                count_event(clp, &clp->coe_errs);
                 memset(rep->buffp, 0, rep->num_blks * rep->bs);
                 pr2serr(">> substituted zeros for in blk=%" PRId64 " for %d "
                         "bytes\n", rep->blk, rep->num_blks * rep->bs);
@@ -880,6 +1102,7 @@ sg_out_operation(Rq_coll * clp, Rq_elem * rep)
                     rep->blk);
             status = pthread_mutex_unlock(&clp->out_mutex);
             if (0 != status) err_exit(status, "unlock out_mutex");
+            rep->out_err = true;
             guarded_stop_both(clp);
             return;
         }
@@ -894,6 +1117,7 @@ sg_out_operation(Rq_coll * clp, Rq_elem * rep)
             /* try again with same addr, count info */
             /* now re-acquire out mutex for balance */
             /* N.B. This re-write could now be out of write sequence */
+            count_event(clp, &clp->num_retries);
             status = pthread_mutex_lock(&clp->out_mutex);
             if (0 != status) err_exit(status, "lock out_mutex");
             break;
@@ -902,11 +1126,14 @@ sg_out_operation(Rq_coll * clp, Rq_elem * rep)
                 pr2serr("error finishing sg out command (medium)\n");
                 if (exit_status <= 0)
                     exit_status = res;
+                rep->out_err = true;
                 guarded_stop_both(clp);
                 return;
-            } else
+            } else {
+                count_event(clp, &clp->coe_errs);
                 pr2serr(">> ignored error for out blk=%" PRId64 " for %d "
                         "bytes\n", rep->blk, rep->num_blks * rep->bs);
+            }
 #if defined(__GNUC__)
 #if (__GNUC__ >= 7)
             __attribute__((fallthrough));
@@ -932,6 +1159,7 @@ sg_out_operation(Rq_coll * clp, Rq_elem * rep)
             pr2serr("error finishing sg out command (%d)\n", res);
             if (exit_status <= 0)
                 exit_status = res;
+            rep->out_err = true;
             guarded_stop_both(clp);
             return;
         }
@@ -945,8 +1173,9 @@ sg_start_io(Rq_elem * rep)
     bool fua = rep->wr ? rep->out_flags.fua : rep->in_flags.fua;
     bool dpo = rep->wr ? rep->out_flags.dpo : rep->in_flags.dpo;
     bool dio = rep->wr ? rep->out_flags.dio : rep->in_flags.dio;
+    bool loop = rep->wr ? rep->out_flags.loop : rep->in_flags.loop;
     int cdbsz = rep->wr ? rep->cdbsz_out : rep->cdbsz_in;
-    int res;
+    int fd, res;
 
     if (sg_build_scsi_cdb(rep->cmd, cdbsz, rep->num_blks, rep->blk,
                           rep->wr, fua, dpo)) {
@@ -974,10 +1203,14 @@ sg_start_io(Rq_elem * rep)
         sg_print_command(hp->cmdp);
     }
 
-    while (((res = write(rep->wr ? rep->outfd : rep->infd, hp,
-                         sizeof(struct sg_io_hdr))) < 0) &&
-           ((EINTR == errno) || (EAGAIN == errno)))
-        ;
+    fd = rep->wr ? rep->outfd : rep->infd;
+    if (loop)       /* loopback completes it now, see sg_finish_io */
+        res = sg_loop_sg_io(fd, hp);
+    else {
+        while (((res = write(fd, hp, sizeof(struct sg_io_hdr))) < 0) &&
+               ((EINTR == errno) || (EAGAIN == errno)))
+            ;
+    }
     if (res < 0) {
         if (ENOMEM == errno)
             return 1;
@@ -993,30 +1226,35 @@ sg_start_io(Rq_elem * rep)
 static int
 sg_finish_io(bool wr, Rq_elem * rep, pthread_mutex_t * a_mutp)
 {
-    int res, status;
+    int fd, res, status;
     struct sg_io_hdr io_hdr;
     struct sg_io_hdr * hp;
 #if 0
     static int testing = 0;     /* thread dubious! */
 #endif
 
-    memset(&io_hdr, 0 , sizeof(struct sg_io_hdr));
-    /* FORCE_PACK_ID active set only read packet with matching pack_id */
-    io_hdr.interface_id = 'S';
-    io_hdr.dxfer_direction = wr ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
-    io_hdr.pack_id = (int)rep->blk;
-
-    while (((res = read(wr ? rep->outfd : rep->infd, &io_hdr,
-                        sizeof(struct sg_io_hdr))) < 0) &&
-           ((EINTR == errno) || (EAGAIN == errno)))
-        ;
-    if (res < 0) {
-        perror("finishing io on sg device, error");
-        return -1;
+    fd = wr ? rep->outfd : rep->infd;
+    /* a loopback command was completed into rep->io_hdr by sg_start_io */
+    if (! (wr ? rep->out_flags.loop : rep->in_flags.loop)) {
+        memset(&io_hdr, 0 , sizeof(struct sg_io_hdr));
+        /* FORCE_PACK_ID active set only read packet with matching
+         * pack_id */
+        io_hdr.interface_id = 'S';
+        io_hdr.dxfer_direction = wr ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
+        io_hdr.pack_id = (int)rep->blk;
+
+        while (((res = read(fd, &io_hdr, sizeof(struct sg_io_hdr))) < 0) &&
+               ((EINTR == errno) || (EAGAIN == errno)))
+            ;
+        if (res < 0) {
+            perror("finishing io on sg device, error");
+            return -1;
+        }
+        if (rep != (Rq_elem *)io_hdr.usr_ptr)
+            err_exit(0, "sg_finish_io: bad usr_ptr, request-response "
+                     "mismatch\n");
+        memcpy(&rep->io_hdr, &io_hdr, sizeof(struct sg_io_hdr));
     }
-    if (rep != (Rq_elem *)io_hdr.usr_ptr)
-        err_exit(0, "sg_finish_io: bad usr_ptr, request-response mismatch\n");
-    memcpy(&rep->io_hdr, &io_hdr, sizeof(struct sg_io_hdr));
     hp = &rep->io_hdr;
 
     res = sg_err_category3(hp);
@@ -1061,6 +1299,174 @@ sg_finish_io(bool wr, Rq_elem * rep, pthread_mutex_t * a_mutp)
     return 0;
 }
 
+/* Reads rep->num_blks blocks starting at 'blk' from a sg OFILE into
+ * rep->vbuffp. Uses the SG_IO ioctl so it does not disturb the pack_id
+ * matching of the write()/read() interface used by the copy. Returns 0 on
+ * success, else a SG_LIB_CAT_* value or -1 . */
+static int
+sg_read_back(Rq_elem * rep, int64_t blk)
+{
+    int res;
+    uint8_t cmd[MAX_SCSI_CDBSZ];
+    uint8_t sb[SENSE_BUFF_LEN];
+    struct sg_io_hdr io_hdr;
+
+    if (sg_build_scsi_cdb(cmd, rep->cdbsz_out, rep->num_blks, blk,
+                          false, rep->out_flags.fua, rep->out_flags.dpo))
+        return -1;
+    memset(&io_hdr, 0, sizeof(struct sg_io_hdr));
+    io_hdr.interface_id = 'S';
+    io_hdr.cmd_len = rep->cdbsz_out;
+    io_hdr.cmdp = cmd;
+    io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+    io_hdr.dxfer_len = rep->bs * rep->num_blks;
+    io_hdr.dxferp = rep->vbuffp;
+    io_hdr.mx_sb_len = sizeof(sb);
+    io_hdr.sbp = sb;
+    io_hdr.timeout = DEF_TIMEOUT;
+    while (((res = (rep->out_flags.loop ?
+                    sg_loop_sg_io(rep->outfd, &io_hdr) :
+                    ioctl(rep->outfd, SG_IO, &io_hdr))) < 0) &&
+           ((EINTR == errno) || (EAGAIN == errno)))
+        ;
+    if (res < 0) {
+        perror("reading back from sg device, error");
+        return -1;
+    }
+    res = sg_err_category3(&io_hdr);
+    switch (res) {
+    case SG_LIB_CAT_CLEAN:
+    case SG_LIB_CAT_RECOVERED:
+        return 0;
+    default:
+        if (rep->debug)
+            sg_chk_n_print3("reading back", &io_hdr, rep->debug > 1);
+        return res;
+    }
+}
+
+/* Checks the blocks that this thread has just written to OFILE. A sg
+ * OFILE is sent VERIFY(16) with BYTCHK=1 (falling back to reading back if
+ * that is not supported), other output files are read back with pread().
+ * Called without any mutex held. */
+static void
+verify_out_operation(Rq_coll * clp, Rq_elem * rep)
+{
+    bool by_read;
+    int k, res, status;
+    int num = rep->num_blks * rep->bs;
+    int64_t lba = -1;
+    uint64_t info = 0;
+    char strerr_buff[STRERR_BUFF_LEN];
+
+    status = pthread_mutex_lock(&clp->aux_mutex);
+    if (0 != status) err_exit(status, "lock aux_mutex");
+    by_read = clp->verify_by_read;
+    status = pthread_mutex_unlock(&clp->aux_mutex);
+    if (0 != status) err_exit(status, "unlock aux_mutex");
+
+    if ((FT_SG == clp->out_type) && (! by_read)) {
+        for (k = 0; k < 2; ++k) {   /* one retry for UA or aborted cmd */
+            res = sg_ll_verify16(rep->outfd, 0, rep->out_flags.dpo,
+                                 1 /* bytchk */, rep->blk, rep->num_blks, 0,
+                                 rep->buffp, num, &info, false,
+                                 (rep->debug > 1) ? (rep->debug - 1) : 0);
+            if ((SG_LIB_CAT_UNIT_ATTENTION != res) &&
+                (SG_LIB_CAT_ABORTED_COMMAND != res))
+                break;
+        }
+        switch (res) {
+        case 0:
+            break;
+        case SG_LIB_CAT_MISCOMPARE:
+            /* info field, if given, is byte offset of first miscompare */
+            lba = rep->blk;
+            if (info < (uint64_t)num)
+                lba += (int64_t)(info / rep->bs);
+            break;
+        case SG_LIB_CAT_INVALID_OP:
+        case SG_LIB_CAT_ILLEGAL_REQ:
+            status = pthread_mutex_lock(&clp->aux_mutex);
+            if (0 != status) err_exit(status, "lock aux_mutex");
+            if (! clp->verify_by_read) {
+                pr2serr(">> VERIFY(16) with BYTCHK=1 not supported on "
+                        "OFILE, will read back and compare\n");
+                clp->verify_by_read = true;
+            }
+            status = pthread_mutex_unlock(&clp->aux_mutex);
+            if (0 != status) err_exit(status, "unlock aux_mutex");
+            by_read = true;
+            break;
+        default:
+            pr2serr("VERIFY(16) failed, blk=%" PRId64 "\n", rep->blk);
+            if (exit_status <= 0)
+                exit_status = res;
+            guarded_stop_both(clp);
+            return;
+        }
+    } else
+        by_read = true;
+
+    if (by_read) {
+        if (FT_SG == clp->out_type) {
+            res = sg_read_back(rep, rep->blk);
+            if (res) {
+                pr2serr("read back for verify failed, blk=%" PRId64 "\n",
+                        rep->blk);
+                if (exit_status <= 0)
+                    exit_status = res;
+                guarded_stop_both(clp);
+                return;
+            }
+        } else {
+            off64_t offset = rep->blk;
+
+            offset *= rep->bs;
+            while (((res = pread(rep->outfd, rep->vbuffp, num, offset)) < 0)
+                   && (EINTR == errno))
+                ;
+            if (res < 0) {
+                pr2serr("read back for verify failed, %s\n",
+                        tsafe_strerror(errno, strerr_buff));
+                if (exit_status <= 0)
+                    exit_status = SG_LIB_FILE_ERROR;
+                guarded_stop_both(clp);
+                return;
+            }
+            num = res;
+        }
+        for (k = 0; k < rep->num_blks; ++k) {
+            res = (num < rep->bs) ? num : rep->bs;
+            if ((res < rep->bs) ||
+                memcmp(rep->buffp + (k * rep->bs),
+                       rep->vbuffp + (k * rep->bs), res))
+                break;
+            num -= res;
+        }
+        if (k < rep->num_blks)
+            lba = rep->blk + k;
+    }
+
+    status = pthread_mutex_lock(&clp->aux_mutex);
+    if (0 != status) err_exit(status, "lock aux_mutex");
+    if (lba < 0)
+        clp->verified_blks += rep->num_blks;
+    else {
+        ++clp->miscompares;
+        if ((clp->first_miscomp_lba < 0) || (lba < clp->first_miscomp_lba))
+            clp->first_miscomp_lba = lba;
+        pr2serr("verify: miscompare at lba=%" PRId64 " [0x%" PRIx64 "]\n",
+                lba, lba);
+    }
+    status = pthread_mutex_unlock(&clp->aux_mutex);
+    if (0 != status) err_exit(status, "unlock aux_mutex");
+    if ((lba >= 0) && (! clp->out_flags.coe)) {
+        if (exit_status <= 0)
+            exit_status = SG_LIB_CAT_MISCOMPARE;
+        guarded_stop_both(clp);
+    }
+}
+
 static int
 sg_prepare(int fd, int bs, int bpt)
 {
@@ -1082,6 +1488,325 @@ sg_prepare(int fd, int bs, int bpt)
     return 0;
 }
 
+/* Returns the number of blocks, from the start of the whole copy, that
+ * have all been written. Writes are issued in order but complete out of
+ * order so this stops at the oldest write still in flight (or one that
+ * failed). Caller holds out_mutex or has joined the worker threads. */
+static int64_t
+ckpt_done(Rq_coll * clp)
+{
+    int k;
+    int64_t blk = clp->out_blk;
+
+    for (k = 0; k < clp->num_ids; ++k) {
+        if ((clp->wr_start[k] >= 0) && (clp->wr_start[k] < blk))
+            blk = clp->wr_start[k];
+    }
+    return blk - clp->seek;
+}
+
+/* Makes the blocks copied so far durable on OFILE, then atomically
+ * replaces the checkpoint file with one recording 'done'. Blocks copied
+ * after 'done' are copied again by resume=1. Returns 0 on success, else
+ * SG_LIB_FILE_ERROR . */
+static int
+ckpt_write(Rq_coll * clp, int64_t done)
+{
+    int res;
+    FILE * fp;
+    char tmp[INOUTF_SZ + 8];
+    char ebuff[EBUFF_SZ + (2 * INOUTF_SZ)];    /* room for both names */
+
+    if (FT_SG == clp->out_type) {
+        if (! clp->out_flags.fua) {
+            res = sg_ll_sync_cache_10(clp->outfd, false, false, 0, 0, 0,
+                                      true, 0);
+            if (SG_LIB_CAT_UNIT_ATTENTION == res)
+                res = sg_ll_sync_cache_10(clp->outfd, false, false, 0, 0, 0,
+                                          false, 0);
+            if (res) {
+                pr2serr("checkpoint: unable to synchronize cache on %s\n",
+                        ckpt.outf);
+                return SG_LIB_FILE_ERROR;
+            }
+        }
+    } else if (((FT_OTHER == clp->out_type) || (FT_BLOCK == clp->out_type) ||
+                (FT_RAW == clp->out_type)) && (fdatasync(clp->outfd) < 0)) {
+        perror(ME "checkpoint: fdatasync on output");
+        return SG_LIB_FILE_ERROR;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ckpt.fn);
+    if (NULL == (fp = fopen(tmp, "w"))) {
+        snprintf(ebuff, sizeof(ebuff), ME "could not open %s for checkpoint",
+                 tmp);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    fprintf(fp, "# sg3_utils copy checkpoint from sgp_dd %s\n",
+            version_str);
+    fprintf(fp, "# if=%s\n# of=%s\n", ckpt.inf, ckpt.outf);
+    fprintf(fp, "bs=%d skip=%" PRId64 " seek=%" PRId64 " count=%" PRId64
+            " done=%" PRId64 "\n", clp->bs, ckpt.skip, ckpt.seek,
+            ckpt.count, done);
+    if (fflush(fp) || (fsync(fileno(fp)) < 0) || ferror(fp)) {
+        perror(ME "writing checkpoint");
+        fclose(fp);
+        return SG_LIB_FILE_ERROR;
+    }
+    fclose(fp);
+    if (rename(tmp, ckpt.fn) < 0) {
+        snprintf(ebuff, sizeof(ebuff), ME "could not rename %s to %s", tmp,
+                 ckpt.fn);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    ckpt.saved = done;
+    gettimeofday(&ckpt.tm, NULL);
+    if (clp->debug > 1)
+        pr2serr("checkpoint: %" PRId64 " blocks done\n", done);
+    return 0;
+}
+
+/* Called by a worker after each write, writes a checkpoint if ckpt.secs
+ * seconds have passed or ckpt.mb MiB have been copied since the last one.
+ * Only one worker does so at a time, the others carry on copying. */
+static void
+ckpt_maybe(Rq_coll * clp)
+{
+    int status;
+    int64_t done;
+    struct timeval now;
+
+    if (0 != pthread_mutex_trylock(&ckpt_mutex))
+        return;
+    status = pthread_mutex_lock(&clp->out_mutex);
+    if (0 != status) err_exit(status, "lock out_mutex");
+    done = ckpt_done(clp);
+    status = pthread_mutex_unlock(&clp->out_mutex);
+    if (0 != status) err_exit(status, "unlock out_mutex");
+    if (done > ckpt.saved) {
+        gettimeofday(&now, NULL);
+        if (((ckpt.mb > 0) && (((done - ckpt.saved) * clp->bs) >=
+                               ((int64_t)ckpt.mb << 20))) ||
+            ((ckpt.secs > 0) && ((now.tv_sec - ckpt.tm.tv_sec) >= ckpt.secs)))
+            ckpt_write(clp, done);
+    }
+    pthread_mutex_unlock(&ckpt_mutex);
+}
+
+/* For resume=1: reads the checkpoint file written by an earlier run with
+ * ckpt=CF and the same bs, skip, seek and count. Yields the number of
+ * blocks already copied via *donep (0 if there is no checkpoint file yet).
+ * Returns 0 on success, else SG_LIB_FILE_ERROR or SG_LIB_SYNTAX_ERROR . */
+static int
+ckpt_load(int bs, int64_t * donep)
+{
+    int f_bs = -1;
+    int lnum, n;
+    int64_t sk, se, cnt, done;
+    FILE * fp;
+    char line[INOUTF_SZ + 16];
+    char ebuff[EBUFF_SZ];
+
+    *donep = 0;
+    if (NULL == (fp = fopen(ckpt.fn, "r"))) {
+        if (ENOENT == errno) {
+            pr2serr("resume: no checkpoint %s, starting at the beginning\n",
+                    ckpt.fn);
+            return 0;
+        }
+        snprintf(ebuff, EBUFF_SZ, ME "could not open checkpoint %s",
+                 ckpt.fn);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    for (lnum = 1; fgets(line, sizeof(line), fp); ++lnum) {
+        n = strlen(line);
+        if ((n > 0) && ('\n' == line[n - 1]))
+            line[--n] = '\0';
+        if (0 == strncmp(line, "# if=", 5)) {
+            if (strcmp(line + 5, ckpt.inf))
+                pr2serr("resume: note, checkpoint was taken with if=%s\n",
+                        line + 5);
+            continue;
+        }
+        if (0 == strncmp(line, "# of=", 5)) {
+            if (strcmp(line + 5, ckpt.outf))
+                pr2serr("resume: note, checkpoint was taken with of=%s\n",
+                        line + 5);
+            continue;
+        }
+        if (('#' == line[0]) || ('\0' == line[0]))
+            continue;
+        if (5 != sscanf(line, "bs=%d skip=%" SCNd64 " seek=%" SCNd64
+                        " count=%" SCNd64 " done=%" SCNd64, &f_bs, &sk, &se,
+                        &cnt, &done)) {
+            pr2serr("checkpoint %s: unexpected line %d: %s\n", ckpt.fn,
+                    lnum, line);
+            fclose(fp);
+            return SG_LIB_SYNTAX_ERROR;
+        }
+    }
+    fclose(fp);
+    if (f_bs < 0) {
+        pr2serr("checkpoint %s: no bs= line\n", ckpt.fn);
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if ((f_bs != bs) || (sk != ckpt.skip) || (se != ckpt.seek) ||
+        (cnt != ckpt.count) || (done < 0) || (done > cnt)) {
+        pr2serr("checkpoint %s is for another copy: bs=%d skip=%" PRId64
+                " seek=%" PRId64 " count=%" PRId64 "\n", ckpt.fn, f_bs, sk,
+                se, cnt);
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    *donep = done;
+    return 0;
+}
+
+/* Token bucket limiter for rate= and iops=, shared by all worker threads.
+ * Takes 'bytes' and one transfer from rlim under rate_mutex then, with no
+ * mutex held, sleeps off this thread's share of any debt so the threads
+ * together keep to the caps. */
+static void
+rate_wait(int bytes)
+{
+    int status;
+    double wait;
+
+    status = pthread_mutex_lock(&rate_mutex);
+    if (0 != status) err_exit(status, "lock rate_mutex");
+    wait = sg_rate_take(&rlim, bytes);
+    status = pthread_mutex_unlock(&rate_mutex);
+    if (0 != status) err_exit(status, "unlock rate_mutex");
+    sg_rate_sleep(wait);
+}
+
+/* Appends the thread and error counts to each progress line */
+static int
+prog_extra(void * arg, char * b, int blen)
+{
+    Rq_coll * clp = (Rq_coll *)arg;
+
+    return snprintf(b, blen, ",\"threads\":%d,\"retries\":%d,"
+                    "\"unrecovered\":%d", num_threads, clp->num_retries,
+                    clp->coe_errs);
+}
+
+/* Loads the chunk digests from manifest file 'mf' (as written by a prior
+ * manifest=MF) into delta_tbl. The manifest must be for the same bs, skip
+ * and seek as this copy. Returns 0 on success, else SG_LIB_FILE_ERROR or
+ * SG_LIB_SYNTAX_ERROR . */
+static int
+delta_load(const char * mf, int bs, int64_t skip, int64_t seek)
+{
+    int m_bs = 0;
+    int n, num, lnum;
+    int64_t off;
+    int64_t m_skip = -1;
+    int64_t m_seek = -1;
+    int64_t alloc_len = 0;
+    unsigned int crc;
+    FILE * fp;
+    struct delta_ent * dep;
+    char line[256];
+    char ebuff[EBUFF_SZ];
+
+    if (NULL == (fp = fopen(mf, "r"))) {
+        snprintf(ebuff, EBUFF_SZ, ME "could not open %s for delta", mf);
+        perror(ebuff);
+        return SG_LIB_FILE_ERROR;
+    }
+    for (lnum = 1; fgets(line, sizeof(line), fp); ++lnum) {
+        if (('#' == line[0]) || ('\n' == line[0]))
+            continue;
+        if (0 == strncmp(line, "bs=", 3)) {
+            if (4 != sscanf(line, "bs=%d mchunk=%d skip=%" SCNd64 " seek=%"
+                            SCNd64, &m_bs, &delta_chunk, &m_skip, &m_seek))
+                goto bad_line;
+            continue;
+        }
+        if (0 == strncmp(line, "total", 5))
+            break;
+        num = sscanf(line, "%" SCNd64 " %d %x", &off, &n, &crc);
+        if ((3 != num) || (delta_chunk < 1) || (n < 1) ||
+            (off != (delta_tbl_len * delta_chunk)))
+            goto bad_line;
+        if (delta_tbl_len >= alloc_len) {
+            alloc_len = alloc_len ? (2 * alloc_len) : 1024;
+            dep = (struct delta_ent *)realloc(delta_tbl, alloc_len *
+                                              sizeof(struct delta_ent));
+            if (NULL == dep) {
+                pr2serr("delta_load: out of memory\n");
+                fclose(fp);
+                return sg_convert_errno(ENOMEM);
+            }
+            delta_tbl = dep;
+        }
+        delta_tbl[delta_tbl_len].blks = n;
+        delta_tbl[delta_tbl_len].crc = crc;
+        ++delta_tbl_len;
+    }
+    fclose(fp);
+    if (m_bs != bs) {
+        pr2serr("delta manifest %s has bs=%d, expected %d\n", mf, m_bs, bs);
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if ((m_skip != skip) || (m_seek != seek)) {
+        pr2serr("delta manifest %s is for skip=%" PRId64 " seek=%" PRId64
+                ", not skip=%" PRId64 " seek=%" PRId64 "\n", mf, m_skip,
+                m_seek, skip, seek);
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    return 0;
+
+bad_line:
+    pr2serr("delta manifest %s: unexpected line %d: %s", mf, lnum, line);
+    fclose(fp);
+    return SG_LIB_SYNTAX_ERROR;
+}
+
+/* Returns true if the 'blocks' blocks at 'bp', which are at 'rel_blk'
+ * from the start of the copy, have the same digest as the corresponding
+ * chunk in the delta= manifest. delta_tbl is read-only while threads run. */
+static bool
+delta_chunk_same(const uint8_t * bp, int blocks, int64_t rel_blk, int bs)
+{
+    int64_t k;
+
+    if (rel_blk % delta_chunk)
+        return false;
+    k = rel_blk / delta_chunk;
+    if ((k >= delta_tbl_len) || (blocks != delta_tbl[k].blks))
+        return false;
+    return delta_tbl[k].crc == sg_crc32c(0, bp, blocks * bs);
+}
+
+/* Returns true if OFILE, starting at 'out_blk', already holds the
+ * rep->num_blks blocks in rep->buffp. Uses rep->vbuffp and is called
+ * without any mutex held. If OFILE can't be read (e.g. it is shorter) then
+ * returns false so those blocks get written. */
+static bool
+ofile_same(Rq_coll * clp, Rq_elem * rep, int64_t out_blk)
+{
+    int res;
+    int num = rep->num_blks * rep->bs;
+
+    if (FT_SG == clp->out_type) {
+        if (sg_read_back(rep, out_blk))
+            return false;
+    } else {
+        off64_t offset = out_blk;
+
+        offset *= rep->bs;
+        while (((res = pread(rep->outfd, rep->vbuffp, num, offset)) < 0) &&
+               (EINTR == errno))
+            ;
+        if (res < num)
+            return false;
+    }
+    return 0 == memcmp(rep->buffp, rep->vbuffp, num);
+}
+
 static int
 process_flags(const char * arg, struct flags_t * fp)
 {
@@ -1104,6 +1829,8 @@ process_flags(const char * arg, struct flags_t * fp)
             fp->append = true;
         else if (0 == strcmp(cp, "coe"))
             fp->coe = true;
+        else if (0 == strcmp(cp, "delta"))
+            fp->delta = true;
         else if (0 == strcmp(cp, "dio"))
             fp->dio = true;
         else if (0 == strcmp(cp, "direct"))
@@ -1118,6 +1845,8 @@ process_flags(const char * arg, struct flags_t * fp)
             fp->fua = true;
         else if (0 == strcmp(cp, "null"))
             ;
+        else if (0 == strcmp(cp, "verify"))
+            fp->verify = true;
         else {
             pr2serr("unrecognised flag: %s\n", cp);
             return 1;
@@ -1129,7 +1858,6 @@ process_flags(const char * arg, struct flags_t * fp)
 
 
 #define STR_SZ 1024
-#define INOUTF_SZ 512
 
 
 int
@@ -1140,13 +1868,21 @@ main(int argc, char * argv[])
     int ibs = 0;
     int obs = 0;
     int bpt_given = 0;
+    bool bpt_auto = false;
     int cdbsz_given = 0;
     char str[STR_SZ];
     char * key;
     char * buf;
     char inf[INOUTF_SZ];
     char outf[INOUTF_SZ];
+    char mf[INOUTF_SZ];
+    char dmf[INOUTF_SZ];
+    char ckf[INOUTF_SZ];
+    char rf[INOUTF_SZ];
+    char pf[INOUTF_SZ];
+    bool do_resume = false;
     int res, k;
+    int mchunk = DEF_MANIFEST_CHUNK;
     int64_t in_num_sect = 0;
     int64_t out_num_sect = 0;
     pthread_t threads[MAX_NUM_THREADS];
@@ -1170,6 +1906,12 @@ main(int argc, char * argv[])
     rcoll.cdbsz_out = DEF_SCSI_CDBSZ;
     inf[0] = '\0';
     outf[0] = '\0';
+    mf[0] = '\0';
+    dmf[0] = '\0';
+    ckf[0] = '\0';
+    rf[0] = '\0';
+    pf[0] = '\0';
+    ckpt.secs = DEF_CKPT_SECS;
 
     for (k = 1; k < argc; k++) {
         if (argv[k]) {
@@ -1182,7 +1924,9 @@ main(int argc, char * argv[])
             buf++;
         if (*buf)
             *buf++ = '\0';
-        if (0 == strcmp(key,"bpt")) {
+        if ((0 == strcmp(key,"bpt")) && (0 == strcmp(buf, "auto")))
+            bpt_auto = true;
+        else if (0 == strcmp(key,"bpt")) {
             rcoll.bpt = sg_get_num(buf);
             if (-1 == rcoll.bpt) {
                 pr2serr(ME "bad argument to 'bpt='\n");
@@ -1199,6 +1943,24 @@ main(int argc, char * argv[])
             rcoll.cdbsz_in = sg_get_num(buf);
             rcoll.cdbsz_out = rcoll.cdbsz_in;
             cdbsz_given = 1;
+        } else if (0 == strcmp(key, "ckpt")) {
+            if ('\0' != ckf[0]) {
+                pr2serr("Second 'ckpt=' argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(ckf, sizeof(ckf), "%s", buf);
+        } else if (0 == strcmp(key, "ckpt_int")) {
+            ckpt.secs = sg_get_num(buf);
+            if (ckpt.secs < 0) {
+                pr2serr(ME "bad argument to 'ckpt_int='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key, "ckpt_mb")) {
+            ckpt.mb = sg_get_num(buf);
+            if (ckpt.mb < 0) {
+                pr2serr(ME "bad argument to 'ckpt_mb='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
         } else if (0 == strcmp(key,"coe")) {
             rcoll.in_flags.coe = !! sg_get_num(buf);
             rcoll.out_flags.coe = rcoll.in_flags.coe;
@@ -1210,6 +1972,12 @@ main(int argc, char * argv[])
                     return SG_LIB_SYNTAX_ERROR;
                 }
             }   /* treat 'count=-1' as calculate count (same as not given) */
+        } else if (0 == strcmp(key, "delta")) {
+            if ('\0' != dmf[0]) {
+                pr2serr("Second 'delta=' argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(dmf, sizeof(dmf), "%s", buf);
         } else if ((0 == strncmp(key,"deb", 3)) ||
                    (0 == strncmp(key,"verb", 4)))
             rcoll.debug = sg_get_num(buf);
@@ -1239,6 +2007,25 @@ main(int argc, char * argv[])
                 pr2serr(ME "bad argument to 'iflag='\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
+        } else if (0 == strcmp(key, "iops")) {
+            rlim.iops = sg_get_num(buf);
+            if (rlim.iops < 0) {
+                pr2serr(ME "bad argument to 'iops='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            rlim.on = true;
+        } else if (0 == strcmp(key, "manifest")) {
+            if ('\0' != mf[0]) {
+                pr2serr("Second 'manifest=' argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(mf, sizeof(mf), "%s", buf);
+        } else if (0 == strcmp(key, "mchunk")) {
+            mchunk = sg_get_num(buf);
+            if (mchunk < 1) {
+                pr2serr(ME "bad argument to 'mchunk='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
         } else if (0 == strcmp(key,"obs")) {
             obs = sg_get_num(buf);
             if (-1 == obs) {
@@ -1256,7 +2043,37 @@ main(int argc, char * argv[])
                 pr2serr(ME "bad argument to 'oflag='\n");
                 return SG_LIB_SYNTAX_ERROR;
             }
-        } else if (0 == strcmp(key,"seek")) {
+        } else if (0 == strcmp(key, "progress")) {
+            prog.secs = sg_get_num(buf);
+            if (prog.secs < 0) {
+                pr2serr(ME "bad argument to 'progress='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key, "progress_file")) {
+            if ('\0' != pf[0]) {
+                pr2serr("Second 'progress_file=' argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(pf, sizeof(pf), "%s", buf);
+            prog.fn = pf;
+        } else if (0 == strcmp(key, "rate")) {
+            rlim.mbps = sg_get_num(buf);
+            if (rlim.mbps < 0) {
+                pr2serr(ME "bad argument to 'rate='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            rlim.on = true;
+        } else if (0 == strcmp(key, "rate_file")) {
+            if ('\0' != rf[0]) {
+                pr2serr("Second 'rate_file=' argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else
+                snprintf(rf, sizeof(rf), "%s", buf);
+            rlim.fn = rf;
+            rlim.on = true;
+        } else if (0 == strcmp(key, "resume"))
+            do_resume = !! sg_get_num(buf);
+        else if (0 == strcmp(key,"seek")) {
             seek = sg_get_llnum(buf);
             if (-1LL == seek) {
                 pr2serr(ME "bad argument to 'seek='\n");
@@ -1307,6 +2124,18 @@ main(int argc, char * argv[])
         pr2serr("Can't use both append and seek switches\n");
         return SG_LIB_SYNTAX_ERROR;
     }
+    if (rcoll.out_flags.verify && rcoll.out_flags.append) {
+        pr2serr("Can't use both append and verify flags\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (rcoll.in_flags.verify)
+        pr2serr("verify flag ignored for iflag\n");
+    if ((rcoll.out_flags.delta || dmf[0]) && rcoll.out_flags.append) {
+        pr2serr("Can't use append with a delta copy\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (rcoll.in_flags.delta)
+        pr2serr("delta flag ignored for iflag\n");
     if (rcoll.bpt < 1) {
         pr2serr("bpt must be greater than 0\n");
         return SG_LIB_SYNTAX_ERROR;
@@ -1316,6 +2145,31 @@ main(int argc, char * argv[])
        SG_IO ioctl. So reduce it in that case. */
     if ((rcoll.bs >= 2048) && (0 == bpt_given))
         rcoll.bpt = DEF_BLOCKS_PER_2048TRANSFER;
+    if (dmf[0]) {
+        if (rcoll.out_flags.delta) {
+            pr2serr("oflag=delta ignored since delta=DMF given\n");
+            rcoll.out_flags.delta = false;
+        }
+        res = delta_load(dmf, rcoll.bs, skip, seek);
+        if (res)
+            return res;
+        if (bpt_given && (rcoll.bpt != delta_chunk))
+            pr2serr("bpt=%d changed to %d to match delta manifest\n",
+                    rcoll.bpt, delta_chunk);
+        rcoll.bpt = delta_chunk;    /* each transfer is one manifest chunk */
+        if (bpt_auto) {
+            pr2serr("bpt=auto ignored since delta=DMF given\n");
+            bpt_auto = false;
+        }
+        if (rcoll.debug)
+            pr2serr("delta: %" PRId64 " chunks of %d blocks loaded from "
+                    "%s\n", delta_tbl_len, delta_chunk, dmf);
+    }
+    if (bpt_auto) {     /* provisional, sizes sg reserved buffers */
+        rcoll.bpt = AUTO_MAX_BYTES / rcoll.bs;
+        if (rcoll.bpt < 1)
+            rcoll.bpt = 1;
+    }
     if ((num_threads < 1) || (num_threads > MAX_NUM_THREADS)) {
         pr2serr("too few or too many threads requested\n");
         usage();
@@ -1350,13 +2204,16 @@ main(int argc, char * argv[])
             if (rcoll.in_flags.dsync)
                 flags |= O_SYNC;
 
-            if ((rcoll.infd = open(inf, flags)) < 0) {
+            if ((rcoll.infd = scsi_pt_open_flags(inf, flags, 0)) < 0) {
+                errno = -rcoll.infd;
                 snprintf(ebuff, EBUFF_SZ,
                          ME "could not open %s for sg reading", inf);
                 perror(ebuff);
                 return SG_LIB_FILE_ERROR;
             }
-            if (sg_prepare(rcoll.infd, rcoll.bs, rcoll.bpt))
+            rcoll.in_flags.loop = sg_loop_fd(rcoll.infd);
+            if ((! rcoll.in_flags.loop) &&
+                sg_prepare(rcoll.infd, rcoll.bs, rcoll.bpt))
                 return SG_LIB_FILE_ERROR;
         }
         else {
@@ -1403,21 +2260,26 @@ main(int argc, char * argv[])
             if (rcoll.out_flags.dsync)
                 flags |= O_SYNC;
 
-            if ((rcoll.outfd = open(outf, flags)) < 0) {
+            if ((rcoll.outfd = scsi_pt_open_flags(outf, flags, 0)) < 0) {
+                errno = -rcoll.outfd;
                 snprintf(ebuff,  EBUFF_SZ,
                          ME "could not open %s for sg writing", outf);
                 perror(ebuff);
                 return SG_LIB_FILE_ERROR;
             }
 
-            if (sg_prepare(rcoll.outfd, rcoll.bs, rcoll.bpt))
+            rcoll.out_flags.loop = sg_loop_fd(rcoll.outfd);
+            if ((! rcoll.out_flags.loop) &&
+                sg_prepare(rcoll.outfd, rcoll.bs, rcoll.bpt))
                 return SG_LIB_FILE_ERROR;
         }
         else if (FT_DEV_NULL == rcoll.out_type)
             rcoll.outfd = -1; /* don't bother opening */
         else {
             if (FT_RAW != rcoll.out_type) {
-                flags = O_WRONLY | O_CREAT;
+                flags = ((rcoll.out_flags.verify || rcoll.out_flags.delta) ?
+                         O_RDWR : O_WRONLY) |
+                        O_CREAT;
                 if (rcoll.out_flags.direct)
                     flags |= O_DIRECT;
                 if (rcoll.out_flags.excl)
@@ -1435,7 +2297,9 @@ main(int argc, char * argv[])
                 }
             }
             else {      /* raw output file */
-                if ((rcoll.outfd = open(outf, O_WRONLY)) < 0) {
+                flags = (rcoll.out_flags.verify || rcoll.out_flags.delta) ?
+                        O_RDWR : O_WRONLY;
+                if ((rcoll.outfd = open(outf, flags)) < 0) {
                     snprintf(ebuff, EBUFF_SZ,
                              ME "could not open %s for raw writing", outf);
                     perror(ebuff);
@@ -1460,6 +2324,28 @@ main(int argc, char * argv[])
         pr2serr("For more information use '--help'\n");
         return SG_LIB_SYNTAX_ERROR;
     }
+    if (rcoll.out_flags.verify && (STDOUT_FILENO == rcoll.outfd)) {
+        pr2serr("oflag=verify needs output file that can be read back\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if ((rcoll.out_flags.delta || delta_tbl) &&
+        ((STDOUT_FILENO == rcoll.outfd) || (FT_ST == rcoll.out_type))) {
+        pr2serr("delta copy needs output file that can be read and "
+                "seeked\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (prog.fn && (0 == prog.secs))
+        prog.secs = DEF_PROGRESS_SECS;
+    if (do_resume && ('\0' == ckf[0])) {
+        pr2serr("resume=1 needs ckpt=CF\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (ckf[0] && ((STDIN_FILENO == rcoll.infd) ||
+                   (STDOUT_FILENO == rcoll.outfd) ||
+                   (FT_ST == rcoll.in_type) || (FT_ST == rcoll.out_type))) {
+        pr2serr("ckpt= needs IFILE and OFILE that can be seeked\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
     if (dd_count < 0) {
         in_num_sect = -1;
         if (FT_SG == rcoll.in_type) {
@@ -1543,6 +2429,26 @@ main(int argc, char * argv[])
         pr2serr("Couldn't calculate count, please give one\n");
         return SG_LIB_CAT_OTHER;
     }
+    if (bpt_auto) {
+        struct sg_simple_block_limits_resp bl;
+
+        /* trim to what the Block Limits VPD pages of sg IFILE and OFILE
+         * allow; the sg reserved buffers were sized for AUTO_MAX_BYTES */
+        for (k = 0; k < 2; ++k) {
+            if ((FT_SG != (k ? rcoll.out_type : rcoll.in_type)) ||
+                sg_simple_block_limits((k ? rcoll.outfd : rcoll.infd), &bl,
+                                       false, (rcoll.debug > 1) ?
+                                              (rcoll.debug - 2) : 0))
+                continue;
+            if ((bl.max_xfer_len > 0) &&
+                (bl.max_xfer_len < (uint32_t)rcoll.bpt))
+                rcoll.bpt = (int)bl.max_xfer_len;
+            if ((bl.opt_xfer_len > 0) &&
+                (bl.opt_xfer_len < (uint32_t)rcoll.bpt))
+                rcoll.bpt = (int)bl.opt_xfer_len;
+        }
+        pr2serr("bpt=auto: %d blocks per transfer\n", rcoll.bpt);
+    }
     if (! cdbsz_given) {
         if ((FT_SG == rcoll.in_type) && (MAX_SCSI_CDBSZ != rcoll.cdbsz_in) &&
             (((dd_count + skip) > UINT_MAX) || (rcoll.bpt > USHRT_MAX))) {
@@ -1558,14 +2464,67 @@ main(int argc, char * argv[])
         }
     }
 
+    if (ckf[0]) {
+        ckpt.inf = inf;
+        ckpt.outf = outf;
+        ckpt.skip = skip;
+        ckpt.seek = seek;
+        ckpt.count = dd_count;
+        ckpt.fn = ckf;
+        if (do_resume) {
+            res = ckpt_load(rcoll.bs, &ckpt.base);
+            if (res)
+                return res;
+        }
+        if (ckpt.base > 0) {
+            if (mf[0]) {
+                pr2serr("manifest= can not cover a resumed copy, drop it or "
+                        "start again\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            pr2serr("resume: %" PRId64 " blocks already copied, continuing "
+                    "at skip=%" PRId64 " seek=%" PRId64 "\n", ckpt.base,
+                    skip + ckpt.base, seek + ckpt.base);
+            if ((FT_SG != rcoll.in_type) &&
+                (lseek64(rcoll.infd, (off64_t)(skip + ckpt.base) * rcoll.bs,
+                         SEEK_SET) < 0)) {
+                perror(ME "resume: lseek64 on input");
+                return SG_LIB_FILE_ERROR;
+            }
+            if ((FT_SG != rcoll.out_type) &&
+                (FT_DEV_NULL != rcoll.out_type) &&
+                (lseek64(rcoll.outfd, (off64_t)(seek + ckpt.base) * rcoll.bs,
+                         SEEK_SET) < 0)) {
+                perror(ME "resume: lseek64 on output");
+                return SG_LIB_FILE_ERROR;
+            }
+            dd_count -= ckpt.base;
+        }
+        ckpt.saved = ckpt.base;
+        gettimeofday(&ckpt.tm, NULL);
+    }
+    if (mf[0]) {
+        snprintf(ebuff, EBUFF_SZ, "sgp_dd %s", version_str);
+        if (sg_manifest_open(&rcoll.mfest, mf, ebuff, rcoll.bs, mchunk,
+                             skip, seek)) {
+            snprintf(ebuff, EBUFF_SZ, ME "could not open %s for manifest",
+                     mf);
+            perror(ebuff);
+            return SG_LIB_FILE_ERROR;
+        }
+    }
+    /* skip and seek stay those of the whole copy, delta= indexes from them */
+    for (k = 0; k < MAX_NUM_THREADS; ++k)
+        rcoll.wr_start[k] = -1;
     rcoll.in_count = dd_count;
     rcoll.in_rem_count = dd_count;
     rcoll.skip = skip;
-    rcoll.in_blk = skip;
+    rcoll.in_blk = skip + ckpt.base;
     rcoll.out_count = dd_count;
     rcoll.out_rem_count = dd_count;
     rcoll.seek = seek;
-    rcoll.out_blk = seek;
+    rcoll.out_blk = seek + ckpt.base;
+    rcoll.first_miscomp_lba = -1;
     status = pthread_mutex_init(&rcoll.in_mutex, NULL);
     if (0 != status) err_exit(status, "init in_mutex");
     status = pthread_mutex_init(&rcoll.out_mutex, NULL);
@@ -1577,6 +2536,8 @@ main(int argc, char * argv[])
 
     sigemptyset(&signal_set);
     sigaddset(&signal_set, SIGINT);
+    if (rlim.fn)
+        sigaddset(&signal_set, SIGHUP);
     status = pthread_sigmask(SIG_BLOCK, &signal_set, NULL);
     if (0 != status) err_exit(status, "pthread_sigmask");
     status = pthread_create(&sig_listen_thread_id, NULL,
@@ -1588,6 +2549,19 @@ main(int argc, char * argv[])
         start_tm.tv_usec = 0;
         gettimeofday(&start_tm, NULL);
     }
+    if (rlim.on)
+        sg_rate_start(&rlim);
+    if (prog.secs > 0) {
+        prog.name = "sgp_dd";
+        prog.bs = rcoll.bs;
+        prog.base = ckpt.base;
+        prog.total = ckpt.base + dd_count;
+        prog.extra = prog_extra;
+        prog.extra_arg = &rcoll;
+        res = sg_prog_open(&prog);
+        if (res)
+            return res;
+    }
 
 /* vvvvvvvvvvv  Start worker threads  vvvvvvvvvvvvvvvvvvvvvvvv */
     if ((rcoll.out_rem_count > 0) && (num_threads > 0)) {
@@ -1642,6 +2616,18 @@ main(int argc, char * argv[])
                 pr2serr("Unable to synchronize cache\n");
         }
     }
+    if (ckpt.fn) {
+        int64_t done = ckpt_done(&rcoll);
+
+        if ((done > ckpt.saved) && ckpt_write(&rcoll, done) &&
+            (0 == exit_status))
+            exit_status = SG_LIB_FILE_ERROR;
+    }
+    if (prog.secs > 0)
+        sg_prog_close(&prog, prog.base + dd_count - rcoll.out_rem_count,
+                      (prog_intr ? "interrupted" :
+                       ((exit_status || (0 != rcoll.out_count)) ?
+                        "error" : "done")));
 
 #if 0
 #if SG_LIB_ANDROID
@@ -1662,6 +2648,18 @@ main(int argc, char * argv[])
     if ((STDOUT_FILENO != rcoll.outfd) && (FT_DEV_NULL != rcoll.out_type))
         close(rcoll.outfd);
     res = exit_status;
+    if ((0 == res) && (rcoll.miscompares > 0))
+        res = SG_LIB_CAT_MISCOMPARE;
+    if (rcoll.mfest.fp) {
+        k = sg_manifest_close(&rcoll.mfest);
+        pr2serr("crc32c of %" PRId64 " blocks copied: 0x%08x\n",
+                rcoll.mfest.chunk_start, rcoll.mfest.total_crc);
+        if (k) {
+            perror(ME "writing manifest");
+            if (0 == res)
+                res = k;
+        }
+    }
     if (0 != rcoll.out_count) {
         pr2serr(">>>> Some error occurred, remaining blocks=%" PRId64 "\n",
                 rcoll.out_count);
@@ -1687,5 +2685,7 @@ main(int argc, char * argv[])
     if (rcoll.sum_of_resids)
         pr2serr(">> Non-zero sum of residual counts=%d\n",
                rcoll.sum_of_resids);
+    if (delta_tbl)
+        free(delta_tbl);
     return (res >= 0) ? res : SG_LIB_CAT_OTHER;
 }
@@ -0,0 +1,1742 @@
+/* A utility program for copying files. Specialised for "files" that
+ * represent devices that understand the SCSI command set.
+ *
+ * Copyright (C) 1999 - 2018 D. Gilbert and P. Allworth
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is a specialisation of the Unix "dd" command in which
+ * one or both of the given files is a scsi generic device or a raw
+ * device. A block size ('bs') is assumed to be 512 if not given. This
+ * program complains if 'ibs' or 'obs' are given with some other value
+ * than 'bs'. If 'if' is not given or 'if=-' then stdin is assumed. If
+ * 'of' is not given or 'of=-' then stdout assumed.
+ *
+ * A non-standard argument "bpt" (blocks per transfer) is added to control
+ * the maximum number of blocks in each transfer. The default value is 128.
+ * For example if "bs=512" and "bpt=32" then a maximum of 32 blocks (16 KiB
+ * in this case) are transferred to or from the sg device in a single SCSI
+ * command.
+ *
+ * Unlike sgp_dd this utility uses a single thread. Up to 'thr' SCSI
+ * commands are queued within the Linux sg driver (using its asynchronous
+ * write()/read() interface) and their completions are collected with
+ * poll(). This keeps the device busy while using very little CPU.
+ *
+ * This version is designed for the linux kernel 2.4, 2.6, 3 and 4 series.
+ */
+
+#define _XOPEN_SOURCE 600
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE 1
+#endif
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>  /* needed for lseek64() */
+#include <sys/time.h>
+#include <linux/major.h>
+#include <linux/fs.h>   /* <sys/mount.h> */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "sg_lib.h"
+#include "sg_cmds_basic.h"
+#include "sg_io_linux.h"
+#include "sg_unaligned.h"
+#include "sg_pr2serr.h"
+
+
+static const char * version_str = "1.00 20261018";
+/* was examples/sgq_dd.c "0.60 20180220" */
+
+#define DEF_BLOCK_SIZE 512
+#define DEF_BLOCKS_PER_TRANSFER 128
+#define DEF_BLOCKS_PER_2048TRANSFER 32
+#define DEF_SCSI_CDBSZ 10
+#define MAX_SCSI_CDBSZ 16
+
+#define ME "sgq_dd: "
+
+/* #define SG_DEBUG */
+
+#define SENSE_BUFF_LEN 64       /* Arbitrary, could be larger */
+#define READ_CAP_REPLY_LEN 8
+#define RCAP16_REPLY_LEN 32
+
+#define DEF_TIMEOUT 60000       /* 60,000 millisecs == 60 seconds */
+
+#define DEF_NUM_THREADS 4       /* actually degree of concurrency */
+#define MAX_NUM_THREADS 32
+
+#define MAX_UNIT_ATTENTIONS 10
+#define MAX_ABORTED_CMDS 256
+
+#ifndef RAW_MAJOR
+#define RAW_MAJOR 255   /*unlikely value */
+#endif
+
+#define FT_OTHER 1              /* filetype other than one of the following */
+#define FT_SG 2                 /* filetype is sg char device */
+#define FT_RAW 4                /* filetype is raw char device */
+#define FT_DEV_NULL 8           /* either "/dev/null" or "." as filename */
+#define FT_ST 16                /* filetype is st char device (tape) */
+#define FT_BLOCK 32             /* filetype is a block device */
+#define FT_ERROR 64             /* couldn't "stat" file */
+
+#define DEV_NULL_MINOR_NUM 3
+
+#define QS_IDLE 0               /* ready to start a copy cycle */
+#define QS_IN_STARTED 1         /* commenced read */
+#define QS_IN_FINISHED 2        /* finished read, ready for write */
+#define QS_OUT_STARTED 3        /* commenced write */
+
+#define QS_IN_POLL 11
+#define QS_OUT_POLL 12
+
+#define STR_SZ 1024
+#define INOUTF_SZ 512
+#define EBUFF_SZ 512
+
+struct flags_t {
+    bool append;
+    bool coe;
+    bool dio;
+    bool direct;
+    bool dpo;
+    bool dsync;
+    bool excl;
+    bool fua;
+    bool sparse;
+};
+
+struct request_element;
+
+typedef struct request_collection
+{       /* one instance, all state used by the single thread */
+    int infd;
+    int64_t skip;
+    int in_type;
+    int cdbsz_in;
+    struct flags_t in_flags;
+    int64_t in_blk;             /* next block address to read */
+    int64_t in_count;           /* blocks remaining for next read */
+    int64_t in_done_count;      /* count of remaining in blocks */
+    int in_partial;
+    bool in_stop;               /* short read on normal file seen */
+    int outfd;
+    int64_t seek;
+    int out_type;
+    int cdbsz_out;
+    struct flags_t out_flags;
+    int64_t out_blk;            /* next block address to write */
+    int64_t out_count;          /* blocks remaining for next write */
+    int64_t out_done_count;     /* count of remaining out blocks */
+    int out_partial;
+    int64_t out_sparse_num;
+    int bs;
+    int bpt;
+    int dio_incomplete;
+    int sum_of_resids;
+    int recovered_errs;
+    int unrecovered_errs;
+    int num_retries;
+    int max_uas;
+    int max_aborted;
+    int debug;
+    int num_rq_elems;
+    struct request_element * req_arr;
+} Rq_coll;
+
+typedef struct request_element
+{       /* one instance per queue slot */
+    int qstate;                 /* "QS" state */
+    bool wr;
+    int infd;
+    int outfd;
+    int64_t blk;
+    int num_blks;
+    int num_bytes;              /* may be less than bs*num_blks at EOF */
+    uint8_t * buffp;
+    uint8_t * alloc_bp;
+    struct sg_io_hdr io_hdr;
+    uint8_t cmd[MAX_SCSI_CDBSZ];
+    uint8_t sb[SENSE_BUFF_LEN];
+    int bs;
+    int dio_incomplete;
+    int resid;
+    int cdbsz_in;
+    int cdbsz_out;
+    struct flags_t in_flags;
+    struct flags_t out_flags;
+    int debug;
+} Rq_elem;
+
+static Rq_coll rcoll;
+/* in_pollfd_arr[k] followed by out_pollfd_arr[k] so one poll() sees both */
+static struct pollfd pollfd_arr[2 * MAX_NUM_THREADS];
+static int64_t dd_count = -1;
+static bool do_time = false;
+static bool start_tm_valid = false;
+static struct timeval start_tm;
+static uint8_t * zeros_buff = NULL;
+static uint8_t * free_zeros_buff = NULL;
+
+static const char * proc_allow_dio = "/proc/scsi/sg/allow_dio";
+
+static int sg_finish_io(bool wr, Rq_elem * rep);
+
+
+static void
+install_handler(int sig_num, void (*sig_handler) (int sig))
+{
+    struct sigaction sigact;
+    sigaction (sig_num, NULL, &sigact);
+    if (sigact.sa_handler != SIG_IGN)
+    {
+        sigact.sa_handler = sig_handler;
+        sigemptyset (&sigact.sa_mask);
+        sigact.sa_flags = 0;
+        sigaction (sig_num, &sigact, NULL);
+    }
+}
+
+static void
+calc_duration_throughput(bool contin)
+{
+    struct timeval end_tm, res_tm;
+    double a, b;
+
+    if (! (start_tm_valid && (start_tm.tv_sec || start_tm.tv_usec)))
+        return;
+    gettimeofday(&end_tm, NULL);
+    res_tm.tv_sec = end_tm.tv_sec - start_tm.tv_sec;
+    res_tm.tv_usec = end_tm.tv_usec - start_tm.tv_usec;
+    if (res_tm.tv_usec < 0) {
+        --res_tm.tv_sec;
+        res_tm.tv_usec += 1000000;
+    }
+    a = res_tm.tv_sec;
+    a += (0.000001 * res_tm.tv_usec);
+    b = (double)rcoll.bs * (dd_count - rcoll.out_done_count);
+    pr2serr("time to transfer data %s %d.%06d secs",
+            (contin ? "so far" : "was"), (int)res_tm.tv_sec,
+            (int)res_tm.tv_usec);
+    if ((a > 0.00001) && (b > 511))
+        pr2serr(", %.2f MB/sec\n", b / (a * 1000000.0));
+    else
+        pr2serr("\n");
+}
+
+static void
+print_stats(const char * str)
+{
+    int64_t infull, outfull;
+
+    if (0 != rcoll.out_count)
+        pr2serr("  remaining block count=%" PRId64 "\n", rcoll.out_count);
+    infull = dd_count - rcoll.in_done_count;
+    pr2serr("%s%" PRId64 "+%d records in\n", str,
+            infull - rcoll.in_partial, rcoll.in_partial);
+    outfull = dd_count - rcoll.out_done_count;
+    pr2serr("%s%" PRId64 "+%d records out\n", str,
+            outfull - rcoll.out_partial, rcoll.out_partial);
+    if (rcoll.out_flags.sparse)
+        pr2serr("%s%" PRId64 " bypassed records out\n", str,
+                rcoll.out_sparse_num);
+    if (rcoll.recovered_errs > 0)
+        pr2serr("%s%d recovered errors\n", str, rcoll.recovered_errs);
+    if (rcoll.num_retries > 0)
+        pr2serr("%s%d retries attempted\n", str, rcoll.num_retries);
+    if (rcoll.in_flags.coe || rcoll.out_flags.coe)
+        pr2serr("%s%d unrecovered errors\n", str, rcoll.unrecovered_errs);
+    else if (rcoll.unrecovered_errs)
+        pr2serr("%s%d unrecovered error(s)\n", str, rcoll.unrecovered_errs);
+}
+
+static void
+interrupt_handler(int sig)
+{
+    struct sigaction sigact;
+
+    sigact.sa_handler = SIG_DFL;
+    sigemptyset(&sigact.sa_mask);
+    sigact.sa_flags = 0;
+    sigaction(sig, &sigact, NULL);
+    pr2serr("Interrupted by signal,");
+    if (do_time)
+        calc_duration_throughput(false);
+    print_stats("");
+    kill(getpid (), sig);
+}
+
+static void
+siginfo_handler(int sig)
+{
+    if (sig) { ; }      /* unused, dummy to suppress warning */
+    pr2serr("Progress report, continuing ...\n");
+    if (do_time)
+        calc_duration_throughput(true);
+    print_stats("  ");
+}
+
+static int
+dd_filetype(const char * filename)
+{
+    struct stat st;
+    size_t len = strlen(filename);
+
+    if ((1 == len) && ('.' == filename[0]))
+        return FT_DEV_NULL;
+    if (stat(filename, &st) < 0)
+        return FT_ERROR;
+    if (S_ISCHR(st.st_mode)) {
+        if ((MEM_MAJOR == major(st.st_rdev)) &&
+            (DEV_NULL_MINOR_NUM == minor(st.st_rdev)))
+            return FT_DEV_NULL;
+        if (RAW_MAJOR == major(st.st_rdev))
+            return FT_RAW;
+        if (SCSI_GENERIC_MAJOR == major(st.st_rdev))
+            return FT_SG;
+        if (SCSI_TAPE_MAJOR == major(st.st_rdev))
+            return FT_ST;
+    } else if (S_ISBLK(st.st_mode))
+        return FT_BLOCK;
+    return FT_OTHER;
+}
+
+static void
+usage()
+{
+    pr2serr("Usage: sgq_dd  [bs=BS] [count=COUNT] [ibs=BS] [if=IFILE]"
+            " [iflag=FLAGS]\n"
+            "               [obs=BS] [of=OFILE] [oflag=FLAGS] "
+            "[seek=SEEK] [skip=SKIP]\n"
+            "               [--help] [--version]\n\n");
+    pr2serr("               [bpt=BPT] [cdbsz=6|10|12|16] [coe=0|1] "
+            "[deb=VERB] [dio=0|1]\n"
+            "               [fua=0|1|2|3] [sync=0|1] [thr=THR] "
+            "[time=0|1] [verbose=VERB]\n"
+            "  where:\n"
+            "    bpt         is blocks_per_transfer (default is 128)\n"
+            "    bs          must be device block size (default 512)\n"
+            "    cdbsz       size of SCSI READ or WRITE cdb (default is 10)\n"
+            "    coe         continue on error, 0->exit (def), "
+            "1->zero + continue\n"
+            "    count       number of blocks to copy (def: device size)\n"
+            "    deb         for debug, 0->none (def), > 0->varying degrees "
+            "of debug\n");
+    pr2serr("    dio         is direct IO, 1->attempt, 0->indirect IO (def)\n"
+            "    fua         force unit access: 0->don't(def), 1->OFILE, "
+            "2->IFILE,\n"
+            "                3->OFILE+IFILE\n"
+            "    if          file or device to read from (def: stdin)\n"
+            "    iflag       comma separated list from: [coe,dio,direct,dpo,"
+            "dsync,excl,\n"
+            "                fua, null]\n"
+            "    of          file or device to write to (def: stdout), "
+            "OFILE of '.'\n"
+            "                treated as /dev/null\n"
+            "    oflag       comma separated list from: [append,coe,dio,"
+            "direct,dpo,dsync,\n"
+            "                excl,fua,null,sparse]\n"
+            "    seek        block position to start writing to OFILE\n"
+            "    skip        block position to start reading from IFILE\n"
+            "    sync        0->no sync(def), 1->SYNCHRONIZE CACHE on OFILE "
+            "after copy\n"
+            "    thr         is number of queued commands, must be > 0, "
+            "default 4, max 32\n"
+            "    time        0->no timing(def), 1->time plus calculate "
+            "throughput\n"
+            "    verbose     same as 'deb=VERB': increase verbosity\n"
+            "    --help      output this usage message then exit\n"
+            "    --version   output version string then exit\n"
+            "Copy from IFILE to OFILE, similar to dd command\n"
+            "specialized for SCSI devices, uses a single thread that queues "
+            "multiple\ncommands within the sg driver\n");
+}
+
+/* Returns -1 for error, 0 for nothing found, QS_IN_POLL or QS_OUT_POLL.
+ * A 'timeout' of -1 blocks until at least one command completes. */
+static int
+do_poll(Rq_coll * clp, int timeout, int * req_indexp)
+{
+    int k, res;
+    int n = clp->num_rq_elems;
+
+    if ((FT_SG != clp->in_type) && (FT_SG != clp->out_type))
+        return 0;
+    while (((res = poll(pollfd_arr, 2 * n, timeout)) < 0) &&
+           (EINTR == errno))
+        ;
+    if (res < 0) {
+        perror(ME "poll error");
+        return -1;
+    } else if (0 == res)
+        return 0;
+    /* favour writes completing since they free a slot */
+    for (k = 0; k < n; ++k) {
+        if (pollfd_arr[n + k].revents & POLLIN) {
+            if (req_indexp)
+                *req_indexp = k;
+            return QS_OUT_POLL;
+        }
+    }
+    for (k = 0; k < n; ++k) {
+        if (pollfd_arr[k].revents & POLLIN) {
+            if (req_indexp)
+                *req_indexp = k;
+            return QS_IN_POLL;
+        }
+    }
+    return 0;
+}
+
+/* Return of 0 -> success, see sg_ll_read_capacity*() otherwise */
+static int
+scsi_read_capacity(int sg_fd, int64_t * num_sect, int * sect_sz)
+{
+    int res;
+    uint8_t rcBuff[RCAP16_REPLY_LEN];
+
+    res = sg_ll_readcap_10(sg_fd, false, 0, rcBuff, READ_CAP_REPLY_LEN, false,
+                           0);
+    if (0 != res)
+        return res;
+
+    if ((0xff == rcBuff[0]) && (0xff == rcBuff[1]) && (0xff == rcBuff[2]) &&
+        (0xff == rcBuff[3])) {
+
+        res = sg_ll_readcap_16(sg_fd, false, 0, rcBuff, RCAP16_REPLY_LEN,
+                               false, 0);
+        if (0 != res)
+            return res;
+        *num_sect = sg_get_unaligned_be64(rcBuff + 0) + 1;
+        *sect_sz = sg_get_unaligned_be32(rcBuff + 8);
+    } else {
+        /* take care not to sign extend values > 0x7fffffff */
+        *num_sect = (int64_t)sg_get_unaligned_be32(rcBuff + 0) + 1;
+        *sect_sz = sg_get_unaligned_be32(rcBuff + 4);
+    }
+#ifdef SG_DEBUG
+    pr2serr("number of sectors=%" PRId64 ", sector size=%d\n", *num_sect,
+            *sect_sz);
+#endif
+    return 0;
+}
+
+/* Return of 0 -> success, -1 -> failure. BLKGETSIZE64, BLKGETSIZE and */
+/* BLKSSZGET macros problematic (from <linux/fs.h> or <sys/mount.h>). */
+static int
+read_blkdev_capacity(int sg_fd, int64_t * num_sect, int * sect_sz)
+{
+#ifdef BLKSSZGET
+    if ((ioctl(sg_fd, BLKSSZGET, sect_sz) < 0) && (*sect_sz > 0)) {
+        perror("BLKSSZGET ioctl error");
+        return -1;
+    } else {
+ #ifdef BLKGETSIZE64
+        uint64_t ull;
+
+        if (ioctl(sg_fd, BLKGETSIZE64, &ull) < 0) {
+
+            perror("BLKGETSIZE64 ioctl error");
+            return -1;
+        }
+        *num_sect = ((int64_t)ull / (int64_t)*sect_sz);
+ #else
+        unsigned long ul;
+
+        if (ioctl(sg_fd, BLKGETSIZE, &ul) < 0) {
+            perror("BLKGETSIZE ioctl error");
+            return -1;
+        }
+        *num_sect = (int64_t)ul;
+ #endif
+    }
+    return 0;
+#else
+    *num_sect = 0;
+    *sect_sz = 0;
+    return -1;
+#endif
+}
+
+static int
+sg_build_scsi_cdb(uint8_t * cdbp, int cdb_sz, unsigned int blocks,
+                  int64_t start_block, bool write_true, bool fua, bool dpo)
+{
+    int rd_opcode[] = {0x8, 0x28, 0xa8, 0x88};
+    int wr_opcode[] = {0xa, 0x2a, 0xaa, 0x8a};
+    int sz_ind;
+
+    memset(cdbp, 0, cdb_sz);
+    if (dpo)
+        cdbp[1] |= 0x10;
+    if (fua)
+        cdbp[1] |= 0x8;
+    switch (cdb_sz) {
+    case 6:
+        sz_ind = 0;
+        cdbp[0] = (uint8_t)(write_true ? wr_opcode[sz_ind] :
+                                               rd_opcode[sz_ind]);
+        sg_put_unaligned_be24(0x1fffff & start_block, cdbp + 1);
+        cdbp[4] = (256 == blocks) ? 0 : (uint8_t)blocks;
+        if (blocks > 256) {
+            pr2serr(ME "for 6 byte commands, maximum number of blocks is "
+                    "256\n");
+            return 1;
+        }
+        if ((start_block + blocks - 1) & (~0x1fffff)) {
+            pr2serr(ME "for 6 byte commands, can't address blocks beyond "
+                    "%d\n", 0x1fffff);
+            return 1;
+        }
+        if (dpo || fua) {
+            pr2serr(ME "for 6 byte commands, neither dpo nor fua bits "
+                    "supported\n");
+            return 1;
+        }
+        break;
+    case 10:
+        sz_ind = 1;
+        cdbp[0] = (uint8_t)(write_true ? wr_opcode[sz_ind] :
+                                               rd_opcode[sz_ind]);
+        sg_put_unaligned_be32((uint32_t)start_block, cdbp + 2);
+        sg_put_unaligned_be16((uint16_t)blocks, cdbp + 7);
+        if (blocks & (~0xffff)) {
+            pr2serr(ME "for 10 byte commands, maximum number of blocks is "
+                    "%d\n", 0xffff);
+            return 1;
+        }
+        break;
+    case 12:
+        sz_ind = 2;
+        cdbp[0] = (uint8_t)(write_true ? wr_opcode[sz_ind] :
+                                               rd_opcode[sz_ind]);
+        sg_put_unaligned_be32((uint32_t)start_block, cdbp + 2);
+        sg_put_unaligned_be32((uint32_t)blocks, cdbp + 6);
+        break;
+    case 16:
+        sz_ind = 3;
+        cdbp[0] = (uint8_t)(write_true ? wr_opcode[sz_ind] :
+                                               rd_opcode[sz_ind]);
+        sg_put_unaligned_be64((uint64_t)start_block, cdbp + 2);
+        sg_put_unaligned_be32((uint32_t)blocks, cdbp + 10);
+        break;
+    default:
+        pr2serr(ME "expected cdb size of 6, 10, 12, or 16 but got %d\n",
+                cdb_sz);
+        return 1;
+    }
+    return 0;
+}
+
+/* 0 -> ok, 1 -> short read, -1 -> error */
+static int
+normal_in_operation(Rq_coll * clp, Rq_elem * rep, int blocks)
+{
+    int res;
+    int stop_after_write = 0;
+
+    rep->qstate = QS_IN_STARTED;
+    if (rep->debug > 8)
+        pr2serr("normal_in_operation: start blk=%" PRId64 " num_blks=%d\n",
+                rep->blk, rep->num_blks);
+    while (((res = read(rep->infd, rep->buffp, blocks * rep->bs)) < 0) &&
+           ((EINTR == errno) || (EAGAIN == errno)))
+        ;
+    if (res < 0) {
+        if (clp->in_flags.coe) {
+            memset(rep->buffp, 0, rep->num_blks * rep->bs);
+            pr2serr(">> substituted zeros for in blk=%" PRId64 " for %d "
+                    "bytes, %s\n", rep->blk, rep->num_blks * rep->bs,
+                    safe_strerror(errno));
+            ++clp->unrecovered_errs;
+            res = rep->num_blks * rep->bs;
+        } else {
+            pr2serr(ME "reading, in_blk=%" PRId64 ", %s\n", rep->blk,
+                    safe_strerror(errno));
+            return -1;
+        }
+    }
+    if (res < blocks * rep->bs) {
+        int o_blocks = blocks;
+
+        stop_after_write = 1;
+        blocks = res / rep->bs;
+        if ((res % rep->bs) > 0) {
+            blocks++;
+            clp->in_partial++;
+            /* in case OFILE is a sg device, don't write stale data */
+            memset(rep->buffp + res, 0, (blocks * rep->bs) - res);
+        }
+        /* Reverse out + re-apply blocks on clp */
+        clp->in_blk -= o_blocks;
+        clp->in_count += o_blocks;
+        rep->num_blks = blocks;
+        rep->num_bytes = res;
+        clp->in_blk += blocks;
+        clp->in_count -= blocks;
+    }
+    clp->in_done_count -= blocks;
+    rep->qstate = QS_IN_FINISHED;
+    return stop_after_write;
+}
+
+/* 0 -> ok, -1 -> error */
+static int
+normal_out_operation(Rq_coll * clp, Rq_elem * rep, int blocks)
+{
+    int res;
+
+    rep->qstate = QS_OUT_STARTED;
+    if (rep->debug > 8)
+        pr2serr("normal_out_operation: start blk=%" PRId64 " num_blks=%d\n",
+                rep->blk, rep->num_blks);
+    while (((res = write(rep->outfd, rep->buffp, rep->num_bytes)) < 0) &&
+           ((EINTR == errno) || (EAGAIN == errno)))
+        ;
+    if (res < 0) {
+        if (clp->out_flags.coe) {
+            pr2serr(">> ignored error for out blk=%" PRId64 " for %d bytes, "
+                    "%s\n", rep->blk, rep->num_blks * rep->bs,
+                    safe_strerror(errno));
+            ++clp->unrecovered_errs;
+            res = rep->num_blks * rep->bs;
+        } else {
+            pr2serr(ME "output, out_blk=%" PRId64 ", %s\n", rep->blk,
+                    safe_strerror(errno));
+            return -1;
+        }
+    }
+    if (res < blocks * rep->bs) {
+        blocks = res / rep->bs;
+        if ((res % rep->bs) > 0) {
+            blocks++;
+            clp->out_partial++;
+        }
+        rep->num_blks = blocks;
+    }
+    clp->out_done_count -= blocks;
+    rep->qstate = QS_IDLE;
+    return 0;
+}
+
+/* Returns 1 for retryable, 0 for ok, -ve for error */
+static int
+sg_fin_in_operation(Rq_coll * clp, Rq_elem * rep)
+{
+    int res;
+
+    rep->qstate = QS_IN_FINISHED;
+    res = sg_finish_io(rep->wr, rep);
+    if (res < 0) {
+        ++clp->unrecovered_errs;
+        if (clp->in_flags.coe) {
+            memset(rep->buffp, 0, rep->num_blks * rep->bs);
+            pr2serr(">> substituted zeros for in blk=%" PRId64 " for %d "
+                    "bytes\n", rep->blk, rep->num_blks * rep->bs);
+            res = 0;
+        } else {
+            pr2serr("error finishing sg in command\n");
+            return res;
+        }
+    }
+    if (0 == res) { /* looks good, going to return */
+        if (rep->dio_incomplete || rep->resid) {
+            clp->dio_incomplete += rep->dio_incomplete;
+            clp->sum_of_resids += rep->resid;
+        }
+        clp->in_done_count -= rep->num_blks;
+    }
+    return res;
+}
+
+/* Returns 1 for retryable, 0 for ok, -ve for error */
+static int
+sg_fin_out_operation(Rq_coll * clp, Rq_elem * rep)
+{
+    int res;
+
+    rep->qstate = QS_IDLE;
+    res = sg_finish_io(rep->wr, rep);
+    if (res < 0) {
+        ++clp->unrecovered_errs;
+        if (clp->out_flags.coe) {
+            pr2serr(">> ignored error for out blk=%" PRId64 " for %d "
+                    "bytes\n", rep->blk, rep->num_blks * rep->bs);
+            res = 0;
+        } else {
+            pr2serr("error finishing sg out command\n");
+            return res;
+        }
+    }
+    if (0 == res) {
+        if (rep->dio_incomplete || rep->resid) {
+            clp->dio_incomplete += rep->dio_incomplete;
+            clp->sum_of_resids += rep->resid;
+        }
+        clp->out_done_count -= rep->num_blks;
+    }
+    return res;
+}
+
+/* Returns 0 -> ok, 1 -> ENOMEM (try again), -1 -> other errors */
+static int
+sg_start_io(Rq_elem * rep)
+{
+    struct sg_io_hdr * hp = &rep->io_hdr;
+    bool fua = rep->wr ? rep->out_flags.fua : rep->in_flags.fua;
+    bool dpo = rep->wr ? rep->out_flags.dpo : rep->in_flags.dpo;
+    bool dio = rep->wr ? rep->out_flags.dio : rep->in_flags.dio;
+    int cdbsz = rep->wr ? rep->cdbsz_out : rep->cdbsz_in;
+    int res;
+
+    rep->qstate = rep->wr ? QS_OUT_STARTED : QS_IN_STARTED;
+    if (sg_build_scsi_cdb(rep->cmd, cdbsz, rep->num_blks, rep->blk,
+                          rep->wr, fua, dpo)) {
+        pr2serr(ME "bad cdb build, start_blk=%" PRId64 ", blocks=%d\n",
+                rep->blk, rep->num_blks);
+        return -1;
+    }
+    memset(hp, 0, sizeof(struct sg_io_hdr));
+    hp->interface_id = 'S';
+    hp->cmd_len = cdbsz;
+    hp->cmdp = rep->cmd;
+    hp->dxfer_direction = rep->wr ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
+    hp->dxfer_len = rep->bs * rep->num_blks;
+    hp->dxferp = rep->buffp;
+    hp->mx_sb_len = sizeof(rep->sb);
+    hp->sbp = rep->sb;
+    hp->timeout = DEF_TIMEOUT;
+    hp->usr_ptr = rep;
+    hp->pack_id = (int)rep->blk;
+    if (dio)
+        hp->flags |= SG_FLAG_DIRECT_IO;
+    if (rep->debug > 8) {
+        pr2serr("sg_start_io: SCSI %s, blk=%" PRId64 " num_blks=%d\n",
+                rep->wr ? "WRITE" : "READ", rep->blk, rep->num_blks);
+        sg_print_command(hp->cmdp);
+        pr2serr(" len=%d, dxfrp=%p, cmd_len=%d\n", hp->dxfer_len,
+                hp->dxferp, hp->cmd_len);
+    }
+
+    while (((res = write(rep->wr ? rep->outfd : rep->infd, hp,
+                         sizeof(struct sg_io_hdr))) < 0) &&
+           ((EINTR == errno) || (EAGAIN == errno)))
+        ;
+    if (res < 0) {
+        if (ENOMEM == errno)
+            return 1;
+        perror("starting io on sg device, error");
+        return -1;
+    }
+    return 0;
+}
+
+/* -1 -> unrecoverable error, 0 -> successful, 1 -> try again (unit
+ * attention or aborted command) */
+static int
+sg_finish_io(bool wr, Rq_elem * rep)
+{
+    int res;
+    struct sg_io_hdr io_hdr;
+    struct sg_io_hdr * hp;
+
+    memset(&io_hdr, 0 , sizeof(struct sg_io_hdr));
+    /* FORCE_PACK_ID active set only read packet with matching pack_id */
+    io_hdr.interface_id = 'S';
+    io_hdr.dxfer_direction = wr ? SG_DXFER_TO_DEV : SG_DXFER_FROM_DEV;
+    io_hdr.pack_id = (int)rep->blk;
+
+    while (((res = read(wr ? rep->outfd : rep->infd, &io_hdr,
+                        sizeof(struct sg_io_hdr))) < 0) &&
+           ((EINTR == errno) || (EAGAIN == errno)))
+        ;
+    if (res < 0) {
+        perror("finishing io on sg device, error");
+        return -1;
+    }
+    if (rep != (Rq_elem *)io_hdr.usr_ptr) {
+        pr2serr("sg_finish_io: bad usr_ptr, request-response mismatch\n");
+        exit(SG_LIB_CAT_OTHER);
+    }
+    memcpy(&rep->io_hdr, &io_hdr, sizeof(struct sg_io_hdr));
+    hp = &rep->io_hdr;
+
+    switch (sg_err_category3(hp)) {
+    case SG_LIB_CAT_CLEAN:
+        break;
+    case SG_LIB_CAT_RECOVERED:
+        ++rcoll.recovered_errs;
+        pr2serr("Recovered error on block=%" PRId64 ", num=%d\n",
+                rep->blk, rep->num_blks);
+        break;
+    case SG_LIB_CAT_UNIT_ATTENTION:
+        if (--rcoll.max_uas > 0) {
+            pr2serr("Unit attention, continuing (%c)\n", wr ? 'w' : 'r');
+            return 1;
+        }
+        pr2serr("Unit attention, too many (%c)\n", wr ? 'w' : 'r');
+        return -1;
+    case SG_LIB_CAT_ABORTED_COMMAND:
+        if (--rcoll.max_aborted > 0) {
+            pr2serr("Aborted command, continuing (%c)\n", wr ? 'w' : 'r');
+            return 1;
+        }
+        pr2serr("Aborted command, too many (%c)\n", wr ? 'w' : 'r');
+        return -1;
+    default:
+        {
+            char ebuff[EBUFF_SZ];
+
+            snprintf(ebuff, EBUFF_SZ, "%s blk=%" PRId64,
+                     wr ? "writing": "reading", rep->blk);
+            sg_chk_n_print3(ebuff, hp, rep->debug > 1);
+            return -1;
+        }
+    }
+    if ((wr ? rep->out_flags.dio : rep->in_flags.dio) &&
+        ((hp->info & SG_INFO_DIRECT_IO_MASK) != SG_INFO_DIRECT_IO))
+        rep->dio_incomplete = 1; /* count dios done as indirect IO */
+    else
+        rep->dio_incomplete = 0;
+    rep->resid = hp->resid;
+    if (rep->debug > 8)
+        pr2serr("sg_finish_io: completed %s, blk=%" PRId64 "\n",
+                wr ? "WRITE" : "READ", rep->blk);
+    return 0;
+}
+
+/* Returns 0 if okay, else 1 */
+static int
+sg_prepare(int fd, int sz)
+{
+    int res, t;
+
+    res = ioctl(fd, SG_GET_VERSION_NUM, &t);
+    if ((res < 0) || (t < 30000)) {
+        pr2serr(ME "sg driver prior to 3.x.y\n");
+        return 1;
+    }
+    res = ioctl(fd, SG_SET_RESERVED_SIZE, &sz);
+    if (res < 0)
+        perror(ME "SG_SET_RESERVED_SIZE error");
+    return 0;
+}
+
+/* Return 0 for ok, anything else for errors */
+static int
+prepare_rq_elems(Rq_coll * clp, const char * inf, const char * outf)
+{
+    int k, flags;
+    int n = clp->num_rq_elems;
+    Rq_elem * rep;
+    char ebuff[EBUFF_SZ];
+    int sz = clp->bpt * clp->bs;
+
+    clp->req_arr = (Rq_elem *)calloc(n, sizeof(Rq_elem));
+    if (NULL == clp->req_arr)
+        return 1;
+    for (k = 0; k < n; ++k) {
+        rep = &clp->req_arr[k];
+        rep->buffp = sg_memalign(sz, 0 /* page align */, &rep->alloc_bp,
+                                 false);
+        if (NULL == rep->buffp)
+            return 1;
+        rep->qstate = QS_IDLE;
+        rep->bs = clp->bs;
+        rep->debug = clp->debug;
+        rep->cdbsz_in = clp->cdbsz_in;
+        rep->cdbsz_out = clp->cdbsz_out;
+        rep->in_flags = clp->in_flags;
+        rep->out_flags = clp->out_flags;
+        pollfd_arr[k].fd = -1;          /* poll() ignores negative fds */
+        pollfd_arr[n + k].fd = -1;
+        if (FT_SG == clp->in_type) {
+            if (0 == k)
+                rep->infd = clp->infd;
+            else {
+                flags = O_RDWR;
+                if (clp->in_flags.direct)
+                    flags |= O_DIRECT;
+                if (clp->in_flags.dsync)
+                    flags |= O_SYNC;
+                if ((rep->infd = open(inf, flags)) < 0) {
+                    snprintf(ebuff, EBUFF_SZ,
+                             ME "could not open %s for sg reading", inf);
+                    perror(ebuff);
+                    return 1;
+                }
+                if (sg_prepare(rep->infd, sz))
+                    return 1;
+            }
+            pollfd_arr[k].fd = rep->infd;
+            pollfd_arr[k].events = POLLIN;
+        } else
+            rep->infd = clp->infd;
+
+        if (FT_SG == clp->out_type) {
+            if (0 == k)
+                rep->outfd = clp->outfd;
+            else {
+                flags = O_RDWR;
+                if (clp->out_flags.direct)
+                    flags |= O_DIRECT;
+                if (clp->out_flags.dsync)
+                    flags |= O_SYNC;
+                if ((rep->outfd = open(outf, flags)) < 0) {
+                    snprintf(ebuff, EBUFF_SZ,
+                             ME "could not open %s for sg writing", outf);
+                    perror(ebuff);
+                    return 1;
+                }
+                if (sg_prepare(rep->outfd, sz))
+                    return 1;
+            }
+            pollfd_arr[n + k].fd = rep->outfd;
+            pollfd_arr[n + k].events = POLLIN;
+        } else
+            rep->outfd = clp->outfd;
+    }
+    return 0;
+}
+
+static void
+release_rq_elems(Rq_coll * clp)
+{
+    int k;
+    Rq_elem * rep;
+
+    if (NULL == clp->req_arr)
+        return;
+    for (k = 0; k < clp->num_rq_elems; ++k) {
+        rep = &clp->req_arr[k];
+        if (k > 0) {
+            if ((FT_SG == clp->in_type) && (rep->infd >= 0))
+                close(rep->infd);
+            if ((FT_SG == clp->out_type) && (rep->outfd >= 0))
+                close(rep->outfd);
+        }
+        if (rep->alloc_bp)
+            free(rep->alloc_bp);
+    }
+    free(clp->req_arr);
+    clp->req_arr = NULL;
+}
+
+/* Returns a "QS" code and req index, or QS_IDLE and position of first idle
+ * (-1 if no idle position or nothing more to read). Rather than spin when
+ * nothing can progress, blocks in poll() until a queued command completes.
+ * Returns -1 on poll error. */
+static int
+decider(Rq_coll * clp, bool first_xfer, int * req_indexp)
+{
+    bool in_progress = false;
+    int k, res, times;
+    int first_idle_index = -1;
+    int lowest_blk_index = -1;
+    int64_t lowest_blk = INT64_MAX;
+    Rq_elem * rep;
+
+    times = first_xfer ? 1 : clp->num_rq_elems;
+    for (k = 0; k < times; ++k) {
+        rep = &clp->req_arr[k];
+        if ((QS_IN_STARTED == rep->qstate) ||
+            (QS_OUT_STARTED == rep->qstate))
+            in_progress = true;
+        else if ((QS_IN_FINISHED == rep->qstate) && (rep->blk < lowest_blk)) {
+            lowest_blk = rep->blk;
+            lowest_blk_index = k;
+        } else if ((QS_IDLE == rep->qstate) && (first_idle_index < 0))
+            first_idle_index = k;
+    }
+    if (in_progress) {
+        res = do_poll(clp, 0, req_indexp);
+        if (0 != res)
+            return res;
+    }
+    /* only write when that write would be in sequence */
+    if ((lowest_blk_index >= 0) &&
+        ((lowest_blk + clp->seek - clp->skip) == clp->out_blk)) {
+        if (req_indexp)
+            *req_indexp = lowest_blk_index;
+        return QS_IN_FINISHED;
+    }
+    if ((first_idle_index >= 0) && (clp->in_count > 0) && (! clp->in_stop)) {
+        if (req_indexp)
+            *req_indexp = first_idle_index;
+        return QS_IDLE;
+    }
+    if (in_progress) {
+        /* nothing else to do, so sleep until something completes */
+        res = do_poll(clp, -1, req_indexp);
+        if (0 != res)
+            return res;
+    }
+    if (req_indexp)
+        *req_indexp = -1;
+    return QS_IDLE;
+}
+
+/* Decides whether the output of rep can be bypassed due to oflag=sparse.
+ * Never bypasses the last write so that the output file gets its full
+ * length. */
+static bool
+sparse_bypass(Rq_coll * clp, Rq_elem * rep)
+{
+    if ((! clp->out_flags.sparse) || (NULL == zeros_buff) ||
+        (clp->out_count <= rep->num_blks))
+        return false;
+    return (0 == memcmp(rep->buffp, zeros_buff, rep->num_blks * clp->bs));
+}
+
+static int
+process_flags(const char * arg, struct flags_t * fp)
+{
+    char buff[256];
+    char * cp;
+    char * np;
+
+    strncpy(buff, arg, sizeof(buff) - 1);
+    buff[sizeof(buff) - 1] = '\0';
+    if ('\0' == buff[0]) {
+        pr2serr("no flag found\n");
+        return 1;
+    }
+    cp = buff;
+    do {
+        np = strchr(cp, ',');
+        if (np)
+            *np++ = '\0';
+        if (0 == strcmp(cp, "append"))
+            fp->append = true;
+        else if (0 == strcmp(cp, "coe"))
+            fp->coe = true;
+        else if (0 == strcmp(cp, "dio"))
+            fp->dio = true;
+        else if (0 == strcmp(cp, "direct"))
+            fp->direct = true;
+        else if (0 == strcmp(cp, "dpo"))
+            fp->dpo = true;
+        else if (0 == strcmp(cp, "dsync"))
+            fp->dsync = true;
+        else if (0 == strcmp(cp, "excl"))
+            fp->excl = true;
+        else if (0 == strcmp(cp, "fua"))
+            fp->fua = true;
+        else if (0 == strcmp(cp, "null"))
+            ;
+        else if (0 == strcmp(cp, "sparse"))
+            fp->sparse = true;
+        else {
+            pr2serr("unrecognised flag: %s\n", cp);
+            return 1;
+        }
+        cp = np;
+    } while (cp);
+    return 0;
+}
+
+/* Returns open input file descriptor (>= 0) or a negative value
+ * (-SG_LIB_FILE_ERROR) if error. */
+static int
+open_if(const char * inf, int64_t skip, Rq_coll * clp)
+{
+    int infd, flags;
+    char ebuff[EBUFF_SZ];
+
+    clp->in_type = dd_filetype(inf);
+    if (FT_ERROR == clp->in_type) {
+        pr2serr(ME "unable to access %s\n", inf);
+        return -SG_LIB_FILE_ERROR;
+    } else if (FT_ST == clp->in_type) {
+        pr2serr(ME "unable to use scsi tape device %s\n", inf);
+        return -SG_LIB_FILE_ERROR;
+    } else if (FT_SG == clp->in_type) {
+        flags = O_RDWR;
+        if (clp->in_flags.direct)
+            flags |= O_DIRECT;
+        if (clp->in_flags.excl)
+            flags |= O_EXCL;
+        if (clp->in_flags.dsync)
+            flags |= O_SYNC;
+        if ((infd = open(inf, flags)) < 0) {
+            snprintf(ebuff, EBUFF_SZ, ME "could not open %s for sg reading",
+                     inf);
+            perror(ebuff);
+            return -SG_LIB_FILE_ERROR;
+        }
+        if (sg_prepare(infd, clp->bs * clp->bpt))
+            return -SG_LIB_FILE_ERROR;
+    } else {
+        flags = O_RDONLY;
+        if (clp->in_flags.direct)
+            flags |= O_DIRECT;
+        if (clp->in_flags.excl)
+            flags |= O_EXCL;
+        if (clp->in_flags.dsync)
+            flags |= O_SYNC;
+        if ((infd = open(inf, flags)) < 0) {
+            snprintf(ebuff, EBUFF_SZ, ME "could not open %s for reading",
+                     inf);
+            perror(ebuff);
+            return -SG_LIB_FILE_ERROR;
+        } else if (skip > 0) {
+            off64_t offset = skip;
+
+            offset *= clp->bs;       /* could exceed 32 bits here! */
+            if (lseek64(infd, offset, SEEK_SET) < 0) {
+                snprintf(ebuff, EBUFF_SZ, ME "couldn't skip to required "
+                         "position on %s", inf);
+                perror(ebuff);
+                return -SG_LIB_FILE_ERROR;
+            }
+        }
+    }
+    return infd;
+}
+
+/* Returns open output file descriptor (>= 0), -1 for don't bother
+ * opening (e.g. /dev/null), or a more negative value (-SG_LIB_FILE_ERROR)
+ * if error. */
+static int
+open_of(const char * outf, int64_t seek, Rq_coll * clp)
+{
+    int outfd, flags;
+    char ebuff[EBUFF_SZ];
+
+    clp->out_type = dd_filetype(outf);
+    if (FT_ST == clp->out_type) {
+        pr2serr(ME "unable to use scsi tape device %s\n", outf);
+        return -SG_LIB_FILE_ERROR;
+    } else if (FT_SG == clp->out_type) {
+        flags = O_RDWR;
+        if (clp->out_flags.direct)
+            flags |= O_DIRECT;
+        if (clp->out_flags.excl)
+            flags |= O_EXCL;
+        if (clp->out_flags.dsync)
+            flags |= O_SYNC;
+        if ((outfd = open(outf, flags)) < 0) {
+            snprintf(ebuff, EBUFF_SZ, ME "could not open %s for sg writing",
+                     outf);
+            perror(ebuff);
+            return -SG_LIB_FILE_ERROR;
+        }
+        if (sg_prepare(outfd, clp->bs * clp->bpt))
+            return -SG_LIB_FILE_ERROR;
+    } else if (FT_DEV_NULL == clp->out_type)
+        outfd = -1; /* don't bother opening */
+    else {
+        if (FT_RAW != clp->out_type) {
+            flags = O_WRONLY | O_CREAT;
+            if (clp->out_flags.direct)
+                flags |= O_DIRECT;
+            if (clp->out_flags.excl)
+                flags |= O_EXCL;
+            if (clp->out_flags.dsync)
+                flags |= O_SYNC;
+            if (clp->out_flags.append)
+                flags |= O_APPEND;
+            if ((outfd = open(outf, flags, 0666)) < 0) {
+                snprintf(ebuff, EBUFF_SZ, ME "could not open %s for writing",
+                         outf);
+                perror(ebuff);
+                return -SG_LIB_FILE_ERROR;
+            }
+        } else {        /* raw output file */
+            if ((outfd = open(outf, O_WRONLY)) < 0) {
+                snprintf(ebuff, EBUFF_SZ, ME "could not open %s for raw "
+                         "writing", outf);
+                perror(ebuff);
+                return -SG_LIB_FILE_ERROR;
+            }
+        }
+        if (seek > 0) {
+            off64_t offset = seek;
+
+            offset *= clp->bs;       /* could exceed 32 bits here! */
+            if (lseek64(outfd, offset, SEEK_SET) < 0) {
+                snprintf(ebuff, EBUFF_SZ, ME "couldn't seek to required "
+                         "position on %s", outf);
+                perror(ebuff);
+                return -SG_LIB_FILE_ERROR;
+            }
+        }
+    }
+    return outfd;
+}
+
+/* Fetches the number of blocks on an input or output device. Returns
+ * -1 when that is not known. */
+static int64_t
+get_num_sect(int fd, int ftype, const char * fname, int bs)
+{
+    int res;
+    int sect_sz = 0;
+    int64_t num_sect = -1;
+
+    if (FT_SG == ftype) {
+        res = scsi_read_capacity(fd, &num_sect, &sect_sz);
+        if ((SG_LIB_CAT_UNIT_ATTENTION == res) ||
+            (SG_LIB_CAT_ABORTED_COMMAND == res)) {
+            pr2serr("Unit attention or aborted command (readcap), "
+                    "continuing\n");
+            res = scsi_read_capacity(fd, &num_sect, &sect_sz);
+        }
+        if (0 != res) {
+            if (res == SG_LIB_CAT_INVALID_OP)
+                pr2serr("read capacity not supported on %s\n", fname);
+            else if (res == SG_LIB_CAT_NOT_READY)
+                pr2serr("read capacity failed, %s not ready\n", fname);
+            else
+                pr2serr("Unable to read capacity on %s\n", fname);
+            return -1;
+        } else if (bs != sect_sz)
+            pr2serr(">> warning: block size on %s confusion: bs=%d, device "
+                    "claims=%d\n", fname, bs, sect_sz);
+    } else if (FT_BLOCK == ftype) {
+        if (0 != read_blkdev_capacity(fd, &num_sect, &sect_sz)) {
+            pr2serr("Unable to read block capacity on %s\n", fname);
+            return -1;
+        }
+        if (bs != sect_sz) {
+            pr2serr("block size on %s confusion; bs=%d, from device=%d\n",
+                    fname, bs, sect_sz);
+            return -1;
+        }
+    }
+    return num_sect;
+}
+
+
+int
+main(int argc, char * argv[])
+{
+    bool bpt_given = false;
+    bool cdbsz_given = false;
+    bool do_sync = false;
+    bool first_xfer, stop_after_write, terminate;
+    int ibs = 0;
+    int obs = 0;
+    int num_threads = DEF_NUM_THREADS;
+    int res, k, n, qstate, req_index, blocks;
+    int ret = 0;
+    int64_t skip = 0;
+    int64_t seek = 0;
+    int64_t in_num_sect = -1;
+    int64_t out_num_sect = -1;
+    char * key;
+    char * buf;
+    Rq_elem * rep;
+    char str[STR_SZ];
+    char inf[INOUTF_SZ];
+    char outf[INOUTF_SZ];
+
+    memset(&rcoll, 0, sizeof(Rq_coll));
+    rcoll.bpt = DEF_BLOCKS_PER_TRANSFER;
+    rcoll.in_type = FT_OTHER;
+    rcoll.out_type = FT_OTHER;
+    rcoll.cdbsz_in = DEF_SCSI_CDBSZ;
+    rcoll.cdbsz_out = DEF_SCSI_CDBSZ;
+    rcoll.max_uas = MAX_UNIT_ATTENTIONS;
+    rcoll.max_aborted = MAX_ABORTED_CMDS;
+    inf[0] = '\0';
+    outf[0] = '\0';
+    if (argc < 2) {
+        pr2serr("Won't default both IFILE to stdin _and_ OFILE to stdout\n");
+        pr2serr("For more information use '--help'\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+
+    for (k = 1; k < argc; k++) {
+        if (argv[k]) {
+            strncpy(str, argv[k], STR_SZ - 1);
+            str[STR_SZ - 1] = '\0';
+        } else
+            continue;
+        for (key = str, buf = key; *buf && *buf != '=';)
+            buf++;
+        if (*buf)
+            *buf++ = '\0';
+        if (0 == strcmp(key,"bpt")) {
+            rcoll.bpt = sg_get_num(buf);
+            if (-1 == rcoll.bpt) {
+                pr2serr(ME "bad argument to 'bpt='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+            bpt_given = true;
+        } else if (0 == strcmp(key,"bs")) {
+            rcoll.bs = sg_get_num(buf);
+            if (-1 == rcoll.bs) {
+                pr2serr(ME "bad argument to 'bs='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key,"cdbsz")) {
+            rcoll.cdbsz_in = sg_get_num(buf);
+            rcoll.cdbsz_out = rcoll.cdbsz_in;
+            cdbsz_given = true;
+        } else if (0 == strcmp(key,"coe")) {
+            rcoll.in_flags.coe = !! sg_get_num(buf);
+            rcoll.out_flags.coe = rcoll.in_flags.coe;
+        } else if (0 == strcmp(key,"count")) {
+            if (0 != strcmp("-1", buf)) {
+                dd_count = sg_get_llnum(buf);
+                if (-1LL == dd_count) {
+                    pr2serr(ME "bad argument to 'count='\n");
+                    return SG_LIB_SYNTAX_ERROR;
+                }
+            }   /* treat 'count=-1' as calculate count (same as not given) */
+        } else if ((0 == strncmp(key,"deb", 3)) ||
+                   (0 == strncmp(key,"verb", 4)))
+            rcoll.debug = sg_get_num(buf);
+        else if (0 == strcmp(key,"dio")) {
+            rcoll.in_flags.dio = !! sg_get_num(buf);
+            rcoll.out_flags.dio = rcoll.in_flags.dio;
+        } else if (0 == strcmp(key,"fua")) {
+            n = sg_get_num(buf);
+            if (n & 1)
+                rcoll.out_flags.fua = true;
+            if (n & 2)
+                rcoll.in_flags.fua = true;
+        } else if (0 == strcmp(key,"ibs")) {
+            ibs = sg_get_num(buf);
+            if (-1 == ibs) {
+                pr2serr(ME "bad argument to 'ibs='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (strcmp(key,"if") == 0) {
+            if ('\0' != inf[0]) {
+                pr2serr("Second 'if=' argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else {
+                strncpy(inf, buf, INOUTF_SZ - 1);
+                inf[INOUTF_SZ - 1] = '\0';
+            }
+        } else if (0 == strcmp(key, "iflag")) {
+            if (process_flags(buf, &rcoll.in_flags)) {
+                pr2serr(ME "bad argument to 'iflag='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key,"obs")) {
+            obs = sg_get_num(buf);
+            if (-1 == obs) {
+                pr2serr(ME "bad argument to 'obs='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (strcmp(key,"of") == 0) {
+            if ('\0' != outf[0]) {
+                pr2serr("Second 'of=' argument??\n");
+                return SG_LIB_SYNTAX_ERROR;
+            } else {
+                strncpy(outf, buf, INOUTF_SZ - 1);
+                outf[INOUTF_SZ - 1] = '\0';
+            }
+        } else if (0 == strcmp(key, "oflag")) {
+            if (process_flags(buf, &rcoll.out_flags)) {
+                pr2serr(ME "bad argument to 'oflag='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key,"seek")) {
+            seek = sg_get_llnum(buf);
+            if (-1LL == seek) {
+                pr2serr(ME "bad argument to 'seek='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key,"skip")) {
+            skip = sg_get_llnum(buf);
+            if (-1LL == skip) {
+                pr2serr(ME "bad argument to 'skip='\n");
+                return SG_LIB_SYNTAX_ERROR;
+            }
+        } else if (0 == strcmp(key,"sync"))
+            do_sync = !! sg_get_num(buf);
+        else if (0 == strcmp(key,"thr"))
+            num_threads = sg_get_num(buf);
+        else if (0 == strcmp(key,"time"))
+            do_time = !! sg_get_num(buf);
+        else if ((0 == strncmp(key, "--help", 7)) ||
+                 (0 == strncmp(key, "-h", 2)) ||
+                 (0 == strcmp(key, "-?"))) {
+            usage();
+            return 0;
+        } else if ((0 == strncmp(key, "--vers", 6)) ||
+                   (0 == strcmp(key, "-V"))) {
+            pr2serr(ME "%s\n", version_str);
+            return 0;
+        } else {
+            pr2serr("Unrecognized option '%s'\n", key);
+            pr2serr("For more information use '--help'\n");
+            return SG_LIB_SYNTAX_ERROR;
+        }
+    }
+    if (rcoll.bs <= 0) {
+        rcoll.bs = DEF_BLOCK_SIZE;
+        pr2serr("Assume default 'bs' (block size) of %d bytes\n", rcoll.bs);
+    }
+    if ((ibs && (ibs != rcoll.bs)) || (obs && (obs != rcoll.bs))) {
+        pr2serr("If 'ibs' or 'obs' given must be same as 'bs'\n");
+        pr2serr("For more information use '--help'\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if ((skip < 0) || (seek < 0)) {
+        pr2serr("skip and seek cannot be negative\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (rcoll.out_flags.append && (seek > 0)) {
+        pr2serr("Can't use both append and seek switches\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (rcoll.bpt < 1) {
+        pr2serr("bpt must be greater than 0\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (rcoll.in_flags.sparse)
+        pr2serr("sparse flag ignored for iflag\n");
+    /* defaulting transfer size to 128*2048 for CD/DVDs is too large
+       for the block layer in lk 2.6 and results in an EIO on the
+       SG_IO ioctl. So reduce it in that case. */
+    if ((rcoll.bs >= 2048) && (! bpt_given))
+        rcoll.bpt = DEF_BLOCKS_PER_2048TRANSFER;
+    if ((num_threads < 1) || (num_threads > MAX_NUM_THREADS)) {
+        pr2serr("too few or too many queued commands (thr=) requested\n");
+        pr2serr("For more information use '--help'\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (rcoll.debug)
+        pr2serr(ME "if=%s skip=%" PRId64 " of=%s seek=%" PRId64 " count=%"
+                PRId64 "\n", inf, skip, outf, seek, dd_count);
+
+    install_handler(SIGINT, interrupt_handler);
+    install_handler(SIGQUIT, interrupt_handler);
+    install_handler(SIGPIPE, interrupt_handler);
+    install_handler(SIGUSR1, siginfo_handler);
+
+    rcoll.infd = STDIN_FILENO;
+    rcoll.outfd = STDOUT_FILENO;
+    if (inf[0] && ('-' != inf[0])) {
+        rcoll.infd = open_if(inf, skip, &rcoll);
+        if (rcoll.infd < 0)
+            return -rcoll.infd;
+    }
+    if (outf[0] && ('-' != outf[0])) {
+        rcoll.outfd = open_of(outf, seek, &rcoll);
+        if (rcoll.outfd < -1)
+            return -rcoll.outfd;
+    }
+    if ((STDIN_FILENO == rcoll.infd) && (STDOUT_FILENO == rcoll.outfd)) {
+        pr2serr("Won't default both IFILE to stdin _and_ OFILE to stdout\n");
+        pr2serr("For more information use '--help'\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (rcoll.out_flags.sparse && (STDOUT_FILENO == rcoll.outfd)) {
+        pr2serr("oflag=sparse needs seekable output file\n");
+        return SG_LIB_SYNTAX_ERROR;
+    }
+    if (dd_count < 0) {
+        in_num_sect = get_num_sect(rcoll.infd, rcoll.in_type, inf,
+                                   rcoll.bs);
+        if (in_num_sect > skip)
+            in_num_sect -= skip;
+        out_num_sect = get_num_sect(rcoll.outfd, rcoll.out_type, outf,
+                                    rcoll.bs);
+        if (out_num_sect > seek)
+            out_num_sect -= seek;
+        if (in_num_sect > 0) {
+            if (out_num_sect > 0)
+                dd_count = (in_num_sect > out_num_sect) ? out_num_sect :
+                                                          in_num_sect;
+            else
+                dd_count = in_num_sect;
+        } else
+            dd_count = out_num_sect;
+    }
+    if (rcoll.debug > 1)
+        pr2serr("Start of loop, count=%" PRId64 ", in_num_sect=%" PRId64
+                ", out_num_sect=%" PRId64 "\n", dd_count, in_num_sect,
+                out_num_sect);
+    if (dd_count < 0) {
+        pr2serr("Couldn't calculate count, please give one\n");
+        return SG_LIB_CAT_OTHER;
+    }
+    if (0 == dd_count)
+        return 0;
+    if (! cdbsz_given) {
+        if ((FT_SG == rcoll.in_type) && (MAX_SCSI_CDBSZ != rcoll.cdbsz_in) &&
+            (((dd_count + skip) > UINT_MAX) || (rcoll.bpt > USHRT_MAX))) {
+            pr2serr("Note: SCSI command size increased to 16 bytes (for "
+                    "'if')\n");
+            rcoll.cdbsz_in = MAX_SCSI_CDBSZ;
+        }
+        if ((FT_SG == rcoll.out_type) && (MAX_SCSI_CDBSZ != rcoll.cdbsz_out) &&
+            (((dd_count + seek) > UINT_MAX) || (rcoll.bpt > USHRT_MAX))) {
+            pr2serr("Note: SCSI command size increased to 16 bytes (for "
+                    "'of')\n");
+            rcoll.cdbsz_out = MAX_SCSI_CDBSZ;
+        }
+    }
+    if (rcoll.out_flags.sparse && (FT_DEV_NULL != rcoll.out_type)) {
+        zeros_buff = sg_memalign(rcoll.bpt * rcoll.bs, 0, &free_zeros_buff,
+                                 false);
+        if (NULL == zeros_buff) {
+            pr2serr("zeros_buff sg_memalign failed\n");
+            return sg_convert_errno(ENOMEM);
+        }
+    }
+
+    rcoll.in_count = dd_count;
+    rcoll.in_done_count = dd_count;
+    rcoll.skip = skip;
+    rcoll.in_blk = skip;
+    rcoll.out_count = dd_count;
+    rcoll.out_done_count = dd_count;
+    rcoll.seek = seek;
+    rcoll.out_blk = seek;
+
+    if ((FT_SG == rcoll.in_type) || (FT_SG == rcoll.out_type))
+        rcoll.num_rq_elems = num_threads;
+    else
+        rcoll.num_rq_elems = 1;
+    if (prepare_rq_elems(&rcoll, inf, outf)) {
+        pr2serr("Setup failure, perhaps no memory\n");
+        release_rq_elems(&rcoll);
+        return SG_LIB_CAT_OTHER;
+    }
+
+    first_xfer = true;
+    stop_after_write = false;
+    terminate = false;
+    if (do_time) {
+        start_tm.tv_sec = 0;
+        start_tm.tv_usec = 0;
+        gettimeofday(&start_tm, NULL);
+        start_tm_valid = true;
+    }
+    while (rcoll.out_done_count > 0) { /* >>>>>>>>> main loop */
+        req_index = -1;
+        qstate = decider(&rcoll, first_xfer, &req_index);
+        rep = (req_index < 0) ? NULL : (rcoll.req_arr + req_index);
+        switch (qstate) {
+        case QS_IDLE:
+            if (NULL == rep) {
+                /* nothing queued, nothing to read and nothing to write */
+                if (stop_after_write || rcoll.in_stop)
+                    terminate = true;   /* short read on input */
+                else {
+                    pr2serr(ME "copy stalled, out_blk=%" PRId64 "\n",
+                            rcoll.out_blk);
+                    ret = SG_LIB_CAT_OTHER;
+                    terminate = true;
+                }
+                break;
+            }
+            if (rcoll.debug > 8)
+                pr2serr("    sgq_dd: non-sleeping QS_IDLE state, "
+                        "req_index=%d\n", req_index);
+            blocks = (rcoll.in_count > rcoll.bpt) ? rcoll.bpt :
+                                                    rcoll.in_count;
+            rep->wr = false;
+            rep->blk = rcoll.in_blk;
+            rep->num_blks = blocks;
+            rep->num_bytes = blocks * rcoll.bs;
+            rcoll.in_blk += blocks;
+            rcoll.in_count -= blocks;
+
+            if (FT_SG == rcoll.in_type) {
+                res = sg_start_io(rep);
+                if (0 != res) {
+                    if (1 == res)
+                        pr2serr("Out of memory starting sg io\n");
+                    ret = SG_LIB_CAT_OTHER;
+                    terminate = true;
+                }
+            } else {
+                res = normal_in_operation(&rcoll, rep, blocks);
+                if (res < 0) {
+                    ret = SG_LIB_FILE_ERROR;
+                    terminate = true;
+                } else if (res > 0) {
+                    stop_after_write = true;
+                    rcoll.in_stop = true;
+                }
+            }
+            break;
+        case QS_IN_FINISHED:
+            if (rcoll.debug > 8)
+                pr2serr("    sgq_dd: state is QS_IN_FINISHED, "
+                        "req_index=%d\n", req_index);
+            if (0 == rep->num_blks) {   /* read nothing so stop */
+                rep->qstate = QS_IDLE;
+                rcoll.in_stop = true;
+                terminate = true;
+                break;
+            }
+            rep->wr = true;
+            rep->blk = rcoll.out_blk;
+            blocks = rep->num_blks;
+            if (sparse_bypass(&rcoll, rep)) {
+                rcoll.out_blk += blocks;
+                rcoll.out_count -= blocks;
+                rcoll.out_sparse_num += blocks;
+                rep->qstate = QS_IDLE;
+                if (FT_SG == rcoll.out_type) {
+                    if (rcoll.debug > 2)
+                        pr2serr("sparse bypassing sg write: blk=%" PRId64
+                                ", blks=%d\n", rep->blk, blocks);
+                } else {
+                    off64_t offset = (off64_t)blocks * rcoll.bs;
+
+                    if (rcoll.debug > 2)
+                        pr2serr("sparse bypassing write: blk=%" PRId64
+                                ", blks=%d\n", rep->blk, blocks);
+                    if (lseek64(rcoll.outfd, offset, SEEK_CUR) < 0) {
+                        perror("lseek64 on output");
+                        ret = SG_LIB_FILE_ERROR;
+                        terminate = true;
+                        break;
+                    }
+                }
+                rcoll.out_done_count -= blocks;
+                first_xfer = false;
+                break;
+            }
+            rcoll.out_blk += blocks;
+            rcoll.out_count -= blocks;
+
+            if (FT_SG == rcoll.out_type) {
+                res = sg_start_io(rep);
+                if (0 != res) {
+                    if (1 == res)
+                        pr2serr("Out of memory starting sg io\n");
+                    ret = SG_LIB_CAT_OTHER;
+                    terminate = true;
+                }
+            } else if (FT_DEV_NULL == rcoll.out_type) {
+                /* skip actual write operation */
+                rcoll.out_done_count -= blocks;
+                rep->qstate = QS_IDLE;
+                first_xfer = false;
+            } else {
+                if (normal_out_operation(&rcoll, rep, blocks) < 0) {
+                    ret = SG_LIB_FILE_ERROR;
+                    terminate = true;
+                }
+                first_xfer = false;
+            }
+            break;
+        case QS_IN_POLL:
+            if (rcoll.debug > 8)
+                pr2serr("    sgq_dd: state is QS_IN_POLL, req_index=%d\n",
+                        req_index);
+            res = sg_fin_in_operation(&rcoll, rep);
+            if (res < 0) {
+                ret = SG_LIB_CAT_OTHER;
+                terminate = true;
+            } else if (res > 0) {
+                ++rcoll.num_retries;
+                /* retry with same addr, count info */
+                if (0 != sg_start_io(rep)) {
+                    ret = SG_LIB_CAT_OTHER;
+                    terminate = true;
+                }
+            }
+            break;
+        case QS_OUT_POLL:
+            if (rcoll.debug > 8)
+                pr2serr("    sgq_dd: state is QS_OUT_POLL, req_index=%d\n",
+                        req_index);
+            res = sg_fin_out_operation(&rcoll, rep);
+            if (res < 0) {
+                ret = SG_LIB_CAT_OTHER;
+                terminate = true;
+            } else if (res > 0) {
+                ++rcoll.num_retries;
+                if (0 != sg_start_io(rep)) {
+                    ret = SG_LIB_CAT_OTHER;
+                    terminate = true;
+                }
+            } else
+                first_xfer = false;
+            break;
+        default:
+            if (rcoll.debug > 8)
+                pr2serr("    sgq_dd: state is ?????\n");
+            ret = SG_LIB_CAT_OTHER;
+            terminate = true;
+            break;
+        }
+        if (terminate)
+            break;
+    } /* >>>>>>>>>>>>> end of main loop */
+
+    if (do_time)
+        calc_duration_throughput(false);
+
+    if (do_sync) {
+        if (FT_SG == rcoll.out_type) {
+            pr2serr(">> Synchronizing cache on %s\n", outf);
+            res = sg_ll_sync_cache_10(rcoll.outfd, false, false, 0, 0, 0,
+                                      false, 0);
+            if (SG_LIB_CAT_UNIT_ATTENTION == res) {
+                pr2serr("Unit attention(out), continuing\n");
+                res = sg_ll_sync_cache_10(rcoll.outfd, false, false, 0, 0, 0,
+                                          false, 0);
+            }
+            if (0 != res)
+                pr2serr("Unable to synchronize cache\n");
+        }
+    }
+
+    release_rq_elems(&rcoll);
+    if (free_zeros_buff)
+        free(free_zeros_buff);
+    if (STDIN_FILENO != rcoll.infd)
+        close(rcoll.infd);
+    if ((STDOUT_FILENO != rcoll.outfd) && (FT_DEV_NULL != rcoll.out_type))
+        close(rcoll.outfd);
+    if ((0 != rcoll.out_count) && (! rcoll.in_stop)) {
+        pr2serr(">>>> Some error occurred,\n");
+        if (0 == ret)
+            ret = SG_LIB_CAT_OTHER;
+    }
+    print_stats("");
+    if (rcoll.dio_incomplete) {
+        int fd;
+        char c;
+
+        pr2serr(">> Direct IO requested but incomplete %d times\n",
+                rcoll.dio_incomplete);
+        if ((fd = open(proc_allow_dio, O_RDONLY)) >= 0) {
+            if (1 == read(fd, &c, 1)) {
+                if ('0' == c)
+                    pr2serr(">>> %s set to '0' but should be set to '1' for "
+                            "direct IO\n", proc_allow_dio);
+            }
+            close(fd);
+        }
+    }
+    if (rcoll.sum_of_resids)
+        pr2serr(">> Non-zero sum of residual counts=%d\n",
+                rcoll.sum_of_resids);
+    return (ret >= 0) ? ret : SG_LIB_CAT_OTHER;
+}
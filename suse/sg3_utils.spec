@@ -109,6 +109,7 @@ install -m 755 scripts/rescan-scsi-bus.sh $RPM_BUILD_ROOT%{_bindir}
 %_bindir/sginfo
 %_bindir/sgp_dd
 %_bindir/sgm_dd
+%_bindir/sgq_dd
 %_bindir/scsi_logging_level
 %_bindir/rescan-scsi-bus.sh
 %_mandir/man8/*.8*
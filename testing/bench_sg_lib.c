@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2026 Douglas Gilbert.
+ * All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the BSD_LICENSE file.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+
+#include <time.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sg_lib.h"
+#include "sg_pt.h"
+
+/*
+ * Micro-benchmarks of some frequently used sg_lib (libsgutils) functions.
+ * Each benchmark cycles through a fixed corpus of inputs (compiled into
+ * this file) so the numbers from two builds can be compared; the result
+ * is the time per call in nanoseconds (ns/op). The best (lowest) of
+ * several repetitions is reported since that is the least disturbed by
+ * the rest of the system. Use it before and after a change to sg_lib to
+ * see if that change has made things slower.
+ */
+
+static const char * version_str = "1.00 20261018";
+
+#define DEF_TARGET_MS 200       /* aim for each repetition to take this */
+#define DEF_REPS 3
+#define MAX_REPS 100
+
+static struct option long_options[] = {
+        {"bench", required_argument, 0, 'b'},
+        {"help", no_argument, 0, 'h'},
+        {"list", no_argument, 0, 'l'},
+        {"num", required_argument, 0, 'n'},
+        {"reps", required_argument, 0, 'r'},
+        {"time", required_argument, 0, 't'},
+        {"verbose", no_argument, 0, 'v'},
+        {"version", no_argument, 0, 'V'},
+        {0, 0, 0, 0},   /* sentinel */
+};
+
+/* Results of each call are added here so the compiler can't drop them */
+static volatile int sink;
+
+static char out_b[4096];
+
+
+/* Sense data corpus: descriptor and fixed format */
+
+static const uint8_t sense_desc1[] = {
+   /* unrec_err, excessive_writes, sdat_ovfl, additional_len=? */
+    0x72, 0x1, 0x3, 0x2, 0x80, 0x0, 0x0, 12+12+8+4,
+   /* Information: 0x11223344556677bb */
+    0x0, 0xa, 0x80, 0x0, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0xbb,
+   /* command specific: 0x3344556677bbccff */
+    0x1, 0xa, 0x0, 0x0, 0x33, 0x44, 0x55, 0x66, 0x77, 0xbb, 0xcc, 0xff,
+   /* sense key specific: SKSV=1, actual_count=257 (hex: 0x101) */
+    0x2, 0x6, 0x0, 0x0, 0x80, 0x1, 0x1, 0x0,
+   /* field replaceable code=0x45 */
+    0x3, 0x2, 0x0, 0x45,
+    };
+
+static const uint8_t sense_desc2[] = {
+   /* ill_req, inv fld in para list, additional_len=? */
+    0x72, 0x5, 0x26, 0x0, 0x0, 0x0, 0x0, 8+4,
+   /* sense key specific: SKSV=1, C/D*=0, bitp=7 bytep=34 */
+    0x2, 0x6, 0x0, 0x0, 0x8f, 0x0, 0x34, 0x0,
+   /* field replaceable code=0x45 */
+    0x3, 0x2, 0x0, 0x45,
+    };
+
+static const uint8_t sense_desc3[] = {
+   /* no_sense, ATA info available */
+    0x72, 0x0, 0x0, 0x1d, 0x0, 0x0, 0x0, 14,
+   /* ATA descriptor extend=1 */
+    0x9, 0xc, 0x1, 0x0, 0x34, 0x12, 0x44, 0x11,
+    0x55, 0x22, 0x66, 0x33, 0x1, 0x0,
+    };
+
+static const uint8_t sense_fixed1[] = {
+   /* medium error, unrecovered read error, info valid: lba 0x12345 */
+    0xf0, 0x0, 0x3, 0x0, 0x1, 0x23, 0x45, 0xa,
+    0x0, 0x0, 0x0, 0x0, 0x11, 0x0, 0x0, 0x0, 0x0, 0x0,
+    };
+
+static const uint8_t sense_fixed2[] = {
+   /* unit attention, power on occurred */
+    0x70, 0x0, 0x6, 0x0, 0x0, 0x0, 0x0, 0xa,
+    0x0, 0x0, 0x0, 0x0, 0x29, 0x0, 0x0, 0x0, 0x0, 0x0,
+    };
+
+static const uint8_t sense_fixed3[] = {
+   /* not ready, becoming ready, progress indication 0x4000 */
+    0x70, 0x0, 0x2, 0x0, 0x0, 0x0, 0x0, 0xa,
+    0x0, 0x0, 0x0, 0x0, 0x4, 0x1, 0x0, 0x80, 0x40, 0x0,
+    };
+
+struct blob_t {
+    const uint8_t * bp;
+    int len;
+};
+
+static const struct blob_t sense_corpus[] = {
+    {sense_desc1, sizeof(sense_desc1)},
+    {sense_desc2, sizeof(sense_desc2)},
+    {sense_desc3, sizeof(sense_desc3)},
+    {sense_fixed1, sizeof(sense_fixed1)},
+    {sense_fixed2, sizeof(sense_fixed2)},
+    {sense_fixed3, sizeof(sense_fixed3)},
+};
+
+/* Designation descriptor corpus (as found in VPD page 0x83) */
+
+static const uint8_t dd_naa5[] = {     /* lu, NAA-5 */
+    0x1, 0x3, 0x0, 0x8,
+    0x50, 0x0, 0xc5, 0x0, 0x1a, 0x2b, 0x3c, 0x4d,
+    };
+
+static const uint8_t dd_naa6[] = {     /* lu, NAA-6 */
+    0x1, 0x3, 0x0, 0x10,
+    0x60, 0x0, 0xc2, 0x94, 0x0, 0x0, 0x0, 0x0,
+    0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0,
+    };
+
+static const uint8_t dd_t10[] = {      /* lu, T10 vendor id */
+    0x2, 0x1, 0x0, 0x18,
+    'L', 'i', 'n', 'u', 'x', ' ', ' ', ' ',
+    's', 'c', 's', 'i', '_', 'd', 'e', 'b',
+    'u', 'g', ' ', ' ', '2', '0', '0', '0',
+    };
+
+static const uint8_t dd_eui64[] = {    /* lu, EUI-64 */
+    0x1, 0x2, 0x0, 0x8,
+    0x00, 0x1b, 0x44, 0x11, 0x3a, 0xb7, 0xc8, 0xd9,
+    };
+
+static const uint8_t dd_name[] = {     /* target device, SCSI name string */
+    0x63, 0xa8, 0x0, 0x18,
+    'n', 'a', 'a', '.', '5', '0', '0', '0',
+    'C', '5', '0', '0', '1', 'A', '2', 'B',
+    '3', 'C', '4', 'D', 0x0, 0x0, 0x0, 0x0,
+    };
+
+static const uint8_t dd_rtp[] = {      /* port, relative target port */
+    0x61, 0x94, 0x0, 0x4,
+    0x0, 0x0, 0x0, 0x1,
+    };
+
+static const struct blob_t dd_corpus[] = {
+    {dd_naa5, sizeof(dd_naa5)},
+    {dd_naa6, sizeof(dd_naa6)},
+    {dd_t10, sizeof(dd_t10)},
+    {dd_eui64, sizeof(dd_eui64)},
+    {dd_name, sizeof(dd_name)},
+    {dd_rtp, sizeof(dd_rtp)},
+};
+
+/* Number parsing corpus, as given on command lines */
+
+static const char * num_corpus[] = {
+    "0", "7", "512", "65536", "2147483647", "1234567890123",
+    "0x1f", "0x1234abcd", "ffh", "1k", "64m", "3g", "2t",
+    "2x512", "4KiB", "8MB", "-1",
+};
+
+/* Hex dump corpus: lengths, the data is a fixed pattern */
+
+static const int hex_lens[] = {4, 16, 36, 64, 252, 512};
+
+static uint8_t hex_data[512];
+
+#define ARR_SZ(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+
+static void
+bench_sense(int k)
+{
+    const struct blob_t * p = sense_corpus + (k % ARR_SZ(sense_corpus));
+
+    sink += sg_get_sense_str(NULL, p->bp, p->len, false, sizeof(out_b),
+                             out_b);
+}
+
+static void
+bench_opcode(int k)
+{
+    /* all 256 opcodes for a disk (pdt 0) then for a tape (pdt 1) */
+    sg_get_opcode_name((uint8_t)(k & 0xff), (k >> 8) & 0x1, sizeof(out_b),
+                       out_b);
+    sink += out_b[0];
+}
+
+static void
+bench_hex2str(int k)
+{
+    int len = hex_lens[k % ARR_SZ(hex_lens)];
+
+    sink += hex2str(hex_data, len, NULL, (k / ARR_SZ(hex_lens)) & 0x1,
+                    sizeof(out_b), out_b);
+}
+
+static void
+bench_llnum(int k)
+{
+    sink += (int)sg_get_llnum(num_corpus[k % ARR_SZ(num_corpus)]);
+}
+
+static void
+bench_desig(int k)
+{
+    const struct blob_t * p = dd_corpus + (k % ARR_SZ(dd_corpus));
+
+    sink += sg_get_designation_descriptor_str(NULL, p->bp, p->len, true,
+                                              (k / ARR_SZ(dd_corpus)) & 0x1,
+                                              sizeof(out_b), out_b);
+}
+
+static void
+bench_pt_obj(int k)
+{
+    struct sg_pt_base * ptp = construct_scsi_pt_obj();
+
+    if (ptp) {
+        sink += k;
+        destruct_scsi_pt_obj(ptp);
+    }
+}
+
+struct bench_t {
+    const char * name;
+    const char * desc;
+    void (*fn)(int);
+    int corpus_sz;      /* one pass over the corpus takes this many calls */
+};
+
+static struct bench_t benches[] = {
+    {"sense_str", "sg_get_sense_str(), fixed and descriptor formats",
+     bench_sense, ARR_SZ(sense_corpus)},
+    {"opcode_name", "sg_get_opcode_name(), all opcodes, disk and tape",
+     bench_opcode, 512},
+    {"hex2str", "hex2str(), 4 to 512 bytes, with and without ASCII",
+     bench_hex2str, 2 * ARR_SZ(hex_lens)},
+    {"get_llnum", "sg_get_llnum(), decimal, hex and multipliers",
+     bench_llnum, ARR_SZ(num_corpus)},
+    {"desig_desc_str", "sg_get_designation_descriptor_str(), 6 types",
+     bench_desig, 2 * ARR_SZ(dd_corpus)},
+    {"pt_obj", "construct_scsi_pt_obj() + destruct_scsi_pt_obj()",
+     bench_pt_obj, 1},
+    {NULL, NULL, NULL, 0},
+};
+
+
+static void
+usage()
+{
+    fprintf(stderr,
+            "Usage: bench_sg_lib [--bench=NAME] [--help] [--list] "
+            "[--num=NUM]\n"
+            "                    [--reps=R] [--time=MS] [--verbose] "
+            "[--version]\n"
+            "  where: --bench=NAME|-b NAME    only run benchmarks whose "
+            "name\n"
+            "                                 contains NAME\n"
+            "         --help|-h          print out usage message\n"
+            "         --list|-l          list the benchmarks then exit\n"
+            "         --num=NUM|-n NUM    calls per repetition (def: enough "
+            "to take\n"
+            "                             about MS milliseconds)\n"
+            "         --reps=R|-r R      repetitions, best is reported "
+            "(def: %d)\n"
+            "         --time=MS|-t MS    target time of each repetition "
+            "(def: %d)\n"
+            "         --verbose|-v       increase verbosity\n"
+            "         --version|-V       print version string and exit\n\n"
+            "Micro-benchmarks of sg_lib functions using fixed inputs. "
+            "Outputs the\nbest time per call in nanoseconds (ns/op) "
+            "for each benchmark.\n", DEF_REPS, DEF_TARGET_MS);
+}
+
+static int64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    if (0 != clock_gettime(CLOCK_MONOTONIC, &ts))
+        return 0;
+    return ((int64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Returns nanoseconds taken for 'num' calls of bp->fn */
+static int64_t
+time_calls(const struct bench_t * bp, int64_t num)
+{
+    int64_t k, start;
+
+    start = now_ns();
+    for (k = 0; k < num; ++k)
+        bp->fn((int)(k & 0x7fffffff));
+    return now_ns() - start;
+}
+
+/* Picks a call count (a multiple of the corpus size) that takes about
+ * 'target_ms' milliseconds */
+static int64_t
+calibrate(const struct bench_t * bp, int target_ms)
+{
+    int64_t num = bp->corpus_sz;
+    int64_t t;
+    int64_t target_ns = (int64_t)target_ms * 1000000;
+
+    while (1) {
+        t = time_calls(bp, num);
+        if ((t >= (target_ns / 8)) || (num > ((int64_t)1 << 40)))
+            break;
+        num *= 2;
+    }
+    if (t > 0)
+        num = (int64_t)((double)num * target_ns / t);
+    num = ((num / bp->corpus_sz) + 1) * bp->corpus_sz;
+    return num;
+}
+
+
+int
+main(int argc, char * argv[])
+{
+    bool do_list = false;
+    int k, j, c;
+    int reps = DEF_REPS;
+    int target_ms = DEF_TARGET_MS;
+    int vb = 0;
+    int did = 0;
+    int64_t num = 0;
+    int64_t n, t, best;
+    const char * only = NULL;
+    const struct bench_t * bp;
+
+    while (1) {
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "b:hln:r:t:vV", long_options,
+                        &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'b':
+            only = optarg;
+            break;
+        case 'h':
+        case '?':
+            usage();
+            return 0;
+        case 'l':
+            do_list = true;
+            break;
+        case 'n':
+            num = sg_get_llnum(optarg);
+            if (num < 1) {
+                fprintf(stderr, "--num= expects a number greater than 0\n");
+                return 1;
+            }
+            break;
+        case 'r':
+            reps = sg_get_num(optarg);
+            if ((reps < 1) || (reps > MAX_REPS)) {
+                fprintf(stderr, "--reps= expects 1 to %d\n", MAX_REPS);
+                return 1;
+            }
+            break;
+        case 't':
+            target_ms = sg_get_num(optarg);
+            if (target_ms < 1) {
+                fprintf(stderr, "--time= expects a number of "
+                        "milliseconds\n");
+                return 1;
+            }
+            break;
+        case 'v':
+            ++vb;
+            break;
+        case 'V':
+            fprintf(stderr, "version: %s\n", version_str);
+            return 0;
+        default:
+            fprintf(stderr, "unrecognised switch code 0x%x ??\n", c);
+            usage();
+            return 1;
+        }
+    }
+    if (optind < argc) {
+        for (; optind < argc; ++optind)
+            fprintf(stderr, "Unexpected extra argument: %s\n",
+                    argv[optind]);
+        usage();
+        return 1;
+    }
+    if (do_list) {
+        for (bp = benches; bp->name; ++bp)
+            printf("  %-16s %s\n", bp->name, bp->desc);
+        return 0;
+    }
+
+    for (k = 0; k < (int)sizeof(hex_data); ++k)
+        hex_data[k] = (uint8_t)((k * 37) + 11);
+
+    for (bp = benches; bp->name; ++bp) {
+        if (only && (NULL == strstr(bp->name, only)))
+            continue;
+        if (0 == did++)
+            printf("%-16s %12s %14s\n", "benchmark", "ns/op", "calls");
+        n = (num > 0) ? num : calibrate(bp, target_ms);
+        best = -1;
+        for (j = 0; j < reps; ++j) {
+            t = time_calls(bp, n);
+            if (vb)
+                fprintf(stderr, "  %s rep %d: %" PRId64 " ns for %" PRId64
+                        " calls\n", bp->name, j + 1, t, n);
+            if ((best < 0) || (t < best))
+                best = t;
+        }
+        printf("%-16s %12.1f %14" PRId64 "\n", bp->name, (double)best / n,
+               n);
+        fflush(stdout);
+    }
+    if (0 == did) {
+        fprintf(stderr, "no benchmark name contains '%s', try '--list'\n",
+                only);
+        return 1;
+    }
+    return 0;
+}
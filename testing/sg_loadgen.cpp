@@ -0,0 +1,836 @@
+/*
+ * Copyright (c) 2014-2026 Douglas Gilbert.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <vector>
+#include <map>
+#include <list>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <poll.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#define __STDC_FORMAT_MACROS 1
+#include <inttypes.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "sg_lib.h"
+#include "sg_io_linux.h"
+#include "sg_unaligned.h"
+#include "sg_pt.h"
+#include "sg_cmds.h"
+
+#include "sg_loadgen.h"
+
+/* The engine behind sg_tst_async, see sg_loadgen.h . */
+
+using namespace std;
+using namespace std::chrono;
+
+#define DEF_TIMEOUT_MS 20000    /* 20 seconds */
+#define DEF_PT_TIMEOUT 60       /* 60 seconds */
+#define MAX_CONSEC_NOMEMS 16
+#define URANDOM_DEV "/dev/urandom"
+#define SENSE_BUFF_LEN 64
+
+#ifndef SG_FLAG_Q_AT_TAIL
+#define SG_FLAG_Q_AT_TAIL 0x10
+#endif
+#ifndef SG_FLAG_Q_AT_HEAD
+#define SG_FLAG_Q_AT_HEAD 0x20
+#endif
+
+#define TUR_CMD_LEN 6
+#define READ16_CMD_LEN 16
+#define WRITE16_CMD_LEN 16
+
+/* What a worker remembers about each of its queued commands */
+struct lg_inflight {
+    lg_cmd_t cmd;
+    uint64_t lba;
+    int64_t start_us;
+    uint8_t * lbp;              /* aligned data buffer or NULL */
+    uint8_t * free_lbp;         /* what to free() for lbp */
+    uint8_t sense[SENSE_BUFF_LEN];
+};
+
+static const char * lg_cmd_names[LG_NUM_CMDS] = {
+    "TEST UNIT READY", "READ(16)", "WRITE(16)",
+};
+static const char * lg_cmd_mix_names[LG_NUM_CMDS] = {"tur", "read", "write"};
+
+
+static int64_t
+now_us(void)
+{
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch())
+           .count();
+}
+
+/* splitmix64, used to spread a seed and a worker's id into a seed for
+ * that worker's generator */
+static uint64_t
+splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+const char *
+lg_cmd_name(lg_cmd_t c)
+{
+    return ((c >= 0) && (c < LG_NUM_CMDS)) ? lg_cmd_names[c] : "??";
+}
+
+Lg_rand::Lg_rand(uint64_t a_seed) : s(splitmix64(a_seed))
+{
+    if (0 == s)
+        s = 0x9e3779b97f4a7c15ULL;     /* xorshift must not start at 0 */
+}
+
+uint64_t
+Lg_rand::next()
+{
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    return s * 0x2545f4914f6cdd1dULL;
+}
+
+uint64_t
+Lg_rand::range(uint64_t lo, uint64_t hi)
+{
+    uint64_t span = hi - lo + 1;
+
+    if (0 == span)              /* lo=0, hi=UINT64_MAX */
+        return next();
+    /* the modulo bias is at most span/2**64, which is negligible here */
+    return lo + (next() % span);
+}
+
+Lg_cmd_mix::Lg_cmd_mix()
+{
+    clear();
+}
+
+void
+Lg_cmd_mix::clear()
+{
+    for (int k = 0; k < LG_NUM_CMDS; ++k)
+        weight[k] = 0;
+    total = 0;
+}
+
+void
+Lg_cmd_mix::add(lg_cmd_t c, unsigned int a_weight)
+{
+    weight[c] += a_weight;
+    total += a_weight;
+}
+
+bool
+Lg_cmd_mix::parse(const char * s)
+{
+    int k, n;
+    const char * cp;
+    const char * ccp;
+    Lg_cmd_mix m;
+
+    for (cp = s; cp && *cp; cp = ccp ? (ccp + 1) : NULL) {
+        ccp = strchr(cp, ',');
+        n = ccp ? (int)(ccp - cp) : (int)strlen(cp);
+        for (k = 0; k < LG_NUM_CMDS; ++k) {
+            int len = strlen(lg_cmd_mix_names[k]);
+
+            if ((n >= len) && (0 == strncmp(cp, lg_cmd_mix_names[k], len)) &&
+                ((n == len) || (':' == cp[len])))
+                break;
+        }
+        if (k >= LG_NUM_CMDS)
+            return false;
+        if (':' == cp[strlen(lg_cmd_mix_names[k])]) {
+            int w = sg_get_num_nomult(cp + strlen(lg_cmd_mix_names[k]) + 1);
+
+            if (w < 0)
+                return false;
+            m.add((lg_cmd_t)k, w);
+        } else
+            m.add((lg_cmd_t)k, 1);
+    }
+    if (m.empty())
+        return false;
+    *this = m;
+    return true;
+}
+
+lg_cmd_t
+Lg_cmd_mix::pick(Lg_rand & r) const
+{
+    int k;
+    unsigned int v;
+
+    for (k = 0; k < LG_NUM_CMDS; ++k) {
+        if (weight[k] == total)
+            return (lg_cmd_t)k;         /* only one, skip the generator */
+    }
+    v = (unsigned int)r.range(0, total - 1);
+    for (k = 0; k < (LG_NUM_CMDS - 1); ++k) {
+        if (v < weight[k])
+            break;
+        v -= weight[k];
+    }
+    return (lg_cmd_t)k;
+}
+
+string
+Lg_cmd_mix::str() const
+{
+    string s;
+    char b[32];
+
+    for (int k = 0; k < LG_NUM_CMDS; ++k) {
+        if (0 == weight[k])
+            continue;
+        snprintf(b, sizeof(b), "%s%s:%u", (s.empty() ? "" : ","),
+                 lg_cmd_mix_names[k], weight[k]);
+        s += b;
+    }
+    return s;
+}
+
+lg_params::lg_params()
+    : num_threads(4), num_per_thread(1000),
+      maxq_per_thread(LG_MAX_Q_PER_FD), lb_sz(512), wait_ms(10), verbose(0),
+      block(false), direct(false), no_xfer(false), generic_pt(false),
+      seed(0), lba(1000), hi_lba(0), blqd(LG_BLQ_DEFAULT),
+      myqd(LG_MYQD_HIGH)
+{
+}
+
+lg_cmd_stats::lg_cmd_stats()
+    : num(0), errs(0), lat_sum_us(0), lat_min_us(0), lat_max_us(0)
+{
+}
+
+void
+lg_cmd_stats::add(int64_t usecs, bool err)
+{
+    if (usecs < 0)
+        usecs = 0;
+    if ((0 == num) || (usecs < lat_min_us))
+        lat_min_us = usecs;
+    if (usecs > lat_max_us)
+        lat_max_us = usecs;
+    lat_sum_us += usecs;
+    ++num;
+    if (err)
+        ++errs;
+}
+
+void
+lg_cmd_stats::merge(const lg_cmd_stats & o)
+{
+    if (0 == o.num)
+        return;
+    if ((0 == num) || (o.lat_min_us < lat_min_us))
+        lat_min_us = o.lat_min_us;
+    if (o.lat_max_us > lat_max_us)
+        lat_max_us = o.lat_max_us;
+    lat_sum_us += o.lat_sum_us;
+    num += o.num;
+    errs += o.errs;
+}
+
+lg_thread_res::lg_thread_res()
+    : id(-1), dev_name(NULL), starts(0), finishes(0), max_queued(0),
+      start_eagains(0), fin_eagains(0), seed(0), failed(false)
+{
+}
+
+void
+lg_thread_res::merge(const lg_thread_res & o)
+{
+    starts += o.starts;
+    finishes += o.finishes;
+    if (o.max_queued > max_queued)
+        max_queued = o.max_queued;
+    start_eagains += o.start_eagains;
+    fin_eagains += o.fin_eagains;
+    if (o.failed)
+        failed = true;
+    for (int k = 0; k < LG_NUM_CMDS; ++k)
+        cmd[k].merge(o.cmd[k]);
+}
+
+lg_thread_res
+lg_result::total() const
+{
+    lg_thread_res t;
+
+    for (size_t k = 0; k < thr.size(); ++k)
+        t.merge(thr[k]);
+    return t;
+}
+
+Load_gen::Load_gen(const lg_params & a_prm) : prm(a_prm), next_pack_id(1)
+{
+}
+
+int
+Load_gen::pr2serr_lk(const char * fmt, ...)
+{
+    int n;
+    va_list args;
+    lock_guard<mutex> lg(console_mutex);
+
+    va_start(args, fmt);
+    n = vfprintf(stderr, fmt, args);
+    va_end(args);
+    return n;
+}
+
+/* Returns 0 if command injected okay, else -1 */
+int
+Load_gen::start_cmd(int sg_fd, lg_cmd_t c, int pack_id, uint64_t lba,
+                    uint8_t * lbp, uint8_t * sbp, int sb_len, int flags,
+                    unsigned int & eagains)
+{
+    struct sg_io_hdr pt;
+    uint8_t turCmdBlk[TUR_CMD_LEN] = {0, 0, 0, 0, 0, 0};
+    uint8_t r16CmdBlk[READ16_CMD_LEN] =
+                {0x88, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0};
+    uint8_t w16CmdBlk[WRITE16_CMD_LEN] =
+                {0x8a, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0};
+
+    memset(&pt, 0, sizeof(pt));
+    switch (c) {
+    case LG_TUR:
+    default:
+        pt.cmdp = turCmdBlk;
+        pt.cmd_len = sizeof(turCmdBlk);
+        pt.dxfer_direction = SG_DXFER_NONE;
+        break;
+    case LG_READ16:
+        sg_put_unaligned_be64(lba, &r16CmdBlk[2]);
+        pt.cmdp = r16CmdBlk;
+        pt.cmd_len = sizeof(r16CmdBlk);
+        pt.dxfer_direction = SG_DXFER_FROM_DEV;
+        pt.dxferp = lbp;
+        pt.dxfer_len = prm.lb_sz;
+        break;
+    case LG_WRITE16:
+        sg_put_unaligned_be64(lba, &w16CmdBlk[2]);
+        pt.cmdp = w16CmdBlk;
+        pt.cmd_len = sizeof(w16CmdBlk);
+        pt.dxfer_direction = SG_DXFER_TO_DEV;
+        pt.dxferp = lbp;
+        pt.dxfer_len = prm.lb_sz;
+        break;
+    }
+    pt.interface_id = 'S';
+    /* sense data is written when the response is read, so 'sbp' must
+     * outlive this function */
+    pt.mx_sb_len = sb_len;
+    pt.sbp = sbp;
+    pt.timeout = DEF_TIMEOUT_MS;
+    pt.pack_id = pack_id;
+    pt.flags = flags;
+
+    for (int k = 0; write(sg_fd, &pt, sizeof(pt)) < 0; ++k) {
+        if ((ENOMEM == errno) && (k < MAX_CONSEC_NOMEMS)) {
+            this_thread::yield();
+            continue;
+        }
+        if (EAGAIN == errno) {
+            ++eagains;
+            this_thread::yield();
+            continue;
+        }
+        pr2serr_lk("%s: %s, pack_id=%d: %s\n", __func__, lg_cmd_name(c),
+                   pack_id, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Reads the oldest completed response into 'pt'. Returns 0 if one was
+ * read (its status still needs checking), else -1 . */
+int
+Load_gen::finish_cmd(int sg_fd, struct sg_io_hdr & pt, unsigned int & eagains)
+{
+    int res;
+
+    memset(&pt, 0, sizeof(pt));
+    pt.interface_id = 'S';
+    pt.pack_id = 0;
+
+    while (((res = read(sg_fd, &pt, sizeof(pt))) < 0) &&
+           (EAGAIN == errno)) {
+        ++eagains;
+        if (prm.wait_ms > 0)
+            this_thread::sleep_for(milliseconds{prm.wait_ms});
+        else if (0 == prm.wait_ms)
+            this_thread::yield();
+        else if (-2 == prm.wait_ms)
+            sleep(0);                   // process yield ??
+    }
+    if (res < 0) {
+        pr2serr_lk("%s: read(): %s\n", __func__, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+void
+Load_gen::work_sync(int id, lg_thread_res & tr)
+{
+    int k, sg_fd, err, rs, n, sense_cat, ret;
+    int vb = prm.verbose;
+    int64_t t_start;
+    struct sg_pt_base * pbp = NULL;
+    uint8_t cdb[6];
+    uint8_t sense_b[32];
+    char b[120];
+
+    if ((prm.mix.has(LG_READ16)) || (prm.mix.has(LG_WRITE16))) {
+        pr2serr_lk("id=%d: only support TUR here for now\n", id);
+        tr.err = "only TUR supported with generic_pt";
+        goto err_out;
+    }
+    if ((sg_fd = sg_cmds_open_device(tr.dev_name, false /* ro */, vb)) < 0) {
+        pr2serr_lk("id=%d: error opening file: %s: %s\n", id, tr.dev_name,
+                   safe_strerror(-sg_fd));
+        tr.err = "open failed";
+        goto err_out;
+    }
+
+    pbp = construct_scsi_pt_obj_with_fd(sg_fd, vb);
+    err = 0;
+    if ((NULL == pbp) || ((err = get_scsi_pt_os_err(pbp)))) {
+        ret = sg_convert_errno(err ? err : ENOMEM);
+        sg_exit2str(ret, true, sizeof(b), b);
+        pr2serr_lk("id=%d: construct_scsi_pt_obj_with_fd: %s\n", id, b);
+        tr.err = b;
+        goto err_out;
+    }
+    for (k = 0; k < prm.num_per_thread; ++k) {
+        bool bad = false;
+
+        /* Might get Unit Attention on first invocation */
+        memset(cdb, 0, sizeof(cdb));    /* TUR's cdb is 6 zeros */
+        set_scsi_pt_cdb(pbp, cdb, sizeof(cdb));
+        set_scsi_pt_sense(pbp, sense_b, sizeof(sense_b));
+        ++tr.starts;
+        t_start = now_us();
+        rs = do_scsi_pt(pbp, -1, DEF_PT_TIMEOUT, vb);
+        n = sg_cmds_process_resp(pbp, "Test unit ready", rs,
+                                 SG_NO_DATA_IN, sense_b,
+                                 (0 == k), vb, &sense_cat);
+        if (-1 == n) {
+            ret = sg_convert_errno(get_scsi_pt_os_err(pbp));
+            sg_exit2str(ret, true, sizeof(b), b);
+            pr2serr_lk("id=%d: do_scsi_pt: %s\n", id, b);
+            tr.err = b;
+            goto err_out;
+        } else if (-2 == n) {
+            switch (sense_cat) {
+            case SG_LIB_CAT_RECOVERED:
+            case SG_LIB_CAT_NO_SENSE:
+                break;
+            case SG_LIB_CAT_NOT_READY:
+                bad = true;
+                if (1 == prm.num_per_thread) {
+                    pr2serr_lk("id=%d: device not ready\n", id);
+                }
+                break;
+            case SG_LIB_CAT_UNIT_ATTENTION:
+                bad = true;
+                if (vb)
+                    pr2serr_lk("Ignoring Unit attention (sense key)\n");
+                break;
+            default:
+                bad = true;
+                if (1 == prm.num_per_thread) {
+                    sg_get_category_sense_str(sense_cat, sizeof(b), b, vb);
+                    pr2serr_lk("%s\n", b);
+                    tr.cmd[LG_TUR].add(now_us() - t_start, bad);
+                    ++tr.finishes;
+                    tr.err = b;
+                    goto err_out;
+                }
+                break;
+            }
+        }
+        tr.cmd[LG_TUR].add(now_us() - t_start, bad);
+        ++tr.finishes;
+        clear_scsi_pt_obj(pbp);
+    }
+err_out:
+    if (pbp)
+        destruct_scsi_pt_obj(pbp);
+    if (tr.cmd[LG_TUR].errs > 0)
+        pr2serr_lk("id=%d: number of errors: %" PRId64 "\n", id,
+                   tr.cmd[LG_TUR].errs);
+    if (! tr.err.empty())
+        tr.failed = true;
+}
+
+void
+Load_gen::work_async(int id, lg_thread_res & tr)
+{
+    int vb = prm.verbose;
+    unsigned int hi_lba;
+    int k, n, res, sg_fd, num_outstanding, do_inc, npt, pack_id, sg_flags;
+    int num_waiting_read, num_to_read;
+    int open_flags = O_RDWR;
+    bool use_rand_lba;
+    char ebuff[256];
+    uint64_t lba;
+    lg_cmd_t c;
+    uint8_t * lbp;
+    uint8_t * free_lbp;
+    const char * err = NULL;
+    struct sg_io_hdr pt;
+    struct pollfd  pfd[1];
+    list<pair<uint8_t *, uint8_t *> > free_lst;   /* of aligned lb buffers */
+    map<int, lg_inflight> pi_2_ifl;     /* pack_id -> queued command */
+    Lg_rand rnd(prm.seed ^ splitmix64((uint64_t)id));
+
+    tr.seed = prm.seed;
+    /* device name and hi_lba may depend on id */
+    n = prm.dev_names.size();
+    if ((UINT_MAX == prm.hi_lba) && (n == (int)prm.hi_lbas.size()))
+        hi_lba = prm.hi_lbas[id % n];
+    else
+        hi_lba = prm.hi_lba;
+    use_rand_lba = (hi_lba > 0);
+
+    if (vb) {
+        if ((vb > 1) && hi_lba)
+            pr2serr_lk("Enter work_thread id=%d using %s\n"
+                       "    LBA range: 0x%x to 0x%x (inclusive)\n",
+                       id, tr.dev_name, (unsigned int)prm.lba, hi_lba);
+        else
+            pr2serr_lk("Enter work_thread id=%d using %s\n", id,
+                       tr.dev_name);
+    }
+    if (! prm.block)
+        open_flags |= O_NONBLOCK;
+
+    sg_fd = open(tr.dev_name, open_flags);
+    if (sg_fd < 0) {
+        pr2serr_lk("%s: id=%d, error opening file: %s: %s\n", __func__, id,
+                   tr.dev_name, strerror(errno));
+        tr.failed = true;
+        tr.err = "open failed";
+        return;
+    }
+    pfd[0].fd = sg_fd;
+    pfd[0].events = POLLIN;
+
+    sg_flags = 0;
+    if (LG_BLQ_AT_TAIL == prm.blqd)
+        sg_flags |= SG_FLAG_Q_AT_TAIL;
+    else if (LG_BLQ_AT_HEAD == prm.blqd)
+        sg_flags |= SG_FLAG_Q_AT_HEAD;
+    if (prm.direct)
+        sg_flags |= SG_FLAG_DIRECT_IO;
+    if (prm.no_xfer)
+        sg_flags |= SG_FLAG_NO_DXFER;
+    if (vb > 1)
+        pr2serr_lk("  id=%d, sg_flags=0x%x, %s cmds\n", id, sg_flags,
+                   prm.mix.str().c_str());
+
+    npt = prm.num_per_thread;
+    /* main loop, continues until num_per_thread exhausted and there are
+     * no more outstanding responses */
+    for (k = 0, num_outstanding = 0; (k < npt) || num_outstanding;
+         k = do_inc ? k + 1 : k) {
+        do_inc = 0;
+        if ((num_outstanding < prm.maxq_per_thread) && (k < npt)) {
+            do_inc = 1;
+            pack_id = next_pack_id.fetch_add(1);
+            c = prm.mix.pick(rnd);
+            lbp = NULL;
+            free_lbp = NULL;
+            if (LG_TUR != c) {  /* get new lb buffer or one from free list */
+                if (free_lst.empty()) {
+                    lbp = sg_memalign(prm.lb_sz, 0, &free_lbp, vb);
+                    if (NULL == lbp) {
+                        err = "out of memory";
+                        break;
+                    }
+                } else {
+                    lbp = free_lst.back().first;
+                    free_lbp = free_lst.back().second;
+                    free_lst.pop_back();
+                }
+                if (use_rand_lba) {
+                    lba = rnd.range(prm.lba, hi_lba);   /* random LBA */
+                    if (vb > 3)
+                        pr2serr_lk("  id=%d: start IO at lba=0x%" PRIx64 "\n",
+                                   id, lba);
+                } else
+                    lba = prm.lba;
+            } else
+                lba = 0;
+            lg_inflight & ifl = pi_2_ifl[pack_id];
+
+            ifl.cmd = c;
+            ifl.lba = lba;
+            ifl.lbp = lbp;
+            ifl.free_lbp = free_lbp;
+            ifl.start_us = now_us();
+            if (start_cmd(sg_fd, c, pack_id, lba, lbp, ifl.sense,
+                          sizeof(ifl.sense), sg_flags, tr.start_eagains)) {
+                err = "start_cmd()";
+                if (lbp)
+                    free_lst.push_front(make_pair(lbp, free_lbp));
+                pi_2_ifl.erase(pack_id);
+                break;
+            }
+            ++tr.starts;
+            ++num_outstanding;
+            if (num_outstanding > tr.max_queued)
+                tr.max_queued = num_outstanding;
+        }
+        num_to_read = 0;
+        if ((num_outstanding >= prm.maxq_per_thread) || (k >= npt)) {
+            /* full queue or finished injecting */
+            num_waiting_read = 0;
+            if (ioctl(sg_fd, SG_GET_NUM_WAITING, &num_waiting_read) < 0) {
+                err = "ioctl(SG_GET_NUM_WAITING) failed";
+                break;
+            }
+            if (1 == num_waiting_read)
+                num_to_read = num_waiting_read;
+            else if (num_waiting_read > 0) {
+                if (k >= npt)
+                    num_to_read = num_waiting_read;
+                else {
+                    switch (prm.myqd) {
+                    case LG_MYQD_LOW:
+                        num_to_read = num_waiting_read;
+                        break;
+                    case LG_MYQD_MEDIUM:
+                        num_to_read = num_waiting_read / 2;
+                        break;
+                    case LG_MYQD_HIGH:
+                    default:
+                        num_to_read = 1;
+                        break;
+                    }
+                }
+            } else {    /* nothing waiting to be read */
+                n = (prm.wait_ms > 0) ? prm.wait_ms : 0;
+                while (0 == (res = poll(pfd, 1, n)))
+                    ;
+                if (res < 0) {
+                    err = "poll(wait_ms) failed";
+                    break;
+                }
+            }
+        } else {        /* not full, not finished injecting */
+            if (LG_MYQD_HIGH == prm.myqd)
+                num_to_read = 0;
+            else {
+                num_waiting_read = 0;
+                if (ioctl(sg_fd, SG_GET_NUM_WAITING, &num_waiting_read) < 0) {
+                    err = "ioctl(SG_GET_NUM_WAITING) failed";
+                    break;
+                }
+                if (num_waiting_read > 0)
+                    num_to_read = num_waiting_read /
+                                  ((LG_MYQD_LOW == prm.myqd) ? 1 : 2);
+                else
+                    num_to_read = 0;
+            }
+        }
+
+        while (num_to_read-- > 0) {
+            bool ok;
+
+            if (finish_cmd(sg_fd, pt, tr.fin_eagains)) {
+                err = "finish_cmd()";
+                break;
+            }
+            ++tr.finishes;
+            --num_outstanding;
+            pack_id = pt.pack_id;
+            auto p = pi_2_ifl.find(pack_id);
+
+            if (p == pi_2_ifl.end()) {
+                snprintf(ebuff, sizeof(ebuff), "pack_id=%d from "
+                         "finish_cmd() not found", pack_id);
+                err = ebuff;
+                break;
+            }
+            lg_inflight & ifl = p->second;
+
+            ok = false;
+            switch (sg_err_category3(&pt)) {
+            case SG_LIB_CAT_CLEAN:
+                ok = true;
+                break;
+            case SG_LIB_CAT_RECOVERED:
+                pr2serr_lk("%s: Recovered error on %s, continuing\n",
+                           __func__, lg_cmd_name(ifl.cmd));
+                ok = true;
+                break;
+            default: /* won't bother decoding other categories */
+                {
+                    lock_guard<mutex> lg(console_mutex);
+                    sg_chk_n_print3(lg_cmd_name(ifl.cmd), &pt, 1);
+                }
+                break;
+            }
+            tr.cmd[ifl.cmd].add(now_us() - ifl.start_us, ! ok);
+            if (vb > 3)
+                pr2serr_lk("    id=%d: finish IO at lba=0x%" PRIx64 "\n", id,
+                           ifl.lba);
+            if (ifl.lbp)
+                free_lst.push_front(make_pair(ifl.lbp, ifl.free_lbp));
+            if (! ok) {
+                if (LG_TUR != ifl.cmd) {
+                    snprintf(ebuff, sizeof(ebuff), "%s failed: lba=0x%"
+                             PRIx64, lg_cmd_name(ifl.cmd), ifl.lba);
+                    err = ebuff;
+                } else
+                    err = "TEST UNIT READY failed";
+            }
+            pi_2_ifl.erase(p);
+            if (err)
+                break;
+        }
+        if (err)
+            break;
+    }
+    close(sg_fd);       // sg driver will handle any commands "in flight"
+
+    if (err || (k < npt)) {
+        tr.failed = true;
+        tr.err = err ? err : "";
+        if (k < npt)
+            pr2serr_lk("thread id=%d FAILed at iteration %d%s%s\n", id, k,
+                       (err ? ", Reason: " : ""), (err ? err : ""));
+        else
+            pr2serr_lk("thread id=%d FAILed on last%s%s\n", id,
+                       (err ? ", Reason: " : ""), (err ? err : ""));
+    }
+    n = pi_2_ifl.size();
+    if (n > 0) {
+        if (vb)
+            pr2serr_lk("thread id=%d Still %d elements in pi_2_ifl map on "
+                       "exit\n", id, n);
+        /* sg_fd is closed so the driver has dropped those commands */
+        for (auto & q : pi_2_ifl) {
+            if (q.second.free_lbp)
+                free(q.second.free_lbp);
+        }
+    }
+    for (k = 0; ! free_lst.empty(); ++k) {
+        free_lbp = free_lst.back().second;
+        free_lst.pop_back();
+        if (free_lbp)
+            free(free_lbp);
+    }
+    if ((vb > 2) && (k > 0))
+        pr2serr_lk("thread id=%d Maximum number of READ/WRITEs queued: %d\n",
+                   id, k);
+}
+
+int
+Load_gen::run(lg_result & res)
+{
+    int k, n;
+    int64_t start;
+    vector<thread> vt;
+
+    res.thr.assign(prm.num_threads, lg_thread_res());
+    n = prm.dev_names.size();
+    if ((0 == n) || prm.mix.empty())
+        return -1;
+    for (k = 0; k < prm.num_threads; ++k) {
+        res.thr[k].id = k;
+        res.thr[k].dev_name = prm.dev_names[k % n];
+    }
+    start = now_us();
+    /* start multi-threaded section */
+    for (k = 0; k < prm.num_threads; ++k) {
+        if (prm.generic_pt)
+            vt.push_back(thread(&Load_gen::work_sync, this, k,
+                                ref(res.thr[k])));
+        else
+            vt.push_back(thread(&Load_gen::work_async, this, k,
+                                ref(res.thr[k])));
+    }
+    for (k = 0; k < (int)vt.size(); ++k)
+        vt[k].join();
+    /* end multi-threaded section, just this main thread left */
+    res.elapsed_secs = (double)(now_us() - start) / 1000000.0;
+
+    for (k = 0; k < prm.num_threads; ++k) {
+        if (res.thr[k].failed)
+            return -1;
+    }
+    return 0;
+}
+
+/* Returns a seed read from /dev/urandom, falling back to the time */
+uint64_t
+lg_urandom_seed(void)
+{
+    uint64_t res = 0;
+    int fd = open(URANDOM_DEV, O_RDONLY);
+
+    if (fd >= 0) {
+        if (sizeof(res) != read(fd, &res, sizeof(res)))
+            res = 0;
+        close(fd);
+    }
+    if (0 == res)
+        res = (uint64_t)now_us() ^ ((uint64_t)getpid() << 32);
+    return res;
+}
@@ -0,0 +1,194 @@
+#ifndef SG_LOADGEN_H
+#define SG_LOADGEN_H
+
+/*
+ * Copyright (c) 2014-2026 Douglas Gilbert.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* Load generator for the Linux sg driver's asynchronous (write()/read())
+ * interface. A Load_gen object is given a set of parameters (devices,
+ * threads, queue depth, command mix, LBA range, seed) and its run() method
+ * starts one worker thread per requested thread. Each worker opens its own
+ * file descriptor, keeps up to maxq_per_thread commands queued and records
+ * what happened in its own lg_thread_res so the workers share nothing but
+ * an atomic pack_id counter and a mutex used for console output.
+ *
+ * LBAs and the choice of command from the mix come from a xorshift64*
+ * generator owned by each worker and seeded from lg_params::seed and the
+ * worker's id, so a run with a given seed issues the same sequence of
+ * commands each time.
+ *
+ * Built into sg_tst_async; see Makefile.cplus . C++11 is required.
+ */
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+
+#include <stdint.h>
+
+struct sg_io_hdr;
+
+#define LG_MAX_Q_PER_FD 16      /* sg driver per file descriptor limit */
+
+enum lg_cmd_t {LG_TUR, LG_READ16, LG_WRITE16, LG_NUM_CMDS};
+/* Linux Block layer queue disciplines: */
+enum lg_blk_qd_t {LG_BLQ_DEFAULT, LG_BLQ_AT_HEAD, LG_BLQ_AT_TAIL};
+/* Queue disciplines of the engine. When both completions and queuing a
+ * new command are both possible: */
+enum lg_my_qd_t {LG_MYQD_LOW,   /* favour completions over new cmds */
+                 LG_MYQD_MEDIUM,
+                 LG_MYQD_HIGH}; /* favour new cmds over completions */
+
+const char * lg_cmd_name(lg_cmd_t c);
+/* Returns a seed read from /dev/urandom, or one based on the time */
+uint64_t lg_urandom_seed(void);
+
+/* xorshift64* pseudo random number generator. Not thread safe, each worker
+ * owns one. */
+class Lg_rand {
+public:
+    explicit Lg_rand(uint64_t a_seed);
+
+    uint64_t next();
+    /* uniform in [lo, hi] (inclusive) */
+    uint64_t range(uint64_t lo, uint64_t hi);
+
+private:
+    uint64_t s;
+};
+
+/* Weighted mix of commands. Built with add() or parsed from a string like
+ * "read:70,write:30" or "tur" (weight defaults to 1). */
+class Lg_cmd_mix {
+public:
+    Lg_cmd_mix();
+
+    void clear();
+    void add(lg_cmd_t c, unsigned int a_weight);
+    /* Returns false if 's' is malformed, leaving this object unchanged */
+    bool parse(const char * s);
+    bool empty() const { return 0 == total; }
+    bool has(lg_cmd_t c) const { return weight[c] > 0; }
+    lg_cmd_t pick(Lg_rand & r) const;
+    std::string str() const;
+
+private:
+    unsigned int weight[LG_NUM_CMDS];
+    unsigned int total;
+};
+
+struct lg_params {
+    std::vector<const char *> dev_names;   /* threads use them round robin */
+    Lg_cmd_mix mix;
+    int num_threads;
+    int num_per_thread;
+    int maxq_per_thread;
+    int lb_sz;
+    int wait_ms;        /* >0: poll(wait_ms); =0: poll(0) or yield */
+    int verbose;
+    bool block;         /* open without O_NONBLOCK */
+    bool direct;
+    bool no_xfer;
+    bool generic_pt;    /* synchronous TURs via sg_pt instead */
+    uint64_t seed;
+    uint64_t lba;
+    unsigned int hi_lba;        /* last one, inclusive range; 0: only lba */
+    std::vector<unsigned int> hi_lbas; /* per device, when hi_lba=UINT_MAX */
+    lg_blk_qd_t blqd;
+    lg_my_qd_t myqd;
+
+    lg_params();
+};
+
+struct lg_cmd_stats {
+    int64_t num;        /* completed */
+    int64_t errs;
+    int64_t lat_sum_us;
+    int64_t lat_min_us;
+    int64_t lat_max_us;
+
+    lg_cmd_stats();
+    void add(int64_t usecs, bool err);
+    void merge(const lg_cmd_stats & o);
+};
+
+struct lg_thread_res {
+    int id;
+    const char * dev_name;
+    int starts;
+    int finishes;
+    int max_queued;
+    unsigned int start_eagains;
+    unsigned int fin_eagains;
+    uint64_t seed;
+    bool failed;
+    std::string err;    /* reason when failed */
+    lg_cmd_stats cmd[LG_NUM_CMDS];
+
+    lg_thread_res();
+    void merge(const lg_thread_res & o);
+};
+
+struct lg_result {
+    std::vector<lg_thread_res> thr;     /* one per worker thread */
+    double elapsed_secs;
+
+    lg_result() : elapsed_secs(0.0) { }
+    lg_thread_res total() const;        /* all threads summed */
+};
+
+class Load_gen {
+public:
+    explicit Load_gen(const lg_params & a_prm);
+
+    /* Starts prm.num_threads workers, waits for them and fills 'res'.
+     * Returns 0 if every worker completed all its commands, else -1 . */
+    int run(lg_result & res);
+
+    /* Output to stderr that is not interleaved with other workers' */
+    int pr2serr_lk(const char * fmt, ...)
+#ifdef __GNUC__
+        __attribute__ ((format (printf, 2, 3)))
+#endif
+        ;
+
+private:
+    void work_async(int id, lg_thread_res & tr);
+    void work_sync(int id, lg_thread_res & tr);
+    int start_cmd(int sg_fd, lg_cmd_t c, int pack_id, uint64_t lba,
+                  uint8_t * lbp, uint8_t * sbp, int sb_len, int flags,
+                  unsigned int & eagains);
+    int finish_cmd(int sg_fd, struct sg_io_hdr & pt, unsigned int & eagains);
+
+    const lg_params prm;
+    std::mutex console_mutex;
+    std::atomic<int> next_pack_id;
+};
+
+#endif